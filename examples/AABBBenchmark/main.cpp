@@ -0,0 +1,110 @@
+#include <chrono>
+
+#include "Physics.h"
+#include "AABBStore.h"
+#include "Colliders.h"
+
+using namespace Physics;
+
+/*
+   Microbenchmark of the one against many AABB overlap test.
+   A set of sphere colliders is placed at random, and each of them is checked
+   against all the others with:
+    - Collider::checkCollisionAABB, one pair at a time
+    - the scalar loop over the pool of AABBs
+    - the SIMD kernel of the pool of AABBs
+   No window or OpenGL context is needed.
+*/
+
+// Number of colliders, and size of the region where they are placed
+const int N_COLLIDERS = 10000;
+const float REGION_SIZE = 100.f;
+// Number of times each test is repeated
+const int N_REPETITIONS = 5;
+
+// Time a test, in milliseconds per repetition
+template <typename T>
+double timeTest( T& test )
+{
+    auto start = std::chrono::steady_clock::now();
+    for ( int i = 0; i < N_REPETITIONS; ++i )
+        test();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>( end - start ).count() / N_REPETITIONS;
+}
+
+int main()
+{
+    // Create the colliders, with random positions and sizes
+    std::mt19937 generator( 1234 );
+    std::uniform_real_distribution<float> position( 0.f, REGION_SIZE );
+    std::uniform_real_distribution<float> scale( 0.2f, 2.f );
+
+    AABBStore store;
+    std::vector<SphereCollider> colliders( N_COLLIDERS );
+    for ( auto& collider : colliders )
+    {
+        collider.attachAABBStore( &store );
+        glm::mat4 modelMatrix = glm::translate( glm::mat4( 1.f ),
+                                                glm::vec3( position( generator ),
+                                                           position( generator ),
+                                                           position( generator ) ) );
+        modelMatrix = glm::scale( modelMatrix, glm::vec3( scale( generator ) ) );
+        collider.moveCollider( modelMatrix );
+    }
+
+    // Number of overlaps found by each test, to check that they agree
+    long nPairwise = 0;
+    long nScalar = 0;
+    long nSIMD = 0;
+    std::vector<int> overlaps;
+
+    auto pairwise = [&]()
+    {
+        nPairwise = 0;
+        for ( int i = 0; i < N_COLLIDERS; ++i )
+            for ( int j = 0; j < N_COLLIDERS; ++j )
+                if ( colliders[ i ].checkCollisionAABB( &colliders[ j ] ) )
+                    ++nPairwise;
+    };
+
+    auto scalar = [&]()
+    {
+        nScalar = 0;
+        for ( int i = 0; i < N_COLLIDERS; ++i )
+        {
+            overlaps.clear();
+            nScalar += store.overlapOneVsManyScalar( store.getMin( i ), store.getMax( i ),
+                                                     0, store.size(), overlaps );
+        }
+    };
+
+    auto simd = [&]()
+    {
+        nSIMD = 0;
+        for ( int i = 0; i < N_COLLIDERS; ++i )
+        {
+            overlaps.clear();
+            nSIMD += store.overlapOneVsMany( store.getMin( i ), store.getMax( i ),
+                                             0, store.size(), overlaps );
+        }
+    };
+
+    double timePairwise = timeTest( pairwise );
+    double timeScalar = timeTest( scalar );
+    double timeSIMD = timeTest( simd );
+
+    std::cout << "SIMD instructions: " << AABBStore::getSIMDName() << std::endl;
+    std::cout << N_COLLIDERS << " colliders, " << nPairwise << " overlaps" << std::endl;
+    std::cout << "Collider::checkCollisionAABB: " << timePairwise << " ms" << std::endl;
+    std::cout << "AABBStore, scalar:            " << timeScalar << " ms" << std::endl;
+    std::cout << "AABBStore, SIMD:              " << timeSIMD << " ms" << std::endl;
+
+    if ( nScalar != nPairwise || nSIMD != nPairwise )
+    {
+        std::cout << "The number of overlaps does not agree" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -85,6 +85,12 @@ void GLSandbox::setupScene()
        mPhsyicsWorld
     */
 
+    // Simulate at 60 steps per second, no matter the frame rate. The bodies
+    // are drawn between their last two steps
+    Physics::TimestepSettings timestepSettings;
+    timestepSettings.fixed = true;
+    mPhysicsWorld.setTimestepSettings( timestepSettings );
+
     // Setup force of gravity
     mGravity = new Physics::GravityForceGenerator( { 0.f, -9.8f, 0.f } );
     // mGravity = new Physics::GravityForceGenerator( { 0.f, 0.f, 0.f } );
@@ -0,0 +1,123 @@
+#include <algorithm>
+
+#include "GLGeometry.h"
+
+using namespace GLBase;
+
+namespace GLGeometry
+{
+    // Constructor
+    GLCloth::GLCloth( int nColumns, int nRows ) :
+        mEBO { 0 }, mNumColumns { nColumns }, mNumRows { nRows }, mVerticesDirty { false }
+    {
+        // Create the Element buffer object
+        glGenBuffers(1, &mEBO);
+
+        // Vertices of the grid, with the texture covering all of it. The
+        // positions and normals are set by updateVertices
+        for (int i = 0; i < mNumRows; ++i)
+        {
+            for (int j = 0; j < mNumColumns; ++j)
+            {
+                Vertex thisVertex;
+                thisVertex.Position = glm::vec3(0.f, 0.f, 0.f);
+                thisVertex.Normal = glm::vec3(0.f, 0.f, 1.f);
+                thisVertex.TexCoords = glm::vec2((float)j / (mNumColumns - 1),
+                                                 (float)i / (mNumRows - 1));
+                mVertices.push_back(thisVertex);
+            }
+        }
+
+        // Indices of the vertices for the EBO, two triangles for each cell
+        for (int i = 0; i < mNumRows - 1; ++i)
+        {
+            for (int j = 0; j < mNumColumns - 1; ++j)
+            {
+                unsigned int corner = i * mNumColumns + j;
+                unsigned int indices[] { corner, corner + 1, corner + mNumColumns + 1,
+                                         corner, corner + mNumColumns + 1, corner + mNumColumns };
+                mIndices.insert(mIndices.end(), indices, indices + 6);
+            }
+        }
+
+        // Bind the VAO and the VBO (as a vertex buffer)
+        glBindVertexArray(mVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, mVBO);
+        // Add the data to the VBO. It changes in each frame
+        glBufferData(GL_ARRAY_BUFFER, mVertices.size() * sizeof(Vertex), 
+                     &mVertices[0], GL_DYNAMIC_DRAW);
+
+        // Bind the EBO as an element array buffer
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mEBO);
+        // Add the data to the EBO
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, mIndices.size() * sizeof(unsigned int),
+                     &mIndices[0], GL_STATIC_DRAW);
+
+        // Set the vertex attribute pointers
+        // Vertex positions
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+        // Vertex normals
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+        // Vertex texture coordinates
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+        // Vertex texture index
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexIndex));
+
+        // Unbind the VAO
+        glBindVertexArray(0);
+    }
+
+    // Copy the positions of the vertices, and recompute the normals from the
+    // differences between the neighbours of each vertex along the grid. The
+    // vertices on the edges use themselves in place of the missing ones
+    void GLCloth::updateVertices(const float* x, const float* y, const float* z)
+    {
+        for (int k = 0; k < (int)mVertices.size(); ++k)
+            mVertices[k].Position = glm::vec3(x[k], y[k], z[k]);
+
+        for (int i = 0; i < mNumRows; ++i)
+        {
+            int up = std::max(i - 1, 0);
+            int down = std::min(i + 1, mNumRows - 1);
+            for (int j = 0; j < mNumColumns; ++j)
+            {
+                int left = std::max(j - 1, 0);
+                int right = std::min(j + 1, mNumColumns - 1);
+                glm::vec3 tangentU = mVertices[i * mNumColumns + right].Position -
+                                     mVertices[i * mNumColumns + left].Position;
+                glm::vec3 tangentV = mVertices[down * mNumColumns + j].Position -
+                                     mVertices[up * mNumColumns + j].Position;
+                glm::vec3 normal = glm::cross(tangentU, tangentV);
+                float length = glm::length(normal);
+                if (length > 1e-12f)
+                    mVertices[i * mNumColumns + j].Normal = normal / length;
+            }
+        }
+
+        mVerticesDirty = true;
+    }
+
+    // Function to render
+    void GLCloth::draw()
+    {
+        // Replace the data of the vertex buffer, without allocating it again
+        if (mVerticesDirty)
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, mVBO);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, mVertices.size() * sizeof(Vertex), &mVertices[0]);
+            mVerticesDirty = false;
+        }
+
+        // Disable face culling, so both faces of the cloth are drawn
+        glDisable(GL_CULL_FACE);
+        glBindVertexArray(mVAO); // This also binds the corresponding EBO
+        glDrawElements(GL_TRIANGLES, mIndices.size(), GL_UNSIGNED_INT, 0);
+        glBindVertexArray(0);
+        // Enable face culling again
+        glEnable(GL_CULL_FACE);
+    }
+}
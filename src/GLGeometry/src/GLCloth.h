@@ -0,0 +1,45 @@
+#ifndef GLCLOTH_H
+#define GLCLOTH_H
+
+#include "GLGeometry.h"
+#include "GLElemObject.h"
+
+using namespace GLBase;
+
+namespace GLGeometry
+{
+    // Grid of vertices that move in each frame, used to draw cloths.
+    // The vertex buffer is allocated once, and its data replaced in place
+    // when the positions change
+    class GLCloth : public GLElemObject
+    {
+        private:
+            // This class will use an element buffer object
+            unsigned int mEBO;
+
+            // Data of the mesh
+            // std::vector<Vertex> mVertices;
+            std::vector<unsigned int> mIndices;
+
+            // Number of vertices along each side of the grid
+            int mNumColumns;
+            int mNumRows;
+
+            // If the vertices changed since they were copied to the buffer
+            bool mVerticesDirty;
+
+        public:
+            // Constructor, with the number of vertices along each side
+            GLCloth( int nColumns, int nRows );
+
+            // Copy the positions of the vertices, given as a structure of
+            // arrays ordered by rows, and recompute the normals. The buffer is
+            // updated when the cloth is drawn
+            void updateVertices( const float* x, const float* y, const float* z );
+
+            // Function to render
+            void draw();
+    };
+}
+
+#endif
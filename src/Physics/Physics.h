@@ -25,7 +25,8 @@
 #include "Terrain.h"
 #include "PhysicsBody.h"
 #include "ParticleSystem.h"
+#include "Cloth.h"
 #include "ForceGenerator.h"
 #include "PhysicsWorld.h"
 // #include "Colliders.h"
-// #include "CollisionSolver.h"
+#include "CollisionSolver.h"
@@ -0,0 +1,368 @@
+#include <algorithm>
+#include <limits>
+
+#if defined( __AVX2__ ) || defined( __SSE2__ )
+#include <immintrin.h>
+#endif
+
+#include "AABBStore.h"
+#include "utils.h"
+
+using namespace GLBase;
+
+namespace Physics
+{
+    //--------------------------------------------------------------------------
+    // AABBStore class
+
+    // Constructor
+    AABBStore::AABBStore()
+    {
+    }
+
+    // Add an empty AABB, and return its identifier.
+    // The empty AABB has its minimum above its maximum, so it overlaps nothing
+    int AABBStore::add()
+    {
+        int id = mMinX.size();
+        float big = std::numeric_limits<float>::max();
+        mMinX.push_back( big );
+        mMinY.push_back( big );
+        mMinZ.push_back( big );
+        mMaxX.push_back( -big );
+        mMaxY.push_back( -big );
+        mMaxZ.push_back( -big );
+        return id;
+    }
+
+    // Set the corners of an AABB
+    void AABBStore::set( int id, const glm::vec3& min, const glm::vec3& max )
+    {
+        mMinX[ id ] = min.x;
+        mMinY[ id ] = min.y;
+        mMinZ[ id ] = min.z;
+        mMaxX[ id ] = max.x;
+        mMaxY[ id ] = max.y;
+        mMaxZ[ id ] = max.z;
+    }
+
+    // Getters
+    glm::vec3 AABBStore::getMin( int id ) const
+    {
+        return glm::vec3( mMinX[ id ], mMinY[ id ], mMinZ[ id ] );
+    }
+
+    glm::vec3 AABBStore::getMax( int id ) const
+    {
+        return glm::vec3( mMaxX[ id ], mMaxY[ id ], mMaxZ[ id ] );
+    }
+
+    int AABBStore::size() const
+    {
+        return mMinX.size();
+    }
+
+    // Box that contains all the AABBs of the pool. The empty AABBs have their
+    // minimum at the largest float and their maximum at the lowest, so they do
+    // not change it
+    void AABBStore::getBounds( glm::vec3& min, glm::vec3& max ) const
+    {
+        float big = std::numeric_limits<float>::max();
+        min = glm::vec3( big );
+        max = glm::vec3( -big );
+        for ( int i = 0; i < size(); ++i )
+        {
+            min = glm::min( min, glm::vec3( mMinX[ i ], mMinY[ i ], mMinZ[ i ] ) );
+            max = glm::max( max, glm::vec3( mMaxX[ i ], mMaxY[ i ], mMaxZ[ i ] ) );
+        }
+    }
+
+    // Arrays of the minimum and maximum coordinates along an axis
+    const float* AABBStore::getMinArray( int axis ) const
+    {
+        switch ( axis )
+        {
+            case 0:
+                return mMinX.data();
+            case 1:
+                return mMinY.data();
+            default:
+                return mMinZ.data();
+        }
+    }
+
+    const float* AABBStore::getMaxArray( int axis ) const
+    {
+        switch ( axis )
+        {
+            case 0:
+                return mMaxX.data();
+            case 1:
+                return mMaxY.data();
+            default:
+                return mMaxZ.data();
+        }
+    }
+
+    // Check if two AABBs of the pool overlap
+    bool AABBStore::checkOverlap( int idA, int idB ) const
+    {
+        return mMinX[ idA ] <= mMaxX[ idB ] && mMaxX[ idA ] >= mMinX[ idB ] &&
+               mMinY[ idA ] <= mMaxY[ idB ] && mMaxY[ idA ] >= mMinY[ idB ] &&
+               mMinZ[ idA ] <= mMaxZ[ idB ] && mMaxZ[ idA ] >= mMinZ[ idB ];
+    }
+
+    // Find the AABBs with identifiers in [ begin, end ) that overlap the given
+    // box. The comparisons are done for 8 (AVX2) or 4 (SSE2) AABBs at a time,
+    // and the resulting bit mask is used to write the identifiers
+    int AABBStore::overlapOneVsMany( const glm::vec3& min, const glm::vec3& max,
+                                     int begin, int end,
+                                     std::vector<int>& overlaps ) const
+    {
+        int nOverlaps = 0;
+        int i = begin;
+
+#if defined( __AVX2__ )
+        const __m256 qMinX = _mm256_set1_ps( min.x );
+        const __m256 qMinY = _mm256_set1_ps( min.y );
+        const __m256 qMinZ = _mm256_set1_ps( min.z );
+        const __m256 qMaxX = _mm256_set1_ps( max.x );
+        const __m256 qMaxY = _mm256_set1_ps( max.y );
+        const __m256 qMaxZ = _mm256_set1_ps( max.z );
+
+        for ( ; i + 8 <= end; i += 8 )
+        {
+            __m256 mask = _mm256_and_ps(
+                _mm256_cmp_ps( _mm256_loadu_ps( &mMinX[ i ] ), qMaxX, _CMP_LE_OQ ),
+                _mm256_cmp_ps( _mm256_loadu_ps( &mMaxX[ i ] ), qMinX, _CMP_GE_OQ ) );
+            mask = _mm256_and_ps( mask,
+                _mm256_cmp_ps( _mm256_loadu_ps( &mMinY[ i ] ), qMaxY, _CMP_LE_OQ ) );
+            mask = _mm256_and_ps( mask,
+                _mm256_cmp_ps( _mm256_loadu_ps( &mMaxY[ i ] ), qMinY, _CMP_GE_OQ ) );
+            mask = _mm256_and_ps( mask,
+                _mm256_cmp_ps( _mm256_loadu_ps( &mMinZ[ i ] ), qMaxZ, _CMP_LE_OQ ) );
+            mask = _mm256_and_ps( mask,
+                _mm256_cmp_ps( _mm256_loadu_ps( &mMaxZ[ i ] ), qMinZ, _CMP_GE_OQ ) );
+
+            // Write the identifiers of the AABBs whose bit is set
+            unsigned int bits = _mm256_movemask_ps( mask );
+            while ( bits != 0 )
+            {
+                overlaps.push_back( i + __builtin_ctz( bits ) );
+                bits &= bits - 1;
+                ++nOverlaps;
+            }
+        }
+#elif defined( __SSE2__ )
+        const __m128 qMinX = _mm_set1_ps( min.x );
+        const __m128 qMinY = _mm_set1_ps( min.y );
+        const __m128 qMinZ = _mm_set1_ps( min.z );
+        const __m128 qMaxX = _mm_set1_ps( max.x );
+        const __m128 qMaxY = _mm_set1_ps( max.y );
+        const __m128 qMaxZ = _mm_set1_ps( max.z );
+
+        for ( ; i + 4 <= end; i += 4 )
+        {
+            __m128 mask = _mm_and_ps( _mm_cmple_ps( _mm_loadu_ps( &mMinX[ i ] ), qMaxX ),
+                                      _mm_cmpge_ps( _mm_loadu_ps( &mMaxX[ i ] ), qMinX ) );
+            mask = _mm_and_ps( mask, _mm_cmple_ps( _mm_loadu_ps( &mMinY[ i ] ), qMaxY ) );
+            mask = _mm_and_ps( mask, _mm_cmpge_ps( _mm_loadu_ps( &mMaxY[ i ] ), qMinY ) );
+            mask = _mm_and_ps( mask, _mm_cmple_ps( _mm_loadu_ps( &mMinZ[ i ] ), qMaxZ ) );
+            mask = _mm_and_ps( mask, _mm_cmpge_ps( _mm_loadu_ps( &mMaxZ[ i ] ), qMinZ ) );
+
+            // Write the identifiers of the AABBs whose bit is set
+            unsigned int bits = _mm_movemask_ps( mask );
+            while ( bits != 0 )
+            {
+                overlaps.push_back( i + __builtin_ctz( bits ) );
+                bits &= bits - 1;
+                ++nOverlaps;
+            }
+        }
+#endif
+
+        // Remaining AABBs, or all of them if SIMD is not available
+        return nOverlaps + overlapOneVsManyScalar( min, max, i, end, overlaps );
+    }
+
+    // Scalar version of overlapOneVsMany
+    int AABBStore::overlapOneVsManyScalar( const glm::vec3& min, const glm::vec3& max,
+                                           int begin, int end,
+                                           std::vector<int>& overlaps ) const
+    {
+        int nOverlaps = 0;
+        for ( int i = begin; i < end; ++i )
+        {
+            if ( mMinX[ i ] <= max.x && mMaxX[ i ] >= min.x &&
+                 mMinY[ i ] <= max.y && mMaxY[ i ] >= min.y &&
+                 mMinZ[ i ] <= max.z && mMaxZ[ i ] >= min.z )
+            {
+                overlaps.push_back( i );
+                ++nOverlaps;
+            }
+        }
+        return nOverlaps;
+    }
+
+    // Find the AABBs with identifiers in [ begin, end ) hit by a ray. This is
+    // the slab test: the ray enters the AABB at the latest of the distances at
+    // which it enters the slab of each axis, and leaves it at the earliest
+    // exit. It is done for 8 (AVX2) or 4 (SSE2) AABBs at a time. The empty
+    // AABBs have their minimum above their maximum, which would give a hit, so
+    // they are checked apart
+    int AABBStore::raycastOneVsMany( const glm::vec3& origin, const glm::vec3& invDirection,
+                                     float maxDistance, int begin, int end,
+                                     std::vector<int>& hits, std::vector<float>& distances ) const
+    {
+        int nHits = 0;
+        int i = begin;
+
+#if defined( __AVX2__ )
+        const __m256 oX = _mm256_set1_ps( origin.x );
+        const __m256 oY = _mm256_set1_ps( origin.y );
+        const __m256 oZ = _mm256_set1_ps( origin.z );
+        const __m256 invX = _mm256_set1_ps( invDirection.x );
+        const __m256 invY = _mm256_set1_ps( invDirection.y );
+        const __m256 invZ = _mm256_set1_ps( invDirection.z );
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 qMaxDistance = _mm256_set1_ps( maxDistance );
+        alignas( 32 ) float entries[ 8 ];
+
+        for ( ; i + 8 <= end; i += 8 )
+        {
+            __m256 minX = _mm256_loadu_ps( &mMinX[ i ] );
+            __m256 maxX = _mm256_loadu_ps( &mMaxX[ i ] );
+            __m256 t1 = _mm256_mul_ps( _mm256_sub_ps( minX, oX ), invX );
+            __m256 t2 = _mm256_mul_ps( _mm256_sub_ps( maxX, oX ), invX );
+            __m256 tEnter = _mm256_max_ps( _mm256_min_ps( t1, t2 ), zero );
+            __m256 tExit = _mm256_min_ps( _mm256_max_ps( t1, t2 ), qMaxDistance );
+
+            t1 = _mm256_mul_ps( _mm256_sub_ps( _mm256_loadu_ps( &mMinY[ i ] ), oY ), invY );
+            t2 = _mm256_mul_ps( _mm256_sub_ps( _mm256_loadu_ps( &mMaxY[ i ] ), oY ), invY );
+            tEnter = _mm256_max_ps( tEnter, _mm256_min_ps( t1, t2 ) );
+            tExit = _mm256_min_ps( tExit, _mm256_max_ps( t1, t2 ) );
+
+            t1 = _mm256_mul_ps( _mm256_sub_ps( _mm256_loadu_ps( &mMinZ[ i ] ), oZ ), invZ );
+            t2 = _mm256_mul_ps( _mm256_sub_ps( _mm256_loadu_ps( &mMaxZ[ i ] ), oZ ), invZ );
+            tEnter = _mm256_max_ps( tEnter, _mm256_min_ps( t1, t2 ) );
+            tExit = _mm256_min_ps( tExit, _mm256_max_ps( t1, t2 ) );
+
+            __m256 mask = _mm256_and_ps( _mm256_cmp_ps( tEnter, tExit, _CMP_LE_OQ ),
+                                         _mm256_cmp_ps( minX, maxX, _CMP_LE_OQ ) );
+
+            // Write the identifiers and distances of the AABBs whose bit is set
+            unsigned int bits = _mm256_movemask_ps( mask );
+            if ( bits == 0 )
+                continue;
+            _mm256_store_ps( entries, tEnter );
+            while ( bits != 0 )
+            {
+                int k = __builtin_ctz( bits );
+                hits.push_back( i + k );
+                distances.push_back( entries[ k ] );
+                bits &= bits - 1;
+                ++nHits;
+            }
+        }
+#elif defined( __SSE2__ )
+        const __m128 oX = _mm_set1_ps( origin.x );
+        const __m128 oY = _mm_set1_ps( origin.y );
+        const __m128 oZ = _mm_set1_ps( origin.z );
+        const __m128 invX = _mm_set1_ps( invDirection.x );
+        const __m128 invY = _mm_set1_ps( invDirection.y );
+        const __m128 invZ = _mm_set1_ps( invDirection.z );
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 qMaxDistance = _mm_set1_ps( maxDistance );
+        alignas( 16 ) float entries[ 4 ];
+
+        for ( ; i + 4 <= end; i += 4 )
+        {
+            __m128 minX = _mm_loadu_ps( &mMinX[ i ] );
+            __m128 maxX = _mm_loadu_ps( &mMaxX[ i ] );
+            __m128 t1 = _mm_mul_ps( _mm_sub_ps( minX, oX ), invX );
+            __m128 t2 = _mm_mul_ps( _mm_sub_ps( maxX, oX ), invX );
+            __m128 tEnter = _mm_max_ps( _mm_min_ps( t1, t2 ), zero );
+            __m128 tExit = _mm_min_ps( _mm_max_ps( t1, t2 ), qMaxDistance );
+
+            t1 = _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( &mMinY[ i ] ), oY ), invY );
+            t2 = _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( &mMaxY[ i ] ), oY ), invY );
+            tEnter = _mm_max_ps( tEnter, _mm_min_ps( t1, t2 ) );
+            tExit = _mm_min_ps( tExit, _mm_max_ps( t1, t2 ) );
+
+            t1 = _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( &mMinZ[ i ] ), oZ ), invZ );
+            t2 = _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( &mMaxZ[ i ] ), oZ ), invZ );
+            tEnter = _mm_max_ps( tEnter, _mm_min_ps( t1, t2 ) );
+            tExit = _mm_min_ps( tExit, _mm_max_ps( t1, t2 ) );
+
+            __m128 mask = _mm_and_ps( _mm_cmple_ps( tEnter, tExit ), _mm_cmple_ps( minX, maxX ) );
+
+            // Write the identifiers and distances of the AABBs whose bit is set
+            unsigned int bits = _mm_movemask_ps( mask );
+            if ( bits == 0 )
+                continue;
+            _mm_store_ps( entries, tEnter );
+            while ( bits != 0 )
+            {
+                int k = __builtin_ctz( bits );
+                hits.push_back( i + k );
+                distances.push_back( entries[ k ] );
+                bits &= bits - 1;
+                ++nHits;
+            }
+        }
+#endif
+
+        // Remaining AABBs, or all of them if SIMD is not available
+        return nHits + raycastOneVsManyScalar( origin, invDirection, maxDistance, i, end,
+                                               hits, distances );
+    }
+
+    // Scalar version of raycastOneVsMany
+    int AABBStore::raycastOneVsManyScalar( const glm::vec3& origin, const glm::vec3& invDirection,
+                                           float maxDistance, int begin, int end,
+                                           std::vector<int>& hits,
+                                           std::vector<float>& distances ) const
+    {
+        int nHits = 0;
+        for ( int i = begin; i < end; ++i )
+        {
+            if ( mMinX[ i ] > mMaxX[ i ] )
+                continue;
+
+            float t1 = ( mMinX[ i ] - origin.x ) * invDirection.x;
+            float t2 = ( mMaxX[ i ] - origin.x ) * invDirection.x;
+            float tEnter = std::max( std::min( t1, t2 ), 0.f );
+            float tExit = std::min( std::max( t1, t2 ), maxDistance );
+
+            t1 = ( mMinY[ i ] - origin.y ) * invDirection.y;
+            t2 = ( mMaxY[ i ] - origin.y ) * invDirection.y;
+            tEnter = std::max( tEnter, std::min( t1, t2 ) );
+            tExit = std::min( tExit, std::max( t1, t2 ) );
+
+            t1 = ( mMinZ[ i ] - origin.z ) * invDirection.z;
+            t2 = ( mMaxZ[ i ] - origin.z ) * invDirection.z;
+            tEnter = std::max( tEnter, std::min( t1, t2 ) );
+            tExit = std::min( tExit, std::max( t1, t2 ) );
+
+            if ( tEnter <= tExit )
+            {
+                hits.push_back( i );
+                distances.push_back( tEnter );
+                ++nHits;
+            }
+        }
+        return nHits;
+    }
+
+    // Name of the SIMD instructions used by overlapOneVsMany
+    const char* AABBStore::getSIMDName()
+    {
+#if defined( __AVX2__ )
+        return "AVX2";
+#elif defined( __SSE2__ )
+        return "SSE2";
+#else
+        return "none";
+#endif
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef AABBSTORE_H
+#define AABBSTORE_H
+
+#include "GLBase.h"
+
+using namespace GLBase;
+
+namespace Physics
+{
+    // Pool of the world space AABBs of the colliders, stored as a structure of
+    // arrays. Each collider added to a world gets an identifier, which is the
+    // position of its AABB in the arrays.
+    // Keeping each coordinate in its own contiguous array allows checking one
+    // AABB against many others with SIMD instructions, several at a time.
+    class AABBStore
+    {
+        public:
+            // Constructor
+            AABBStore();
+
+            // Add an empty AABB, and return its identifier
+            int add();
+
+            // Set the corners of an AABB
+            void set( int id, const glm::vec3& min, const glm::vec3& max );
+
+            // Getters
+            glm::vec3 getMin( int id ) const;
+            glm::vec3 getMax( int id ) const;
+            int size() const;
+
+            // Box that contains all the AABBs of the pool
+            void getBounds( glm::vec3& min, glm::vec3& max ) const;
+
+            // Arrays of the minimum and maximum coordinates along an axis
+            const float* getMinArray( int axis ) const;
+            const float* getMaxArray( int axis ) const;
+
+            // Check if two AABBs of the pool overlap
+            bool checkOverlap( int idA, int idB ) const;
+
+            // Find the AABBs with identifiers in [ begin, end ) that overlap the
+            // given box, and append their identifiers to overlaps.
+            // Returns the number of AABBs found
+            int overlapOneVsMany( const glm::vec3& min, const glm::vec3& max,
+                                  int begin, int end, std::vector<int>& overlaps ) const;
+
+            // Scalar version of overlapOneVsMany, used for the elements left
+            // after the SIMD loop, and to compare with it
+            int overlapOneVsManyScalar( const glm::vec3& min, const glm::vec3& max,
+                                        int begin, int end,
+                                        std::vector<int>& overlaps ) const;
+
+            // Find the AABBs with identifiers in [ begin, end ) hit by a ray
+            // before the given distance, and append their identifiers and the
+            // distances at which the ray enters them to hits and distances.
+            // The ray is given by its origin and the inverse of its direction,
+            // which must have no zero components. Returns the number of AABBs
+            // found
+            int raycastOneVsMany( const glm::vec3& origin, const glm::vec3& invDirection,
+                                  float maxDistance, int begin, int end,
+                                  std::vector<int>& hits, std::vector<float>& distances ) const;
+
+            // Scalar version of raycastOneVsMany
+            int raycastOneVsManyScalar( const glm::vec3& origin, const glm::vec3& invDirection,
+                                        float maxDistance, int begin, int end,
+                                        std::vector<int>& hits,
+                                        std::vector<float>& distances ) const;
+
+            // Name of the SIMD instructions used by overlapOneVsMany and
+            // raycastOneVsMany
+            static const char* getSIMDName();
+
+        private:
+            // Coordinates of the corners of the AABBs
+            std::vector<float> mMinX;
+            std::vector<float> mMinY;
+            std::vector<float> mMinZ;
+            std::vector<float> mMaxX;
+            std::vector<float> mMaxY;
+            std::vector<float> mMaxZ;
+    };
+}
+
+#endif
@@ -0,0 +1,522 @@
+#include <algorithm>
+
+#include "AABBTree.h"
+#include "utils.h"
+
+using namespace GLBase;
+
+namespace Physics
+{
+    //--------------------------------------------------------------------------
+    // AABBTree class
+
+    // Constructor
+    AABBTree::AABBTree() :
+        mFreeList { NULL_NODE }, mRoot { NULL_NODE }
+    {
+    }
+
+    // Insert a leaf with the given AABB, and return its identifier
+    int AABBTree::createProxy( const glm::vec3& min, const glm::vec3& max, int userData )
+    {
+        int proxyId = allocateNode();
+        Node& leaf = mNodes[ proxyId ];
+        leaf.min = min;
+        leaf.max = max;
+        leaf.userData = userData;
+        leaf.height = 0;
+
+        insertLeaf( proxyId );
+
+        return proxyId;
+    }
+
+    // Remove a leaf
+    void AABBTree::destroyProxy( int proxyId )
+    {
+        assert( mNodes[ proxyId ].isLeaf() );
+
+        removeLeaf( proxyId );
+        freeNode( proxyId );
+    }
+
+    // Update the AABB of a leaf after it has moved
+    bool AABBTree::moveProxy( int proxyId, const glm::vec3& min, const glm::vec3& max,
+                              float margin )
+    {
+        Node& leaf = mNodes[ proxyId ];
+
+        // Nothing to do if the AABB is still inside the enlarged one
+        if ( leaf.min.x <= min.x && leaf.min.y <= min.y && leaf.min.z <= min.z &&
+             max.x <= leaf.max.x && max.y <= leaf.max.y && max.z <= leaf.max.z )
+            return false;
+
+        // Enlarged AABB
+        glm::vec3 fatMin = min - glm::vec3( margin );
+        glm::vec3 fatMax = max + glm::vec3( margin );
+
+        // If the new AABB overlaps the old one, the leaf is still close to its
+        // siblings, so it is enough to refit the ancestors
+        bool overlaps = ( fatMin.x <= leaf.max.x && fatMax.x >= leaf.min.x &&
+                          fatMin.y <= leaf.max.y && fatMax.y >= leaf.min.y &&
+                          fatMin.z <= leaf.max.z && fatMax.z >= leaf.min.z );
+        if ( overlaps )
+        {
+            leaf.min = fatMin;
+            leaf.max = fatMax;
+            refitAncestors( leaf.parent );
+        }
+        // Otherwise, insert it again in the best place
+        else
+        {
+            removeLeaf( proxyId );
+            mNodes[ proxyId ].min = fatMin;
+            mNodes[ proxyId ].max = fatMax;
+            insertLeaf( proxyId );
+        }
+
+        return true;
+    }
+
+    // Build the tree from a list of leaves, using the surface area heuristic
+    void AABBTree::build( const std::vector<Leaf>& leaves, std::vector<int>& proxyIds )
+    {
+        clear();
+
+        // Create the leaf nodes
+        proxyIds.resize( leaves.size() );
+        for ( int i = 0; i < (int)leaves.size(); ++i )
+        {
+            int proxyId = allocateNode();
+            Node& leaf = mNodes[ proxyId ];
+            leaf.min = leaves[ i ].min;
+            leaf.max = leaves[ i ].max;
+            leaf.userData = leaves[ i ].userData;
+            leaf.height = 0;
+            proxyIds[ i ] = proxyId;
+        }
+
+        if ( leaves.empty() )
+            return;
+
+        // Build the hierarchy from the top
+        std::vector<int> nodes = proxyIds;
+        mRoot = buildRange( nodes, 0, nodes.size() );
+        mNodes[ mRoot ].parent = NULL_NODE;
+    }
+
+    // Remove all the nodes
+    void AABBTree::clear()
+    {
+        mNodes.clear();
+        mFreeList = NULL_NODE;
+        mRoot = NULL_NODE;
+    }
+
+    // Getters
+    int AABBTree::getUserData( int proxyId ) const
+    {
+        return mNodes[ proxyId ].userData;
+    }
+    const glm::vec3& AABBTree::getMin( int proxyId ) const
+    {
+        return mNodes[ proxyId ].min;
+    }
+    const glm::vec3& AABBTree::getMax( int proxyId ) const
+    {
+        return mNodes[ proxyId ].max;
+    }
+    int AABBTree::getHeight() const
+    {
+        if ( mRoot == NULL_NODE )
+            return 0;
+        return mNodes[ mRoot ].height;
+    }
+
+    // Get a node from the free list, or create a new one
+    int AABBTree::allocateNode()
+    {
+        int node;
+        if ( mFreeList == NULL_NODE )
+        {
+            node = mNodes.size();
+            mNodes.push_back( Node() );
+        }
+        else
+        {
+            node = mFreeList;
+            mFreeList = mNodes[ node ].parent;
+        }
+
+        mNodes[ node ].parent = NULL_NODE;
+        mNodes[ node ].child1 = NULL_NODE;
+        mNodes[ node ].child2 = NULL_NODE;
+        mNodes[ node ].height = 0;
+        mNodes[ node ].userData = -1;
+
+        return node;
+    }
+
+    // Return a node to the free list
+    void AABBTree::freeNode( int node )
+    {
+        mNodes[ node ].parent = mFreeList;
+        mNodes[ node ].height = -1;
+        mFreeList = node;
+    }
+
+    // Insert a leaf in the tree
+    void AABBTree::insertLeaf( int leaf )
+    {
+        if ( mRoot == NULL_NODE )
+        {
+            mRoot = leaf;
+            mNodes[ leaf ].parent = NULL_NODE;
+            return;
+        }
+
+        // Find the best sibling for the leaf, descending from the root to the
+        // child with the lowest increase of the surface area
+        const Node& leafNode = mNodes[ leaf ];
+        int index = mRoot;
+        while ( !mNodes[ index ].isLeaf() )
+        {
+            const Node& node = mNodes[ index ];
+            float nodeArea = area( node.min, node.max );
+            float combinedArea = areaUnion( node, leafNode );
+
+            // Cost of making a new parent for this node and the leaf
+            float cost = 2.f * combinedArea;
+            // Minimum cost of pushing the leaf further down
+            float inheritance = 2.f * ( combinedArea - nodeArea );
+
+            // Cost of descending into each of the children
+            float childCost[ 2 ];
+            int children[ 2 ] = { node.child1, node.child2 };
+            for ( int i = 0; i < 2; ++i )
+            {
+                const Node& child = mNodes[ children[ i ] ];
+                childCost[ i ] = areaUnion( child, leafNode ) + inheritance;
+                if ( !child.isLeaf() )
+                    childCost[ i ] -= area( child.min, child.max );
+            }
+
+            // Stop if creating the parent here is the cheapest option
+            if ( cost < childCost[ 0 ] && cost < childCost[ 1 ] )
+                break;
+
+            index = childCost[ 0 ] < childCost[ 1 ] ? children[ 0 ] : children[ 1 ];
+        }
+        int sibling = index;
+
+        // Create a new parent for the sibling and the leaf
+        int oldParent = mNodes[ sibling ].parent;
+        int newParent = allocateNode();
+        mNodes[ newParent ].parent = oldParent;
+        mNodes[ newParent ].child1 = sibling;
+        mNodes[ newParent ].child2 = leaf;
+        mNodes[ sibling ].parent = newParent;
+        mNodes[ leaf ].parent = newParent;
+
+        if ( oldParent != NULL_NODE )
+        {
+            if ( mNodes[ oldParent ].child1 == sibling )
+                mNodes[ oldParent ].child1 = newParent;
+            else
+                mNodes[ oldParent ].child2 = newParent;
+        }
+        else
+        {
+            mRoot = newParent;
+        }
+
+        // Fix the AABBs and heights of the ancestors
+        refitAncestors( newParent );
+    }
+
+    // Remove a leaf from the tree
+    void AABBTree::removeLeaf( int leaf )
+    {
+        if ( leaf == mRoot )
+        {
+            mRoot = NULL_NODE;
+            return;
+        }
+
+        int parent = mNodes[ leaf ].parent;
+        int grandParent = mNodes[ parent ].parent;
+        int sibling = mNodes[ parent ].child1 == leaf ? mNodes[ parent ].child2
+                                                      : mNodes[ parent ].child1;
+
+        // Replace the parent by the sibling
+        if ( grandParent != NULL_NODE )
+        {
+            if ( mNodes[ grandParent ].child1 == parent )
+                mNodes[ grandParent ].child1 = sibling;
+            else
+                mNodes[ grandParent ].child2 = sibling;
+            mNodes[ sibling ].parent = grandParent;
+            freeNode( parent );
+
+            // Fix the AABBs and heights of the ancestors
+            refitAncestors( grandParent );
+        }
+        else
+        {
+            mRoot = sibling;
+            mNodes[ sibling ].parent = NULL_NODE;
+            freeNode( parent );
+        }
+    }
+
+    // Walk up from a node to the root, recomputing the AABBs and heights
+    void AABBTree::refitAncestors( int node )
+    {
+        while ( node != NULL_NODE )
+        {
+            updateFromChildren( node );
+            rotate( node );
+            node = mNodes[ node ].parent;
+        }
+    }
+
+    // Swap a child of a node with a grandchild, if this reduces the area
+    void AABBTree::rotate( int node )
+    {
+        Node& a = mNodes[ node ];
+        if ( a.height < 2 )
+            return;
+
+        int b = a.child1;
+        int c = a.child2;
+
+        // Possible rotations:
+        //  0: swap b with the first child of c
+        //  1: swap b with the second child of c
+        //  2: swap c with the first child of b
+        //  3: swap c with the second child of b
+        // The cost of each one is the change in the area of the modified child
+        float bestCost = 0.f;
+        int bestRotation = -1;
+        if ( !mNodes[ c ].isLeaf() )
+        {
+            const Node& nodeC = mNodes[ c ];
+            float areaC = area( nodeC.min, nodeC.max );
+            float cost0 = areaUnion( mNodes[ b ], mNodes[ nodeC.child2 ] ) - areaC;
+            float cost1 = areaUnion( mNodes[ b ], mNodes[ nodeC.child1 ] ) - areaC;
+            if ( cost0 < bestCost )
+            {
+                bestCost = cost0;
+                bestRotation = 0;
+            }
+            if ( cost1 < bestCost )
+            {
+                bestCost = cost1;
+                bestRotation = 1;
+            }
+        }
+        if ( !mNodes[ b ].isLeaf() )
+        {
+            const Node& nodeB = mNodes[ b ];
+            float areaB = area( nodeB.min, nodeB.max );
+            float cost2 = areaUnion( mNodes[ c ], mNodes[ nodeB.child2 ] ) - areaB;
+            float cost3 = areaUnion( mNodes[ c ], mNodes[ nodeB.child1 ] ) - areaB;
+            if ( cost2 < bestCost )
+            {
+                bestCost = cost2;
+                bestRotation = 2;
+            }
+            if ( cost3 < bestCost )
+            {
+                bestCost = cost3;
+                bestRotation = 3;
+            }
+        }
+
+        // Apply the best rotation
+        int grandChild;
+        switch ( bestRotation )
+        {
+            case 0:
+                grandChild = mNodes[ c ].child1;
+                a.child1 = grandChild;
+                mNodes[ c ].child1 = b;
+                break;
+            case 1:
+                grandChild = mNodes[ c ].child2;
+                a.child1 = grandChild;
+                mNodes[ c ].child2 = b;
+                break;
+            case 2:
+                grandChild = mNodes[ b ].child1;
+                a.child2 = grandChild;
+                mNodes[ b ].child1 = c;
+                break;
+            case 3:
+                grandChild = mNodes[ b ].child2;
+                a.child2 = grandChild;
+                mNodes[ b ].child2 = c;
+                break;
+            default:
+                return;
+        }
+
+        // Fix the parents, and recompute the modified child and the node itself
+        mNodes[ grandChild ].parent = node;
+        if ( bestRotation < 2 )
+        {
+            mNodes[ b ].parent = c;
+            updateFromChildren( c );
+        }
+        else
+        {
+            mNodes[ c ].parent = b;
+            updateFromChildren( b );
+        }
+        updateFromChildren( node );
+    }
+
+    // Build a subtree from a range of leaves, and return its root
+    int AABBTree::buildRange( std::vector<int>& leaves, int begin, int end )
+    {
+        if ( end - begin == 1 )
+            return leaves[ begin ];
+
+        // Bounds of the centers of the leaves
+        glm::vec3 centerMin = glm::vec3( std::numeric_limits<float>::max() );
+        glm::vec3 centerMax = glm::vec3( -std::numeric_limits<float>::max() );
+        for ( int i = begin; i < end; ++i )
+        {
+            glm::vec3 center = 0.5f * ( mNodes[ leaves[ i ] ].min + mNodes[ leaves[ i ] ].max );
+            centerMin = glm::min( centerMin, center );
+            centerMax = glm::max( centerMax, center );
+        }
+
+        // Split along the axis where the centers are most spread
+        glm::vec3 extent = centerMax - centerMin;
+        int axis = 0;
+        if ( extent[ 1 ] > extent[ axis ] )
+            axis = 1;
+        if ( extent[ 2 ] > extent[ axis ] )
+            axis = 2;
+
+        int middle = ( begin + end ) / 2;
+        if ( extent[ axis ] > 0.f )
+        {
+            // Distribute the leaves in bins along the axis
+            const int nBins = 16;
+            int binCount[ nBins ] = { 0 };
+            glm::vec3 binMin[ nBins ];
+            glm::vec3 binMax[ nBins ];
+            for ( int i = 0; i < nBins; ++i )
+            {
+                binMin[ i ] = glm::vec3( std::numeric_limits<float>::max() );
+                binMax[ i ] = glm::vec3( -std::numeric_limits<float>::max() );
+            }
+            auto binOf = [&]( int leaf )
+            {
+                float center = 0.5f * ( mNodes[ leaf ].min[ axis ] + mNodes[ leaf ].max[ axis ] );
+                int bin = (int)( nBins * ( center - centerMin[ axis ] ) / extent[ axis ] );
+                return std::min( bin, nBins - 1 );
+            };
+            for ( int i = begin; i < end; ++i )
+            {
+                int bin = binOf( leaves[ i ] );
+                binCount[ bin ]++;
+                binMin[ bin ] = glm::min( binMin[ bin ], mNodes[ leaves[ i ] ].min );
+                binMax[ bin ] = glm::max( binMax[ bin ], mNodes[ leaves[ i ] ].max );
+            }
+
+            // Cost of the leaves to the right of each split
+            float rightCost[ nBins ];
+            glm::vec3 accumMin = glm::vec3( std::numeric_limits<float>::max() );
+            glm::vec3 accumMax = glm::vec3( -std::numeric_limits<float>::max() );
+            int accumCount = 0;
+            for ( int i = nBins - 1; i > 0; --i )
+            {
+                accumCount += binCount[ i ];
+                accumMin = glm::min( accumMin, binMin[ i ] );
+                accumMax = glm::max( accumMax, binMax[ i ] );
+                rightCost[ i ] = accumCount > 0 ? accumCount * area( accumMin, accumMax ) : 0.f;
+            }
+
+            // Find the split with the lowest cost, sweeping from the left
+            float bestCost = std::numeric_limits<float>::max();
+            int bestSplit = -1;
+            accumMin = glm::vec3( std::numeric_limits<float>::max() );
+            accumMax = glm::vec3( -std::numeric_limits<float>::max() );
+            accumCount = 0;
+            for ( int i = 0; i < nBins - 1; ++i )
+            {
+                accumCount += binCount[ i ];
+                accumMin = glm::min( accumMin, binMin[ i ] );
+                accumMax = glm::max( accumMax, binMax[ i ] );
+                if ( accumCount == 0 || accumCount == end - begin )
+                    continue;
+                float cost = accumCount * area( accumMin, accumMax ) + rightCost[ i + 1 ];
+                if ( cost < bestCost )
+                {
+                    bestCost = cost;
+                    bestSplit = i;
+                }
+            }
+
+            // Partition the leaves around the best split
+            if ( bestSplit >= 0 )
+            {
+                auto splitIter = std::partition( leaves.begin() + begin, leaves.begin() + end,
+                                                 [&]( int leaf ) { return binOf( leaf ) <= bestSplit; } );
+                middle = splitIter - leaves.begin();
+            }
+        }
+
+        // Build the two children
+        int node = allocateNode();
+        int child1 = buildRange( leaves, begin, middle );
+        int child2 = buildRange( leaves, middle, end );
+        mNodes[ node ].child1 = child1;
+        mNodes[ node ].child2 = child2;
+        mNodes[ child1 ].parent = node;
+        mNodes[ child2 ].parent = node;
+        updateFromChildren( node );
+
+        return node;
+    }
+
+    // Recompute the AABB and height of an internal node from its children
+    void AABBTree::updateFromChildren( int node )
+    {
+        Node& parent = mNodes[ node ];
+        const Node& child1 = mNodes[ parent.child1 ];
+        const Node& child2 = mNodes[ parent.child2 ];
+        parent.min = glm::min( child1.min, child2.min );
+        parent.max = glm::max( child1.max, child2.max );
+        parent.height = 1 + std::max( child1.height, child2.height );
+    }
+
+    // Distance at which a ray enters the AABB of a node, with the slab test
+    float AABBTree::rayEntry( const Node& node, const glm::vec3& origin,
+                              const glm::vec3& invDirection, float maxDistance )
+    {
+        glm::vec3 t1 = ( node.min - origin ) * invDirection;
+        glm::vec3 t2 = ( node.max - origin ) * invDirection;
+        glm::vec3 tMin = glm::min( t1, t2 );
+        glm::vec3 tMax = glm::max( t1, t2 );
+        float tEnter = std::max( std::max( tMin.x, tMin.y ), std::max( tMin.z, 0.f ) );
+        float tExit = std::min( std::min( tMax.x, tMax.y ), std::min( tMax.z, maxDistance ) );
+        return tEnter <= tExit ? tEnter : std::numeric_limits<float>::infinity();
+    }
+
+    // Surface area of an AABB
+    float AABBTree::area( const glm::vec3& min, const glm::vec3& max )
+    {
+        glm::vec3 d = max - min;
+        return 2.f * ( d.x * d.y + d.y * d.z + d.z * d.x );
+    }
+
+    // Surface area of the union of the AABBs of two nodes
+    float AABBTree::areaUnion( const Node& a, const Node& b )
+    {
+        return area( glm::min( a.min, b.min ), glm::max( a.max, b.max ) );
+    }
+}
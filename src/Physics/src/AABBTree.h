@@ -0,0 +1,272 @@
+#ifndef AABBTREE_H
+#define AABBTREE_H
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include "GLBase.h"
+
+using namespace GLBase;
+
+namespace Physics
+{
+    // Bounding volume hierarchy of AABBs.
+    // The leaves store the AABB of one object each, and an integer given by the
+    // user to identify it. The tree can be modified incrementally, inserting and
+    // removing leaves, or built at once from a list of leaves.
+    class AABBTree
+    {
+        public:
+            // Leaf to be used when building the tree at once
+            struct Leaf
+            {
+                glm::vec3 min;
+                glm::vec3 max;
+                int userData;
+            };
+
+            // Constructor
+            AABBTree();
+
+            // Insert a leaf with the given AABB, and return its identifier
+            int createProxy( const glm::vec3& min, const glm::vec3& max, int userData );
+
+            // Remove a leaf
+            void destroyProxy( int proxyId );
+
+            // Update the AABB of a leaf after it has moved.
+            // The AABB of the leaf is enlarged by the given margin, so nothing is
+            // done if the new AABB is still contained in it. Small displacements
+            // are handled by refitting the ancestors of the leaf, and large ones
+            // by inserting it again.
+            // Returns true if the AABB of the leaf has been modified.
+            bool moveProxy( int proxyId, const glm::vec3& min, const glm::vec3& max,
+                            float margin );
+
+            // Build the tree from a list of leaves, using the surface area
+            // heuristic. This replaces the previous content of the tree.
+            // The identifiers of the leaves are written to proxyIds.
+            void build( const std::vector<Leaf>& leaves, std::vector<int>& proxyIds );
+
+            // Remove all the nodes
+            void clear();
+
+            // Getters
+            int getUserData( int proxyId ) const;
+            const glm::vec3& getMin( int proxyId ) const;
+            const glm::vec3& getMax( int proxyId ) const;
+            int getHeight() const;
+
+            // Call callback( userData ) for each leaf whose AABB overlaps the
+            // given one. The query stops if the callback returns false
+            template <typename T>
+            void query( const glm::vec3& min, const glm::vec3& max, T& callback ) const;
+
+            // Call callback( userData ) for each leaf whose AABB is hit by a ray
+            // before maxDistance, given the inverse of the direction of the ray.
+            // The nearest child of each node is visited first, and the callback
+            // returns the distance up to which the ray must still be checked
+            template <typename T>
+            void raycast( const glm::vec3& origin, const glm::vec3& invDirection,
+                          float maxDistance, T& callback ) const;
+
+        private:
+            // Node of the tree. The leaves have child1 = NULL_NODE
+            struct Node
+            {
+                glm::vec3 min;
+                glm::vec3 max;
+                // Parent node, or next free node if the node is not used
+                int parent;
+                int child1;
+                int child2;
+                // Height of the node in the tree, with zero for the leaves
+                int height;
+                int userData;
+
+                bool isLeaf() const
+                {
+                    return child1 == NULL_NODE;
+                }
+            };
+
+            // Identifier of a null node
+            static const int NULL_NODE = -1;
+            // Number of nodes that fit in the stack used when traversing the
+            // tree before it moves to the heap
+            static const int QUERY_STACK_SIZE = 1024;
+
+            // Stack of nodes to visit when traversing the tree. The nodes are
+            // kept in a fixed array, so the queries do not allocate, and moved
+            // to the heap only if a degenerate tree is deeper than that
+            template <typename T>
+            class TraversalStack
+            {
+                public:
+                    TraversalStack() :
+                        mData { mFixed },
+                        mSize { 0 },
+                        mCapacity { QUERY_STACK_SIZE }
+                    {
+                    }
+
+                    void push( const T& value )
+                    {
+                        if ( mSize == mCapacity )
+                        {
+                            if ( mData == mFixed )
+                                mHeap.assign( mFixed, mFixed + mSize );
+                            mCapacity *= 2;
+                            mHeap.resize( mCapacity );
+                            mData = mHeap.data();
+                        }
+                        mData[ mSize++ ] = value;
+                    }
+
+                    T pop()
+                    {
+                        return mData[ --mSize ];
+                    }
+
+                    bool empty() const
+                    {
+                        return mSize == 0;
+                    }
+
+                private:
+                    T mFixed[ QUERY_STACK_SIZE ];
+                    std::vector<T> mHeap;
+                    T* mData;
+                    int mSize;
+                    int mCapacity;
+            };
+
+            // Node to visit in a ray cast, with the distance at which the ray
+            // enters it
+            struct RayStackEntry
+            {
+                int node;
+                float entry;
+            };
+
+            // Nodes stored contiguously. The unused ones form a linked list
+            std::vector<Node> mNodes;
+            int mFreeList;
+            int mRoot;
+
+            // Get a node from the free list, or create a new one
+            int allocateNode();
+            // Return a node to the free list
+            void freeNode( int node );
+
+            // Insert and remove a leaf from the tree
+            void insertLeaf( int leaf );
+            void removeLeaf( int leaf );
+
+            // Walk up from a node to the root, recomputing the AABBs and heights,
+            // and rotating the nodes to reduce the area of the tree
+            void refitAncestors( int node );
+
+            // Swap a child of a node with a grandchild, if this reduces the area
+            void rotate( int node );
+
+            // Build a subtree from a range of leaves, and return its root
+            int buildRange( std::vector<int>& leaves, int begin, int end );
+
+            // Recompute the AABB and height of an internal node from its children
+            void updateFromChildren( int node );
+
+            // Distance at which a ray enters the AABB of a node, or infinity if
+            // it misses it or enters it after maxDistance
+            static float rayEntry( const Node& node, const glm::vec3& origin,
+                                   const glm::vec3& invDirection, float maxDistance );
+
+            // Surface area of an AABB, and of the union of two
+            static float area( const glm::vec3& min, const glm::vec3& max );
+            static float areaUnion( const Node& a, const Node& b );
+    };
+
+    // Call callback( userData ) for each leaf whose AABB overlaps the given one
+    template <typename T>
+    void AABBTree::query( const glm::vec3& min, const glm::vec3& max, T& callback ) const
+    {
+        if ( mRoot == NULL_NODE )
+            return;
+
+        // Stack of nodes to visit
+        TraversalStack<int> stack;
+        stack.push( mRoot );
+
+        while ( !stack.empty() )
+        {
+            const Node& node = mNodes[ stack.pop() ];
+
+            // Skip the node if its AABB does not overlap the given one
+            if ( node.min.x > max.x || node.max.x < min.x ||
+                 node.min.y > max.y || node.max.y < min.y ||
+                 node.min.z > max.z || node.max.z < min.z )
+                continue;
+
+            if ( node.isLeaf() )
+            {
+                if ( !callback( node.userData ) )
+                    return;
+            }
+            else
+            {
+                stack.push( node.child1 );
+                stack.push( node.child2 );
+            }
+        }
+    }
+
+    // Call callback( userData ) for each leaf whose AABB is hit by a ray
+    template <typename T>
+    void AABBTree::raycast( const glm::vec3& origin, const glm::vec3& invDirection,
+                            float maxDistance, T& callback ) const
+    {
+        if ( mRoot == NULL_NODE )
+            return;
+
+        // Stack of nodes to visit, with the distance at which the ray enters them
+        TraversalStack<RayStackEntry> stack;
+        float rootEntry = rayEntry( mNodes[ mRoot ], origin, invDirection, maxDistance );
+        if ( rootEntry == std::numeric_limits<float>::infinity() )
+            return;
+        stack.push( { mRoot, rootEntry } );
+
+        while ( !stack.empty() )
+        {
+            RayStackEntry top = stack.pop();
+            // Skip the node if the callback has shortened the ray past it
+            if ( top.entry > maxDistance )
+                continue;
+            const Node& node = mNodes[ top.node ];
+
+            if ( node.isLeaf() )
+            {
+                maxDistance = std::min( maxDistance, callback( node.userData ) );
+                continue;
+            }
+
+            // Push the farthest child first, so the nearest one is visited next
+            float entry1 = rayEntry( mNodes[ node.child1 ], origin, invDirection, maxDistance );
+            float entry2 = rayEntry( mNodes[ node.child2 ], origin, invDirection, maxDistance );
+            int near = node.child1;
+            int far = node.child2;
+            if ( entry2 < entry1 )
+            {
+                std::swap( entry1, entry2 );
+                std::swap( near, far );
+            }
+
+            if ( entry2 != std::numeric_limits<float>::infinity() )
+                stack.push( { far, entry2 } );
+            if ( entry1 != std::numeric_limits<float>::infinity() )
+                stack.push( { near, entry1 } );
+        }
+    }
+}
+
+#endif
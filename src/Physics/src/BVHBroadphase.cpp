@@ -0,0 +1,202 @@
+#include "Broadphase.h"
+#include "utils.h"
+
+using namespace GLBase;
+using namespace GLGeometry;
+
+namespace Physics
+{
+    //--------------------------------------------------------------------------
+    // BVHBroadphase class
+
+    // Constructor
+    BVHBroadphase::BVHBroadphase( const AABBStore& aabbStore, float margin ) :
+        Broadphase( aabbStore ),
+        mMargin { margin }, mStaticTreeDirty { false }
+    {
+    }
+
+    // Add a body
+    void BVHBroadphase::addBody( CollisionBody* body, bool isStatic )
+    {
+        // Bodies without a collider can not collide
+        if ( body->mCollider == nullptr )
+            return;
+
+        // Create the proxy of the body, at the position of its AABB in the pool
+        int proxy = body->mCollider->getAABBId();
+        if ( proxy >= (int)mProxies.size() )
+            mProxies.resize( proxy + 1, { nullptr, true, -1 } );
+        mProxies[ proxy ] = { body, isStatic, -1 };
+
+        if ( isStatic )
+        {
+            // The static tree is built again in the next update
+            mStaticTreeDirty = true;
+        }
+        else
+        {
+            // Insert the enlarged AABB in the dynamic tree, and look for the
+            // pairs of the new body in the next update
+            mProxies[ proxy ].treeProxy = mDynamicTree.createProxy( mAABBStore.getMin( proxy ) - glm::vec3( mMargin ),
+                                                                    mAABBStore.getMax( proxy ) + glm::vec3( mMargin ),
+                                                                    proxy );
+            mMovedProxies.push_back( proxy );
+        }
+    }
+
+    // Update the trees and the list of overlapping pairs
+    void BVHBroadphase::update()
+    {
+        // Build the static tree, if needed. The dynamic bodies need to look
+        // for pairs with all the new static ones
+        if ( mStaticTreeDirty )
+        {
+            buildStaticTree();
+            mStaticTreeDirty = false;
+
+            mMovedProxies.clear();
+            for ( int i = 0; i < (int)mProxies.size(); ++i )
+                if ( mProxies[ i ].body != nullptr && !mProxies[ i ].isStatic )
+                    mMovedProxies.push_back( i );
+        }
+
+        // Update the dynamic tree with the new AABBs. Only the bodies that have
+        // left their enlarged AABB are modified
+        for ( int i = 0; i < (int)mProxies.size(); ++i )
+        {
+            Proxy& proxy = mProxies[ i ];
+            if ( proxy.isStatic )
+                continue;
+
+            if ( mDynamicTree.moveProxy( proxy.treeProxy, mAABBStore.getMin( i ),
+                                         mAABBStore.getMax( i ), mMargin ) )
+                mMovedProxies.push_back( i );
+        }
+
+        // Remove the pairs whose enlarged AABBs do not overlap anymore.
+        // Iterating backwards, the pair moved to the position of a removed one
+        // has already been checked
+        for ( int i = (int)mPairs.size() - 1; i >= 0; --i )
+        {
+            int proxyA = mPairs[ i ].first;
+            int proxyB = mPairs[ i ].second;
+            if ( !checkOverlap( getFatMin( proxyA ), getFatMax( proxyA ),
+                                getFatMin( proxyB ), getFatMax( proxyB ) ) )
+                removePair( proxyA, proxyB );
+        }
+
+        // Find the new pairs of the bodies that have moved in the trees
+        for ( int moved : mMovedProxies )
+        {
+            auto addPairCallback = [&]( int other )
+            {
+                if ( other != moved )
+                    addPair( moved, other );
+                return true;
+            };
+            const glm::vec3& fatMin = getFatMin( moved );
+            const glm::vec3& fatMax = getFatMax( moved );
+            mDynamicTree.query( fatMin, fatMax, addPairCallback );
+            mStaticTree.query( fatMin, fatMax, addPairCallback );
+        }
+        mMovedProxies.clear();
+    }
+
+    // Write the pairs of bodies whose AABBs overlap
+    void BVHBroadphase::findPairs( std::vector<BodyPair>& pairs )
+    {
+        // The pairs are kept while their enlarged AABBs overlap. Only write the
+        // ones whose actual AABBs overlap
+        pairs.clear();
+        mStats = BroadphaseStats();
+        for ( auto& pair : mPairs )
+        {
+            if ( mAABBStore.checkOverlap( pair.first, pair.second ) )
+                writePair( mProxies[ pair.first ].body, mProxies[ pair.second ].body, pairs );
+        }
+    }
+
+    // Write the bodies whose AABBs overlap the given box
+    void BVHBroadphase::queryAABB( const glm::vec3& min, const glm::vec3& max,
+                                   std::vector<CollisionBody*>& bodies ) const
+    {
+        auto addBodyCallback = [&]( int proxy )
+        {
+            // The leaves of the dynamic tree are enlarged, so check the actual AABB
+            if ( checkOverlap( mAABBStore.getMin( proxy ), mAABBStore.getMax( proxy ), min, max ) )
+                bodies.push_back( mProxies[ proxy ].body );
+            return true;
+        };
+        mDynamicTree.query( min, max, addBodyCallback );
+        mStaticTree.query( min, max, addBodyCallback );
+    }
+
+    // Call callback( body ) for the bodies whose AABBs are hit by a ray.
+    // The leaves of the dynamic tree are enlarged, so a few bodies whose actual
+    // AABBs are missed may be reported too. The distances to the enlarged
+    // AABBs are not larger than to the actual ones, so no hit is skipped, as
+    // long as the bodies have not moved out of them since the last update
+    void BVHBroadphase::raycast( const glm::vec3& origin, const glm::vec3& direction,
+                                 float maxDistance,
+                                 const std::function<float( CollisionBody* )>& callback ) const
+    {
+        // The static tree is not built until the next update
+        if ( mStaticTreeDirty )
+        {
+            Broadphase::raycast( origin, direction, maxDistance, callback );
+            return;
+        }
+
+        // The distance is shared by both trees, so the hits found in the
+        // dynamic tree also prune the static one
+        float distance = maxDistance;
+        auto raycastCallback = [&]( int proxy )
+        {
+            distance = std::min( distance, callback( mProxies[ proxy ].body ) );
+            return distance;
+        };
+        glm::vec3 invDirection = getInverseDirection( direction );
+        mDynamicTree.raycast( origin, invDirection, distance, raycastCallback );
+        mStaticTree.raycast( origin, invDirection, distance, raycastCallback );
+    }
+
+    // Body of a proxy, or nullptr if the AABB is not in the broad phase
+    CollisionBody* BVHBroadphase::getProxyBody( int proxy ) const
+    {
+        return proxy < (int)mProxies.size() ? mProxies[ proxy ].body : nullptr;
+    }
+
+    // Get the enlarged AABB of a proxy, from its tree
+    const glm::vec3& BVHBroadphase::getFatMin( int proxy ) const
+    {
+        const Proxy& p = mProxies[ proxy ];
+        return p.isStatic ? mStaticTree.getMin( p.treeProxy ) : mDynamicTree.getMin( p.treeProxy );
+    }
+    const glm::vec3& BVHBroadphase::getFatMax( int proxy ) const
+    {
+        const Proxy& p = mProxies[ proxy ];
+        return p.isStatic ? mStaticTree.getMax( p.treeProxy ) : mDynamicTree.getMax( p.treeProxy );
+    }
+
+    // Build the static tree from all the static bodies
+    void BVHBroadphase::buildStaticTree()
+    {
+        // The static bodies do not move, so their AABBs are not enlarged
+        std::vector<AABBTree::Leaf> leaves;
+        std::vector<int> staticProxies;
+        for ( int i = 0; i < (int)mProxies.size(); ++i )
+        {
+            if ( mProxies[ i ].body == nullptr || !mProxies[ i ].isStatic )
+                continue;
+            leaves.push_back( { mAABBStore.getMin( i ), mAABBStore.getMax( i ), i } );
+            staticProxies.push_back( i );
+        }
+
+        // Build the tree, and store the leaf of each proxy
+        std::vector<int> treeProxies;
+        mStaticTree.build( leaves, treeProxies );
+        for ( int i = 0; i < (int)staticProxies.size(); ++i )
+            mProxies[ staticProxies[ i ] ].treeProxy = treeProxies[ i ];
+    }
+}
@@ -0,0 +1,181 @@
+#include <algorithm>
+#include <cmath>
+
+#include "Broadphase.h"
+#include "utils.h"
+
+using namespace GLBase;
+using namespace GLGeometry;
+
+namespace Physics
+{
+    //--------------------------------------------------------------------------
+    // Broadphase class
+
+    // Constructor, with the pool of AABBs of the world
+    Broadphase::Broadphase( const AABBStore& aabbStore ) :
+        mAABBStore { aabbStore }
+    {
+    }
+
+    // Call callback( body ) for the bodies whose AABBs are hit by a ray.
+    // The ray is checked against the whole pool at once, and the bodies hit
+    // are visited in the order in which the ray enters their AABBs
+    void Broadphase::raycast( const glm::vec3& origin, const glm::vec3& direction,
+                              float maxDistance,
+                              const std::function<float( CollisionBody* )>& callback ) const
+    {
+        // Auxiliary arrays, one set per thread so that rays can be cast from
+        // several threads at once without allocating in each call
+        thread_local std::vector<int> hits;
+        thread_local std::vector<float> distances;
+        hits.clear();
+        distances.clear();
+        mAABBStore.raycastOneVsMany( origin, getInverseDirection( direction ), maxDistance,
+                                     0, mAABBStore.size(), hits, distances );
+        visitRayHits( hits, distances, maxDistance, callback );
+    }
+
+    // Set the callback used to filter the pairs
+    void Broadphase::setPairFilter( const PairFilter& filter )
+    {
+        mPairFilter = filter;
+    }
+
+    // Pairs found and rejected in the last call to findPairs
+    const BroadphaseStats& Broadphase::getStats() const
+    {
+        return mStats;
+    }
+
+    // Write a pair of overlapping bodies, if it passes the filters
+    void Broadphase::writePair( CollisionBody* bodyA, CollisionBody* bodyB,
+                                std::vector<BodyPair>& pairs )
+    {
+        mStats.overlappingPairs++;
+
+        if ( !bodyA->isDynamic() && !bodyB->isDynamic() )
+        {
+            mStats.staticPairsRejected++;
+            return;
+        }
+        if ( !bodyA->canCollide( bodyB ) )
+        {
+            mStats.maskPairsRejected++;
+            return;
+        }
+        if ( mPairFilter && !mPairFilter( bodyA, bodyB ) )
+        {
+            mStats.callbackPairsRejected++;
+            return;
+        }
+
+        pairs.push_back( { bodyA, bodyB } );
+    }
+
+    // Add a pair of proxies, if it is not already in the list
+    void Broadphase::addPair( int proxyA, int proxyB )
+    {
+        uint64_t key = pairKey( proxyA, proxyB );
+        if ( mPairIndices.find( key ) != mPairIndices.end() )
+            return;
+
+        mPairIndices[ key ] = mPairs.size();
+        mPairs.push_back( { proxyA, proxyB } );
+    }
+
+    // Remove a pair of proxies, if it is in the list
+    void Broadphase::removePair( int proxyA, int proxyB )
+    {
+        auto pairIter = mPairIndices.find( pairKey( proxyA, proxyB ) );
+        if ( pairIter == mPairIndices.end() )
+            return;
+
+        // Move the last pair to the position of the removed one
+        int index = pairIter->second;
+        mPairIndices.erase( pairIter );
+        if ( index != (int)mPairs.size() - 1 )
+        {
+            mPairs[ index ] = mPairs.back();
+            mPairIndices[ pairKey( mPairs[ index ].first, mPairs[ index ].second ) ] = index;
+        }
+        mPairs.pop_back();
+    }
+
+    // Key of a pair of proxies, independent of their order
+    uint64_t Broadphase::pairKey( int proxyA, int proxyB )
+    {
+        if ( proxyA > proxyB )
+            std::swap( proxyA, proxyB );
+        return ( (uint64_t)proxyA << 32 ) | (uint64_t)proxyB;
+    }
+
+    // Check if two AABBs overlap
+    bool Broadphase::checkOverlap( const glm::vec3& minA, const glm::vec3& maxA,
+                                   const glm::vec3& minB, const glm::vec3& maxB )
+    {
+        return ( minA.x <= maxB.x && maxA.x >= minB.x &&
+                 minA.y <= maxB.y && maxA.y >= minB.y &&
+                 minA.z <= maxB.z && maxA.z >= minB.z );
+    }
+
+    // Call the callback for the bodies of the AABBs hit by a ray, from the
+    // nearest to the farthest, stopping at the first AABB past the distance
+    // returned by the callback
+    void Broadphase::visitRayHits( const std::vector<int>& hits,
+                                   const std::vector<float>& distances, float& maxDistance,
+                                   const std::function<float( CollisionBody* )>& callback ) const
+    {
+        // Sort the hits by distance
+        thread_local std::vector<int> order;
+        order.resize( hits.size() );
+        for ( int i = 0; i < (int)hits.size(); ++i )
+            order[ i ] = i;
+        std::sort( order.begin(), order.end(), [&]( int a, int b )
+        {
+            return distances[ a ] < distances[ b ];
+        } );
+
+        for ( int i : order )
+        {
+            if ( distances[ i ] > maxDistance )
+                return;
+            CollisionBody* body = getProxyBody( hits[ i ] );
+            if ( body != nullptr )
+                maxDistance = std::min( maxDistance, callback( body ) );
+        }
+    }
+
+    // Interval of distances along a ray inside an AABB, clipped to
+    // [ 0, maxDistance ]
+    bool Broadphase::clipRay( const glm::vec3& min, const glm::vec3& max,
+                              const glm::vec3& origin, const glm::vec3& invDirection,
+                              float maxDistance, float& tEnter, float& tExit )
+    {
+        tEnter = 0.f;
+        tExit = maxDistance;
+        for ( int i = 0; i < 3; ++i )
+        {
+            float t1 = ( min[ i ] - origin[ i ] ) * invDirection[ i ];
+            float t2 = ( max[ i ] - origin[ i ] ) * invDirection[ i ];
+            tEnter = std::max( tEnter, std::min( t1, t2 ) );
+            tExit = std::min( tExit, std::max( t1, t2 ) );
+        }
+        return tEnter <= tExit;
+    }
+
+    // Inverse of the direction of a ray, with the zero components replaced by
+    // tiny ones of the same sign
+    glm::vec3 Broadphase::getInverseDirection( const glm::vec3& direction )
+    {
+        glm::vec3 invDirection;
+        for ( int i = 0; i < 3; ++i )
+        {
+            float d = direction[ i ];
+            if ( std::abs( d ) < 1e-20f )
+                d = std::copysign( 1e-20f, d );
+            invDirection[ i ] = 1.f / d;
+        }
+        return invDirection;
+    }
+}
@@ -0,0 +1,383 @@
+#ifndef BROADPHASE_H
+#define BROADPHASE_H
+
+#include <functional>
+#include <unordered_map>
+
+#include "GLBase.h"
+#include "Colliders.h"
+#include "PhysicsBody.h"
+#include "AABBTree.h"
+#include "AABBStore.h"
+
+using namespace GLBase;
+
+namespace Physics
+{
+    // Pair of bodies whose AABBs overlap, that need to be checked in the narrow
+    // phase of collision detection
+    struct BodyPair
+    {
+        CollisionBody* bodyA;
+        CollisionBody* bodyB;
+    };
+
+    // Callback that decides if a pair of bodies that passed the category and
+    // mask filters is checked in the narrow phase
+    typedef std::function<bool( const CollisionBody*, const CollisionBody* )> PairFilter;
+
+    // Pairs of bodies found by the broad phase in the last call to findPairs,
+    // and the ones of them rejected before the narrow phase, by each filter
+    struct BroadphaseStats
+    {
+        int overlappingPairs = 0;
+        int staticPairsRejected = 0;
+        int maskPairsRejected = 0;
+        int callbackPairsRejected = 0;
+    };
+
+    // Types of broad phase that can be used by a CollisionWorld
+    enum class BroadphaseType
+    {
+        SweepAndPrune,
+        AABBTree,
+        SpatialHash
+    };
+
+    // Base class for the broad phase of collision detection.
+    // The AABBs of the bodies are read from the pool of the world, and the
+    // proxies of the bodies are indexed by the identifier of their AABB in it
+    class Broadphase
+    {
+        public:
+            // Constructor, with the pool of AABBs of the world
+            Broadphase( const AABBStore& aabbStore );
+
+            // Destructor
+            virtual ~Broadphase() = default;
+
+            // Add a body. Bodies without a collider are ignored.
+            // Static bodies are not expected to move after being added
+            virtual void addBody( CollisionBody* body, bool isStatic ) = 0;
+
+            // Update the structure after the bodies have been moved
+            virtual void update() = 0;
+
+            // Write the pairs of bodies whose AABBs overlap, and that pass the
+            // collision filters
+            virtual void findPairs( std::vector<BodyPair>& pairs ) = 0;
+
+            // Set the callback used to filter the pairs. It is called after
+            // the category and mask filters, and can be empty
+            void setPairFilter( const PairFilter& filter );
+
+            // Pairs found and rejected in the last call to findPairs
+            const BroadphaseStats& getStats() const;
+
+            // Write the bodies whose AABBs overlap the given box. This does not
+            // modify the broad phase, so it can be called from several threads
+            // at once
+            virtual void queryAABB( const glm::vec3& min, const glm::vec3& max,
+                                    std::vector<CollisionBody*>& bodies ) const = 0;
+
+            // Call callback( body ) for the bodies whose AABBs are hit by a ray
+            // before maxDistance, roughly from the nearest to the farthest. The
+            // callback returns the distance up to which the ray must still be
+            // checked, so the bodies behind a hit are skipped.
+            // The direction must be normalized. This does not modify the broad
+            // phase, so it can be called from several threads at once
+            virtual void raycast( const glm::vec3& origin, const glm::vec3& direction,
+                                  float maxDistance,
+                                  const std::function<float( CollisionBody* )>& callback ) const;
+
+        protected:
+            // Pool with the AABBs of the bodies
+            const AABBStore& mAABBStore;
+
+            // Callback used to filter the pairs, and pairs found and rejected
+            PairFilter mPairFilter;
+            BroadphaseStats mStats;
+
+            // Write a pair of overlapping bodies, if it passes the filters.
+            // Pairs of bodies without dynamics are rejected first, then the
+            // ones whose categories and masks do not match, and then the ones
+            // rejected by the callback
+            void writePair( CollisionBody* bodyA, CollisionBody* bodyB,
+                            std::vector<BodyPair>& pairs );
+
+            // List of overlapping pairs of proxies, and the position of each of
+            // them in the list, indexed by pairKey
+            std::vector<std::pair<int, int>> mPairs;
+            std::unordered_map<uint64_t, int> mPairIndices;
+
+            // Add and remove pairs of proxies from the list
+            void addPair( int proxyA, int proxyB );
+            void removePair( int proxyA, int proxyB );
+
+            // Key of a pair of proxies, independent of their order
+            static uint64_t pairKey( int proxyA, int proxyB );
+
+            // Check if two AABBs overlap
+            static bool checkOverlap( const glm::vec3& minA, const glm::vec3& maxA,
+                                      const glm::vec3& minB, const glm::vec3& maxB );
+
+            // Body of a proxy, or nullptr if the AABB is not in the broad phase
+            virtual CollisionBody* getProxyBody( int proxy ) const = 0;
+
+            // Call the callback for the bodies of the AABBs hit by a ray, given
+            // the distances at which the ray enters them, from the nearest to
+            // the farthest. The callback shortens maxDistance
+            void visitRayHits( const std::vector<int>& hits, const std::vector<float>& distances,
+                               float& maxDistance,
+                               const std::function<float( CollisionBody* )>& callback ) const;
+
+            // Interval of distances along a ray inside an AABB, clipped to
+            // [ 0, maxDistance ]. Returns false if the ray misses the AABB in it
+            static bool clipRay( const glm::vec3& min, const glm::vec3& max,
+                                 const glm::vec3& origin, const glm::vec3& invDirection,
+                                 float maxDistance, float& tEnter, float& tExit );
+
+            // Inverse of the direction of a ray, used in the slab tests. The zero
+            // components are replaced by tiny ones, so the inverse is finite
+            static glm::vec3 getInverseDirection( const glm::vec3& direction );
+    };
+
+    // Sweep and prune broad phase.
+    // The two endpoints of the AABB of each body are kept sorted along each of
+    // the three axes. Since the bodies move little between frames, the arrays
+    // are almost sorted, and insertion sort updates them in close to linear time.
+    // The pairs of overlapping bodies are updated only when two endpoints swap.
+    class SweepAndPrune : public Broadphase
+    {
+        public:
+            // Constructor
+            SweepAndPrune( const AABBStore& aabbStore );
+
+            // Add a body
+            void addBody( CollisionBody* body, bool isStatic );
+
+            // Update the endpoints and the list of overlapping pairs
+            void update();
+
+            // Write the pairs of bodies whose AABBs overlap
+            void findPairs( std::vector<BodyPair>& pairs );
+
+            // Write the bodies whose AABBs overlap the given box
+            void queryAABB( const glm::vec3& min, const glm::vec3& max,
+                            std::vector<CollisionBody*>& bodies ) const;
+
+            // Call callback( body ) for the bodies whose AABBs are hit by a ray,
+            // checking only the ones whose interval along one of the sorted
+            // axes overlaps the ray
+            void raycast( const glm::vec3& origin, const glm::vec3& direction, float maxDistance,
+                          const std::function<float( CollisionBody* )>& callback ) const;
+
+        private:
+            // Minimum or maximum of the AABB of a body, along one axis
+            struct Endpoint
+            {
+                float value;
+                int proxy;
+                bool isMin;
+            };
+
+            // Bodies of the proxies, or nullptr for the AABBs of the pool that
+            // are not in the broad phase
+            std::vector<CollisionBody*> mProxies;
+
+            // Body of a proxy
+            CollisionBody* getProxyBody( int proxy ) const;
+            // Sorted endpoints, along each axis
+            std::vector<Endpoint> mEndpoints[ 3 ];
+
+            // True if bodies have been added since the last update
+            bool mNeedsRebuild;
+
+            // Proxies much larger than the median, and largest size of the
+            // other ones along each axis and box that contains them, found in
+            // the last update
+            std::vector<int> mLargeProxies;
+            float mMaxExtents[ 3 ];
+            glm::vec3 mBoundsMin;
+            glm::vec3 mBoundsMax;
+            // Auxiliary array used to compute the median size of the AABBs
+            std::vector<float> mExtents;
+
+            // Find the large proxies and the largest size of the others
+            void computeExtents();
+
+            // Sort all the endpoints, and find the overlapping pairs from scratch
+            void rebuild();
+
+            // Sort the endpoints along an axis, updating the overlapping pairs
+            void sortAxis( int axis );
+
+            // Check if an endpoint goes before another one in the sorted arrays
+            static bool isBefore( const Endpoint& a, const Endpoint& b );
+    };
+
+    // Broad phase based on bounding volume hierarchies.
+    // Static and dynamic bodies are stored in separate trees. The static tree
+    // is built once with the surface area heuristic, and the dynamic tree is
+    // updated incrementally. The leaves of the dynamic tree are enlarged AABBs,
+    // so a body only needs to be updated in the tree when it moves out of its
+    // enlarged box.
+    // The pairs are found using the enlarged AABBs, and are kept between steps.
+    // Only the bodies that have been updated in the tree look for new pairs.
+    class BVHBroadphase : public Broadphase
+    {
+        public:
+            // Constructor
+            BVHBroadphase( const AABBStore& aabbStore, float margin = 0.1f );
+
+            // Add a body
+            void addBody( CollisionBody* body, bool isStatic );
+
+            // Update the trees and the list of overlapping pairs
+            void update();
+
+            // Write the pairs of bodies whose AABBs overlap
+            void findPairs( std::vector<BodyPair>& pairs );
+
+            // Write the bodies whose AABBs overlap the given box
+            void queryAABB( const glm::vec3& min, const glm::vec3& max,
+                            std::vector<CollisionBody*>& bodies ) const;
+
+            // Call callback( body ) for the bodies whose AABBs are hit by a ray,
+            // traversing the trees from the nearest to the farthest node
+            void raycast( const glm::vec3& origin, const glm::vec3& direction, float maxDistance,
+                          const std::function<float( CollisionBody* )>& callback ) const;
+
+        private:
+            // Body stored in the broad phase. The body is nullptr for the AABBs
+            // of the pool that are not in the broad phase
+            struct Proxy
+            {
+                CollisionBody* body;
+                bool isStatic;
+                // Identifier of the leaf in the corresponding tree
+                int treeProxy;
+            };
+
+            // Margin used to enlarge the AABBs of the dynamic bodies
+            float mMargin;
+
+            // Proxies of the bodies
+            std::vector<Proxy> mProxies;
+
+            // Trees of static and dynamic bodies. The user data of the leaves is
+            // the index of the proxy
+            AABBTree mStaticTree;
+            AABBTree mDynamicTree;
+
+            // True if static bodies have been added since the static tree was built
+            bool mStaticTreeDirty;
+
+            // Dynamic proxies that have been updated in the tree in this step
+            std::vector<int> mMovedProxies;
+
+            // Body of a proxy
+            CollisionBody* getProxyBody( int proxy ) const;
+
+            // Get the enlarged AABB of a proxy, from its tree
+            const glm::vec3& getFatMin( int proxy ) const;
+            const glm::vec3& getFatMax( int proxy ) const;
+
+            // Build the static tree from all the static bodies
+            void buildStaticTree();
+    };
+
+    // Broad phase based on a uniform grid, stored in a hash table.
+    // This works best for many bodies of similar size. The size of the cells
+    // is the median size of the AABBs, so most bodies are in a few cells.
+    // The table is built again in each update, reusing the same memory, and
+    // the pairs are found by checking the bodies in the same cell.
+    class SpatialHashGrid : public Broadphase
+    {
+        public:
+            // Constructor
+            SpatialHashGrid( const AABBStore& aabbStore );
+
+            // Add a body
+            void addBody( CollisionBody* body, bool isStatic );
+
+            // Build the grid and find the overlapping pairs
+            void update();
+
+            // Write the pairs of bodies whose AABBs overlap
+            void findPairs( std::vector<BodyPair>& pairs );
+
+            // Write the bodies whose AABBs overlap the given box
+            void queryAABB( const glm::vec3& min, const glm::vec3& max,
+                            std::vector<CollisionBody*>& bodies ) const;
+
+            // Call callback( body ) for the bodies whose AABBs are hit by a ray,
+            // walking the cells of the grid along the ray
+            void raycast( const glm::vec3& origin, const glm::vec3& direction, float maxDistance,
+                          const std::function<float( CollisionBody* )>& callback ) const;
+
+        private:
+            // Body stored in the broad phase. The body is nullptr for the AABBs
+            // of the pool that are not in the broad phase
+            struct Proxy
+            {
+                CollisionBody* body;
+                bool isStatic;
+            };
+
+            // Cell of the grid, stored in the hash table
+            struct Cell
+            {
+                glm::ivec3 coords;
+                // Number of proxies in the cell, or -1 if the slot is empty
+                int count;
+                // Position of the first proxy of the cell in mCellProxies
+                int start;
+            };
+
+            // Maximum number of cells of a body. Larger bodies are checked
+            // against all the others instead
+            static const int MAX_CELLS_PER_BODY = 64;
+
+            // Proxies of the bodies
+            std::vector<Proxy> mProxies;
+            // Proxies too large to be stored in the grid
+            std::vector<int> mLargeProxies;
+
+            // Size of the cells
+            float mCellSize;
+            // Box that contains the bodies stored in the grid
+            glm::vec3 mGridMin;
+            glm::vec3 mGridMax;
+
+            // Hash table of cells, with open addressing. The size is a power of two
+            std::vector<Cell> mCells;
+            // Proxies in each of the cells, stored contiguously
+            std::vector<int> mCellProxies;
+
+            // Overlapping pairs found in the last update
+            std::vector<std::pair<int, int>> mGridPairs;
+
+            // Auxiliary array used to compute the median size of the AABBs
+            std::vector<float> mExtents;
+            // Auxiliary array with the AABBs that overlap a large one
+            std::vector<int> mOverlaps;
+
+            // Body of a proxy
+            CollisionBody* getProxyBody( int proxy ) const;
+
+            // Compute the size of the cells from the AABBs of the bodies
+            void computeCellSize();
+
+            // Range of cells covered by an AABB
+            void getCellRange( const glm::vec3& min, const glm::vec3& max,
+                               glm::ivec3& cellMin, glm::ivec3& cellMax ) const;
+            glm::ivec3 getCellCoords( const glm::vec3& point ) const;
+
+            // Find the slot of a cell in the hash table. If the cell is not in
+            // the table, this returns the empty slot where it would go
+            int findSlot( const glm::ivec3& coords ) const;
+    };
+}
+
+#endif
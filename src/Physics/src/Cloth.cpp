@@ -0,0 +1,700 @@
+#include <algorithm>
+#include <cmath>
+
+#if defined( __SSE2__ )
+#include <immintrin.h>
+#endif
+
+#include "Cloth.h"
+#include "utils.h"
+
+using namespace GLGeometry;
+using namespace GLBase;
+
+namespace Physics
+{
+    // Types of the constraints of a cloth, which have different compliances
+    enum class LinkType
+    {
+        Stretch,
+        Shear,
+        Bend
+    };
+
+    // Constraints between each particle and the ones the given number of
+    // rows and columns after it
+    struct LinkFamily
+    {
+        int rowOffset;
+        int columnOffset;
+        LinkType type;
+    };
+
+    const LinkFamily LINK_FAMILIES[] = {
+        { 0, 1, LinkType::Stretch },
+        { 1, 0, LinkType::Stretch },
+        { 1, 1, LinkType::Shear },
+        { 1, -1, LinkType::Shear },
+        { 0, 2, LinkType::Bend },
+        { 2, 0, LinkType::Bend }
+    };
+
+    // Smallest distance at which the particles are checked for self
+    // collisions, used as the size of the cells of the spatial hash when the
+    // cloth has no thickness and does not move
+    const float MIN_NEIGHBOR_RADIUS = 1e-4f;
+
+    // Cell of the spatial hash of a point, in a table of the given size
+    static int hashCell( int x, int y, int z, int tableSize )
+    {
+        uint32_t hash = ( (uint32_t)x * 92837111u ) ^ ( (uint32_t)y * 689287499u ) ^
+                        ( (uint32_t)z * 283923481u );
+        return hash % tableSize;
+    }
+
+    // Call a task for each row, or pair of rows, in the threads of the pool
+    static void forEachRow( ThreadPool* threadPool, int count,
+                            const std::function<void( int )>& task )
+    {
+        if ( threadPool != nullptr && count > 1 )
+        {
+            threadPool->parallelFor( count, [&]( int index, int )
+            {
+                task( index );
+            } );
+        }
+        else
+        {
+            for ( int index = 0; index < count; ++index )
+                task( index );
+        }
+    }
+
+#if defined( __SSE2__ )
+    // Project four constraints at once, given the coordinates of the particles
+    // at both ends and their inverse masses
+    static inline void projectLinks4( __m128 a[3], __m128 b[3], __m128 invMassA,
+                                      __m128 invMassB, __m128 restLength, __m128 alpha )
+    {
+        __m128 difference[3];
+        __m128 length2 = _mm_setzero_ps();
+        for ( int k = 0; k < 3; ++k )
+        {
+            difference[ k ] = _mm_sub_ps( a[ k ], b[ k ] );
+            length2 = _mm_add_ps( length2, _mm_mul_ps( difference[ k ], difference[ k ] ) );
+        }
+        __m128 length = _mm_sqrt_ps( length2 );
+
+        // Change of the multiplier over the length, zero for the constraints
+        // with no length or between fixed particles
+        __m128 denominator = _mm_mul_ps( _mm_add_ps( _mm_add_ps( invMassA, invMassB ), alpha ),
+                                         length );
+        __m128 valid = _mm_cmpgt_ps( denominator, _mm_set1_ps( 1e-9f ) );
+        __m128 scale = _mm_and_ps( valid, _mm_div_ps( _mm_sub_ps( restLength, length ),
+                                                      denominator ) );
+        __m128 scaleA = _mm_mul_ps( invMassA, scale );
+        __m128 scaleB = _mm_mul_ps( invMassB, scale );
+
+        for ( int k = 0; k < 3; ++k )
+        {
+            a[ k ] = _mm_add_ps( a[ k ], _mm_mul_ps( scaleA, difference[ k ] ) );
+            b[ k ] = _mm_sub_ps( b[ k ], _mm_mul_ps( scaleB, difference[ k ] ) );
+        }
+    }
+
+    // Load eight consecutive values of a row, and split them into the first
+    // and second ends of four constraints between particles the given number
+    // of columns apart. With one column they are the even and odd values, and
+    // with two they alternate in pairs
+    static inline void loadLinks( const float* values, int columnOffset, __m128& a, __m128& b )
+    {
+        __m128 low = _mm_loadu_ps( values );
+        __m128 high = _mm_loadu_ps( values + 4 );
+        if ( columnOffset == 1 )
+        {
+            a = _mm_shuffle_ps( low, high, _MM_SHUFFLE( 2, 0, 2, 0 ) );
+            b = _mm_shuffle_ps( low, high, _MM_SHUFFLE( 3, 1, 3, 1 ) );
+        }
+        else
+        {
+            a = _mm_shuffle_ps( low, high, _MM_SHUFFLE( 1, 0, 1, 0 ) );
+            b = _mm_shuffle_ps( low, high, _MM_SHUFFLE( 3, 2, 3, 2 ) );
+        }
+    }
+
+    // Merge the ends of the constraints back into the eight values of the row
+    static inline void storeLinks( float* values, int columnOffset, __m128 a, __m128 b )
+    {
+        if ( columnOffset == 1 )
+        {
+            _mm_storeu_ps( values, _mm_unpacklo_ps( a, b ) );
+            _mm_storeu_ps( values + 4, _mm_unpackhi_ps( a, b ) );
+        }
+        else
+        {
+            _mm_storeu_ps( values, _mm_shuffle_ps( a, b, _MM_SHUFFLE( 1, 0, 1, 0 ) ) );
+            _mm_storeu_ps( values + 4, _mm_shuffle_ps( a, b, _MM_SHUFFLE( 3, 2, 3, 2 ) ) );
+        }
+    }
+#endif
+
+    //--------------------------------------------------------------------------
+    // Cloth class
+
+    // Constructor
+    Cloth::Cloth( const glm::vec3& corner, const glm::vec3& sideU, const glm::vec3& sideV,
+                  int nColumns, int nRows, float mass ) :
+        CollisionBody( glm::vec3( 0.f, 0.f, 0.f ), glm::vec3( 1.f, 1.f, 1.f ),
+                       0.f, glm::vec3( 1.f, 0.f, 0.f ) ),
+        mNumColumns { std::max( nColumns, 2 ) },
+        mNumRows { std::max( nRows, 2 ) },
+        mClothGL { nullptr }
+    {
+        mSpacingU = sideU / (float)( mNumColumns - 1 );
+        mSpacingV = sideV / (float)( mNumRows - 1 );
+
+        // Without a positive mass, the particles do not move, like the rigid
+        // bodies with infinite mass
+        int nParticles = mNumColumns * mNumRows;
+        if ( mass > 0.f )
+            mParticleInvMass = nParticles / mass;
+        else
+        {
+            LOG_ERROR( "The mass of a cloth must be positive" );
+            mParticleInvMass = 0.f;
+        }
+        mInvMass.assign( nParticles, mParticleInvMass );
+        mVelocityX.assign( nParticles, 0.f );
+        mVelocityY.assign( nParticles, 0.f );
+        mVelocityZ.assign( nParticles, 0.f );
+
+        for ( int i = 0; i < mNumRows; ++i )
+        {
+            for ( int j = 0; j < mNumColumns; ++j )
+            {
+                glm::vec3 position = corner + (float)j * mSpacingU + (float)i * mSpacingV;
+                mPositionX.push_back( position.x );
+                mPositionY.push_back( position.y );
+                mPositionZ.push_back( position.z );
+            }
+        }
+        mPreviousX = mPositionX;
+        mPreviousY = mPositionY;
+        mPreviousZ = mPositionZ;
+    }
+
+    // Add the geometry used to draw the cloth, and copy it to the list of
+    // elementary objects of the GLSandbox class
+    void Cloth::setClothGeometry( std::vector<GLElemObject*>& elemObjs )
+    {
+        // Add a GLCloth object, with the current positions of the particles
+        mClothGL = new GLCloth( mNumColumns, mNumRows );
+        mClothGL->updateVertices( mPositionX.data(), mPositionY.data(), mPositionZ.data() );
+        mGeometryObject = mClothGL;
+
+        // Store the pointer also in the list of elementary objects in the scene
+        elemObjs.push_back( mClothGL );
+
+        // Set the model matrix of the geometry object
+        mTransformDirty = true;
+        updateTransform();
+    }
+
+    // Settings
+    void Cloth::setSettings( const ClothSettings& settings )
+    {
+        mSettings = settings;
+    }
+
+    const ClothSettings& Cloth::getSettings() const
+    {
+        return mSettings;
+    }
+
+    // Add a force. The generators are kept, so changes to them apply to the
+    // cloth too
+    bool Cloth::addForce( ForceGenerator* force )
+    {
+        switch ( force->getType() )
+        {
+            case ForceType::Gravity:
+                mGravityForces.push_back( static_cast<GravityForceGenerator*>( force ) );
+                return true;
+            case ForceType::Drag:
+                mDragForces.push_back( static_cast<DragForceGenerator*>( force ) );
+                return true;
+            default:
+                LOG_ERROR( "Only gravity and drag forces can act on a cloth" );
+                return false;
+        }
+    }
+
+    // Fix a particle where it is, or release it
+    void Cloth::pinParticle( int row, int column, bool pinned )
+    {
+        int id = row * mNumColumns + column;
+        mInvMass[ id ] = pinned ? 0.f : mParticleInvMass;
+        mVelocityX[ id ] = 0.f;
+        mVelocityY[ id ] = 0.f;
+        mVelocityZ[ id ] = 0.f;
+    }
+
+    // Move a particle
+    void Cloth::setParticlePosition( int row, int column, const glm::vec3& position )
+    {
+        int id = row * mNumColumns + column;
+        mPositionX[ id ] = mPreviousX[ id ] = position.x;
+        mPositionY[ id ] = mPreviousY[ id ] = position.y;
+        mPositionZ[ id ] = mPreviousZ[ id ] = position.z;
+    }
+
+    // Getters
+    glm::vec3 Cloth::getParticlePosition( int row, int column ) const
+    {
+        int id = row * mNumColumns + column;
+        return glm::vec3( mPositionX[ id ], mPositionY[ id ], mPositionZ[ id ] );
+    }
+
+    glm::vec3 Cloth::getParticleVelocity( int row, int column ) const
+    {
+        int id = row * mNumColumns + column;
+        return glm::vec3( mVelocityX[ id ], mVelocityY[ id ], mVelocityZ[ id ] );
+    }
+
+    int Cloth::getNumRows() const
+    {
+        return mNumRows;
+    }
+
+    int Cloth::getNumColumns() const
+    {
+        return mNumColumns;
+    }
+
+    // Box that contains the cloth during a step, assuming that the particles
+    // keep their velocities
+    void Cloth::getBounds( float deltaTime, glm::vec3& min, glm::vec3& max ) const
+    {
+        min = glm::vec3( mPositionX[0], mPositionY[0], mPositionZ[0] );
+        max = min;
+        float maxSpeed2 = 0.f;
+        for ( int i = 0; i < (int)mPositionX.size(); ++i )
+        {
+            glm::vec3 position( mPositionX[ i ], mPositionY[ i ], mPositionZ[ i ] );
+            min = glm::min( min, position );
+            max = glm::max( max, position );
+            maxSpeed2 = std::max( maxSpeed2, mVelocityX[ i ] * mVelocityX[ i ] +
+                                             mVelocityY[ i ] * mVelocityY[ i ] +
+                                             mVelocityZ[ i ] * mVelocityZ[ i ] );
+        }
+
+        float margin = mSettings.thickness + std::sqrt( maxSpeed2 ) * deltaTime;
+        min -= glm::vec3( margin );
+        max += glm::vec3( margin );
+    }
+
+    // Simulate a step, in sub-steps. The colliders of the bodies and the pairs
+    // of particles that can touch are found once for the whole step
+    void Cloth::simulate( float deltaTime, CollisionBody* const* bodies, int nBodies,
+                          ThreadPool* threadPool )
+    {
+        mColliders.clear();
+        mFrictions.clear();
+        for ( int k = 0; k < nBodies; ++k )
+        {
+            if ( bodies[ k ]->mCollider == nullptr || !canCollide( bodies[ k ] ) )
+                continue;
+            mColliders.push_back( bodies[ k ]->mCollider );
+            mFrictions.push_back( std::sqrt( getFriction() * bodies[ k ]->getFriction() ) );
+        }
+
+        if ( mSettings.selfCollision )
+            findNeighbors( deltaTime );
+
+        int nSubsteps = std::max( mSettings.substeps, 1 );
+        float substepTime = deltaTime / nSubsteps;
+        for ( int substep = 0; substep < nSubsteps; ++substep )
+        {
+            integrate( substepTime );
+            projectConstraints( substepTime, threadPool );
+            solveCollisions();
+            if ( mSettings.selfCollision )
+                solveSelfCollisions();
+            updateVelocities( substepTime );
+        }
+
+        // Copy the new positions to the geometry
+        if ( mClothGL != nullptr )
+            mClothGL->updateVertices( mPositionX.data(), mPositionY.data(), mPositionZ.data() );
+    }
+
+    // Move the particles with their velocities, after adding the acceleration
+    // of the forces. The drag is computed with the velocity relative to the air
+    void Cloth::integrate( float deltaTime )
+    {
+        glm::vec3 gravity( 0.f, 0.f, 0.f );
+        for ( auto force : mGravityForces )
+            gravity += force->getGravity();
+        float k1 = 0.f;
+        float k2 = 0.f;
+        for ( auto force : mDragForces )
+        {
+            k1 += force->getK1();
+            k2 += force->getK2();
+        }
+        float dampingFactor = powf( mSettings.damping, deltaTime );
+
+        for ( int i = 0; i < (int)mPositionX.size(); ++i )
+        {
+            mPreviousX[ i ] = mPositionX[ i ];
+            mPreviousY[ i ] = mPositionY[ i ];
+            mPreviousZ[ i ] = mPositionZ[ i ];
+            if ( mInvMass[ i ] == 0.f )
+                continue;
+
+            glm::vec3 velocity( mVelocityX[ i ], mVelocityY[ i ], mVelocityZ[ i ] );
+            glm::vec3 relativeVelocity = velocity - mSettings.wind;
+            float speed = glm::length( relativeVelocity );
+            glm::vec3 acceleration = gravity - mInvMass[ i ] * ( k1 + k2 * speed ) *
+                                               relativeVelocity;
+            velocity = ( velocity + deltaTime * acceleration ) * dampingFactor;
+
+            mVelocityX[ i ] = velocity.x;
+            mVelocityY[ i ] = velocity.y;
+            mVelocityZ[ i ] = velocity.z;
+            mPositionX[ i ] += deltaTime * velocity.x;
+            mPositionY[ i ] += deltaTime * velocity.y;
+            mPositionZ[ i ] += deltaTime * velocity.z;
+        }
+    }
+
+    // Project all the constraints once. The constraints of each family are
+    // split in two sets that share no particles: along the rows they
+    // alternate within each row, and between rows they alternate by pairs
+    // of rows. Each set is projected in parallel
+    void Cloth::projectConstraints( float deltaTime, ThreadPool* threadPool )
+    {
+        float invDeltaTime2 = 1.f / ( deltaTime * deltaTime );
+        for ( const LinkFamily& family : LINK_FAMILIES )
+        {
+            float compliance = family.type == LinkType::Stretch ? mSettings.stretchCompliance :
+                               family.type == LinkType::Shear ? mSettings.shearCompliance :
+                                                                mSettings.bendCompliance;
+            float alpha = compliance * invDeltaTime2;
+            float restLength = glm::length( (float)family.columnOffset * mSpacingU +
+                                            (float)family.rowOffset * mSpacingV );
+            if ( family.columnOffset >= mNumColumns || family.rowOffset >= mNumRows )
+                continue;
+
+            for ( int phase = 0; phase < 2; ++phase )
+            {
+                if ( family.rowOffset == 0 )
+                {
+                    forEachRow( threadPool, mNumRows, [&]( int row )
+                    {
+                        projectRowLinks( row, family.columnOffset, phase, restLength, alpha );
+                    } );
+                    continue;
+                }
+
+                // The first rows of the pairs in this set are the ones with
+                // ( row / rowOffset ) % 2 == phase
+                int offset = family.rowOffset;
+                auto firstRow = [&]( int index )
+                {
+                    return ( 2 * ( index / offset ) + phase ) * offset + index % offset;
+                };
+                int nPairs = 0;
+                while ( firstRow( nPairs ) + offset < mNumRows )
+                    nPairs++;
+
+                forEachRow( threadPool, nPairs, [&]( int index )
+                {
+                    int row = firstRow( index );
+                    projectRowPairLinks( row, row + offset, family.columnOffset,
+                                         restLength, alpha );
+                } );
+            }
+        }
+    }
+
+    // Project the constraints of a row in one of its two sets: the ones that
+    // start at the columns with ( column / columnOffset ) % 2 == phase. The
+    // SIMD loop takes blocks of eight particles, with four constraints each
+    void Cloth::projectRowLinks( int row, int columnOffset, int phase,
+                                 float restLength, float alpha )
+    {
+        int rowStart = row * mNumColumns;
+        int column = columnOffset * phase;
+
+#if defined( __SSE2__ )
+        float* x = &mPositionX[ rowStart ];
+        float* y = &mPositionY[ rowStart ];
+        float* z = &mPositionZ[ rowStart ];
+        const float* invMass = &mInvMass[ rowStart ];
+        __m128 restLength4 = _mm_set1_ps( restLength );
+        __m128 alpha4 = _mm_set1_ps( alpha );
+        for ( ; column + 8 <= mNumColumns; column += 8 )
+        {
+            __m128 a[3], b[3], invMassA, invMassB;
+            loadLinks( x + column, columnOffset, a[0], b[0] );
+            loadLinks( y + column, columnOffset, a[1], b[1] );
+            loadLinks( z + column, columnOffset, a[2], b[2] );
+            loadLinks( invMass + column, columnOffset, invMassA, invMassB );
+
+            projectLinks4( a, b, invMassA, invMassB, restLength4, alpha4 );
+
+            storeLinks( x + column, columnOffset, a[0], b[0] );
+            storeLinks( y + column, columnOffset, a[1], b[1] );
+            storeLinks( z + column, columnOffset, a[2], b[2] );
+        }
+#endif
+
+        // The rest of the row, one constraint at a time
+        for ( ; column + columnOffset < mNumColumns; ++column )
+        {
+            if ( ( column / columnOffset ) % 2 == phase )
+                projectLink( rowStart + column, rowStart + column + columnOffset,
+                             restLength, alpha );
+        }
+    }
+
+    // Project the constraints between two rows. The particles of each row
+    // are consecutive, so the SIMD loop reads four of them at a time
+    void Cloth::projectRowPairLinks( int rowA, int rowB, int columnOffset,
+                                     float restLength, float alpha )
+    {
+        int begin = std::max( 0, -columnOffset );
+        int end = std::min( mNumColumns, mNumColumns - columnOffset );
+        int startA = rowA * mNumColumns;
+        int startB = rowB * mNumColumns + columnOffset;
+        int column = begin;
+
+#if defined( __SSE2__ )
+        float* positions[3] = { mPositionX.data(), mPositionY.data(), mPositionZ.data() };
+        __m128 restLength4 = _mm_set1_ps( restLength );
+        __m128 alpha4 = _mm_set1_ps( alpha );
+        for ( ; column + 4 <= end; column += 4 )
+        {
+            __m128 a[3], b[3];
+            for ( int k = 0; k < 3; ++k )
+            {
+                a[ k ] = _mm_loadu_ps( positions[ k ] + startA + column );
+                b[ k ] = _mm_loadu_ps( positions[ k ] + startB + column );
+            }
+            __m128 invMassA = _mm_loadu_ps( &mInvMass[ startA + column ] );
+            __m128 invMassB = _mm_loadu_ps( &mInvMass[ startB + column ] );
+
+            projectLinks4( a, b, invMassA, invMassB, restLength4, alpha4 );
+
+            for ( int k = 0; k < 3; ++k )
+            {
+                _mm_storeu_ps( positions[ k ] + startA + column, a[ k ] );
+                _mm_storeu_ps( positions[ k ] + startB + column, b[ k ] );
+            }
+        }
+#endif
+
+        // The rest of the rows, one constraint at a time
+        for ( ; column < end; ++column )
+            projectLink( startA + column, startB + column, restLength, alpha );
+    }
+
+    // Project one constraint, keeping the distance between two particles at
+    // the rest length
+    void Cloth::projectLink( int a, int b, float restLength, float alpha )
+    {
+        glm::vec3 difference( mPositionX[ a ] - mPositionX[ b ],
+                              mPositionY[ a ] - mPositionY[ b ],
+                              mPositionZ[ a ] - mPositionZ[ b ] );
+        float length = glm::length( difference );
+        float denominator = ( mInvMass[ a ] + mInvMass[ b ] + alpha ) * length;
+        if ( denominator <= 1e-9f )
+            return;
+
+        float scale = ( restLength - length ) / denominator;
+        glm::vec3 correctionA = mInvMass[ a ] * scale * difference;
+        glm::vec3 correctionB = mInvMass[ b ] * scale * difference;
+        mPositionX[ a ] += correctionA.x;
+        mPositionY[ a ] += correctionA.y;
+        mPositionZ[ a ] += correctionA.z;
+        mPositionX[ b ] -= correctionB.x;
+        mPositionY[ b ] -= correctionB.y;
+        mPositionZ[ b ] -= correctionB.z;
+    }
+
+    // Push the particles out of the colliders, to the thickness of the cloth
+    // along the normal of their surface. The friction removes the motion
+    // along the surface in the sub-step, up to the friction coefficient
+    // times the distance pushed
+    void Cloth::solveCollisions()
+    {
+        if ( mColliders.empty() )
+            return;
+
+        int nParticles = mPositionX.size();
+        mCollisionPositions.resize( nParticles );
+        mCollisionDepths.resize( nParticles );
+        mCollisionNormals.resize( nParticles );
+        for ( int i = 0; i < nParticles; ++i )
+            mCollisionPositions[ i ] = glm::vec3( mPositionX[ i ], mPositionY[ i ], mPositionZ[ i ] );
+
+        for ( int k = 0; k < (int)mColliders.size(); ++k )
+        {
+            mColliders[ k ]->getPenetrations( mCollisionPositions.data(), nParticles,
+                                              mCollisionDepths.data(),
+                                              mCollisionNormals.data() );
+            for ( int i = 0; i < nParticles; ++i )
+            {
+                float push = mCollisionDepths[ i ] + mSettings.thickness;
+                if ( push <= 0.f || mInvMass[ i ] == 0.f )
+                    continue;
+
+                const glm::vec3& normal = mCollisionNormals[ i ];
+                glm::vec3& position = mCollisionPositions[ i ];
+                position += push * normal;
+
+                glm::vec3 displacement = position - glm::vec3( mPreviousX[ i ], mPreviousY[ i ],
+                                                               mPreviousZ[ i ] );
+                glm::vec3 tangent = displacement - glm::dot( displacement, normal ) * normal;
+                float sliding = glm::length( tangent );
+                if ( sliding > 1e-9f )
+                    position -= std::min( mFrictions[ k ] * push / sliding, 1.f ) * tangent;
+            }
+        }
+
+        for ( int i = 0; i < nParticles; ++i )
+        {
+            mPositionX[ i ] = mCollisionPositions[ i ].x;
+            mPositionY[ i ] = mCollisionPositions[ i ].y;
+            mPositionZ[ i ] = mCollisionPositions[ i ].z;
+        }
+    }
+
+    // Find the pairs of particles that can touch in a step: the ones closer
+    // than the thickness plus the distance that the fastest particle moves.
+    // The particles are sorted into a spatial hash with cells of that size,
+    // and each of them checks the cells around it
+    void Cloth::findNeighbors( float deltaTime )
+    {
+        int nParticles = mPositionX.size();
+        float maxSpeed2 = 0.f;
+        for ( int i = 0; i < nParticles; ++i )
+            maxSpeed2 = std::max( maxSpeed2, mVelocityX[ i ] * mVelocityX[ i ] +
+                                             mVelocityY[ i ] * mVelocityY[ i ] +
+                                             mVelocityZ[ i ] * mVelocityZ[ i ] );
+        // The radius is kept positive, so the cells have a finite size
+        float radius = std::max( MIN_NEIGHBOR_RADIUS,
+                                 mSettings.thickness + std::sqrt( maxSpeed2 ) * deltaTime );
+        float invCellSize = 1.f / radius;
+
+        auto cellOf = [&]( float coordinate )
+        {
+            return (int)std::floor( coordinate * invCellSize );
+        };
+
+        // Counting sort of the particles by cell
+        int tableSize = 2 * nParticles;
+        mCellStarts.assign( tableSize + 1, 0 );
+        mCellEntries.resize( nParticles );
+        for ( int i = 0; i < nParticles; ++i )
+            mCellStarts[ hashCell( cellOf( mPositionX[ i ] ), cellOf( mPositionY[ i ] ),
+                                   cellOf( mPositionZ[ i ] ), tableSize ) ]++;
+        for ( int cell = 0; cell < tableSize; ++cell )
+            mCellStarts[ cell + 1 ] += mCellStarts[ cell ];
+        for ( int i = 0; i < nParticles; ++i )
+        {
+            int cell = hashCell( cellOf( mPositionX[ i ] ), cellOf( mPositionY[ i ] ),
+                                 cellOf( mPositionZ[ i ] ), tableSize );
+            mCellEntries[ --mCellStarts[ cell ] ] = i;
+        }
+
+        // Neighbours of each particle with a higher index. Different cells
+        // can share an entry of the table, so the repeated ones are removed
+        mNeighborStarts.resize( nParticles + 1 );
+        mNeighbors.clear();
+        for ( int i = 0; i < nParticles; ++i )
+        {
+            mNeighborStarts[ i ] = mNeighbors.size();
+            glm::vec3 position( mPositionX[ i ], mPositionY[ i ], mPositionZ[ i ] );
+            glm::ivec3 first( cellOf( position.x - radius ), cellOf( position.y - radius ),
+                              cellOf( position.z - radius ) );
+            glm::ivec3 last( cellOf( position.x + radius ), cellOf( position.y + radius ),
+                             cellOf( position.z + radius ) );
+
+            for ( int x = first.x; x <= last.x; ++x )
+            for ( int y = first.y; y <= last.y; ++y )
+            for ( int z = first.z; z <= last.z; ++z )
+            {
+                int cell = hashCell( x, y, z, tableSize );
+                for ( int entry = mCellStarts[ cell ]; entry < mCellStarts[ cell + 1 ]; ++entry )
+                {
+                    int j = mCellEntries[ entry ];
+                    if ( j <= i )
+                        continue;
+                    glm::vec3 difference = glm::vec3( mPositionX[ j ], mPositionY[ j ],
+                                                      mPositionZ[ j ] ) - position;
+                    if ( glm::dot( difference, difference ) < radius * radius )
+                        mNeighbors.push_back( j );
+                }
+            }
+
+            auto begin = mNeighbors.begin() + mNeighborStarts[ i ];
+            std::sort( begin, mNeighbors.end() );
+            mNeighbors.erase( std::unique( begin, mNeighbors.end() ), mNeighbors.end() );
+        }
+        mNeighborStarts[ nParticles ] = mNeighbors.size();
+    }
+
+    // Keep the pairs of neighbours at least at the thickness of the cloth,
+    // or at their rest distance if it is shorter
+    void Cloth::solveSelfCollisions()
+    {
+        int nParticles = mPositionX.size();
+        for ( int i = 0; i < nParticles; ++i )
+        {
+            for ( int k = mNeighborStarts[ i ]; k < mNeighborStarts[ i + 1 ]; ++k )
+            {
+                int j = mNeighbors[ k ];
+                float invMassSum = mInvMass[ i ] + mInvMass[ j ];
+                if ( invMassSum == 0.f )
+                    continue;
+
+                glm::vec3 difference( mPositionX[ i ] - mPositionX[ j ],
+                                      mPositionY[ i ] - mPositionY[ j ],
+                                      mPositionZ[ i ] - mPositionZ[ j ] );
+                float distance2 = glm::dot( difference, difference );
+                float restDistance = glm::length( (float)( j % mNumColumns - i % mNumColumns ) * mSpacingU +
+                                                  (float)( j / mNumColumns - i / mNumColumns ) * mSpacingV );
+                float minDistance = std::min( mSettings.thickness, restDistance );
+                if ( distance2 >= minDistance * minDistance || distance2 < 1e-12f )
+                    continue;
+
+                float distance = std::sqrt( distance2 );
+                glm::vec3 correction = ( minDistance - distance ) / ( distance * invMassSum ) *
+                                       difference;
+                mPositionX[ i ] += mInvMass[ i ] * correction.x;
+                mPositionY[ i ] += mInvMass[ i ] * correction.y;
+                mPositionZ[ i ] += mInvMass[ i ] * correction.z;
+                mPositionX[ j ] -= mInvMass[ j ] * correction.x;
+                mPositionY[ j ] -= mInvMass[ j ] * correction.y;
+                mPositionZ[ j ] -= mInvMass[ j ] * correction.z;
+            }
+        }
+    }
+
+    // Compute the velocities from the displacements of the sub-step. The
+    // pinned particles stay at rest
+    void Cloth::updateVelocities( float deltaTime )
+    {
+        float invDeltaTime = 1.f / deltaTime;
+        for ( int i = 0; i < (int)mPositionX.size(); ++i )
+        {
+            if ( mInvMass[ i ] == 0.f )
+                continue;
+            mVelocityX[ i ] = ( mPositionX[ i ] - mPreviousX[ i ] ) * invDeltaTime;
+            mVelocityY[ i ] = ( mPositionY[ i ] - mPreviousY[ i ] ) * invDeltaTime;
+            mVelocityZ[ i ] = ( mPositionZ[ i ] - mPreviousZ[ i ] ) * invDeltaTime;
+        }
+    }
+}
@@ -0,0 +1,194 @@
+#ifndef CLOTH_H
+#define CLOTH_H
+
+#include "GLBase.h"
+#include "GLGeometry.h"
+#include "Colliders.h"
+#include "PhysicsBody.h"
+#include "ForceGenerator.h"
+#include "ThreadPool.h"
+
+using namespace GLGeometry;
+using namespace GLBase;
+
+namespace Physics
+{
+    // Parameters of the simulation of a cloth
+    struct ClothSettings
+    {
+        // Number of sub-steps in each step. The constraints are projected once
+        // in each of them, which converges faster than several iterations
+        // in a longer step
+        int substeps = 10;
+        // Compliance of the constraints between neighbours along the grid,
+        // next to each other along the diagonals, and two apart, which keep
+        // the cloth from stretching, shearing and bending. It is the inverse
+        // of the stiffness, in meters per newton, and zero makes them rigid
+        float stretchCompliance = 0.f;
+        float shearCompliance = 1e-4f;
+        float bendCompliance = 1e-2f;
+        // Fraction of the velocity of the particles kept after one second
+        float damping = 0.9f;
+        // Minimum distance between the cloth and the colliders, and between
+        // parts of the cloth that are not neighbours
+        float thickness = 0.02f;
+        bool selfCollision = true;
+        // Velocity of the air, used by the drag forces, so the wind can move
+        // flags and sails
+        glm::vec3 wind = glm::vec3( 0.f, 0.f, 0.f );
+    };
+
+    /*
+       Cloth given by a regular grid of particles, simulated with extended
+       position based dynamics in small sub-steps: in each of them the
+       particles are moved with their velocities, then moved again to satisfy
+       the constraints and to leave the colliders, and their velocities are
+       given by the total displacement.
+       The state of the particles is stored as a structure of arrays, ordered
+       by rows. The constraints are not stored: they join each particle to
+       its neighbours along the rows, the columns and the diagonals, and to
+       the ones two apart along the rows and the columns, all with the same
+       rest length for each direction. The ones along the rows are projected
+       four at a time with SIMD instructions, alternating between two sets
+       of constraints that share no particles, and the ones between rows are
+       projected a whole pair of rows at a time, alternating between the
+       pairs of rows that share none. Each row, or pair of rows, is handed
+       to a thread of the pool.
+       The cloth collides with the spheres, planes and terrain of the world
+       whose AABBs overlap it, and with itself. Pairs of particles closer
+       than the thickness plus their motion in the step are found with a
+       spatial hash at the start of the step, and kept apart in each
+       sub-step. The bodies are not pushed back by the cloth.
+       Only gravity and drag act on the cloth. They are applied to each
+       particle as to a rigid body of the same mass.
+       The particles are in world space, so the transform of the body is the
+       identity.
+    */
+    class Cloth : public CollisionBody
+    {
+        public:
+            // Constructor, with the particles of the grid spread from a corner
+            // along two sides, and the total mass. The rest shape is the
+            // flat parallelogram of the sides
+            Cloth( const glm::vec3& corner, const glm::vec3& sideU, const glm::vec3& sideV,
+                   int nColumns, int nRows, float mass );
+
+            // Add the geometry used to draw the cloth, and copy it to the list of
+            // elementary objects of the GLSandbox class
+            void setClothGeometry( std::vector<GLElemObject*>& elemObjs );
+
+            // Settings
+            void setSettings( const ClothSettings& settings );
+            const ClothSettings& getSettings() const;
+
+            // Add a force. Returns false if it is not gravity or drag
+            bool addForce( ForceGenerator* force );
+
+            // Fix a particle where it is, or release it
+            void pinParticle( int row, int column, bool pinned = true );
+
+            // Move a particle, for example a pinned one that follows a body
+            void setParticlePosition( int row, int column, const glm::vec3& position );
+
+            // Getters
+            glm::vec3 getParticlePosition( int row, int column ) const;
+            glm::vec3 getParticleVelocity( int row, int column ) const;
+            int getNumRows() const;
+            int getNumColumns() const;
+
+            // Box that contains the cloth during a step of the given duration,
+            // plus its thickness
+            void getBounds( float deltaTime, glm::vec3& min, glm::vec3& max ) const;
+
+            // Simulate a step of the given duration, colliding with the given
+            // bodies. If there is a thread pool, the rows are split among its
+            // threads
+            void simulate( float deltaTime, CollisionBody* const* bodies, int nBodies,
+                           ThreadPool* threadPool = nullptr );
+
+        private:
+            ClothSettings mSettings;
+
+            // Number of particles along each side
+            int mNumColumns;
+            int mNumRows;
+
+            // Distance between neighbours along the rows and the columns
+            glm::vec3 mSpacingU;
+            glm::vec3 mSpacingV;
+
+            // Position, position at the start of the sub-step, velocity and
+            // inverse mass of the particles. The pinned ones have no inverse
+            // mass
+            std::vector<float> mPositionX;
+            std::vector<float> mPositionY;
+            std::vector<float> mPositionZ;
+            std::vector<float> mPreviousX;
+            std::vector<float> mPreviousY;
+            std::vector<float> mPreviousZ;
+            std::vector<float> mVelocityX;
+            std::vector<float> mVelocityY;
+            std::vector<float> mVelocityZ;
+            std::vector<float> mInvMass;
+            float mParticleInvMass;
+
+            // Forces acting on the cloth
+            std::vector<const GravityForceGenerator*> mGravityForces;
+            std::vector<const DragForceGenerator*> mDragForces;
+
+            // Colliders overlapping the cloth in the current step, and the
+            // friction with each of them
+            std::vector<const Collider*> mColliders;
+            std::vector<float> mFrictions;
+            // Positions of the particles as vectors, and their depths and normals
+            // in the collider being checked
+            std::vector<glm::vec3> mCollisionPositions;
+            std::vector<float> mCollisionDepths;
+            std::vector<glm::vec3> mCollisionNormals;
+
+            // Spatial hash of the particles: first entry of each cell, and
+            // particles sorted by cell. Pairs of particles that can touch in
+            // the current step: first neighbour of each particle, and the
+            // neighbours with a higher index
+            std::vector<int> mCellStarts;
+            std::vector<int> mCellEntries;
+            std::vector<int> mNeighborStarts;
+            std::vector<int> mNeighbors;
+
+            // Geometry used to draw the cloth, or nullptr
+            GLCloth* mClothGL;
+
+            // Move the particles with their velocities and the forces
+            void integrate( float deltaTime );
+
+            // Project all the constraints once
+            void projectConstraints( float deltaTime, ThreadPool* threadPool );
+
+            // Project the constraints between the particles of a row and the
+            // ones the given number of columns after them, in one of the two
+            // sets that share no particles
+            void projectRowLinks( int row, int columnOffset, int phase,
+                                  float restLength, float alpha );
+
+            // Project the constraints between the particles of two rows, with
+            // the ones of the second row the given number of columns after
+            void projectRowPairLinks( int rowA, int rowB, int columnOffset,
+                                      float restLength, float alpha );
+
+            // Project one constraint
+            void projectLink( int a, int b, float restLength, float alpha );
+
+            // Push the particles out of the colliders
+            void solveCollisions();
+
+            // Find the pairs of particles that can touch in a step, and keep
+            // them apart
+            void findNeighbors( float deltaTime );
+            void solveSelfCollisions();
+
+            // Compute the velocities from the displacements of the sub-step
+            void updateVelocities( float deltaTime );
+    };
+}
+
+#endif
@@ -1,4 +1,12 @@
+#include <cmath>
+#include <limits>
+
+#if defined( __AVX2__ ) || defined( __SSE2__ )
+#include <immintrin.h>
+#endif
+
 #include "Colliders.h"
+#include "GJK.h"
 
 
 using namespace GLBase;
@@ -10,7 +18,9 @@ namespace Physics
     // Collider class
 
     // Constructor
-    Collider::Collider()
+    Collider::Collider() :
+        mAABBStore { nullptr },
+        mAABBId { -1 }
     {
     }
 
@@ -18,6 +28,60 @@ namespace Physics
     // {
     // }
 
+    // Get the axis aligned boundary box
+    const AABB& Collider::getAABB() const
+    {
+        return mAABB;
+    }
+
+    // Store the world space AABB in the pool of a world
+    void Collider::attachAABBStore( AABBStore* store )
+    {
+        mAABBStore = store;
+        mAABBId = store->add();
+        mAABBStore->set( mAABBId, mAABB.cornersWorld[0], mAABB.cornersWorld[1] );
+    }
+
+    // Identifier of the AABB in the pool
+    int Collider::getAABBId() const
+    {
+        return mAABBId;
+    }
+
+    // Radius of the sphere swept around the core shape of the collider
+    float Collider::getMargin() const
+    {
+        return 0.f;
+    }
+
+    // Cast a ray against the collider, using GJK
+    bool Collider::raycast( const glm::vec3& origin, const glm::vec3& direction,
+                            float maxDistance, float& distance, glm::vec3& normal ) const
+    {
+        return gjkRaycast( this, origin, direction, maxDistance, distance, normal );
+    }
+
+    // By default the points are never under the surface
+    void Collider::getPenetrations( const glm::vec3* positions, int count,
+                                    float* depths, glm::vec3* normals ) const
+    {
+        for ( int k = 0; k < count; ++k )
+        {
+            depths[ k ] = -std::numeric_limits<float>::max();
+            normals[ k ] = glm::vec3( 0.f, 1.f, 0.f );
+        }
+    }
+
+    // Collision points of B against A from the ones of A against B
+    CollisionPoints Collider::swapPoints( const CollisionPoints& points )
+    {
+        CollisionPoints swapped = points;
+        swapped.A = points.B;
+        swapped.B = points.A;
+        swapped.Normal = -points.Normal;
+        return swapped;
+    }
+
     // Method to check for a collision with another object's AABB
     bool Collider::checkCollisionAABB( const Collider* other ) const
     {
@@ -42,50 +106,165 @@ namespace Physics
         return true;
     }
 
-    // Compute the eight vertices of the AABB in model space
-    void Collider::computeVerticesAABB()
+    // Update the collider and AABB after a transformation
+    void Collider::moveCollider( const glm::mat4& modelMatrix )
     {
-        // Compute the eight vertices
-        for ( int i = 0; i < 2; ++i )
-            for ( int j = 0; j < 2; ++j )
-                for ( int k = 0; k < 2; ++k )
-                    mAABB.verticesModel.push_back( glm::vec4( mAABB.cornersModel[i][0],
-                                                              mAABB.cornersModel[j][1],
-                                                              mAABB.cornersModel[k][2],
-                                                              1.f ) );
-
-        // Initialize the two corners in world space
-        mAABB.cornersWorld.push_back( glm::vec3( 0.f, 0.f, 0.f ) );
-        mAABB.cornersWorld.push_back( glm::vec3( 0.f, 0.f, 0.f ) );
+        Collider* collider = this;
+        const glm::mat4* matrix = &modelMatrix;
+        moveColliders( &collider, &matrix, 1 );
     }
 
-    // Compute the AABB from a mesh of vertices, after a transformation
-    void Collider::computeAABBTransformed( const std::vector<glm::vec4>& vertices,
-                                           const glm::mat4& modelMatrix,
-                                           std::vector<glm::vec3>& corners )
+    // Transform the center and half extents of an AABB with a model matrix,
+    // and write the world space corners. The center is transformed as a
+    // point, and each world half extent is the sum of the model half extents
+    // weighted by the absolute values of the rotation and scale, which gives
+    // the same box as transforming the eight vertices
+    static void transformCenterExtents( const glm::vec3& center, const glm::vec3& extents,
+                                        const glm::mat4& modelMatrix,
+                                        glm::vec3& min, glm::vec3& max )
     {
-        // Initialize minimum and maximum of each vertex
         for ( int i = 0; i < 3; ++i )
         {
-            corners[0][i] = std::numeric_limits<float>::max();
-            corners[1][i] = -std::numeric_limits<float>::max();
+            float c = modelMatrix[3][i];
+            float e = 0.f;
+            for ( int j = 0; j < 3; ++j )
+            {
+                c += modelMatrix[j][i] * center[j];
+                e += std::abs( modelMatrix[j][i] ) * extents[j];
+            }
+            min[i] = c - e;
+            max[i] = c + e;
+        }
+    }
+
+#if defined( __AVX2__ ) || defined( __SSE2__ )
+    // Same as above, with the four rows of the matrix in the lanes of a
+    // register. The last lane is computed and discarded
+    static inline void transformCenterExtents4( const glm::vec3& center, const glm::vec3& extents,
+                                                const glm::mat4& modelMatrix, __m128 absMask,
+                                                glm::vec3& min, glm::vec3& max )
+    {
+        const float* m = glm::value_ptr( modelMatrix );
+        __m128 col0 = _mm_loadu_ps( m );
+        __m128 col1 = _mm_loadu_ps( m + 4 );
+        __m128 col2 = _mm_loadu_ps( m + 8 );
+        __m128 col3 = _mm_loadu_ps( m + 12 );
+
+        // Transform the center
+        __m128 c = _mm_add_ps( col3, _mm_mul_ps( col0, _mm_set1_ps( center.x ) ) );
+        c = _mm_add_ps( c, _mm_mul_ps( col1, _mm_set1_ps( center.y ) ) );
+        c = _mm_add_ps( c, _mm_mul_ps( col2, _mm_set1_ps( center.z ) ) );
+
+        // Transform the half extents with the absolute values of the columns
+        __m128 e = _mm_mul_ps( _mm_and_ps( col0, absMask ), _mm_set1_ps( extents.x ) );
+        e = _mm_add_ps( e, _mm_mul_ps( _mm_and_ps( col1, absMask ), _mm_set1_ps( extents.y ) ) );
+        e = _mm_add_ps( e, _mm_mul_ps( _mm_and_ps( col2, absMask ), _mm_set1_ps( extents.z ) ) );
+
+        alignas( 16 ) float lo[4];
+        alignas( 16 ) float hi[4];
+        _mm_store_ps( lo, _mm_sub_ps( c, e ) );
+        _mm_store_ps( hi, _mm_add_ps( c, e ) );
+        min = glm::vec3( lo[0], lo[1], lo[2] );
+        max = glm::vec3( hi[0], hi[1], hi[2] );
+    }
+#endif
+
+    // Update several colliders at once, each one with its model matrix
+    void Collider::moveColliders( Collider* const* colliders,
+                                  const glm::mat4* const* modelMatrices, int count )
+    {
+        // Transform the AABBs
+        int i = 0;
+
+#if defined( __AVX2__ )
+        // Two AABBs at a time, one in each half of the registers
+        const __m256 absMask8 = _mm256_castsi256_ps( _mm256_set1_epi32( 0x7fffffff ) );
+        for ( ; i + 2 <= count; i += 2 )
+        {
+            const AABB& a = colliders[i]->mAABB;
+            const AABB& b = colliders[i + 1]->mAABB;
+            const float* ma = glm::value_ptr( *modelMatrices[i] );
+            const float* mb = glm::value_ptr( *modelMatrices[i + 1] );
+
+            __m256 col0 = _mm256_loadu2_m128( mb, ma );
+            __m256 col1 = _mm256_loadu2_m128( mb + 4, ma + 4 );
+            __m256 col2 = _mm256_loadu2_m128( mb + 8, ma + 8 );
+            __m256 col3 = _mm256_loadu2_m128( mb + 12, ma + 12 );
+
+            // Transform the centers
+            __m256 cx = _mm256_setr_m128( _mm_set1_ps( a.centerModel.x ), _mm_set1_ps( b.centerModel.x ) );
+            __m256 cy = _mm256_setr_m128( _mm_set1_ps( a.centerModel.y ), _mm_set1_ps( b.centerModel.y ) );
+            __m256 cz = _mm256_setr_m128( _mm_set1_ps( a.centerModel.z ), _mm_set1_ps( b.centerModel.z ) );
+            __m256 c = _mm256_add_ps( col3, _mm256_mul_ps( col0, cx ) );
+            c = _mm256_add_ps( c, _mm256_mul_ps( col1, cy ) );
+            c = _mm256_add_ps( c, _mm256_mul_ps( col2, cz ) );
+
+            // Transform the half extents
+            __m256 ex = _mm256_setr_m128( _mm_set1_ps( a.halfExtentsModel.x ), _mm_set1_ps( b.halfExtentsModel.x ) );
+            __m256 ey = _mm256_setr_m128( _mm_set1_ps( a.halfExtentsModel.y ), _mm_set1_ps( b.halfExtentsModel.y ) );
+            __m256 ez = _mm256_setr_m128( _mm_set1_ps( a.halfExtentsModel.z ), _mm_set1_ps( b.halfExtentsModel.z ) );
+            __m256 e = _mm256_mul_ps( _mm256_and_ps( col0, absMask8 ), ex );
+            e = _mm256_add_ps( e, _mm256_mul_ps( _mm256_and_ps( col1, absMask8 ), ey ) );
+            e = _mm256_add_ps( e, _mm256_mul_ps( _mm256_and_ps( col2, absMask8 ), ez ) );
+
+            alignas( 32 ) float lo[8];
+            alignas( 32 ) float hi[8];
+            _mm256_store_ps( lo, _mm256_sub_ps( c, e ) );
+            _mm256_store_ps( hi, _mm256_add_ps( c, e ) );
+            colliders[i]->setAABBWorld( glm::vec3( lo[0], lo[1], lo[2] ),
+                                        glm::vec3( hi[0], hi[1], hi[2] ) );
+            colliders[i + 1]->setAABBWorld( glm::vec3( lo[4], lo[5], lo[6] ),
+                                            glm::vec3( hi[4], hi[5], hi[6] ) );
         }
-        // Find the maximum and minimum values in each coordinate
-        // Iterate through the vertices
-        for ( auto vertex : vertices )
+#endif
+
+#if defined( __AVX2__ ) || defined( __SSE2__ )
+        // One AABB at a time, with the rows of the matrix in the lanes
+        const __m128 absMask = _mm_castsi128_ps( _mm_set1_epi32( 0x7fffffff ) );
+        for ( ; i < count; ++i )
         {
-            // Compute the transformed vertex
-            glm::vec4 vertexTrans = modelMatrix * vertex;
+            const AABB& aabb = colliders[i]->mAABB;
+            glm::vec3 min, max;
+            transformCenterExtents4( aabb.centerModel, aabb.halfExtentsModel,
+                                     *modelMatrices[i], absMask, min, max );
+            colliders[i]->setAABBWorld( min, max );
+        }
+#endif
 
-            // Iterate through the 3 dimensions
-            for ( int i = 0; i < 3; ++i )
-            {
-                if ( vertexTrans[i] < corners[0][i] )
-                    corners[0][i] = vertexTrans[i];
-                if ( vertexTrans[i] > corners[1][i] )
-                    corners[1][i] = vertexTrans[i];
-            }
+        // Remaining AABBs
+        for ( ; i < count; ++i )
+        {
+            const AABB& aabb = colliders[i]->mAABB;
+            glm::vec3 min, max;
+            transformCenterExtents( aabb.centerModel, aabb.halfExtentsModel,
+                                    *modelMatrices[i], min, max );
+            colliders[i]->setAABBWorld( min, max );
         }
+
+        // Update the shapes
+        for ( i = 0; i < count; ++i )
+            colliders[i]->moveShape( *modelMatrices[i] );
+    }
+
+    // Compute the center and half extents of the AABB in model space
+    void Collider::computeCenterExtentsAABB()
+    {
+        mAABB.centerModel = 0.5f * ( mAABB.cornersModel[0] + mAABB.cornersModel[1] );
+        mAABB.halfExtentsModel = 0.5f * ( mAABB.cornersModel[1] - mAABB.cornersModel[0] );
+
+        // Initialize the two corners in world space
+        mAABB.cornersWorld[0] = glm::vec3( 0.f, 0.f, 0.f );
+        mAABB.cornersWorld[1] = glm::vec3( 0.f, 0.f, 0.f );
+    }
+
+    // Set the world space AABB, and copy it to the pool
+    void Collider::setAABBWorld( const glm::vec3& min, const glm::vec3& max )
+    {
+        mAABB.cornersWorld[0] = min;
+        mAABB.cornersWorld[1] = max;
+
+        if ( mAABBStore != nullptr )
+            mAABBStore->set( mAABBId, min, max );
     }
 
 };
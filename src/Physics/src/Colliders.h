@@ -3,29 +3,76 @@
 
 #include "GLBase.h"
 #include "GLGeometry.h"
+#include "AABBStore.h"
 
 using namespace GLBase;
 using namespace GLGeometry;
 
 namespace Physics
 {
+    class Collider;
+
     // Axis aligned boundary box
     struct AABB
     {
         // Min and max vertices in model space
-        std::vector<glm::vec3> cornersModel;
+        glm::vec3 cornersModel[2];
 
-        // All vertices in model space
-        std::vector<glm::vec4> verticesModel;
+        // Center and half extents in model space, used to transform the AABB
+        glm::vec3 centerModel;
+        glm::vec3 halfExtentsModel;
 
         // Min and max vertices in world space
-        std::vector<glm::vec3> cornersWorld;
+        glm::vec3 cornersWorld[2];
+    };
+
+    // Struct that describes the collision points between two objects A and B
+    struct CollisionPoints
+    {
+        glm::vec3 A;       // Furthest point of A into B
+        glm::vec3 B;       // Furthest point of B into A
+        glm::vec3 Normal;  // Normal of the contact, pointing from A to B
+        float Depth;       // Penetration depth, length of B – A
+        bool HasCollision;
+    };
+
+    // Point of the Minkowski difference A - B of two colliders, used by GJK
+    // and EPA
+    struct SupportPoint
+    {
+        // Point of the Minkowski difference, and the points of A and B it
+        // comes from
+        glm::vec3 point;
+        glm::vec3 pointA;
+        glm::vec3 pointB;
+        // Direction in which the point was found
+        glm::vec3 direction;
+    };
+
+    // Simplex found by GJK for a pair of colliders.
+    // It is kept between steps for each pair of bodies, so that the next query
+    // starts from it. Only the directions are reused, and the points are
+    // computed again with the new positions of the colliders
+    struct Simplex
+    {
+        SupportPoint points[4];
+        // Barycentric coordinates of the point closest to the origin
+        float weights[4];
+        int size = 0;
+        // Colliders used as A and B in the last query
+        const Collider* colliderA = nullptr;
+        const Collider* colliderB = nullptr;
+        // Number of support points computed in the last query, not counting
+        // the ones of the warm start. GJK did not converge if it reaches
+        // GJK_MAX_ITERATIONS
+        int iterations = 0;
     };
 
     // Forward declare the different classes
     class SphereCollider;
     class PlaneCollider;
     class ConvexCollider;
+    class HeightfieldCollider;
 
     // Base collider class
     class Collider
@@ -33,23 +80,65 @@ namespace Physics
         public:
             // Constructor
             Collider();
-            //
-            // ~Collider();
+
+            // Destructor
+            virtual ~Collider() = default;
 
             // Update the collider and AABB after a transformation
-            // This needs to be implemented for each collider
-            virtual void moveCollider( const glm::mat4& modelMatrix ) = 0;
+            void moveCollider( const glm::mat4& modelMatrix );
+
+            // Update several colliders at once, each one with its model
+            // matrix. The AABBs are transformed with SIMD instructions, and
+            // then the shape of each collider is updated
+            static void moveColliders( Collider* const* colliders,
+                                       const glm::mat4* const* modelMatrices, int count );
+
+            // Get the axis aligned boundary box
+            const AABB& getAABB() const;
+
+            // Store the world space AABB in the pool of a world, which gives the
+            // collider its identifier. The pool is updated when the collider moves
+            void attachAABBStore( AABBStore* store );
+            // Identifier of the AABB in the pool, or -1 if it is not in one
+            int getAABBId() const;
 
             // Method to check for a collision with another object's AABB
             bool checkCollisionAABB( const Collider* other ) const;
             // Method to check for a collision with a plane
             bool checkCollisionAABBPlane( const Collider* plane ) const;
 
-            // Methods to check for collisions with different colliders
-            virtual bool findCollision( const Collider* other ) const = 0;
-            virtual bool findCollision( const SphereCollider* other ) const = 0;
-            virtual bool findCollision( const PlaneCollider* other ) const = 0;
-            virtual bool findCollision( const ConvexCollider* other ) const = 0;
+            // Methods to check for collisions with different colliders.
+            // The collision points are given with this collider as A and the
+            // other one as B. The simplex of the pair is used by GJK
+            virtual CollisionPoints findCollision( const Collider* other, Simplex& simplex ) const = 0;
+            virtual CollisionPoints findCollision( const SphereCollider* other, Simplex& simplex ) const = 0;
+            virtual CollisionPoints findCollision( const PlaneCollider* other, Simplex& simplex ) const = 0;
+            virtual CollisionPoints findCollision( const ConvexCollider* other, Simplex& simplex ) const = 0;
+            virtual CollisionPoints findCollision( const HeightfieldCollider* other, Simplex& simplex ) const = 0;
+
+            // Method to find the furthest point in a given direction, needed for
+            // the GJK algorithm
+            virtual glm::vec3 findFurthestPoint( const glm::vec3& direction ) const = 0;
+
+            // Radius of the sphere swept around the core shape of the collider.
+            // GJK works with the core shape, and the margin is added afterwards
+            virtual float getMargin() const;
+
+            // Cast a ray against the collider. Returns true if the ray hits it
+            // before maxDistance, with the distance along the ray and the normal
+            // of the surface at the hit point. The direction must be normalized.
+            // By default this uses GJK, so it works for any convex collider
+            virtual bool raycast( const glm::vec3& origin, const glm::vec3& direction,
+                                  float maxDistance, float& distance,
+                                  glm::vec3& normal ) const;
+
+            // Depth of an array of points under the surface of the collider,
+            // along the normal of the surface closest to each of them, and that
+            // normal. Negative above it. Used to collide particles, like the
+            // ones of the cloths, with the colliders. By default the points
+            // are never under the surface
+            virtual void getPenetrations( const glm::vec3* positions, int count,
+                                          float* depths, glm::vec3* normals ) const;
 
             // Set any other collider as a friend
             friend class Collider;
@@ -58,19 +147,23 @@ namespace Physics
             // Axis aligned boundary box, for the broad phase of collision checking
             AABB mAABB;
 
-            // Compute the eight vertices of the AABB in model space
-            void computeVerticesAABB();
+            // Pool where the world space AABB is also stored, and its position
+            AABBStore* mAABBStore;
+            int mAABBId;
+
+            // Compute the center and half extents of the AABB in model space,
+            // from its corners
+            void computeCenterExtentsAABB();
 
-            // Compute the AABB from a mesh of vertices, after a transformation
-            void computeAABBTransformed( const std::vector<glm::vec4>& vertices,
-                                         const glm::mat4& modelMatrix,
-                                         std::vector<glm::vec3>& corners );
+            // Set the world space AABB, and copy it to the pool
+            void setAABBWorld( const glm::vec3& min, const glm::vec3& max );
 
-            // // Method to find the furthest point in a given direction, needed for 
-            // // the GJK algorithm
-            // virtual glm::vec3 findFurthestPoint( const glm::vec3& direction ) const = 0;
-            // // Method to compute the support point with another collider
-            // glm::vec3 support( const Collider* other, const glm::vec3& d ) const;
+            // Update the shape of the collider after a transformation. The AABB
+            // is already updated. This needs to be implemented for each collider
+            virtual void moveShape( const glm::mat4& modelMatrix ) = 0;
+
+            // Collision points of B against A from the ones of A against B
+            static CollisionPoints swapPoints( const CollisionPoints& points );
     };
 
     // Sphere collider
@@ -83,27 +176,40 @@ namespace Physics
             // It also computes the AABB
             SphereCollider();
 
-            // Update the collider and AABB after a transformation
-            void moveCollider( const glm::mat4& modelMatrix );
+            // Update the collider after a transformation
+            void moveShape( const glm::mat4& modelMatrix ) override;
 
             // Methods for finding collisions
-            bool findCollision( const Collider* other ) const;
-            bool findCollision( const SphereCollider* other ) const;
-            bool findCollision( const PlaneCollider* other ) const;
-            bool findCollision( const ConvexCollider* other ) const;
+            CollisionPoints findCollision( const Collider* other, Simplex& simplex ) const;
+            CollisionPoints findCollision( const SphereCollider* other, Simplex& simplex ) const;
+            CollisionPoints findCollision( const PlaneCollider* other, Simplex& simplex ) const;
+            CollisionPoints findCollision( const ConvexCollider* other, Simplex& simplex ) const;
+            CollisionPoints findCollision( const HeightfieldCollider* other, Simplex& simplex ) const;
+
+            // Method to find the furthest point in a given direction
+            glm::vec3 findFurthestPoint( const glm::vec3& direction ) const;
+
+            // The core shape of the sphere is its center, and the margin its radius
+            float getMargin() const;
+
+            // Cast a ray against the sphere
+            bool raycast( const glm::vec3& origin, const glm::vec3& direction, float maxDistance,
+                          float& distance, glm::vec3& normal ) const;
+
+            // Depth of points inside the sphere, along the direction from its
+            // center
+            void getPenetrations( const glm::vec3* positions, int count,
+                                  float* depths, glm::vec3* normals ) const override;
 
             friend class PlaneCollider;
             friend class ConvexCollider;
+            friend class HeightfieldCollider;
 
         private:
             // Radius of the sphere
             float mRadius;
             // Center of the sphere
             glm::vec3 mCenter;
-
-            // // Method to find the furthest point in a given direction, needed for 
-            // // the GJK algorithm
-            // glm::vec3 findFurthestPoint( const glm::vec3& direction ) const;
     };
 
     // Plane collider
@@ -115,14 +221,29 @@ namespace Physics
             // This also computes the AABB
             PlaneCollider();
 
-            // Update the collider and AABB after a transformation
-            void moveCollider( const glm::mat4& modelMatrix );
+            // Update the collider after a transformation
+            void moveShape( const glm::mat4& modelMatrix ) override;
 
             // Methods for finding collisions
-            bool findCollision( const Collider* other ) const;
-            bool findCollision( const SphereCollider* other ) const;
-            bool findCollision( const PlaneCollider* other ) const;
-            bool findCollision( const ConvexCollider* other ) const;
+            CollisionPoints findCollision( const Collider* other, Simplex& simplex ) const;
+            CollisionPoints findCollision( const SphereCollider* other, Simplex& simplex ) const;
+            CollisionPoints findCollision( const PlaneCollider* other, Simplex& simplex ) const;
+            CollisionPoints findCollision( const ConvexCollider* other, Simplex& simplex ) const;
+            CollisionPoints findCollision( const HeightfieldCollider* other, Simplex& simplex ) const;
+
+            // Method to find the furthest point in a given direction
+            glm::vec3 findFurthestPoint( const glm::vec3& direction ) const;
+
+            // Cast a ray against the plane. Both of its faces can be hit, and
+            // the normal faces the ray
+            bool raycast( const glm::vec3& origin, const glm::vec3& direction, float maxDistance,
+                          float& distance, glm::vec3& normal ) const;
+
+            // The plane has no thickness, so the points over its rectangle are
+            // at minus their distance to it, with the normal of the face on
+            // their side. The ones beyond its edges are far from it
+            void getPenetrations( const glm::vec3* positions, int count,
+                                  float* depths, glm::vec3* normals ) const override;
 
             friend class SphereCollider;
             friend class ConvexCollider;
@@ -137,13 +258,9 @@ namespace Physics
             // Normal vector
             glm::vec3 mNormal;
             // Tangent vectors
-            std::vector<glm::vec3> mTangent;
-            // Dimensions
-            std::vector<float> mDimensions;
-
-            // // Method to find the furthest point in a given direction, needed for 
-            // // the GJK algorithm
-            // glm::vec3 findFurthestPoint( const glm::vec3& direction ) const;
+            glm::vec3 mTangent[2];
+            // Half of the dimensions along the tangent vectors
+            float mDimensions[2];
     };
 
     // Generic convex collider
@@ -154,17 +271,22 @@ namespace Physics
             // This computes the AABB
             ConvexCollider( GLElemObject* elemObject );
 
-            // Update the collider and AABB after a transformation
-            void moveCollider( const glm::mat4& modelMatrix );
+            // Update the collider after a transformation
+            void moveShape( const glm::mat4& modelMatrix ) override;
 
             // Methods for finding collisions
-            bool findCollision( const Collider* other ) const;
-            bool findCollision( const SphereCollider* other ) const;
-            bool findCollision( const PlaneCollider* other ) const;
-            bool findCollision( const ConvexCollider* other ) const;
+            CollisionPoints findCollision( const Collider* other, Simplex& simplex ) const;
+            CollisionPoints findCollision( const SphereCollider* other, Simplex& simplex ) const;
+            CollisionPoints findCollision( const PlaneCollider* other, Simplex& simplex ) const;
+            CollisionPoints findCollision( const ConvexCollider* other, Simplex& simplex ) const;
+            CollisionPoints findCollision( const HeightfieldCollider* other, Simplex& simplex ) const;
+
+            // Method to find the furthest point in a given direction
+            glm::vec3 findFurthestPoint( const glm::vec3& direction ) const;
 
             friend class SphereCollider;
             friend class PlaneCollider;
+            friend class HeightfieldCollider;
 
         private:
             // Vectors of vertices, in model space and world space
@@ -173,10 +295,79 @@ namespace Physics
 
             // Compute the AABB in model space from a vector of vertices
             void computeAABB( GLElemObject* elemObject );
+    };
 
-            // // Method to find the furthest point in a given direction, needed for 
-            // // the GJK algorithm
-            // glm::vec3 findFurthestPoint( const glm::vec3& direction ) const;
+    // Collider of a terrain, given by a grid of heights and normals.
+    // The arrays are not copied, so they must outlive the collider. They are
+    // stored by rows, with the row index along z, and four floats for each
+    // normal, as in the textures of the terrain.
+    // In model space the grid goes from -width / 2 to width / 2 along x, and
+    // from -height / 2 to height / 2 along z, with the samples at the centers
+    // of the texels, and the heights are the values of the grid. The model
+    // matrix can only translate and scale it, as the one of the terrain patch.
+    // The heights and normals are interpolated bilinearly, so each query only
+    // reads the four samples around the point
+    class HeightfieldCollider : public Collider
+    {
+        public:
+            // Constructor, with the arrays of heights and normals and the
+            // number of samples along x and z
+            HeightfieldCollider( const float* heights, const float* normals,
+                                 int width, int height );
+
+            // Update the collider after a transformation
+            void moveShape( const glm::mat4& modelMatrix ) override;
+
+            // Methods for finding collisions. Spheres use the surface under
+            // their center, and convex colliders the deepest of their vertices
+            CollisionPoints findCollision( const Collider* other, Simplex& simplex ) const;
+            CollisionPoints findCollision( const SphereCollider* other, Simplex& simplex ) const;
+            CollisionPoints findCollision( const PlaneCollider* other, Simplex& simplex ) const;
+            CollisionPoints findCollision( const ConvexCollider* other, Simplex& simplex ) const;
+            CollisionPoints findCollision( const HeightfieldCollider* other, Simplex& simplex ) const;
+
+            // The terrain is not convex, so GJK can not be used with it. This
+            // returns the center of its AABB
+            glm::vec3 findFurthestPoint( const glm::vec3& direction ) const;
+
+            // Cast a ray against the surface, marching along it in steps of
+            // half a cell until it goes under the surface, and then bisecting
+            bool raycast( const glm::vec3& origin, const glm::vec3& direction, float maxDistance,
+                          float& distance, glm::vec3& normal ) const;
+
+            // Height of the terrain and its normal under a point in world space
+            float getHeight( const glm::vec3& position ) const;
+            glm::vec3 getNormal( const glm::vec3& position ) const;
+            // Depth of a point under the surface, along the normal. Negative
+            // above it
+            float getPenetration( const glm::vec3& position, glm::vec3& normal ) const;
+
+            // Same for arrays of points
+            void getHeights( const glm::vec3* positions, int count, float* heights ) const;
+            void getNormals( const glm::vec3* positions, int count, glm::vec3* normals ) const;
+            void getPenetrations( const glm::vec3* positions, int count, float* depths,
+                                  glm::vec3* normals ) const override;
+
+        private:
+            // Grid of heights and normals, and its number of samples
+            const float* mHeights;
+            const float* mNormals;
+            int mWidth;
+            int mHeight;
+
+            // Translation and scale of the model matrix
+            glm::vec3 mTranslation;
+            glm::vec3 mScale;
+
+            // Position in the grid of a point in world space: the index of the
+            // sample before it along x and z, and the weights of the next ones
+            void findCell( const glm::vec3& position, int& i, int& j,
+                           float& weightX, float& weightZ ) const;
+
+            // Interpolate the height and the normal in a cell of the grid, in
+            // model space
+            float interpolateHeight( int i, int j, float weightX, float weightZ ) const;
+            glm::vec3 interpolateNormal( int i, int j, float weightX, float weightZ ) const;
     };
 
 };
@@ -0,0 +1,309 @@
+#include "CollisionSolver.h"
+#include "utils.h"
+
+using namespace GLBase;
+
+namespace Physics
+{
+    // Two unit vectors perpendicular to a normal and to each other
+    static void computeTangents( const glm::vec3& normal, glm::vec3 tangents[2] )
+    {
+        if ( std::fabs( normal.x ) > 0.57735f )
+            tangents[0] = glm::normalize( glm::vec3( normal.y, -normal.x, 0.f ) );
+        else
+            tangents[0] = glm::normalize( glm::vec3( 0.f, normal.z, -normal.y ) );
+        tangents[1] = glm::cross( normal, tangents[0] );
+    }
+
+    //--------------------------------------------------------------------------
+    // CollisionSolver class
+
+    // Constructor
+    CollisionSolver::CollisionSolver() :
+        mIterations { 0 }
+    {
+    }
+
+    // Settings
+    void CollisionSolver::setSettings( const SolverSettings& settings )
+    {
+        mSettings = settings;
+    }
+
+    const SolverSettings& CollisionSolver::getSettings() const
+    {
+        return mSettings;
+    }
+
+    // Solve the contacts of an island
+    void CollisionSolver::solveIsland( const IslandManager& islandManager, const Island& island,
+                                       float deltaTime, ThreadPool* threadPool )
+    {
+        initialize( islandManager, island, deltaTime );
+
+        if ( mSettings.warmStarting )
+            warmStart();
+
+        // Iterate over the velocity constraints until the impulses converge
+        mIterations = 0;
+        while ( mIterations < mSettings.velocityIterations )
+        {
+            mIterations++;
+            if ( iterate( false, threadPool ) < mSettings.tolerance )
+                break;
+        }
+
+        // Same for the position constraints
+        for ( int i = 0; i < mSettings.positionIterations; ++i )
+        {
+            if ( iterate( true, threadPool ) < mSettings.tolerance )
+                break;
+        }
+
+        finish( islandManager, island, deltaTime );
+    }
+
+    // Number of velocity iterations done in the last island solved
+    int CollisionSolver::getIterations() const
+    {
+        return mIterations;
+    }
+
+    // Copy the bodies and contacts of an island to the arrays of the solver
+    void CollisionSolver::initialize( const IslandManager& islandManager, const Island& island,
+                                      float deltaTime )
+    {
+        const std::vector<RigidBody*>& bodies = islandManager.getBodies();
+        const std::vector<ContactManifold*>& manifolds = islandManager.getManifolds();
+        const std::vector<RigidBody*>& kinematicBodies = islandManager.getKinematicBodies();
+
+        mVelocities.resize( island.nBodies );
+        mInvMasses.resize( island.nBodies );
+        for ( int i = 0; i < island.nBodies; ++i )
+        {
+            RigidBody* body = bodies[ island.firstBody + i ];
+            mVelocities[ i ] = body->getVelocity();
+            mInvMasses[ i ] = body->getInvMass();
+        }
+
+        // Index of a body of a manifold in the arrays. The bodies that do not
+        // move get a new element for each manifold, so the threads never
+        // write to the same one
+        auto getIndex = [&]( CollisionBody* body )
+        {
+            if ( body->mSolverIndex > 0 )
+                return body->mSolverIndex - 1;
+
+            glm::vec3 velocity( 0.f );
+            if ( body->mSolverIndex < 0 )
+                velocity = kinematicBodies[ -body->mSolverIndex - 1 ]->getVelocity();
+            mVelocities.push_back( velocity );
+            mInvMasses.push_back( 0.f );
+            return (int)mVelocities.size() - 1;
+        };
+
+        mConstraints.clear();
+        for ( int m = island.firstManifold; m < island.firstManifold + island.nManifolds; ++m )
+        {
+            ContactManifold* manifold = manifolds[ m ];
+            int bodyA = getIndex( manifold->bodyA );
+            int bodyB = getIndex( manifold->bodyB );
+            float invMassSum = mInvMasses[ bodyA ] + mInvMasses[ bodyB ];
+            if ( invMassSum == 0.f )
+                continue;
+
+            ContactConstraint constraint;
+            constraint.bodyA = bodyA;
+            constraint.bodyB = bodyB;
+            constraint.normal = manifold->normal;
+            computeTangents( constraint.normal, constraint.tangents );
+            constraint.mass = 1.f / invMassSum;
+
+            // Combine the properties of the surfaces of both bodies
+            constraint.friction = std::sqrt( manifold->bodyA->getFriction() *
+                                             manifold->bodyB->getFriction() );
+            float restitution = std::max( manifold->bodyA->getRestitution(),
+                                          manifold->bodyB->getRestitution() );
+
+            // Only the contacts approaching fast enough bounce, so the resting
+            // ones do not jitter
+            float normalVelocity = glm::dot( mVelocities[ bodyB ] - mVelocities[ bodyA ],
+                                             constraint.normal );
+            constraint.velocityBias = 0.f;
+            if ( normalVelocity < -mSettings.restitutionThreshold )
+                constraint.velocityBias = -restitution * normalVelocity;
+
+            for ( int i = 0; i < manifold->nPoints; ++i )
+            {
+                ContactPoint& point = manifold->points[ i ];
+                constraint.positionBias = mSettings.baumgarte / deltaTime *
+                                          std::max( point.depth - mSettings.slop, 0.f );
+                constraint.normalImpulse = point.normalImpulse;
+                constraint.tangentImpulses[0] = point.tangentImpulse[0];
+                constraint.tangentImpulses[1] = point.tangentImpulse[1];
+                constraint.pseudoImpulse = 0.f;
+                constraint.point = &point;
+                if ( !mSettings.warmStarting )
+                {
+                    constraint.normalImpulse = 0.f;
+                    constraint.tangentImpulses[0] = 0.f;
+                    constraint.tangentImpulses[1] = 0.f;
+                }
+
+                mConstraints.push_back( constraint );
+            }
+        }
+
+        mPseudoVelocities.assign( mVelocities.size(), glm::vec3( 0.f ) );
+
+        // Only the large islands are colored, so the order in which the
+        // constraints are solved does not depend on the number of threads
+        mColoring.clear();
+        if ( island.nManifolds >= mSettings.coloringThreshold )
+            colorConstraints( island.nBodies );
+    }
+
+    // Sort the constraints by color. Only the dynamic bodies of the island are
+    // colored, as the ones that do not move can be shared
+    void CollisionSolver::colorConstraints( int nBodies )
+    {
+        int nConstraints = mConstraints.size();
+        for ( int i = 0; i < nConstraints; ++i )
+        {
+            int bodyA = mConstraints[ i ].bodyA;
+            int bodyB = mConstraints[ i ].bodyB;
+            int bodies[2] = { bodyA < nBodies ? bodyA : -1, bodyB < nBodies ? bodyB : -1 };
+            mColoring.add( bodies, 2 );
+        }
+
+        mColoring.sort( mSortedPositions );
+        mSortedConstraints.resize( nConstraints );
+        for ( int i = 0; i < nConstraints; ++i )
+            mSortedConstraints[ mSortedPositions[ i ] ] = mConstraints[ i ];
+        std::swap( mConstraints, mSortedConstraints );
+    }
+
+    // Apply the impulses of the previous step
+    void CollisionSolver::warmStart()
+    {
+        for ( auto& constraint : mConstraints )
+        {
+            glm::vec3 impulse = constraint.normalImpulse * constraint.normal +
+                                constraint.tangentImpulses[0] * constraint.tangents[0] +
+                                constraint.tangentImpulses[1] * constraint.tangents[1];
+            mVelocities[ constraint.bodyA ] -= mInvMasses[ constraint.bodyA ] * impulse;
+            mVelocities[ constraint.bodyB ] += mInvMasses[ constraint.bodyB ] * impulse;
+        }
+    }
+
+    // One iteration over all the constraints. In a colored island, each color
+    // is split in chunks that are solved in parallel, and the largest change
+    // of each chunk is combined afterwards, in the same order
+    float CollisionSolver::iterate( bool positions, ThreadPool* threadPool )
+    {
+        if ( mColoring.size() == 0 )
+        {
+            return positions ? solvePositions( 0, mConstraints.size() ) :
+                               solveVelocities( 0, mConstraints.size() );
+        }
+
+        auto solveChunk = [&]( int begin, int end )
+        {
+            return positions ? solvePositions( begin, end ) : solveVelocities( begin, end );
+        };
+        return mColoring.forEachChunk( threadPool, solveChunk );
+    }
+
+    // One iteration over the velocity constraints in [ begin, end ). Returns
+    // the largest change of an impulse
+    float CollisionSolver::solveVelocities( int begin, int end )
+    {
+        float maxChange = 0.f;
+        for ( int i = begin; i < end; ++i )
+        {
+            ContactConstraint& constraint = mConstraints[ i ];
+            glm::vec3& velocityA = mVelocities[ constraint.bodyA ];
+            glm::vec3& velocityB = mVelocities[ constraint.bodyB ];
+            float invMassA = mInvMasses[ constraint.bodyA ];
+            float invMassB = mInvMasses[ constraint.bodyB ];
+
+            // Friction, limited by the current normal impulse
+            float maxFriction = constraint.friction * constraint.normalImpulse;
+            for ( int k = 0; k < 2; ++k )
+            {
+                float tangentVelocity = glm::dot( velocityB - velocityA, constraint.tangents[ k ] );
+                float oldImpulse = constraint.tangentImpulses[ k ];
+                float newImpulse = glm::clamp( oldImpulse - constraint.mass * tangentVelocity,
+                                               -maxFriction, maxFriction );
+                float change = newImpulse - oldImpulse;
+                constraint.tangentImpulses[ k ] = newImpulse;
+
+                velocityA -= invMassA * change * constraint.tangents[ k ];
+                velocityB += invMassB * change * constraint.tangents[ k ];
+                maxChange = std::max( maxChange, std::fabs( change ) );
+            }
+
+            // Normal, with the accumulated impulse kept positive so the
+            // bodies can separate
+            float normalVelocity = glm::dot( velocityB - velocityA, constraint.normal );
+            float oldImpulse = constraint.normalImpulse;
+            float newImpulse = std::max( oldImpulse + constraint.mass *
+                                         ( constraint.velocityBias - normalVelocity ), 0.f );
+            float change = newImpulse - oldImpulse;
+            constraint.normalImpulse = newImpulse;
+
+            velocityA -= invMassA * change * constraint.normal;
+            velocityB += invMassB * change * constraint.normal;
+            maxChange = std::max( maxChange, std::fabs( change ) );
+        }
+        return maxChange;
+    }
+
+    // One iteration over the position constraints in [ begin, end ), with the
+    // pseudo velocities. Returns the largest change of an impulse
+    float CollisionSolver::solvePositions( int begin, int end )
+    {
+        float maxChange = 0.f;
+        for ( int i = begin; i < end; ++i )
+        {
+            ContactConstraint& constraint = mConstraints[ i ];
+            glm::vec3& velocityA = mPseudoVelocities[ constraint.bodyA ];
+            glm::vec3& velocityB = mPseudoVelocities[ constraint.bodyB ];
+
+            float normalVelocity = glm::dot( velocityB - velocityA, constraint.normal );
+            float oldImpulse = constraint.pseudoImpulse;
+            float newImpulse = std::max( oldImpulse + constraint.mass *
+                                         ( constraint.positionBias - normalVelocity ), 0.f );
+            float change = newImpulse - oldImpulse;
+            constraint.pseudoImpulse = newImpulse;
+
+            velocityA -= mInvMasses[ constraint.bodyA ] * change * constraint.normal;
+            velocityB += mInvMasses[ constraint.bodyB ] * change * constraint.normal;
+            maxChange = std::max( maxChange, std::fabs( change ) );
+        }
+        return maxChange;
+    }
+
+    // Copy the results back to the bodies and manifolds
+    void CollisionSolver::finish( const IslandManager& islandManager, const Island& island,
+                                  float deltaTime )
+    {
+        // Keep the impulses for the warm start of the next step
+        for ( auto& constraint : mConstraints )
+        {
+            constraint.point->normalImpulse = constraint.normalImpulse;
+            constraint.point->tangentImpulse[0] = constraint.tangentImpulses[0];
+            constraint.point->tangentImpulse[1] = constraint.tangentImpulses[1];
+        }
+
+        // Update the velocities, and move the bodies out of the penetration
+        const std::vector<RigidBody*>& bodies = islandManager.getBodies();
+        for ( int i = 0; i < island.nBodies; ++i )
+        {
+            RigidBody* body = bodies[ island.firstBody + i ];
+            body->setVelocity( mVelocities[ i ] );
+            if ( mPseudoVelocities[ i ] != glm::vec3( 0.f ) )
+                body->translate( mPseudoVelocities[ i ] * deltaTime );
+        }
+    }
+}
@@ -0,0 +1,150 @@
+#ifndef COLLISION_SOLVER_H
+#define COLLISION_SOLVER_H
+
+#include "GLBase.h"
+#include "PhysicsBody.h"
+#include "ContactManifold.h"
+#include "Islands.h"
+#include "GraphColoring.h"
+#include "ThreadPool.h"
+
+using namespace GLBase;
+
+namespace Physics
+{
+    // Parameters of the collision solver
+    struct SolverSettings
+    {
+        // Maximum number of iterations for the velocities and the positions
+        int velocityIterations = 10;
+        int positionIterations = 4;
+        // The iterations stop when no impulse changes by more than this
+        float tolerance = 1e-4f;
+        // Fraction of the penetration removed in each step. With split impulses
+        // the correction does not add energy, so it can be large
+        float baumgarte = 0.8f;
+        // Penetration allowed, so the contacts are kept from one step to the next
+        float slop = 0.005f;
+        // Relative velocity below which the contacts do not bounce
+        float restitutionThreshold = 1.f;
+        // Use the impulses of the previous step as a starting point
+        bool warmStarting = true;
+        // Islands with at least this number of manifolds have their
+        // constraints colored, so they can be solved by several threads
+        int coloringThreshold = 128;
+    };
+
+    // Sequential impulse solver for the contacts between bodies.
+    // Each contact point gives three constraints, which are solved one at a
+    // time, iterating over all of them until the impulses converge:
+    //  - Along the normal, the bodies can not approach each other. The target
+    //    velocity includes the bounce given by the restitution.
+    //  - Along two tangents, friction opposes sliding, with an impulse
+    //    limited by the friction coefficient times the normal impulse.
+    // The penetration is removed with split impulses: a separate set of
+    // pseudo velocities, solved with the same constraints and used only to
+    // correct the positions, so the correction does not add energy.
+    // The bodies only have linear motion, so the constraints have no
+    // angular terms.
+    // The solver works on one island at a time. In large islands, the
+    // constraints are colored so that no two constraints of the same color
+    // share a dynamic body, and each color is split among the threads. The
+    // colors depend only on the island, so the result is the same for any
+    // number of threads.
+    class CollisionSolver
+    {
+        public:
+            // Constructor
+            CollisionSolver();
+
+            // Settings
+            void setSettings( const SolverSettings& settings );
+            const SolverSettings& getSettings() const;
+
+            // Solve the contacts of an island, changing the velocities and
+            // positions of its bodies. The solver indices of the bodies must
+            // be the ones given by the IslandManager. If there is a thread
+            // pool, it is used for the colored islands
+            void solveIsland( const IslandManager& islandManager, const Island& island,
+                              float deltaTime, ThreadPool* threadPool = nullptr );
+
+            // Number of velocity iterations done in the last island solved
+            int getIterations() const;
+
+        private:
+            // Constraints of one contact point, with everything that does not
+            // change during the iterations computed in advance
+            struct ContactConstraint
+            {
+                // Indices of the bodies in the arrays of the solver
+                int bodyA;
+                int bodyB;
+                glm::vec3 normal;
+                glm::vec3 tangents[2];
+                // Effective mass of the constraints, the same for all of them
+                // as there is no rotation
+                float mass;
+                float friction;
+                // Target normal velocity, due to the restitution
+                float velocityBias;
+                // Target normal pseudo velocity, to remove the penetration
+                float positionBias;
+                // Accumulated impulses
+                float normalImpulse;
+                float tangentImpulses[2];
+                float pseudoImpulse;
+                // Point of the manifold where the impulses are stored
+                ContactPoint* point;
+            };
+
+            SolverSettings mSettings;
+
+            // Velocities, pseudo velocities and inverse masses of the bodies.
+            // The dynamic bodies of the island come first, followed by one
+            // element for each body that does not move in each manifold
+            std::vector<glm::vec3> mVelocities;
+            std::vector<glm::vec3> mPseudoVelocities;
+            std::vector<float> mInvMasses;
+
+            // Constraints, packed in one array
+            std::vector<ContactConstraint> mConstraints;
+
+            // Colors of the constraints, and the arrays used to sort them.
+            // The coloring is empty if the island is not colored
+            GraphColoring mColoring;
+            std::vector<int> mSortedPositions;
+            std::vector<ContactConstraint> mSortedConstraints;
+
+            int mIterations;
+
+            // Copy the bodies and contacts of an island to the arrays of the
+            // solver
+            void initialize( const IslandManager& islandManager, const Island& island,
+                             float deltaTime );
+
+            // Sort the constraints by color
+            void colorConstraints( int nBodies );
+
+            // Apply the impulses of the previous step
+            void warmStart();
+
+            // One iteration over all the constraints, using the thread pool
+            // for the colored ones. Returns the largest change of an impulse
+            float iterate( bool positions, ThreadPool* threadPool );
+
+            // One iteration over the velocity constraints in [ begin, end ).
+            // Returns the largest change of an impulse
+            float solveVelocities( int begin, int end );
+
+            // One iteration over the position constraints in [ begin, end ),
+            // with the pseudo velocities. Returns the largest change of an
+            // impulse
+            float solvePositions( int begin, int end );
+
+            // Copy the results back to the bodies and manifolds
+            void finish( const IslandManager& islandManager, const Island& island,
+                         float deltaTime );
+    };
+}
+
+#endif
@@ -0,0 +1,422 @@
+#include <limits>
+
+#include "ContactManifold.h"
+#include "utils.h"
+
+using namespace GLBase;
+
+namespace Physics
+{
+    // Initial number of slots of the hash table of the contact cache
+    const int CONTACT_CACHE_INITIAL_SLOTS = 64;
+    // Number of manifolds allocated at once by the pool of the contact cache
+    const int MANIFOLD_BLOCK_SIZE = 64;
+
+    // Transform a point from world space to the frame of a body, given by its
+    // position and rotation, and back. The scale is not used, so the
+    // transformation can always be inverted
+    static glm::vec3 toBodyFrame( CollisionBody* body, const glm::vec3& point )
+    {
+        glm::mat3 rotation( body->getRotationMatrix() );
+        return glm::transpose( rotation ) * ( point - body->getPosition() );
+    }
+
+    static glm::vec3 toWorldFrame( CollisionBody* body, const glm::vec3& point )
+    {
+        glm::mat3 rotation( body->getRotationMatrix() );
+        return rotation * point + body->getPosition();
+    }
+
+    // Measure of the area of the quadrilateral given by four points in any
+    // order: the largest cross product of the diagonals, among the three ways
+    // of joining the points
+    static float computeQuadArea( const glm::vec3 p[4] )
+    {
+        glm::vec3 cross0 = glm::cross( p[1] - p[0], p[3] - p[2] );
+        glm::vec3 cross1 = glm::cross( p[2] - p[0], p[3] - p[1] );
+        glm::vec3 cross2 = glm::cross( p[3] - p[0], p[2] - p[1] );
+        return std::max( glm::dot( cross0, cross0 ),
+                         std::max( glm::dot( cross1, cross1 ), glm::dot( cross2, cross2 ) ) );
+    }
+
+    //--------------------------------------------------------------------------
+    // ContactEvents struct
+
+    // Remove all the events
+    void ContactEvents::clear()
+    {
+        begin.clear();
+        persist.clear();
+        end.clear();
+    }
+
+    //--------------------------------------------------------------------------
+    // ContactManifold class
+
+    // Set the bodies of the pair and remove the contact points
+    void ContactManifold::reset( CollisionBody* a, CollisionBody* b )
+    {
+        bodyA = a;
+        bodyB = b;
+        normal = glm::vec3( 0.f, 1.f, 0.f );
+        nPoints = 0;
+        simplex = Simplex();
+        lastStep = 0;
+        isTouching = false;
+    }
+
+    // Run the narrow phase for the pair, and update the contact points
+    void ContactManifold::update()
+    {
+        CollisionPoints collisionPoints = bodyA->mCollider->findCollision( bodyB->mCollider,
+                                                                          simplex );
+        if ( !collisionPoints.HasCollision )
+        {
+            nPoints = 0;
+            return;
+        }
+
+        // The old points are measured along the new normal
+        normal = collisionPoints.Normal;
+        refresh();
+        addPoint( collisionPoints );
+    }
+
+    // Move the contact points with their bodies, and remove the ones that are
+    // no longer valid
+    void ContactManifold::refresh()
+    {
+        int i = 0;
+        while ( i < nPoints )
+        {
+            ContactPoint& point = points[ i ];
+            point.pointA = toWorldFrame( bodyA, point.localA );
+            point.pointB = toWorldFrame( bodyB, point.localB );
+            point.depth = glm::dot( point.pointA - point.pointB, normal );
+
+            // Remove the point if the bodies have separated along the normal,
+            // or slid along the contact plane
+            glm::vec3 drift = point.pointA - point.depth * normal - point.pointB;
+            if ( point.depth < -CONTACT_THRESHOLD ||
+                 glm::dot( drift, drift ) > CONTACT_THRESHOLD * CONTACT_THRESHOLD )
+                points[ i ] = points[ --nPoints ];
+            else
+                ++i;
+        }
+    }
+
+    // Add the point found by the narrow phase
+    void ContactManifold::addPoint( const CollisionPoints& collisionPoints )
+    {
+        ContactPoint point;
+        point.pointA = collisionPoints.A;
+        point.pointB = collisionPoints.B;
+        point.localA = toBodyFrame( bodyA, collisionPoints.A );
+        point.localB = toBodyFrame( bodyB, collisionPoints.B );
+        point.depth = collisionPoints.Depth;
+        point.normalImpulse = 0.f;
+        point.tangentImpulse[0] = 0.f;
+        point.tangentImpulse[1] = 0.f;
+
+        // If the point was already in the manifold, keep its impulses
+        int index = findMatchingPoint( point.pointA );
+        if ( index >= 0 )
+        {
+            point.normalImpulse = points[ index ].normalImpulse;
+            point.tangentImpulse[0] = points[ index ].tangentImpulse[0];
+            point.tangentImpulse[1] = points[ index ].tangentImpulse[1];
+            points[ index ] = point;
+            return;
+        }
+
+        if ( nPoints < MAX_MANIFOLD_POINTS )
+        {
+            points[ nPoints++ ] = point;
+            return;
+        }
+
+        points[ findReplacedPoint( point.pointA, point.depth ) ] = point;
+    }
+
+    // Old point close enough to the given one, or -1 if there is none
+    int ContactManifold::findMatchingPoint( const glm::vec3& pointA ) const
+    {
+        int closest = -1;
+        float minDistSq = CONTACT_THRESHOLD * CONTACT_THRESHOLD;
+        for ( int i = 0; i < nPoints; ++i )
+        {
+            glm::vec3 diff = points[ i ].pointA - pointA;
+            float distSq = glm::dot( diff, diff );
+            if ( distSq < minDistSq )
+            {
+                minDistSq = distSq;
+                closest = i;
+            }
+        }
+        return closest;
+    }
+
+    // Point to be replaced by the given one when the manifold is full. The
+    // deepest point is always kept, and among the rest, the one removed is
+    // the one that leaves the largest area
+    int ContactManifold::findReplacedPoint( const glm::vec3& pointA, float depth ) const
+    {
+        int deepest = -1;
+        float maxDepth = depth;
+        for ( int i = 0; i < nPoints; ++i )
+        {
+            if ( points[ i ].depth > maxDepth )
+            {
+                maxDepth = points[ i ].depth;
+                deepest = i;
+            }
+        }
+
+        int replaced = 0;
+        float maxArea = -1.f;
+        for ( int i = 0; i < nPoints; ++i )
+        {
+            if ( i == deepest )
+                continue;
+
+            // Points left if this one is replaced
+            glm::vec3 quad[4];
+            int n = 0;
+            for ( int j = 0; j < nPoints; ++j )
+            {
+                if ( j != i )
+                    quad[ n++ ] = points[ j ].pointA;
+            }
+            quad[ n ] = pointA;
+
+            float area = computeQuadArea( quad );
+            if ( area > maxArea )
+            {
+                maxArea = area;
+                replaced = i;
+            }
+        }
+        return replaced;
+    }
+
+    //--------------------------------------------------------------------------
+    // ContactCache class
+
+    // Constructor
+    ContactCache::ContactCache() :
+        mSlots( CONTACT_CACHE_INITIAL_SLOTS, { 0, nullptr } )
+    {
+    }
+
+    // Destructor
+    ContactCache::~ContactCache()
+    {
+        for ( auto block : mBlocks )
+            delete[] block;
+    }
+
+    // Manifold of a pair of bodies, created if it does not exist
+    ContactManifold* ContactCache::findOrCreate( CollisionBody* bodyA, CollisionBody* bodyB )
+    {
+        // Keep the load factor of the table below one half, so the probe
+        // sequences are short
+        if ( 2 * ( mManifolds.size() + 1 ) > mSlots.size() )
+            grow();
+
+        uint64_t key = getKey( bodyA, bodyB );
+        int slot = findSlot( key );
+        if ( mSlots[ slot ].manifold != nullptr )
+            return mSlots[ slot ].manifold;
+
+        // Body A is the one with the lowest AABB identifier, so the normal
+        // does not depend on the order given by the broad phase
+        if ( bodyA->mCollider->getAABBId() > bodyB->mCollider->getAABBId() )
+            std::swap( bodyA, bodyB );
+
+        ContactManifold* manifold = allocate();
+        manifold->reset( bodyA, bodyB );
+        mManifolds.push_back( manifold );
+
+        mSlots[ slot ].key = key;
+        mSlots[ slot ].manifold = manifold;
+        return manifold;
+    }
+
+    // Manifold of a pair of bodies, or nullptr if it does not exist
+    ContactManifold* ContactCache::find( CollisionBody* bodyA, CollisionBody* bodyB ) const
+    {
+        return mSlots[ findSlot( getKey( bodyA, bodyB ) ) ].manifold;
+    }
+
+    // Write the events of the contacts that began, persisted and ended in
+    // the given step, comparing the state of each manifold with the one of
+    // the previous call
+    void ContactCache::collectEvents( int step, ContactEvents& events )
+    {
+        for ( auto manifold : mManifolds )
+        {
+            bool isTouching = manifold->lastStep == step && manifold->nPoints > 0;
+            if ( !isTouching )
+            {
+                if ( manifold->isTouching )
+                    events.end.push_back( manifold->lastContact );
+                manifold->isTouching = false;
+                continue;
+            }
+
+            // Contact of this step, at the deepest point
+            ContactEvent& contact = manifold->lastContact;
+            contact.bodyA = manifold->bodyA;
+            contact.bodyB = manifold->bodyB;
+            contact.normal = manifold->normal;
+            contact.depth = -std::numeric_limits<float>::max();
+            for ( int i = 0; i < manifold->nPoints; ++i )
+            {
+                if ( manifold->points[ i ].depth > contact.depth )
+                {
+                    contact.point = manifold->points[ i ].pointA;
+                    contact.depth = manifold->points[ i ].depth;
+                }
+            }
+
+            if ( manifold->isTouching )
+                events.persist.push_back( contact );
+            else
+                events.begin.push_back( contact );
+            manifold->isTouching = true;
+        }
+    }
+
+    // Remove the manifolds of the pairs not found in the given step
+    void ContactCache::removeStale( int step )
+    {
+        for ( int i = mManifolds.size() - 1; i >= 0; --i )
+        {
+            ContactManifold* manifold = mManifolds[ i ];
+            if ( manifold->lastStep == step )
+                continue;
+
+            removeKey( getKey( manifold->bodyA, manifold->bodyB ) );
+
+            // Move the last manifold of the list to this position
+            mManifolds[ i ] = mManifolds.back();
+            mManifolds.pop_back();
+
+            release( manifold );
+        }
+    }
+
+    // Remove all the manifolds
+    void ContactCache::clear()
+    {
+        for ( auto manifold : mManifolds )
+            release( manifold );
+        mManifolds.clear();
+
+        for ( auto& slot : mSlots )
+            slot.manifold = nullptr;
+    }
+
+    // Getters
+    int ContactCache::size() const
+    {
+        return mManifolds.size();
+    }
+
+    const std::vector<ContactManifold*>& ContactCache::getManifolds() const
+    {
+        return mManifolds;
+    }
+
+    // Key of a pair of bodies, from the AABB identifiers of their colliders
+    uint64_t ContactCache::getKey( CollisionBody* bodyA, CollisionBody* bodyB )
+    {
+        uint64_t idA = bodyA->mCollider->getAABBId();
+        uint64_t idB = bodyB->mCollider->getAABBId();
+        if ( idA > idB )
+            std::swap( idA, idB );
+        return ( idA << 32 ) | idB;
+    }
+
+    // Slot where a key is, or the empty slot where it should be inserted.
+    // The key is mixed with a multiplicative hash, and the table is probed
+    // linearly from there
+    int ContactCache::findSlot( uint64_t key ) const
+    {
+        uint64_t mask = mSlots.size() - 1;
+        uint64_t hash = key * 0x9E3779B97F4A7C15ull;
+        uint64_t slot = ( hash ^ ( hash >> 32 ) ) & mask;
+
+        while ( mSlots[ slot ].manifold != nullptr && mSlots[ slot ].key != key )
+            slot = ( slot + 1 ) & mask;
+
+        return slot;
+    }
+
+    // Remove a key from the table. The keys after it in the same probe
+    // sequence are moved back, so no tombstones are needed
+    void ContactCache::removeKey( uint64_t key )
+    {
+        int mask = mSlots.size() - 1;
+        int empty = findSlot( key );
+        if ( mSlots[ empty ].manifold == nullptr )
+            return;
+        mSlots[ empty ].manifold = nullptr;
+
+        int slot = empty;
+        while ( true )
+        {
+            slot = ( slot + 1 ) & mask;
+            if ( mSlots[ slot ].manifold == nullptr )
+                break;
+
+            // Keys whose home slot is cyclically in ( empty, slot ] can stay
+            uint64_t hash = mSlots[ slot ].key * 0x9E3779B97F4A7C15ull;
+            int home = ( hash ^ ( hash >> 32 ) ) & mask;
+            bool stays = empty <= slot ? ( empty < home && home <= slot ) :
+                                         ( empty < home || home <= slot );
+            if ( stays )
+                continue;
+
+            mSlots[ empty ] = mSlots[ slot ];
+            mSlots[ slot ].manifold = nullptr;
+            empty = slot;
+        }
+    }
+
+    // Double the size of the table, and insert again all the keys
+    void ContactCache::grow()
+    {
+        std::vector<Slot> oldSlots( mSlots.size() * 2, { 0, nullptr } );
+        std::swap( oldSlots, mSlots );
+
+        for ( auto& slot : oldSlots )
+        {
+            if ( slot.manifold != nullptr )
+                mSlots[ findSlot( slot.key ) ] = slot;
+        }
+    }
+
+    // Get a manifold from the pool. When there are no free ones, a new block
+    // is allocated
+    ContactManifold* ContactCache::allocate()
+    {
+        if ( mFreeManifolds.empty() )
+        {
+            ContactManifold* block = new ContactManifold[ MANIFOLD_BLOCK_SIZE ];
+            mBlocks.push_back( block );
+            for ( int i = MANIFOLD_BLOCK_SIZE - 1; i >= 0; --i )
+                mFreeManifolds.push_back( &block[ i ] );
+        }
+
+        ContactManifold* manifold = mFreeManifolds.back();
+        mFreeManifolds.pop_back();
+        return manifold;
+    }
+
+    // Return a manifold to the pool
+    void ContactCache::release( ContactManifold* manifold )
+    {
+        mFreeManifolds.push_back( manifold );
+    }
+}
@@ -0,0 +1,185 @@
+#ifndef CONTACT_MANIFOLD_H
+#define CONTACT_MANIFOLD_H
+
+#include "GLBase.h"
+#include "Colliders.h"
+#include "PhysicsBody.h"
+
+using namespace GLBase;
+
+namespace Physics
+{
+    // Maximum number of points of a contact manifold
+    const int MAX_MANIFOLD_POINTS = 4;
+    // Distance below which a new contact point is matched to an old one, and
+    // above which an old point is removed when its bodies separate or slide
+    const float CONTACT_THRESHOLD = 0.02f;
+
+    // Point of a contact between two bodies
+    struct ContactPoint
+    {
+        // Points of A and B relative to the position and rotation of their bodies
+        glm::vec3 localA;
+        glm::vec3 localB;
+        // Points of A and B in world space
+        glm::vec3 pointA;
+        glm::vec3 pointB;
+        // Penetration depth along the normal of the manifold
+        float depth;
+        // Impulses accumulated by the solver, kept between steps to use them
+        // as a starting point
+        float normalImpulse;
+        float tangentImpulse[2];
+    };
+
+    // Change in the contact between a pair of bodies. For the contacts that
+    // end, the normal, point and depth are the ones of the last step in which
+    // the bodies touched
+    struct ContactEvent
+    {
+        CollisionBody* bodyA;
+        CollisionBody* bodyB;
+        // Normal pointing from A to B, deepest point of A, and its depth
+        glm::vec3 normal;
+        glm::vec3 point;
+        float depth;
+    };
+
+    // Contacts that began, persisted and ended, written in batches after each
+    // step instead of calling a function for each pair
+    struct ContactEvents
+    {
+        std::vector<ContactEvent> begin;
+        std::vector<ContactEvent> persist;
+        std::vector<ContactEvent> end;
+
+        // Remove all the events
+        void clear();
+    };
+
+    // Set of up to four contact points between a pair of bodies, kept from one
+    // step to the next.
+    // The narrow phase only gives one point per step, so the manifold is built
+    // over several steps: the old points are moved with their bodies, the ones
+    // that are no longer valid are removed, and the new point replaces the
+    // closest old one or is added to the rest. When there are too many, the
+    // deepest point is kept along with the ones that cover the largest area.
+    class ContactManifold
+    {
+        public:
+            // Bodies of the pair, with A the one with the lowest AABB identifier
+            CollisionBody* bodyA;
+            CollisionBody* bodyB;
+
+            // Normal of the contact, pointing from A to B
+            glm::vec3 normal;
+
+            // Contact points
+            ContactPoint points[ MAX_MANIFOLD_POINTS ];
+            int nPoints;
+
+            // Last simplex found by GJK for this pair
+            Simplex simplex;
+
+            // Last step in which the pair was found by the broad phase
+            int lastStep;
+
+            // If the bodies touched in the last step in which the events were
+            // collected, and the contact of that step
+            bool isTouching;
+            ContactEvent lastContact;
+
+            // Set the bodies of the pair and remove the contact points
+            void reset( CollisionBody* a, CollisionBody* b );
+
+            // Run the narrow phase for the pair, and update the contact points
+            void update();
+
+            // Move the contact points with their bodies, and remove the ones
+            // that are no longer valid
+            void refresh();
+
+            // Add the point found by the narrow phase
+            void addPoint( const CollisionPoints& collisionPoints );
+
+        private:
+            // Old point close enough to the given one, or -1 if there is none
+            int findMatchingPoint( const glm::vec3& pointA ) const;
+
+            // Point to be replaced by the given one when the manifold is full,
+            // so that the remaining ones cover the largest area
+            int findReplacedPoint( const glm::vec3& pointA, float depth ) const;
+    };
+
+    // Persistent map from pairs of bodies to their contact manifolds.
+    // The pairs are identified by the AABB identifiers of their bodies, and
+    // kept in a hash table with open addressing. The manifolds come from a
+    // pool that reuses the ones of the pairs that have been removed, so once
+    // the number of pairs stabilises no memory is allocated.
+    class ContactCache
+    {
+        public:
+            // Constructor
+            ContactCache();
+
+            // Destructor
+            ~ContactCache();
+
+            // Manifold of a pair of bodies, created if it does not exist
+            ContactManifold* findOrCreate( CollisionBody* bodyA, CollisionBody* bodyB );
+
+            // Manifold of a pair of bodies, or nullptr if it does not exist
+            ContactManifold* find( CollisionBody* bodyA, CollisionBody* bodyB ) const;
+
+            // Write the events of the contacts that began, persisted and
+            // ended in the given step. A contact ends when the pair no longer
+            // has points, or when it was not found by the broad phase, so this
+            // is called before removeStale
+            void collectEvents( int step, ContactEvents& events );
+
+            // Remove the manifolds of the pairs not found in the given step
+            void removeStale( int step );
+
+            // Remove all the manifolds
+            void clear();
+
+            // Getters
+            int size() const;
+            const std::vector<ContactManifold*>& getManifolds() const;
+
+        private:
+            // Slot of the hash table. The empty slots have manifold = nullptr
+            struct Slot
+            {
+                uint64_t key;
+                ContactManifold* manifold;
+            };
+
+            // Hash table, with a size that is a power of two
+            std::vector<Slot> mSlots;
+            // Manifolds in the table, in no particular order
+            std::vector<ContactManifold*> mManifolds;
+
+            // Blocks of memory of the pool, and manifolds not in use
+            std::vector<ContactManifold*> mBlocks;
+            std::vector<ContactManifold*> mFreeManifolds;
+
+            // Key of a pair of bodies
+            static uint64_t getKey( CollisionBody* bodyA, CollisionBody* bodyB );
+
+            // Slot where a key is, or the empty slot where it should be inserted
+            int findSlot( uint64_t key ) const;
+
+            // Remove a key from the table, moving back the keys after it
+            void removeKey( uint64_t key );
+
+            // Double the size of the table
+            void grow();
+
+            // Get a manifold from the pool, or return it
+            ContactManifold* allocate();
+            void release( ContactManifold* manifold );
+    };
+}
+
+#endif
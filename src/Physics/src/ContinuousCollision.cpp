@@ -0,0 +1,82 @@
+#include "ContinuousCollision.h"
+#include "GJK.h"
+#include "utils.h"
+
+using namespace GLBase;
+
+namespace Physics
+{
+    // Distance at which two shapes are considered to be touching
+    const float TOI_TOLERANCE = 1e-3f;
+
+    // Time of impact of two colliders, when A moves by the given displacement
+    // relative to B
+    float findTimeOfImpact( const Collider* a, const Collider* b,
+                            const glm::vec3& displacement, float depth,
+                            int maxIterations )
+    {
+        Simplex simplex;
+        float time = 0.f;
+        for ( int i = 0; i < maxIterations; ++i )
+        {
+            // Distance with A at the current time of the motion
+            glm::vec3 closestA;
+            glm::vec3 closestB;
+            float distance = gjkDistance( a, ( time - 1.f ) * displacement, b,
+                                          simplex, closestA, closestB );
+            if ( distance == 0.f )
+                return time == 0.f ? 1.f : time;
+
+            // Speed at which A approaches B along the normal. If it moves
+            // away, there is no contact
+            glm::vec3 normal = glm::normalize( closestB - closestA );
+            float approach = glm::dot( displacement, normal );
+            if ( approach <= 0.f )
+                return 1.f;
+
+            // Close enough: go on to the given depth
+            if ( distance < TOI_TOLERANCE )
+                return std::min( time + ( distance + depth ) / approach, 1.f );
+
+            time += distance / approach;
+            if ( time >= 1.f )
+                return 1.f;
+        }
+
+        // The time found so far is still before the contact
+        return time;
+    }
+
+    // Time of impact of a collider with the terrain
+    float findTimeOfImpact( const Collider* collider, const HeightfieldCollider* terrain,
+                            const glm::vec3& displacement, float depth )
+    {
+        float length = glm::length( displacement );
+        if ( length == 0.f )
+            return 1.f;
+        glm::vec3 direction = displacement / length;
+
+        // Center of the collider at the start of the motion
+        const AABB& aabb = collider->getAABB();
+        glm::vec3 halfExtents = 0.5f * ( aabb.cornersWorld[1] - aabb.cornersWorld[0] );
+        glm::vec3 start = 0.5f * ( aabb.cornersWorld[0] + aabb.cornersWorld[1] ) - displacement;
+
+        glm::vec3 normal;
+        if ( terrain->getPenetration( start, normal ) > 0.f )
+            return 1.f;
+
+        float distance;
+        if ( !terrain->raycast( start, direction, length, distance, normal ) )
+            return 1.f;
+
+        // The AABB touches the surface when its center is at the distance of
+        // its extent along the normal. The motion gets closer by the speed
+        // along the normal
+        float approach = -glm::dot( direction, normal );
+        if ( approach <= 0.f )
+            return 1.f;
+        float extent = glm::dot( halfExtents, glm::abs( normal ) );
+        float contact = distance - ( extent - depth ) / approach;
+        return glm::clamp( contact / length, 0.f, 1.f );
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef CONTINUOUS_COLLISION_H
+#define CONTINUOUS_COLLISION_H
+
+#include "GLBase.h"
+#include "Colliders.h"
+
+using namespace GLBase;
+
+namespace Physics
+{
+    // Parameters of the continuous collision detection
+    struct CCDSettings
+    {
+        bool enabled = true;
+        // Fraction of the smallest size of its AABB that a body must move in
+        // a step for its motion to be swept
+        float motionThreshold = 0.25f;
+        // Depth to which the bodies are moved into the ones they hit, so the
+        // narrow phase finds the contact in the same step
+        float depth = 0.0025f;
+        // Maximum number of iterations of the conservative advancement
+        int maxIterations = 32;
+    };
+
+    /*
+       Time of impact of two colliders, when A moves by the given displacement
+       relative to B during a step. A is at its position at the end of the
+       step, so the motion starts at its position minus the displacement.
+       It uses conservative advancement: GJK gives the distance between the
+       shapes and their normal, and the motion can be advanced by the distance
+       divided by the speed along the normal without getting past the first
+       contact. Spheres and planes need one or two iterations, as the core of
+       a sphere is a point.
+       The motion goes on past the contact until the given depth is reached.
+       Returns the fraction of the step at which this happens, or 1 if the
+       shapes do not collide during the motion, or already overlap at its
+       start, which is left to the narrow phase
+    */
+    float findTimeOfImpact( const Collider* a, const Collider* b,
+                            const glm::vec3& displacement, float depth,
+                            int maxIterations );
+
+    /*
+       Time of impact of a collider with the terrain, when it moves by the
+       given displacement. The terrain is not convex, so GJK can not be used:
+       a ray is cast against it from the center of the collider at the start
+       of the motion, and the contact is where the AABB of the collider
+       touches the surface at the point hit, along its normal. The motion goes
+       on past the contact until the given depth is reached.
+       Returns the fraction of the step at which this happens, or 1 if the ray
+       does not hit the terrain or the center is under it at the start
+    */
+    float findTimeOfImpact( const Collider* collider, const HeightfieldCollider* terrain,
+                            const glm::vec3& displacement, float depth );
+}
+
+#endif
@@ -1,4 +1,7 @@
+#include <algorithm>
+
 #include "Colliders.h"
+#include "GJK.h"
 
 using namespace GLBase;
 using namespace GLGeometry;
@@ -12,30 +15,40 @@ namespace Physics
     ConvexCollider::ConvexCollider( GLElemObject* elemObject )
     {
         // Compute the AABB in model space, from the vertices of the GLElemObject
-        mAABB.cornersModel.push_back( glm::vec3( -0.5f, -0.5f, -0.5f ) );
-        mAABB.cornersModel.push_back( glm::vec3(  0.5f,  0.5f,  0.5f ) );
+        mAABB.cornersModel[0] = glm::vec3( -0.5f, -0.5f, -0.5f );
+        mAABB.cornersModel[1] = glm::vec3(  0.5f,  0.5f,  0.5f );
 
         // Compute the vertices of the AABB in model space
         computeAABB( elemObject );
 
-        // Compute the vertices of the AABB in model space
-        computeVerticesAABB();
+        // Compute the center and half extents of the AABB in model space
+        computeCenterExtentsAABB();
     }
     
     // Compute the AABB in model space from a vector of vertices
     void ConvexCollider::computeAABB( GLElemObject* elemObject )
     {
         // Initialize minimum and maximum of each vertex
-        mAABB.cornersModel.push_back( glm::vec3( 0.f, 0.f, 0.f ) );
-        mAABB.cornersModel.push_back( glm::vec3( 0.f, 0.f, 0.f ) );
         for ( int i = 0; i < 3; ++i )
         {
             mAABB.cornersModel[0][i] = std::numeric_limits<float>::max();
             mAABB.cornersModel[1][i] = -std::numeric_limits<float>::max();
         }
+        // Store the vertices, without the repeated ones. The meshes repeat the
+        // vertices shared by faces with different normals
+        mVerticesModel = elemObject->getVertices();
+        auto isLess = []( const glm::vec3& a, const glm::vec3& b )
+        {
+            return a.x < b.x || ( a.x == b.x && ( a.y < b.y || ( a.y == b.y && a.z < b.z ) ) );
+        };
+        std::sort( mVerticesModel.begin(), mVerticesModel.end(), isLess );
+        mVerticesModel.erase( std::unique( mVerticesModel.begin(), mVerticesModel.end() ),
+                              mVerticesModel.end() );
+        mVerticesWorld = mVerticesModel;
+
         // Find the maximum and minimum values in each coordinate
         // Iterate through the vertices
-        for ( auto vertex : elemObject->getVertices() )
+        for ( auto vertex : mVerticesModel )
         {
             // Iterate through the 3 dimensions
             for ( int i = 0; i < 3; ++i )
@@ -48,71 +61,74 @@ namespace Physics
         }
     }
 
-    // Update the collider and AABB after a transformation
-    void ConvexCollider::moveCollider( const glm::mat4& modelMatrix )
+    // Update the collider after a transformation
+    void ConvexCollider::moveShape( const glm::mat4& modelMatrix )
     {
-        // Update the AABB
-        computeAABBTransformed( mAABB.verticesModel, modelMatrix, mAABB.cornersWorld );
-
         // Update the collider
-
+        for ( int i = 0; i < (int)mVerticesModel.size(); ++i )
+            mVerticesWorld[ i ] = glm::vec3( modelMatrix * glm::vec4( mVerticesModel[ i ], 1.f ) );
     }
 
     // Methods for finding collisions
-    bool ConvexCollider::findCollision( const Collider* other ) const
+    CollisionPoints ConvexCollider::findCollision( const Collider* other, Simplex& simplex ) const
     {
-        return other->findCollision( this );
+        return swapPoints( other->findCollision( this, simplex ) );
     }
 
-    bool ConvexCollider::findCollision( const SphereCollider* sphere ) const
+    CollisionPoints ConvexCollider::findCollision( const SphereCollider* sphere, Simplex& simplex ) const
     {
         // Test collisions between AABBs
         if ( checkCollisionAABB( sphere ) )
-        {
-            // TODO
-            LOG_DEBUG("Collision convex sphere");
-            return true;
-        }
-
-        //
-        //
-        //
+            return findCollisionGJK( this, sphere, simplex );
 
-        return true;
+        CollisionPoints points;
+        points.HasCollision = false;
+        return points;
     }
 
-    bool ConvexCollider::findCollision( const PlaneCollider* plane ) const
+    CollisionPoints ConvexCollider::findCollision( const PlaneCollider* plane, Simplex& simplex ) const
     {
         // Test collision with the AABB
         if ( checkCollisionAABBPlane( plane ) )
-        {
-            // TODO
-            return true;
-        }
-
-        //
-        //
-        //
+            return findCollisionGJK( this, plane, simplex );
 
-        return true;
+        CollisionPoints points;
+        points.HasCollision = false;
+        return points;
     }
 
-    bool ConvexCollider::findCollision( const ConvexCollider* other ) const
+    CollisionPoints ConvexCollider::findCollision( const ConvexCollider* other, Simplex& simplex ) const
     {
         // Test collisions between AABBs
         if ( checkCollisionAABB( other ) )
-        {
-            // TODO
-            LOG_DEBUG("Collision convex convex");
-            return true;
-        }
-
-        //
-        //
-        //
+            return findCollisionGJK( this, other, simplex );
 
-        return true;
+        CollisionPoints points;
+        points.HasCollision = false;
+        return points;
     }
 
+    CollisionPoints ConvexCollider::findCollision( const HeightfieldCollider* other, Simplex& simplex ) const
+    {
+        // This collision is implemented in the class HeightfieldCollider
+        return swapPoints( other->findCollision( this, simplex ) );
+    }
 
+    // Method to find the furthest point in a given direction, which is one of
+    // the vertices
+    glm::vec3 ConvexCollider::findFurthestPoint( const glm::vec3& direction ) const
+    {
+        glm::vec3 furthest = mVerticesWorld[ 0 ];
+        float maxProjection = glm::dot( furthest, direction );
+        for ( auto& vertex : mVerticesWorld )
+        {
+            float projection = glm::dot( vertex, direction );
+            if ( projection > maxProjection )
+            {
+                maxProjection = projection;
+                furthest = vertex;
+            }
+        }
+        return furthest;
+    }
 }
@@ -6,6 +6,15 @@ using namespace GLBase;
 
 namespace Physics
 {
+    //--------------------------------------------------------------------------
+    // Class ForceGenerator
+
+    // Type of the generator
+    ForceType ForceGenerator::getType() const
+    {
+        return ForceType::Custom;
+    }
+
     //--------------------------------------------------------------------------
     // Class GravityForceGenerator
 
@@ -23,6 +32,16 @@ namespace Physics
         rigidBody->addForce( mGravity * rigidBody->getMass() );
     }
 
+    ForceType GravityForceGenerator::getType() const
+    {
+        return ForceType::Gravity;
+    }
+
+    const glm::vec3& GravityForceGenerator::getGravity() const
+    {
+        return mGravity;
+    }
+
     //--------------------------------------------------------------------------
     // Class DragForceGenerator
     DragForceGenerator::DragForceGenerator( float k1, float k2 ) :
@@ -40,6 +59,21 @@ namespace Physics
         rigidBody->addForce( - velocity * ( mK1 + mK2 * speed ) );
     }
 
+    ForceType DragForceGenerator::getType() const
+    {
+        return ForceType::Drag;
+    }
+
+    float DragForceGenerator::getK1() const
+    {
+        return mK1;
+    }
+
+    float DragForceGenerator::getK2() const
+    {
+        return mK2;
+    }
+
     //--------------------------------------------------------------------------
     // Class SpringForceGenerator
     SpringForceGenerator::SpringForceGenerator( RigidBody* other, float springConst, 
@@ -75,6 +109,31 @@ namespace Physics
 
     }
 
+    ForceType SpringForceGenerator::getType() const
+    {
+        return ForceType::Spring;
+    }
+
+    RigidBody* SpringForceGenerator::getOtherBody() const
+    {
+        return mOtherBody;
+    }
+
+    float SpringForceGenerator::getSpringConst() const
+    {
+        return mSpringConst;
+    }
+
+    float SpringForceGenerator::getDampingCoeff() const
+    {
+        return mDampingCoeff;
+    }
+
+    float SpringForceGenerator::getRestLength() const
+    {
+        return mRestLength;
+    }
+
     //--------------------------------------------------------------------------
     // Class BungeeForceGenerator
     BungeeForceGenerator::BungeeForceGenerator( RigidBody* other, float springConst, 
@@ -93,4 +152,24 @@ namespace Physics
         if ( magnitude < 0 )
             rigidBody->addForce( magnitude * separation);
     }
+
+    ForceType BungeeForceGenerator::getType() const
+    {
+        return ForceType::Bungee;
+    }
+
+    RigidBody* BungeeForceGenerator::getOtherBody() const
+    {
+        return mOtherBody;
+    }
+
+    float BungeeForceGenerator::getSpringConst() const
+    {
+        return mSpringConst;
+    }
+
+    float BungeeForceGenerator::getRestLength() const
+    {
+        return mRestLength;
+    }
 }
@@ -8,12 +8,29 @@ using namespace GLBase;
 
 namespace Physics
 {
+    // Types of the force generators. The registry of forces applies the ones
+    // of each built-in type together, and calls updateForce for the others
+    enum class ForceType
+    {
+        Gravity,
+        Drag,
+        Spring,
+        Bungee,
+        Custom
+    };
+
     // Virtual force generator
     class ForceGenerator
     {
         public:
+            // Destructor
+            virtual ~ForceGenerator() = default;
+
             // Calculate and apply the corresponding force to a RigidBody
             virtual void updateForce( RigidBody* rigidBody, float deltaTime ) = 0;
+
+            // Type of the generator. The user-defined generators are Custom
+            virtual ForceType getType() const;
     };
 
     // Gravity force generator
@@ -24,6 +41,9 @@ namespace Physics
 
             virtual void updateForce( RigidBody* rigidBody, float deltaTime );
 
+            ForceType getType() const override;
+            const glm::vec3& getGravity() const;
+
         private:
             glm::vec3 mGravity;
     };
@@ -36,6 +56,10 @@ namespace Physics
 
             virtual void updateForce( RigidBody* rigidBody, float deltaTime );
 
+            ForceType getType() const override;
+            float getK1() const;
+            float getK2() const;
+
         private:
             // Coefficients for velocity and velocity square
             float mK1;
@@ -51,6 +75,12 @@ namespace Physics
 
             virtual void updateForce( RigidBody* rigidBody, float deltaTime );
 
+            ForceType getType() const override;
+            RigidBody* getOtherBody() const;
+            float getSpringConst() const;
+            float getDampingCoeff() const;
+            float getRestLength() const;
+
         private:
             // The body at the other end of the spring
             RigidBody* mOtherBody;
@@ -72,6 +102,11 @@ namespace Physics
 
             virtual void updateForce( RigidBody* rigidBody, float deltaTime );
 
+            ForceType getType() const override;
+            RigidBody* getOtherBody() const;
+            float getSpringConst() const;
+            float getRestLength() const;
+
         private:
             // The body at the other end of the spring
             RigidBody* mOtherBody;
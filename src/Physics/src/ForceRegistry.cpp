@@ -0,0 +1,410 @@
+#include <cmath>
+#include <typeinfo>
+
+#include "ForceRegistry.h"
+#include "utils.h"
+
+using namespace GLBase;
+
+namespace Physics
+{
+    // Remove the element at index of each array by moving the last one to its place
+    template <typename T>
+    static void removeAt( int index, std::vector<T>& values )
+    {
+        values[ index ] = values.back();
+        values.pop_back();
+    }
+
+    template <typename T, typename... Rest>
+    static void removeAt( int index, std::vector<T>& values, Rest&... rest )
+    {
+        removeAt( index, values );
+        removeAt( index, rest... );
+    }
+
+    //--------------------------------------------------------------------------
+    // BodyForceRegistry class
+
+    // Constructor
+    BodyForceRegistry::BodyForceRegistry( RigidBodyStore& store ) :
+        mStore { store }
+    {
+    }
+
+    // Register a pair body-force, and return its handle.
+    // The bodies must have been added to the world, so their state is in the
+    // pool
+    ForceHandle BodyForceRegistry::addBodyForce( RigidBody* body, ForceGenerator* force )
+    {
+        ForceType type = getBucketType( force );
+        int index = 0;
+
+        RigidBody* other = nullptr;
+        if ( type == ForceType::Spring )
+            other = static_cast<SpringForceGenerator*>( force )->getOtherBody();
+        else if ( type == ForceType::Bungee )
+            other = static_cast<BungeeForceGenerator*>( force )->getOtherBody();
+        if ( body->getStore() != &mStore || ( other != nullptr && other->getStore() != &mStore ) )
+        {
+            LOG_ERROR( "The bodies of a force must be added to the world before the force" );
+            return -1;
+        }
+        int id = body->getStoreId();
+
+        // Copy the parameters of the generator to the bucket of its type
+        switch ( type )
+        {
+            case ForceType::Gravity:
+            {
+                GravityForceGenerator* gravity = static_cast<GravityForceGenerator*>( force );
+                index = mGravity.bodies.size();
+                mGravity.bodies.push_back( id );
+                mGravity.gravity.push_back( gravity->getGravity() );
+                break;
+            }
+            case ForceType::Drag:
+            {
+                DragForceGenerator* drag = static_cast<DragForceGenerator*>( force );
+                index = mDrag.bodies.size();
+                mDrag.bodies.push_back( id );
+                mDrag.k1.push_back( drag->getK1() );
+                mDrag.k2.push_back( drag->getK2() );
+                break;
+            }
+            case ForceType::Spring:
+            {
+                SpringForceGenerator* spring = static_cast<SpringForceGenerator*>( force );
+                index = mSprings.bodies.size();
+                mSprings.bodies.push_back( id );
+                mSprings.otherBodies.push_back( other->getStoreId() );
+                mSprings.springConst.push_back( spring->getSpringConst() );
+                mSprings.dampingCoeff.push_back( spring->getDampingCoeff() );
+                mSprings.restLength.push_back( spring->getRestLength() );
+                mSpringVersion++;
+                break;
+            }
+            case ForceType::Bungee:
+            {
+                BungeeForceGenerator* bungee = static_cast<BungeeForceGenerator*>( force );
+                index = mBungees.bodies.size();
+                mBungees.bodies.push_back( id );
+                mBungees.otherBodies.push_back( other->getStoreId() );
+                mBungees.springConst.push_back( bungee->getSpringConst() );
+                mBungees.restLength.push_back( bungee->getRestLength() );
+                break;
+            }
+            default:
+            {
+                index = mCustom.bodies.size();
+                mCustom.bodies.push_back( id );
+                mCustom.rigidBodies.push_back( body );
+                mCustom.generators.push_back( force );
+                break;
+            }
+        }
+
+        ForceHandle handle = allocateHandle( type, index );
+
+        switch ( type )
+        {
+            case ForceType::Gravity: mGravity.handles.push_back( handle ); break;
+            case ForceType::Drag:    mDrag.handles.push_back( handle ); break;
+            case ForceType::Spring:  mSprings.handles.push_back( handle ); break;
+            case ForceType::Bungee:  mBungees.handles.push_back( handle ); break;
+            default:                 mCustom.handles.push_back( handle ); break;
+        }
+
+        mSize++;
+        return handle;
+    }
+
+    // Remove a pair body-force.
+    // If the handle is not in use, this will not do anything
+    void BodyForceRegistry::removeBodyForce( ForceHandle handle )
+    {
+        if ( handle < 0 || handle >= (int)mHandles.size() || !mHandles[ handle ].isUsed )
+            return;
+
+        HandleSlot& slot = mHandles[ handle ];
+        int index = slot.index;
+
+        // Handle of the last pair of the bucket, that takes the place of the removed one
+        ForceHandle moved = -1;
+        switch ( slot.type )
+        {
+            case ForceType::Gravity:
+                moved = mGravity.handles.back();
+                removeAt( index, mGravity.bodies, mGravity.gravity, mGravity.handles );
+                break;
+            case ForceType::Drag:
+                moved = mDrag.handles.back();
+                removeAt( index, mDrag.bodies, mDrag.k1, mDrag.k2, mDrag.handles );
+                break;
+            case ForceType::Spring:
+                moved = mSprings.handles.back();
+                removeAt( index, mSprings.bodies, mSprings.otherBodies, mSprings.springConst,
+                          mSprings.dampingCoeff, mSprings.restLength, mSprings.handles );
+                mSpringVersion++;
+                break;
+            case ForceType::Bungee:
+                moved = mBungees.handles.back();
+                removeAt( index, mBungees.bodies, mBungees.otherBodies, mBungees.springConst,
+                          mBungees.restLength, mBungees.handles );
+                break;
+            default:
+                moved = mCustom.handles.back();
+                removeAt( index, mCustom.bodies, mCustom.rigidBodies, mCustom.generators,
+                          mCustom.handles );
+                break;
+        }
+        mHandles[ moved ].index = index;
+
+        // Return the handle to the free list
+        slot.isUsed = false;
+        slot.index = mFreeHandle;
+        mFreeHandle = handle;
+
+        mSize--;
+    }
+
+    // Clear all the registrations
+    void BodyForceRegistry::clear()
+    {
+        mGravity = GravityBucket();
+        mDrag = DragBucket();
+        mSprings = SpringBucket();
+        mBungees = BungeeBucket();
+        mCustom = CustomBucket();
+        mHandles.clear();
+        mFreeHandle = -1;
+        mSize = 0;
+        mSpringVersion++;
+    }
+
+    // Apply the forces to the bodies.
+    // Sleeping bodies are skipped, as the forces would wake them up
+    void BodyForceRegistry::applyForces( float deltaTime, bool includeSprings )
+    {
+        applyGravity();
+        applyDrag();
+        if ( includeSprings )
+            applySprings();
+        applyBungees();
+        applyCustom( deltaTime );
+    }
+
+    // Number of pairs registered
+    int BodyForceRegistry::size() const
+    {
+        return mSize;
+    }
+
+    // Bucket of the damped springs
+    const BodyForceRegistry::SpringBucket& BodyForceRegistry::getSprings() const
+    {
+        return mSprings;
+    }
+
+    // Number that changes each time a spring is added or removed
+    int BodyForceRegistry::getSpringVersion() const
+    {
+        return mSpringVersion;
+    }
+
+    // Type of the bucket of a generator. A class derived from a built-in one
+    // can override updateForce, so only the generators of exactly the built-in
+    // classes have their forces computed in the buckets
+    ForceType BodyForceRegistry::getBucketType( const ForceGenerator* force )
+    {
+        ForceType type = force->getType();
+        const std::type_info& forceClass = typeid( *force );
+        switch ( type )
+        {
+            case ForceType::Gravity:
+                return forceClass == typeid( GravityForceGenerator ) ? type : ForceType::Custom;
+            case ForceType::Drag:
+                return forceClass == typeid( DragForceGenerator ) ? type : ForceType::Custom;
+            case ForceType::Spring:
+                return forceClass == typeid( SpringForceGenerator ) ? type : ForceType::Custom;
+            case ForceType::Bungee:
+                return forceClass == typeid( BungeeForceGenerator ) ? type : ForceType::Custom;
+            default:
+                return ForceType::Custom;
+        }
+    }
+
+    // Get a handle for a new pair, at the given position of a bucket
+    ForceHandle BodyForceRegistry::allocateHandle( ForceType type, int index )
+    {
+        ForceHandle handle;
+        if ( mFreeHandle != -1 )
+        {
+            handle = mFreeHandle;
+            mFreeHandle = mHandles[ handle ].index;
+        }
+        else
+        {
+            handle = mHandles.size();
+            mHandles.emplace_back();
+        }
+
+        mHandles[ handle ] = { type, index, true };
+        return handle;
+    }
+
+    // Gravity, scaled by the mass of the body. The bodies with infinite mass
+    // are not moved by it
+    void BodyForceRegistry::applyGravity()
+    {
+        int size = mGravity.bodies.size();
+        const int* bodies = mGravity.bodies.data();
+        const glm::vec3* gravity = mGravity.gravity.data();
+
+        const int* awake = mStore.getAwakeArray();
+        const float* invMass = mStore.getInvMassArray();
+        float* forceX = mStore.getForceArray( 0 );
+        float* forceY = mStore.getForceArray( 1 );
+        float* forceZ = mStore.getForceArray( 2 );
+
+        for ( int i = 0; i < size; i++ )
+        {
+            int id = bodies[ i ];
+            if ( !awake[ id ] || invMass[ id ] <= 0.f )
+                continue;
+            float mass = 1.f / invMass[ id ];
+            forceX[ id ] += gravity[ i ].x * mass;
+            forceY[ id ] += gravity[ i ].y * mass;
+            forceZ[ id ] += gravity[ i ].z * mass;
+        }
+    }
+
+    // Drag, with a linear and a quadratic term on the speed
+    void BodyForceRegistry::applyDrag()
+    {
+        int size = mDrag.bodies.size();
+        const int* bodies = mDrag.bodies.data();
+        const float* k1 = mDrag.k1.data();
+        const float* k2 = mDrag.k2.data();
+
+        const int* awake = mStore.getAwakeArray();
+        const float* velocityX = mStore.getVelocityArray( 0 );
+        const float* velocityY = mStore.getVelocityArray( 1 );
+        const float* velocityZ = mStore.getVelocityArray( 2 );
+        float* forceX = mStore.getForceArray( 0 );
+        float* forceY = mStore.getForceArray( 1 );
+        float* forceZ = mStore.getForceArray( 2 );
+
+        for ( int i = 0; i < size; i++ )
+        {
+            int id = bodies[ i ];
+            if ( !awake[ id ] )
+                continue;
+            float vx = velocityX[ id ];
+            float vy = velocityY[ id ];
+            float vz = velocityZ[ id ];
+            float speed = sqrtf( vx * vx + vy * vy + vz * vz );
+            float factor = k1[ i ] + k2[ i ] * speed;
+            forceX[ id ] -= vx * factor;
+            forceY[ id ] -= vy * factor;
+            forceZ[ id ] -= vz * factor;
+        }
+    }
+
+    // Damped springs between two bodies
+    void BodyForceRegistry::applySprings()
+    {
+        int size = mSprings.bodies.size();
+        const int* bodies = mSprings.bodies.data();
+        const int* otherBodies = mSprings.otherBodies.data();
+        const float* springConst = mSprings.springConst.data();
+        const float* dampingCoeff = mSprings.dampingCoeff.data();
+        const float* restLength = mSprings.restLength.data();
+
+        const int* awake = mStore.getAwakeArray();
+        const float* positionX = mStore.getPositionArray( 0 );
+        const float* positionY = mStore.getPositionArray( 1 );
+        const float* positionZ = mStore.getPositionArray( 2 );
+        const float* velocityX = mStore.getVelocityArray( 0 );
+        const float* velocityY = mStore.getVelocityArray( 1 );
+        const float* velocityZ = mStore.getVelocityArray( 2 );
+        float* forceX = mStore.getForceArray( 0 );
+        float* forceY = mStore.getForceArray( 1 );
+        float* forceZ = mStore.getForceArray( 2 );
+
+        for ( int i = 0; i < size; i++ )
+        {
+            int id = bodies[ i ];
+            if ( !awake[ id ] )
+                continue;
+            int other = otherBodies[ i ];
+
+            float dx = positionX[ id ] - positionX[ other ];
+            float dy = positionY[ id ] - positionY[ other ];
+            float dz = positionZ[ id ] - positionZ[ other ];
+            float distance = sqrtf( dx * dx + dy * dy + dz * dz );
+            dx /= distance;
+            dy /= distance;
+            dz /= distance;
+            // Force of the spring, and damping proportional to the relative speed
+            float magnitude = springConst[ i ] * ( restLength[ i ] - distance );
+            float relativeSpeed = ( velocityX[ id ] - velocityX[ other ] ) * dx +
+                                  ( velocityY[ id ] - velocityY[ other ] ) * dy +
+                                  ( velocityZ[ id ] - velocityZ[ other ] ) * dz;
+            magnitude -= dampingCoeff[ i ] * relativeSpeed;
+            forceX[ id ] += magnitude * dx;
+            forceY[ id ] += magnitude * dy;
+            forceZ[ id ] += magnitude * dz;
+        }
+    }
+
+    // Springs that only pull when they are stretched
+    void BodyForceRegistry::applyBungees()
+    {
+        int size = mBungees.bodies.size();
+        const int* bodies = mBungees.bodies.data();
+        const int* otherBodies = mBungees.otherBodies.data();
+        const float* springConst = mBungees.springConst.data();
+        const float* restLength = mBungees.restLength.data();
+
+        const int* awake = mStore.getAwakeArray();
+        const float* positionX = mStore.getPositionArray( 0 );
+        const float* positionY = mStore.getPositionArray( 1 );
+        const float* positionZ = mStore.getPositionArray( 2 );
+        float* forceX = mStore.getForceArray( 0 );
+        float* forceY = mStore.getForceArray( 1 );
+        float* forceZ = mStore.getForceArray( 2 );
+
+        for ( int i = 0; i < size; i++ )
+        {
+            int id = bodies[ i ];
+            if ( !awake[ id ] )
+                continue;
+            int other = otherBodies[ i ];
+
+            float dx = positionX[ id ] - positionX[ other ];
+            float dy = positionY[ id ] - positionY[ other ];
+            float dz = positionZ[ id ] - positionZ[ other ];
+            float distance = sqrtf( dx * dx + dy * dy + dz * dz );
+            float magnitude = springConst[ i ] * ( restLength[ i ] / distance - 1.f );
+            if ( magnitude < 0 )
+            {
+                forceX[ id ] += magnitude * dx;
+                forceY[ id ] += magnitude * dy;
+                forceZ[ id ] += magnitude * dz;
+            }
+        }
+    }
+
+    // User-defined generators, through their updateForce method
+    void BodyForceRegistry::applyCustom( float deltaTime )
+    {
+        int size = mCustom.bodies.size();
+        const int* awake = mStore.getAwakeArray();
+        for ( int i = 0; i < size; i++ )
+        {
+            if ( awake[ mCustom.bodies[ i ] ] )
+                mCustom.generators[ i ]->updateForce( mCustom.rigidBodies[ i ], deltaTime );
+        }
+    }
+}
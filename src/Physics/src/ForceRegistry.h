@@ -0,0 +1,143 @@
+#ifndef FORCE_REGISTRY_H
+#define FORCE_REGISTRY_H
+
+#include "GLBase.h"
+#include "PhysicsBody.h"
+#include "ForceGenerator.h"
+#include "RigidBodyStore.h"
+
+using namespace GLBase;
+
+namespace Physics
+{
+    // Identifier of a pair body-force in the registry, used to remove it.
+    // A handle is no longer valid after its pair is removed
+    typedef int ForceHandle;
+
+    /*
+       Registry for the forces that apply to each body in the world.
+       The pairs are stored in one bucket for each type of force generator,
+       with the identifiers of the bodies in the pool of the world and the
+       parameters of the forces in contiguous arrays. The forces of each bucket
+       are applied in a single loop, that reads the state of the bodies and adds
+       their forces directly in the arrays of the pool, without virtual calls.
+       Only the generators of exactly the built-in classes are copied to the
+       buckets. The user-defined generators, and the ones derived from the
+       built-in classes, go to a bucket of their own, and their updateForce
+       method is called.
+       The generators are read when the pair is registered, so their parameters
+       are copied to the buckets.
+       Each pair gets a handle, which gives its bucket and position. A pair is
+       removed by moving the last one of its bucket to its position.
+    */
+    class BodyForceRegistry
+    {
+        public:
+            // Constructor, with the pool that has the state of the bodies
+            BodyForceRegistry( RigidBodyStore& store );
+
+            // Register a pair body-force, and return its handle, or -1 if the
+            // bodies are not in the pool
+            ForceHandle addBodyForce( RigidBody* body, ForceGenerator* force );
+
+            // Remove a pair body-force
+            void removeBodyForce( ForceHandle handle );
+
+            // Clear all the registrations
+            void clear();
+
+            // Apply the forces to the bodies. The springs can be left out, when
+            // they are integrated implicitly
+            void applyForces( float deltaTime, bool includeSprings = true );
+
+            // Number of pairs registered
+            int size() const;
+
+            // Bucket of the damped springs, read by the implicit solver. The
+            // bodies are given by their identifiers in the pool
+            struct SpringBucket
+            {
+                std::vector<int> bodies;
+                std::vector<int> otherBodies;
+                std::vector<float> springConst;
+                std::vector<float> dampingCoeff;
+                std::vector<float> restLength;
+                std::vector<ForceHandle> handles;
+            };
+            const SpringBucket& getSprings() const;
+
+            // Number that changes each time a spring is added or removed
+            int getSpringVersion() const;
+
+        private:
+            // Bucket of each type of force. All the arrays of a bucket have the
+            // same size, and handles gives the handle of each pair
+            struct GravityBucket
+            {
+                std::vector<int> bodies;
+                std::vector<glm::vec3> gravity;
+                std::vector<ForceHandle> handles;
+            };
+            struct DragBucket
+            {
+                std::vector<int> bodies;
+                std::vector<float> k1;
+                std::vector<float> k2;
+                std::vector<ForceHandle> handles;
+            };
+            struct BungeeBucket
+            {
+                std::vector<int> bodies;
+                std::vector<int> otherBodies;
+                std::vector<float> springConst;
+                std::vector<float> restLength;
+                std::vector<ForceHandle> handles;
+            };
+            struct CustomBucket
+            {
+                std::vector<int> bodies;
+                std::vector<RigidBody*> rigidBodies;
+                std::vector<ForceGenerator*> generators;
+                std::vector<ForceHandle> handles;
+            };
+
+            // Bucket and position of the pair of a handle. The unused handles
+            // form a linked list through the position
+            struct HandleSlot
+            {
+                ForceType type;
+                int index;
+                bool isUsed;
+            };
+
+            // Pool with the state of the bodies
+            RigidBodyStore& mStore;
+
+            GravityBucket mGravity;
+            DragBucket mDrag;
+            SpringBucket mSprings;
+            BungeeBucket mBungees;
+            CustomBucket mCustom;
+
+            std::vector<HandleSlot> mHandles;
+            int mFreeHandle = -1;
+            int mSize = 0;
+            int mSpringVersion = 0;
+
+            // Type of the bucket of a generator: its own type if it is exactly
+            // one of the built-in classes, and custom otherwise
+            static ForceType getBucketType( const ForceGenerator* force );
+
+            // Get a handle for a new pair, at the given position of a bucket
+            ForceHandle allocateHandle( ForceType type, int index );
+
+            // Apply the forces of each bucket
+            void applyGravity();
+            void applyDrag();
+            void applySprings();
+            void applyBungees();
+            void applyCustom( float deltaTime );
+    };
+}
+
+#endif
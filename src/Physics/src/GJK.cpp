@@ -0,0 +1,748 @@
+#include <limits>
+
+#include "GJK.h"
+
+using namespace GLBase;
+
+namespace Physics
+{
+    // Relative tolerance of the distance found by GJK
+    const float GJK_TOLERANCE = 1e-4f;
+    // Squared distance below which two points are considered the same
+    const float GJK_EPSILON = 1e-10f;
+    // Squared distance below which the origin is considered to be on the
+    // simplex, relative to the squared size of the simplex. Large shapes have
+    // larger rounding errors
+    const float GJK_RELATIVE_EPSILON = 1e-12f;
+    // Relative tolerance used to detect degenerate simplices
+    const float GJK_DEGENERATE = 1e-6f;
+    // Tolerance of the penetration depth found by EPA
+    const float EPA_TOLERANCE = 1e-4f;
+
+    // Point of a simplex closest to the origin, given by the vertices of the
+    // simplex needed to express it and their barycentric coordinates
+    struct ClosestPoint
+    {
+        glm::vec3 point;
+        int size;
+        int indices[3];
+        float weights[3];
+    };
+
+    // Face of the polytope used by EPA, with its vertices ordered so that the
+    // normal points outwards
+    struct PolytopeFace
+    {
+        int vertices[3];
+        glm::vec3 normal;
+        float distance;
+    };
+
+    // Support point of the Minkowski difference of the core shapes of two
+    // colliders, in the given direction. Collider A can be translated from its
+    // current position
+    static SupportPoint support( const Collider* a, const Collider* b,
+                                 const glm::vec3& direction,
+                                 const glm::vec3& translationA = glm::vec3( 0.f ) )
+    {
+        glm::vec3 n( 1.f, 0.f, 0.f );
+        float length = glm::length( direction );
+        if ( length > 0.f )
+            n = direction / length;
+
+        glm::vec3 pointA = a->findFurthestPoint( n ) - a->getMargin() * n + translationA;
+        glm::vec3 pointB = b->findFurthestPoint( -n ) + b->getMargin() * n;
+
+        return { pointA - pointB, pointA, pointB, n };
+    }
+
+    // Check if a point is already in the simplex
+    static bool isInSimplex( const Simplex& simplex, const glm::vec3& point )
+    {
+        for ( int i = 0; i < simplex.size; ++i )
+        {
+            glm::vec3 diff = simplex.points[ i ].point - point;
+            if ( glm::dot( diff, diff ) < GJK_EPSILON )
+                return true;
+        }
+        return false;
+    }
+
+    // Compute again the points of the simplex of the last query, with the
+    // current positions of the colliders
+    static void warmStart( const Collider* a, const Collider* b, Simplex& simplex,
+                           const glm::vec3& translationA )
+    {
+        // If the colliders have been swapped, the Minkowski difference is the
+        // opposite one, and so are the directions
+        bool swapped = simplex.colliderA == b && simplex.colliderB == a;
+        if ( !swapped && ( simplex.colliderA != a || simplex.colliderB != b ) )
+            simplex.size = 0;
+        simplex.colliderA = a;
+        simplex.colliderB = b;
+
+        int size = simplex.size;
+        simplex.size = 0;
+        for ( int i = 0; i < size; ++i )
+        {
+            glm::vec3 direction = simplex.points[ i ].direction;
+            SupportPoint point = support( a, b, swapped ? -direction : direction,
+                                          translationA );
+            if ( !isInSimplex( simplex, point.point ) )
+                simplex.points[ simplex.size++ ] = point;
+        }
+    }
+
+    // Point of a segment of the simplex closest to the origin
+    static ClosestPoint closestOnSegment( const Simplex& simplex, int i, int j )
+    {
+        const glm::vec3& a = simplex.points[ i ].point;
+        const glm::vec3& b = simplex.points[ j ].point;
+        glm::vec3 ab = b - a;
+
+        float denom = glm::dot( ab, ab );
+        float t = denom > 0.f ? -glm::dot( a, ab ) / denom : 0.f;
+        if ( t <= 0.f )
+            return { a, 1, { i }, { 1.f } };
+        if ( t >= 1.f )
+            return { b, 1, { j }, { 1.f } };
+        return { a + t * ab, 2, { i, j }, { 1.f - t, t } };
+    }
+
+    // Point of a triangle of the simplex closest to the origin.
+    // From "Real-Time Collision Detection" by Christer Ericson
+    static ClosestPoint closestOnTriangle( const Simplex& simplex, int i, int j, int k )
+    {
+        const glm::vec3& a = simplex.points[ i ].point;
+        const glm::vec3& b = simplex.points[ j ].point;
+        const glm::vec3& c = simplex.points[ k ].point;
+        glm::vec3 ab = b - a;
+        glm::vec3 ac = c - a;
+
+        // Vertex region of a
+        float d1 = -glm::dot( ab, a );
+        float d2 = -glm::dot( ac, a );
+        if ( d1 <= 0.f && d2 <= 0.f )
+            return { a, 1, { i }, { 1.f } };
+
+        // Vertex region of b
+        float d3 = -glm::dot( ab, b );
+        float d4 = -glm::dot( ac, b );
+        if ( d3 >= 0.f && d4 <= d3 )
+            return { b, 1, { j }, { 1.f } };
+
+        // Edge region of ab
+        float vc = d1 * d4 - d3 * d2;
+        if ( vc <= 0.f && d1 >= 0.f && d3 <= 0.f )
+        {
+            float t = d1 / ( d1 - d3 );
+            return { a + t * ab, 2, { i, j }, { 1.f - t, t } };
+        }
+
+        // Vertex region of c
+        float d5 = -glm::dot( ab, c );
+        float d6 = -glm::dot( ac, c );
+        if ( d6 >= 0.f && d5 <= d6 )
+            return { c, 1, { k }, { 1.f } };
+
+        // Edge region of ac
+        float vb = d5 * d2 - d1 * d6;
+        if ( vb <= 0.f && d2 >= 0.f && d6 <= 0.f )
+        {
+            float t = d2 / ( d2 - d6 );
+            return { a + t * ac, 2, { i, k }, { 1.f - t, t } };
+        }
+
+        // Edge region of bc
+        float va = d3 * d6 - d5 * d4;
+        if ( va <= 0.f && ( d4 - d3 ) >= 0.f && ( d5 - d6 ) >= 0.f )
+        {
+            float t = ( d4 - d3 ) / ( ( d4 - d3 ) + ( d5 - d6 ) );
+            return { b + t * ( c - b ), 2, { j, k }, { 1.f - t, t } };
+        }
+
+        // For a degenerate triangle, take the closest of the three edges
+        float sum = va + vb + vc;
+        if ( sum <= GJK_DEGENERATE * glm::dot( ab, ab ) * glm::dot( ac, ac ) )
+        {
+            ClosestPoint closest = closestOnSegment( simplex, i, j );
+            ClosestPoint other = closestOnSegment( simplex, i, k );
+            if ( glm::dot( other.point, other.point ) < glm::dot( closest.point, closest.point ) )
+                closest = other;
+            other = closestOnSegment( simplex, j, k );
+            if ( glm::dot( other.point, other.point ) < glm::dot( closest.point, closest.point ) )
+                closest = other;
+            return closest;
+        }
+
+        // Face region. The point is found projecting the origin on the plane
+        // of the triangle, which has a smaller rounding error than using the
+        // barycentric coordinates when the triangle is large
+        float v = vb / sum;
+        float w = vc / sum;
+        glm::vec3 normal = glm::cross( ab, ac );
+        glm::vec3 point = ( glm::dot( a, normal ) / glm::dot( normal, normal ) ) * normal;
+        return { point, 3, { i, j, k }, { 1.f - v - w, v, w } };
+    }
+
+    // Point of the tetrahedron of the simplex closest to the origin.
+    // containsOrigin is set to true if the origin is inside the tetrahedron
+    static ClosestPoint closestOnTetrahedron( const Simplex& simplex, bool& containsOrigin )
+    {
+        // Faces of the tetrahedron, and the vertex opposite to each of them
+        static const int faces[4][4] = { { 0, 1, 2, 3 }, { 0, 3, 1, 2 },
+                                         { 0, 2, 3, 1 }, { 1, 3, 2, 0 } };
+
+        const glm::vec3& a = simplex.points[ 0 ].point;
+        glm::vec3 ab = simplex.points[ 1 ].point - a;
+        glm::vec3 ac = simplex.points[ 2 ].point - a;
+        glm::vec3 ad = simplex.points[ 3 ].point - a;
+        float volume = glm::dot( ad, glm::cross( ab, ac ) );
+        bool degenerate = std::fabs( volume ) <= GJK_DEGENERATE * glm::length( ab ) *
+                                                 glm::length( ac ) * glm::length( ad );
+
+        // Check the faces that have the origin on their outer side. For a
+        // degenerate tetrahedron, check all of them
+        ClosestPoint closest;
+        float minDistSq = std::numeric_limits<float>::max();
+        containsOrigin = !degenerate;
+        for ( auto& face : faces )
+        {
+            const glm::vec3& p = simplex.points[ face[0] ].point;
+            glm::vec3 normal = glm::cross( simplex.points[ face[1] ].point - p,
+                                           simplex.points[ face[2] ].point - p );
+            float signOrigin = -glm::dot( p, normal );
+            float signOpposite = glm::dot( simplex.points[ face[3] ].point - p, normal );
+            if ( !degenerate && signOrigin * signOpposite >= 0.f )
+                continue;
+
+            containsOrigin = false;
+            ClosestPoint faceClosest = closestOnTriangle( simplex, face[0], face[1], face[2] );
+            float distSq = glm::dot( faceClosest.point, faceClosest.point );
+            if ( distSq < minDistSq )
+            {
+                minDistSq = distSq;
+                closest = faceClosest;
+            }
+        }
+
+        if ( containsOrigin )
+            closest = { glm::vec3( 0.f ), 0, { 0 }, { 0.f } };
+
+        return closest;
+    }
+
+    // Replace the simplex by the point closest to the origin, keeping only the
+    // vertices needed to express it. Returns true if the simplex is a
+    // tetrahedron that contains the origin
+    static bool reduceSimplex( Simplex& simplex, glm::vec3& closestPoint )
+    {
+        bool containsOrigin = false;
+        ClosestPoint closest;
+        switch ( simplex.size )
+        {
+            case 1:
+                closest = { simplex.points[ 0 ].point, 1, { 0 }, { 1.f } };
+                break;
+            case 2:
+                closest = closestOnSegment( simplex, 0, 1 );
+                break;
+            case 3:
+                closest = closestOnTriangle( simplex, 0, 1, 2 );
+                break;
+            default:
+                closest = closestOnTetrahedron( simplex, containsOrigin );
+                break;
+        }
+
+        closestPoint = closest.point;
+        if ( containsOrigin )
+        {
+            for ( int i = 0; i < 4; ++i )
+                simplex.weights[ i ] = 0.25f;
+            return true;
+        }
+
+        // Keep only the vertices of the closest point
+        SupportPoint points[3];
+        for ( int i = 0; i < closest.size; ++i )
+            points[ i ] = simplex.points[ closest.indices[ i ] ];
+        for ( int i = 0; i < closest.size; ++i )
+        {
+            simplex.points[ i ] = points[ i ];
+            simplex.weights[ i ] = closest.weights[ i ];
+        }
+        simplex.size = closest.size;
+
+        return false;
+    }
+
+    // Run GJK on the core shapes of two colliders, starting from the given
+    // simplex. Returns true if they intersect. Otherwise, the simplex is left
+    // with the points closest to the origin.
+    // If earlyExit is true, this stops as soon as a separating direction is
+    // found, without computing the distance
+    static bool runGJK( const Collider* a, const Collider* b, Simplex& simplex,
+                        bool earlyExit, const glm::vec3& translationA = glm::vec3( 0.f ) )
+    {
+        warmStart( a, b, simplex, translationA );
+        simplex.iterations = 0;
+
+        // Without a previous simplex, start with the direction between the
+        // centers of the AABBs
+        if ( simplex.size == 0 )
+        {
+            const AABB& aabbA = a->getAABB();
+            const AABB& aabbB = b->getAABB();
+            glm::vec3 direction = 0.5f * ( aabbA.cornersWorld[0] + aabbA.cornersWorld[1] -
+                                           aabbB.cornersWorld[0] - aabbB.cornersWorld[1] ) +
+                                translationA;
+            simplex.points[ 0 ] = support( a, b, direction, translationA );
+            simplex.size = 1;
+            simplex.iterations = 1;
+        }
+
+        float lastVV = std::numeric_limits<float>::max();
+        while ( simplex.iterations < GJK_MAX_ITERATIONS )
+        {
+            // Point of the simplex closest to the origin
+            glm::vec3 v;
+            if ( reduceSimplex( simplex, v ) )
+                return true;
+
+            // The origin is on the simplex, so the shapes are touching
+            float vv = glm::dot( v, v );
+            float maxSq = 0.f;
+            for ( int i = 0; i < simplex.size; ++i )
+                maxSq = std::max( maxSq, glm::dot( simplex.points[ i ].point,
+                                                   simplex.points[ i ].point ) );
+            if ( vv < std::max( GJK_EPSILON, GJK_RELATIVE_EPSILON * maxSq ) )
+                return true;
+
+            // The distance must decrease at each iteration. If rounding errors
+            // stop it from doing so, v is as close as it gets
+            if ( vv >= lastVV )
+                return false;
+            lastVV = vv;
+
+            // New point in the direction of the origin
+            SupportPoint w = support( a, b, -v, translationA );
+            simplex.iterations++;
+            float vw = glm::dot( v, w.point );
+
+            // The new point does not get past the origin, so -v is a
+            // separating direction
+            if ( earlyExit && vw > 0.f )
+                return false;
+
+            // The new point does not get closer to the origin, so v is the
+            // closest point of the Minkowski difference
+            if ( vv - vw <= GJK_TOLERANCE * vv || isInSimplex( simplex, w.point ) )
+                return false;
+
+            simplex.points[ simplex.size++ ] = w;
+        }
+
+        // Did not converge, which the caller sees from the iterations reaching
+        // the maximum. This is not logged, as it runs for every pair
+        return false;
+    }
+
+    // Closest points of the core shapes, from the barycentric coordinates of
+    // the simplex
+    static void closestPoints( const Simplex& simplex, glm::vec3& closestA,
+                               glm::vec3& closestB )
+    {
+        closestA = glm::vec3( 0.f );
+        closestB = glm::vec3( 0.f );
+        for ( int i = 0; i < simplex.size; ++i )
+        {
+            closestA += simplex.weights[ i ] * simplex.points[ i ].pointA;
+            closestB += simplex.weights[ i ] * simplex.points[ i ].pointB;
+        }
+    }
+
+    // Add points to a simplex that encloses the origin, until it is a
+    // tetrahedron. Returns false if the Minkowski difference is flat
+    static bool buildTetrahedron( const Collider* a, const Collider* b, Simplex& simplex )
+    {
+        // Add a point in one of the directions of the axes
+        if ( simplex.size == 1 )
+        {
+            for ( int i = 0; i < 6 && simplex.size == 1; ++i )
+            {
+                glm::vec3 direction( 0.f );
+                direction[ i / 2 ] = ( i % 2 == 0 ) ? 1.f : -1.f;
+                SupportPoint point = support( a, b, direction );
+                if ( !isInSimplex( simplex, point.point ) )
+                    simplex.points[ simplex.size++ ] = point;
+            }
+        }
+
+        // Add a point in one of the directions perpendicular to the segment
+        if ( simplex.size == 2 )
+        {
+            glm::vec3 segment = glm::normalize( simplex.points[ 1 ].point - simplex.points[ 0 ].point );
+
+            // Perpendicular vector from the axis least aligned with the segment
+            glm::vec3 axis( 0.f );
+            glm::vec3 absSegment = glm::abs( segment );
+            int minAxis = absSegment.x < absSegment.y ? ( absSegment.x < absSegment.z ? 0 : 2 )
+                                                      : ( absSegment.y < absSegment.z ? 1 : 2 );
+            axis[ minAxis ] = 1.f;
+            glm::vec3 perpendicular = glm::normalize( glm::cross( segment, axis ) );
+            glm::vec3 perpendicular2 = glm::cross( segment, perpendicular );
+
+            // Rotate the direction around the segment, 60 degrees at a time
+            for ( int i = 0; i < 6 && simplex.size == 2; ++i )
+            {
+                float angle = i * M_PI / 3.f;
+                glm::vec3 direction = std::cos( angle ) * perpendicular +
+                                      std::sin( angle ) * perpendicular2;
+                SupportPoint point = support( a, b, direction );
+                glm::vec3 fromStart = point.point - simplex.points[ 0 ].point;
+                glm::vec3 offLine = fromStart - glm::dot( fromStart, segment ) * segment;
+                if ( glm::dot( offLine, offLine ) > GJK_EPSILON )
+                    simplex.points[ simplex.size++ ] = point;
+            }
+        }
+
+        // Add a point in the direction of one of the normals of the triangle
+        if ( simplex.size == 3 )
+        {
+            const glm::vec3& p = simplex.points[ 0 ].point;
+            glm::vec3 normal = glm::cross( simplex.points[ 1 ].point - p,
+                                           simplex.points[ 2 ].point - p );
+            for ( int i = 0; i < 2 && simplex.size == 3; ++i )
+            {
+                SupportPoint point = support( a, b, i == 0 ? normal : -normal );
+                float distance = glm::dot( point.point - p, normal );
+                if ( distance * distance > GJK_EPSILON * glm::dot( normal, normal ) )
+                    simplex.points[ simplex.size++ ] = point;
+            }
+        }
+
+        return simplex.size == 4;
+    }
+
+    // Barycentric coordinates of a point in a triangle
+    static glm::vec3 barycentric( const glm::vec3& point, const glm::vec3& a,
+                                  const glm::vec3& b, const glm::vec3& c )
+    {
+        glm::vec3 v0 = b - a;
+        glm::vec3 v1 = c - a;
+        glm::vec3 v2 = point - a;
+        float d00 = glm::dot( v0, v0 );
+        float d01 = glm::dot( v0, v1 );
+        float d11 = glm::dot( v1, v1 );
+        float d20 = glm::dot( v2, v0 );
+        float d21 = glm::dot( v2, v1 );
+        float denom = d00 * d11 - d01 * d01;
+        if ( denom <= 0.f )
+            return glm::vec3( 1.f / 3.f );
+
+        float v = ( d11 * d20 - d01 * d21 ) / denom;
+        float w = ( d00 * d21 - d01 * d20 ) / denom;
+        return glm::vec3( 1.f - v - w, v, w );
+    }
+
+    // Create a face of the polytope. Returns false if it is degenerate
+    static bool createFace( const std::vector<SupportPoint>& vertices,
+                            int i, int j, int k, PolytopeFace& face )
+    {
+        const glm::vec3& a = vertices[ i ].point;
+        glm::vec3 normal = glm::cross( vertices[ j ].point - a, vertices[ k ].point - a );
+        float length = glm::length( normal );
+        if ( length <= 0.f )
+            return false;
+
+        face.vertices[0] = i;
+        face.vertices[1] = j;
+        face.vertices[2] = k;
+        face.normal = normal / length;
+        face.distance = glm::dot( face.normal, a );
+        return true;
+    }
+
+    // Add an edge to the horizon of the polytope. If the opposite edge is
+    // already in it, both are shared by removed faces, so it is removed
+    static void addHorizonEdge( std::vector<std::pair<int, int>>& edges, int i, int j )
+    {
+        for ( int e = 0; e < (int)edges.size(); ++e )
+        {
+            if ( edges[ e ].first == j && edges[ e ].second == i )
+            {
+                edges[ e ] = edges.back();
+                edges.pop_back();
+                return;
+            }
+        }
+        edges.push_back( { i, j } );
+    }
+
+    // Check if the core shapes of two colliders intersect
+    bool gjkIntersect( const Collider* a, const Collider* b, Simplex& simplex )
+    {
+        return runGJK( a, b, simplex, true );
+    }
+
+    // Distance between two colliders, and their closest points
+    float gjkDistance( const Collider* a, const Collider* b, Simplex& simplex,
+                       glm::vec3& closestA, glm::vec3& closestB )
+    {
+        return gjkDistance( a, glm::vec3( 0.f ), b, simplex, closestA, closestB );
+    }
+
+    // Distance between two colliders, with A translated from its current
+    // position, and their closest points
+    float gjkDistance( const Collider* a, const glm::vec3& translationA, const Collider* b,
+                       Simplex& simplex, glm::vec3& closestA, glm::vec3& closestB )
+    {
+        float margin = a->getMargin() + b->getMargin();
+        if ( runGJK( a, b, simplex, false, translationA ) )
+            return 0.f;
+
+        closestPoints( simplex, closestA, closestB );
+        glm::vec3 separation = closestB - closestA;
+        float distance = glm::length( separation );
+        if ( distance <= margin )
+            return 0.f;
+
+        // Add the margins to the closest points of the core shapes
+        glm::vec3 normal = separation / distance;
+        closestA += a->getMargin() * normal;
+        closestB -= b->getMargin() * normal;
+        return distance - margin;
+    }
+
+    // Cast a ray against a collider. The simplex is built from the points
+    // x - p, where x is the current point of the ray and p the support points
+    // of the collider. When x is outside of the supporting plane of the last
+    // support point, it is advanced to the plane, which never goes past the
+    // collider. The ray hits the collider when x gets on it
+    bool gjkRaycast( const Collider* collider, const glm::vec3& origin,
+                     const glm::vec3& direction, float maxDistance,
+                     float& distance, glm::vec3& normal )
+    {
+        auto supportPoint = [&]( const glm::vec3& d )
+        {
+            return collider->findFurthestPoint( glm::normalize( d ) );
+        };
+
+        // The tolerance is relative to the size of the collider
+        const AABB& aabb = collider->getAABB();
+        glm::vec3 size = aabb.cornersWorld[1] - aabb.cornersWorld[0];
+        float epsilon = std::max( GJK_EPSILON, GJK_TOLERANCE * GJK_TOLERANCE *
+                                               glm::dot( size, size ) );
+
+        float lambda = 0.f;
+        glm::vec3 x = origin;
+        glm::vec3 v = x - supportPoint( -direction );
+        normal = glm::vec3( 0.f );
+
+        Simplex simplex;
+        float vv = glm::dot( v, v );
+        for ( int iteration = 0; iteration < GJK_MAX_ITERATIONS && vv > epsilon; ++iteration )
+        {
+            glm::vec3 p = supportPoint( v );
+            glm::vec3 w = x - p;
+            float vw = glm::dot( v, w );
+            bool advanced = vw > 0.f;
+            if ( advanced )
+            {
+                // The ray goes away from the supporting plane, so it misses
+                float vr = glm::dot( v, direction );
+                if ( vr >= 0.f )
+                    return false;
+
+                // Advance the point to the supporting plane
+                lambda -= vw / vr;
+                if ( lambda > maxDistance )
+                    return false;
+                x = origin + lambda * direction;
+                normal = v;
+
+                // Move the points of the simplex with it
+                for ( int i = 0; i < simplex.size; ++i )
+                {
+                    simplex.points[ i ].pointA = x;
+                    simplex.points[ i ].point = x - simplex.points[ i ].pointB;
+                }
+            }
+
+            // If the support point is already in the simplex, v only changes
+            // if the point of the ray has moved
+            if ( !isInSimplex( simplex, x - p ) )
+                simplex.points[ simplex.size++ ] = { x - p, x, p, v };
+            else if ( !advanced )
+                break;
+
+            if ( reduceSimplex( simplex, v ) )
+            {
+                vv = 0.f;
+                break;
+            }
+            vv = glm::dot( v, v );
+        }
+
+        if ( vv > epsilon )
+            return false;
+
+        // A ray starting inside the collider hits it at its origin, facing it
+        distance = lambda;
+        float length = glm::length( normal );
+        normal = length > 0.f ? normal / length : -direction;
+        return true;
+    }
+
+    // Penetration of the core shapes of two colliders, using EPA
+    CollisionPoints epaPenetration( const Collider* a, const Collider* b,
+                                    const Simplex& simplex )
+    {
+        CollisionPoints points;
+        points.HasCollision = false;
+
+        // Start from a tetrahedron that encloses the origin
+        Simplex tetrahedron = simplex;
+        if ( !buildTetrahedron( a, b, tetrahedron ) )
+            return points;
+
+        std::vector<SupportPoint> vertices( tetrahedron.points, tetrahedron.points + 4 );
+        std::vector<PolytopeFace> faces;
+        std::vector<std::pair<int, int>> edges;
+
+        // Faces of the tetrahedron, oriented away from its centroid
+        glm::vec3 centroid = 0.25f * ( vertices[0].point + vertices[1].point +
+                                       vertices[2].point + vertices[3].point );
+        static const int tetrahedronFaces[4][3] = { { 0, 1, 2 }, { 0, 3, 1 },
+                                                    { 0, 2, 3 }, { 1, 3, 2 } };
+        for ( auto& f : tetrahedronFaces )
+        {
+            PolytopeFace face;
+            if ( !createFace( vertices, f[0], f[1], f[2], face ) )
+                return points;
+            if ( glm::dot( face.normal, centroid - vertices[ f[0] ].point ) > 0.f )
+                createFace( vertices, f[0], f[2], f[1], face );
+            faces.push_back( face );
+        }
+
+        PolytopeFace closest = faces[0];
+        for ( int iteration = 0; iteration < EPA_MAX_ITERATIONS; ++iteration )
+        {
+            // Face closest to the origin
+            closest = faces[0];
+            for ( auto& face : faces )
+                if ( face.distance < closest.distance )
+                    closest = face;
+
+            // Stop if the polytope can not be expanded further in the
+            // direction of the face
+            SupportPoint point = support( a, b, closest.normal );
+            float distance = glm::dot( point.point, closest.normal );
+            if ( distance - closest.distance <= EPA_TOLERANCE * std::max( 1.f, distance ) )
+                break;
+
+            // Remove the faces that can be seen from the new point, keeping
+            // the edges of the hole they leave
+            edges.clear();
+            for ( int i = (int)faces.size() - 1; i >= 0; --i )
+            {
+                const PolytopeFace& face = faces[ i ];
+                if ( glm::dot( face.normal, point.point - vertices[ face.vertices[0] ].point ) <= 0.f )
+                    continue;
+                for ( int e = 0; e < 3; ++e )
+                    addHorizonEdge( edges, face.vertices[ e ], face.vertices[ ( e + 1 ) % 3 ] );
+                faces[ i ] = faces.back();
+                faces.pop_back();
+            }
+
+            // Close the hole with faces joining its edges to the new point
+            int newVertex = vertices.size();
+            vertices.push_back( point );
+            for ( auto& edge : edges )
+            {
+                PolytopeFace face;
+                if ( createFace( vertices, edge.first, edge.second, newVertex, face ) )
+                    faces.push_back( face );
+            }
+
+            if ( faces.empty() )
+                break;
+        }
+
+        // Contact points from the projection of the origin on the closest face
+        glm::vec3 weights = barycentric( closest.normal * closest.distance,
+                                         vertices[ closest.vertices[0] ].point,
+                                         vertices[ closest.vertices[1] ].point,
+                                         vertices[ closest.vertices[2] ].point );
+        points.A = glm::vec3( 0.f );
+        points.B = glm::vec3( 0.f );
+        for ( int i = 0; i < 3; ++i )
+        {
+            points.A += weights[ i ] * vertices[ closest.vertices[ i ] ].pointA;
+            points.B += weights[ i ] * vertices[ closest.vertices[ i ] ].pointB;
+        }
+        points.Normal = closest.normal;
+        points.Depth = closest.distance;
+        points.HasCollision = true;
+
+        return points;
+    }
+
+    // Collision points between two colliders, using GJK and EPA
+    CollisionPoints findCollisionGJK( const Collider* a, const Collider* b,
+                                      Simplex& simplex )
+    {
+        CollisionPoints points;
+        points.HasCollision = false;
+
+        float marginA = a->getMargin();
+        float marginB = b->getMargin();
+
+        // Without margins, the distance is not needed, only if they intersect
+        if ( !runGJK( a, b, simplex, marginA + marginB == 0.f ) )
+        {
+            // The cores are separated, but the shapes may overlap in the margins
+            glm::vec3 closestA, closestB;
+            closestPoints( simplex, closestA, closestB );
+            glm::vec3 separation = closestB - closestA;
+            float distance = glm::length( separation );
+            if ( marginA + marginB == 0.f || distance > marginA + marginB )
+                return points;
+
+            points.Normal = separation / distance;
+            points.A = closestA + marginA * points.Normal;
+            points.B = closestB - marginB * points.Normal;
+            points.Depth = marginA + marginB - distance;
+            points.HasCollision = true;
+            return points;
+        }
+
+        // The cores intersect, so find their penetration with EPA
+        points = epaPenetration( a, b, simplex );
+        if ( !points.HasCollision )
+        {
+            // The cores are flat and touching, which can only be a collision
+            // with margins. Use the direction between the AABBs as normal
+            if ( marginA + marginB == 0.f )
+                return points;
+
+            const AABB& aabbA = a->getAABB();
+            const AABB& aabbB = b->getAABB();
+            glm::vec3 direction = aabbB.cornersWorld[0] + aabbB.cornersWorld[1] -
+                                  aabbA.cornersWorld[0] - aabbA.cornersWorld[1];
+            points.Normal = glm::length( direction ) > 0.f ? glm::normalize( direction )
+                                                           : glm::vec3( 0.f, 1.f, 0.f );
+            closestPoints( simplex, points.A, points.B );
+            points.Depth = 0.f;
+            points.HasCollision = true;
+        }
+
+        // Add the margins
+        points.A += marginA * points.Normal;
+        points.B -= marginB * points.Normal;
+        points.Depth += marginA + marginB;
+
+        return points;
+    }
+}
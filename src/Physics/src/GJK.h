@@ -0,0 +1,64 @@
+#ifndef GJK_H
+#define GJK_H
+
+#include "GLBase.h"
+#include "Colliders.h"
+
+using namespace GLBase;
+
+namespace Physics
+{
+    /*
+       Narrow phase for pairs of convex colliders, based on the Minkowski
+       difference A - B of the two shapes, which contains the origin only if
+       they intersect:
+        - GJK finds the point of the difference closest to the origin, using
+          a simplex of up to four support points. It gives whether the shapes
+          intersect and, if they do not, their distance and closest points.
+        - EPA expands the final simplex of GJK into a polytope, until it finds
+          the face of the difference closest to the origin. This gives the
+          penetration depth and normal.
+       The colliders are treated as a core shape with a margin around it (the
+       center and radius of a sphere), so GJK converges in a few iterations for
+       curved shapes, and EPA is only needed when the cores intersect.
+       The simplex passed in is used as the starting point, so the queries of
+       a pair that moves little between steps need very few iterations.
+    */
+
+    // Maximum number of iterations of GJK and EPA
+    const int GJK_MAX_ITERATIONS = 64;
+    const int EPA_MAX_ITERATIONS = 64;
+
+    // Check if the core shapes of two colliders intersect
+    bool gjkIntersect( const Collider* a, const Collider* b, Simplex& simplex );
+
+    // Distance between two colliders, and their closest points. The distance
+    // is zero if they intersect
+    float gjkDistance( const Collider* a, const Collider* b, Simplex& simplex,
+                       glm::vec3& closestA, glm::vec3& closestB );
+
+    // Same, with A translated from its current position. This avoids moving
+    // the collider to check it at other positions along its motion
+    float gjkDistance( const Collider* a, const glm::vec3& translationA, const Collider* b,
+                       Simplex& simplex, glm::vec3& closestA, glm::vec3& closestB );
+
+    // Penetration of the core shapes of two colliders, from a simplex that
+    // encloses the origin found by gjkIntersect
+    CollisionPoints epaPenetration( const Collider* a, const Collider* b,
+                                    const Simplex& simplex );
+
+    // Collision points between two colliders, using GJK and EPA
+    CollisionPoints findCollisionGJK( const Collider* a, const Collider* b,
+                                      Simplex& simplex );
+
+    // Cast a ray against a collider. Returns true if the ray hits it before
+    // maxDistance, with the distance along the ray and the normal of the
+    // surface at the hit point. The direction must be normalized. From "Ray
+    // Casting against General Convex Objects with Application to Continuous
+    // Collision Detection" by Gino van den Bergen
+    bool gjkRaycast( const Collider* collider, const glm::vec3& origin,
+                     const glm::vec3& direction, float maxDistance,
+                     float& distance, glm::vec3& normal );
+}
+
+#endif
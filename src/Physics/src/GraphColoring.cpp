@@ -0,0 +1,81 @@
+#include "GraphColoring.h"
+
+namespace Physics
+{
+    //--------------------------------------------------------------------------
+    // GraphColoring class
+
+    // Color a new constraint with the first color not used by its bodies
+    int GraphColoring::add( const int* bodies, int nBodies )
+    {
+        uint64_t used = 0;
+        for ( int k = 0; k < nBodies; ++k )
+        {
+            int body = bodies[ k ];
+            if ( body < 0 )
+                continue;
+            if ( body >= (int)mUsedColors.size() )
+                mUsedColors.resize( body + 1, 0 );
+            used |= mUsedColors[ body ];
+        }
+
+        int color = MAX_COLORS;
+        if ( used != ~(uint64_t)0 )
+        {
+            color = __builtin_ctzll( ~used );
+            for ( int k = 0; k < nBodies; ++k )
+            {
+                if ( bodies[ k ] >= 0 )
+                    mUsedColors[ bodies[ k ] ] |= (uint64_t)1 << color;
+            }
+        }
+
+        mColors.push_back( color );
+        return color;
+    }
+
+    // Sort the constraints by color, with a counting sort
+    void GraphColoring::sort( std::vector<int>& positions )
+    {
+        int nConstraints = mColors.size();
+        mColorStarts.assign( MAX_COLORS + 2, 0 );
+        for ( int i = 0; i < nConstraints; ++i )
+            mColorStarts[ mColors[ i ] + 1 ]++;
+        for ( int color = 0; color <= MAX_COLORS; ++color )
+            mColorStarts[ color + 1 ] += mColorStarts[ color ];
+
+        // The colors are moved with the constraints, so more of them can be
+        // added and sorted again
+        std::vector<int> next( mColorStarts.begin(), mColorStarts.end() - 1 );
+        std::vector<int> sortedColors( nConstraints );
+        positions.resize( nConstraints );
+        for ( int i = 0; i < nConstraints; ++i )
+        {
+            positions[ i ] = next[ mColors[ i ] ]++;
+            sortedColors[ positions[ i ] ] = mColors[ i ];
+        }
+        std::swap( mColors, sortedColors );
+    }
+
+    // Remove all the constraints
+    void GraphColoring::clear()
+    {
+        mColors.clear();
+        mUsedColors.clear();
+        mColorStarts.clear();
+    }
+
+    // Getters
+    int GraphColoring::size() const
+    {
+        return mColors.size();
+    }
+
+    int GraphColoring::getNumColors() const
+    {
+        int nColors = 0;
+        for ( auto color : mColors )
+            nColors = std::max( nColors, color + 1 );
+        return nColors;
+    }
+}
@@ -0,0 +1,105 @@
+#ifndef GRAPH_COLORING_H
+#define GRAPH_COLORING_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "ThreadPool.h"
+
+namespace Physics
+{
+    // Maximum number of colors of the constraints. The constraints that do not
+    // fit in them go to one more color, which is solved by a single thread
+    const int MAX_COLORS = 64;
+    // Number of constraints of a color given to a thread at a time
+    const int COLOR_CHUNK_SIZE = 64;
+
+    // Coloring of the constraints of a solver, so the ones of the same color
+    // share no body and are solved in parallel without locks. Each constraint
+    // gets the first color not used yet by its bodies, going through them in
+    // the order they are added, with the colors of each body kept in a bit
+    // mask. The colors depend only on that order, so the result is the same
+    // for any number of threads.
+    // The solvers keep their constraints in arrays sorted by color, moving
+    // them to the positions given by sort
+    class GraphColoring
+    {
+        public:
+            // Color a new constraint on the given bodies, and return its color.
+            // The negative bodies, like the ones that do not move, share no
+            // color
+            int add( const int* bodies, int nBodies );
+
+            // Sort the constraints by color, keeping their order inside each
+            // color. The new position of each constraint is written to
+            // positions
+            void sort( std::vector<int>& positions );
+
+            // Remove all the constraints
+            void clear();
+
+            // Getters
+            int size() const;
+            int getNumColors() const;
+
+            // Call task( begin, end ) for chunks of the constraints in
+            // [ begin, end ) of each color, after they are sorted. The colors
+            // are done one after another, and the chunks of a color in
+            // parallel if there is a thread pool. Returns the largest value
+            // returned by the task
+            template <typename T>
+            float forEachChunk( ThreadPool* threadPool, T& task );
+
+        private:
+            // Color of each constraint, and colors used by the constraints of
+            // each body
+            std::vector<int> mColors;
+            std::vector<uint64_t> mUsedColors;
+
+            // First constraint of each color, after they are sorted, and the
+            // values returned by the chunks of a color
+            std::vector<int> mColorStarts;
+            std::vector<float> mChunkValues;
+    };
+
+    // Call task( begin, end ) for the chunks of each color. The last color
+    // has constraints that share bodies, so it is done in a single chunk
+    template <typename T>
+    float GraphColoring::forEachChunk( ThreadPool* threadPool, T& task )
+    {
+        float maxValue = 0.f;
+        for ( int color = 0; color + 1 < (int)mColorStarts.size(); ++color )
+        {
+            int begin = mColorStarts[ color ];
+            int end = mColorStarts[ color + 1 ];
+            if ( begin == end )
+                continue;
+
+            int chunkSize = color < MAX_COLORS ? COLOR_CHUNK_SIZE : end - begin;
+            int nChunks = ( end - begin + chunkSize - 1 ) / chunkSize;
+            mChunkValues.resize( nChunks );
+
+            auto runChunk = [&]( int chunk, int )
+            {
+                int chunkBegin = begin + chunk * chunkSize;
+                int chunkEnd = std::min( chunkBegin + chunkSize, end );
+                mChunkValues[ chunk ] = task( chunkBegin, chunkEnd );
+            };
+
+            if ( threadPool != nullptr && nChunks > 1 )
+                threadPool->parallelFor( nChunks, runChunk );
+            else
+            {
+                for ( int chunk = 0; chunk < nChunks; ++chunk )
+                    runChunk( chunk, 0 );
+            }
+
+            for ( auto value : mChunkValues )
+                maxValue = std::max( maxValue, value );
+        }
+        return maxValue;
+    }
+}
+
+#endif
@@ -0,0 +1,304 @@
+#include "Colliders.h"
+#include "utils.h"
+
+using namespace GLBase;
+using namespace GLGeometry;
+
+namespace Physics
+{
+    //--------------------------------------------------------------------------
+    // HeightfieldCollider class
+
+    // Constructor
+    HeightfieldCollider::HeightfieldCollider( const float* heights, const float* normals,
+                                              int width, int height ) :
+        mHeights { heights },
+        mNormals { normals },
+        mWidth { width },
+        mHeight { height },
+        mTranslation { glm::vec3( 0.f ) },
+        mScale { glm::vec3( 1.f ) }
+    {
+        // The AABB in model space goes from the lowest to the highest sample
+        float minHeight = std::numeric_limits<float>::max();
+        float maxHeight = -std::numeric_limits<float>::max();
+        for ( int i = 0; i < width * height; ++i )
+        {
+            minHeight = std::min( minHeight, heights[ i ] );
+            maxHeight = std::max( maxHeight, heights[ i ] );
+        }
+        mAABB.cornersModel[0] = glm::vec3( -0.5f * width, minHeight, -0.5f * height );
+        mAABB.cornersModel[1] = glm::vec3(  0.5f * width, maxHeight,  0.5f * height );
+
+        // Compute the center and half extents of the AABB in model space
+        computeCenterExtentsAABB();
+    }
+
+    // Update the collider after a transformation
+    void HeightfieldCollider::moveShape( const glm::mat4& modelMatrix )
+    {
+        // The model matrix only translates and scales
+        mTranslation = glm::vec3( modelMatrix[3] );
+        for ( int i = 0; i < 3; ++i )
+            mScale[ i ] = glm::length( glm::vec3( modelMatrix[ i ] ) );
+    }
+
+    // Methods for finding collisions
+    CollisionPoints HeightfieldCollider::findCollision( const Collider* other, Simplex& simplex ) const
+    {
+        return swapPoints( other->findCollision( this, simplex ) );
+    }
+
+    // The surface under the center of the sphere is taken as a plane, with the
+    // interpolated height and normal
+    CollisionPoints HeightfieldCollider::findCollision( const SphereCollider* sphere, Simplex& simplex ) const
+    {
+        CollisionPoints points;
+        points.HasCollision = false;
+
+        if ( !checkCollisionAABB( sphere ) )
+            return points;
+
+        // Distance from the center to the plane
+        glm::vec3 normal;
+        float distance = -getPenetration( sphere->mCenter, normal );
+        if ( distance > sphere->mRadius )
+            return points;
+
+        // The normal goes from the terrain to the sphere
+        points.Normal = normal;
+        points.A = sphere->mCenter - distance * normal;
+        points.B = sphere->mCenter - sphere->mRadius * normal;
+        points.Depth = sphere->mRadius - distance;
+        points.HasCollision = true;
+        return points;
+    }
+
+    CollisionPoints HeightfieldCollider::findCollision( const PlaneCollider* other, Simplex& simplex ) const
+    {
+        // No collision between planes and terrains
+        CollisionPoints points;
+        points.HasCollision = false;
+        return points;
+    }
+
+    // The deepest vertex of the convex collider gives the contact. Over several
+    // steps, the manifold of the pair keeps up to four of them
+    CollisionPoints HeightfieldCollider::findCollision( const ConvexCollider* convex, Simplex& simplex ) const
+    {
+        CollisionPoints points;
+        points.HasCollision = false;
+
+        if ( !checkCollisionAABB( convex ) )
+            return points;
+
+        float maxDepth = 0.f;
+        for ( auto& vertex : convex->mVerticesWorld )
+        {
+            glm::vec3 normal;
+            float depth = getPenetration( vertex, normal );
+            if ( depth <= maxDepth )
+                continue;
+
+            maxDepth = depth;
+            points.Normal = normal;
+            points.A = vertex + depth * normal;
+            points.B = vertex;
+            points.Depth = depth;
+            points.HasCollision = true;
+        }
+        return points;
+    }
+
+    CollisionPoints HeightfieldCollider::findCollision( const HeightfieldCollider* other, Simplex& simplex ) const
+    {
+        // No collision between terrains
+        CollisionPoints points;
+        points.HasCollision = false;
+        return points;
+    }
+
+    // The terrain is not convex, so this returns the center of its AABB
+    glm::vec3 HeightfieldCollider::findFurthestPoint( const glm::vec3& direction ) const
+    {
+        return 0.5f * ( mAABB.cornersWorld[0] + mAABB.cornersWorld[1] );
+    }
+
+    // Cast a ray against the surface. The ray is clipped to the AABB, and then
+    // checked at steps of half a cell along x and z, which does not miss the
+    // features of the bilinear surface larger than a cell. The crossing is
+    // refined by bisection
+    bool HeightfieldCollider::raycast( const glm::vec3& origin, const glm::vec3& direction,
+                                       float maxDistance, float& distance,
+                                       glm::vec3& normal ) const
+    {
+        // Part of the ray inside the AABB, with the slab test
+        float tEnter = 0.f;
+        float tExit = maxDistance;
+        for ( int i = 0; i < 3; ++i )
+        {
+            float lower = mAABB.cornersWorld[0][ i ] - origin[ i ];
+            float upper = mAABB.cornersWorld[1][ i ] - origin[ i ];
+            if ( std::abs( direction[ i ] ) < 1e-8f )
+            {
+                if ( lower > 0.f || upper < 0.f )
+                    return false;
+                continue;
+            }
+            float t1 = lower / direction[ i ];
+            float t2 = upper / direction[ i ];
+            tEnter = std::max( tEnter, std::min( t1, t2 ) );
+            tExit = std::min( tExit, std::max( t1, t2 ) );
+        }
+        if ( tEnter > tExit )
+            return false;
+
+        // Height of the ray over the surface
+        auto heightOver = [&]( float t )
+        {
+            glm::vec3 point = origin + t * direction;
+            return point.y - getHeight( point );
+        };
+
+        // A ray starting under the surface hits it where it enters the AABB
+        float lastT = tEnter;
+        float hitT = tEnter;
+        if ( heightOver( tEnter ) > 0.f )
+        {
+            // Length of the steps along the ray. The height along a vertical
+            // ray is linear, so a single step is enough
+            float horizontal = std::sqrt( direction.x * direction.x + direction.z * direction.z );
+            float step = tExit - tEnter;
+            if ( horizontal > 1e-8f )
+                step = std::min( step, 0.5f * std::min( mScale.x, mScale.z ) / horizontal );
+
+            // March until the ray is under the surface
+            bool crossed = false;
+            while ( lastT < tExit && !crossed )
+            {
+                float t = std::min( lastT + step, tExit );
+                if ( heightOver( t ) <= 0.f )
+                {
+                    hitT = t;
+                    crossed = true;
+                }
+                else
+                    lastT = t;
+            }
+            if ( !crossed )
+                return false;
+
+            // Bisect between the last point over the surface and the first
+            // one under it
+            for ( int k = 0; k < 16; ++k )
+            {
+                float t = 0.5f * ( lastT + hitT );
+                if ( heightOver( t ) > 0.f )
+                    lastT = t;
+                else
+                    hitT = t;
+            }
+        }
+
+        distance = hitT;
+        normal = getNormal( origin + hitT * direction );
+        return true;
+    }
+
+    // Height of the terrain under a point in world space
+    float HeightfieldCollider::getHeight( const glm::vec3& position ) const
+    {
+        int i, j;
+        float weightX, weightZ;
+        findCell( position, i, j, weightX, weightZ );
+        return mTranslation.y + mScale.y * interpolateHeight( i, j, weightX, weightZ );
+    }
+
+    // Normal of the terrain under a point in world space
+    glm::vec3 HeightfieldCollider::getNormal( const glm::vec3& position ) const
+    {
+        int i, j;
+        float weightX, weightZ;
+        findCell( position, i, j, weightX, weightZ );
+        return interpolateNormal( i, j, weightX, weightZ );
+    }
+
+    // Depth of a point under the surface, along the normal
+    float HeightfieldCollider::getPenetration( const glm::vec3& position, glm::vec3& normal ) const
+    {
+        int i, j;
+        float weightX, weightZ;
+        findCell( position, i, j, weightX, weightZ );
+        float height = mTranslation.y + mScale.y * interpolateHeight( i, j, weightX, weightZ );
+        normal = interpolateNormal( i, j, weightX, weightZ );
+
+        // Distance to the plane tangent to the surface under the point
+        return ( height - position.y ) * normal.y;
+    }
+
+    // Same for arrays of points
+    void HeightfieldCollider::getHeights( const glm::vec3* positions, int count,
+                                          float* heights ) const
+    {
+        for ( int k = 0; k < count; ++k )
+            heights[ k ] = getHeight( positions[ k ] );
+    }
+
+    void HeightfieldCollider::getNormals( const glm::vec3* positions, int count,
+                                          glm::vec3* normals ) const
+    {
+        for ( int k = 0; k < count; ++k )
+            normals[ k ] = getNormal( positions[ k ] );
+    }
+
+    void HeightfieldCollider::getPenetrations( const glm::vec3* positions, int count,
+                                               float* depths, glm::vec3* normals ) const
+    {
+        for ( int k = 0; k < count; ++k )
+            depths[ k ] = getPenetration( positions[ k ], normals[ k ] );
+    }
+
+    // Position in the grid of a point in world space. The points outside of the
+    // grid use the samples of its border
+    void HeightfieldCollider::findCell( const glm::vec3& position, int& i, int& j,
+                                        float& weightX, float& weightZ ) const
+    {
+        // Coordinates in units of samples, with the first one at zero
+        float x = ( position.x - mTranslation.x ) / mScale.x + 0.5f * ( mWidth - 1 );
+        float z = ( position.z - mTranslation.z ) / mScale.z + 0.5f * ( mHeight - 1 );
+        x = glm::clamp( x, 0.f, (float)( mWidth - 1 ) );
+        z = glm::clamp( z, 0.f, (float)( mHeight - 1 ) );
+
+        i = std::min( (int)x, mWidth - 2 );
+        j = std::min( (int)z, mHeight - 2 );
+        weightX = x - i;
+        weightZ = z - j;
+    }
+
+    // Interpolate the height in a cell of the grid, in model space
+    float HeightfieldCollider::interpolateHeight( int i, int j, float weightX,
+                                                  float weightZ ) const
+    {
+        const float* row0 = mHeights + j * mWidth + i;
+        const float* row1 = row0 + mWidth;
+        float height0 = row0[0] + weightX * ( row0[1] - row0[0] );
+        float height1 = row1[0] + weightX * ( row1[1] - row1[0] );
+        return height0 + weightZ * ( height1 - height0 );
+    }
+
+    // Interpolate the normal in a cell of the grid
+    glm::vec3 HeightfieldCollider::interpolateNormal( int i, int j, float weightX,
+                                                      float weightZ ) const
+    {
+        const float* row0 = mNormals + 4 * ( j * mWidth + i );
+        const float* row1 = row0 + 4 * mWidth;
+        glm::vec3 normal;
+        for ( int k = 0; k < 3; ++k )
+        {
+            float normal0 = row0[ k ] + weightX * ( row0[ k + 4 ] - row0[ k ] );
+            float normal1 = row1[ k ] + weightX * ( row1[ k + 4 ] - row1[ k ] );
+            normal[ k ] = normal0 + weightZ * ( normal1 - normal0 );
+        }
+        return glm::normalize( normal );
+    }
+}
@@ -0,0 +1,343 @@
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+
+#include "ImplicitSprings.h"
+#include "utils.h"
+
+using namespace GLBase;
+
+namespace Physics
+{
+    // Dot product of two vectors of the system
+    static float dot( const std::vector<glm::vec3>& a, const std::vector<glm::vec3>& b )
+    {
+        float result = 0.f;
+        for ( size_t i = 0; i < a.size(); ++i )
+            result += glm::dot( a[ i ], b[ i ] );
+        return result;
+    }
+
+    // Key of an ordered pair of nodes
+    static uint64_t pairKey( int row, int column )
+    {
+        return ( (uint64_t)row << 32 ) | (uint64_t)(uint32_t)column;
+    }
+
+    //--------------------------------------------------------------------------
+    // ImplicitSpringSolver class
+
+    // Constructor
+    ImplicitSpringSolver::ImplicitSpringSolver() :
+        mSpringVersion { -1 }
+    {
+    }
+
+    // Find the velocities of the bodies pulled by the springs after a step
+    int ImplicitSpringSolver::solve( const BodyForceRegistry& registry,
+                                     const RigidBodyStore& store, float deltaTime,
+                                     int maxIterations, float tolerance )
+    {
+        const BodyForceRegistry::SpringBucket& springs = registry.getSprings();
+        if ( registry.getSpringVersion() != mSpringVersion )
+        {
+            buildStructure( springs );
+            mSpringVersion = registry.getSpringVersion();
+        }
+        if ( mNodes.empty() )
+            return 0;
+
+        assemble( springs, store, deltaTime );
+
+        // Start from the velocities of the previous step plus their last change
+        for ( size_t i = 0; i < mNodes.size(); ++i )
+            mSolution[ i ] = mIsFixed[ i ] ? mVelocities[ i ] : mVelocities[ i ] + mChanges[ i ];
+
+        int nIterations = solveConjugateGradient( maxIterations, tolerance );
+
+        // Forces of the springs that change the velocities to the solution,
+        // together with the forces already added
+        for ( size_t i = 0; i < mNodes.size(); ++i )
+        {
+            if ( mIsFixed[ i ] )
+            {
+                mChanges[ i ] = glm::vec3( 0.f );
+                mForces[ i ] = glm::vec3( 0.f );
+                continue;
+            }
+            mChanges[ i ] = mSolution[ i ] - mVelocities[ i ];
+            float mass = 1.f / store.getInvMass( mNodes[ i ] );
+            mForces[ i ] = mass * mChanges[ i ] / deltaTime - mExternalForces[ i ];
+        }
+
+        return nIterations;
+    }
+
+    // Add the forces of the springs found by the last solve
+    void ImplicitSpringSolver::applyForces( RigidBodyStore& store )
+    {
+        for ( size_t i = 0; i < mNodes.size(); ++i )
+            if ( !mIsFixed[ i ] )
+                store.addForce( mNodes[ i ], mForces[ i ] );
+    }
+
+    // Build the nodes and the structure of the matrix from the springs.
+    // Two nodes are coupled in the matrix if each one has exactly one spring
+    // to the other, with the same parameters, so their blocks are symmetric
+    void ImplicitSpringSolver::buildStructure( const BodyForceRegistry::SpringBucket& springs )
+    {
+        int nSprings = springs.bodies.size();
+
+        // Nodes of the bodies pulled by the springs
+        std::unordered_map<int, int> nodeIds;
+        mNodes.clear();
+        for ( int body : springs.bodies )
+        {
+            if ( nodeIds.emplace( body, mNodes.size() ).second )
+                mNodes.push_back( body );
+        }
+        int nNodes = mNodes.size();
+
+        // Row and column of each spring, and number of springs of each
+        // ordered pair of nodes
+        mSpringRows.resize( nSprings );
+        mSpringColumns.resize( nSprings );
+        std::unordered_map<uint64_t, int> pairCounts;
+        for ( int s = 0; s < nSprings; ++s )
+        {
+            mSpringRows[ s ] = nodeIds[ springs.bodies[ s ] ];
+            auto other = nodeIds.find( springs.otherBodies[ s ] );
+            mSpringColumns[ s ] = other != nodeIds.end() ? other->second : -1;
+            if ( mSpringColumns[ s ] >= 0 )
+                pairCounts[ pairKey( mSpringRows[ s ], mSpringColumns[ s ] ) ]++;
+        }
+
+        // Spring of each ordered pair with a single one
+        std::unordered_map<uint64_t, int> pairSprings;
+        for ( int s = 0; s < nSprings; ++s )
+        {
+            if ( mSpringColumns[ s ] < 0 )
+                continue;
+            uint64_t key = pairKey( mSpringRows[ s ], mSpringColumns[ s ] );
+            if ( pairCounts[ key ] == 1 )
+                pairSprings[ key ] = s;
+        }
+
+        // Columns of the blocks of each row: the diagonal, and the nodes
+        // coupled to it
+        std::vector<std::vector<int>> rowColumns( nNodes );
+        std::vector<char> isCoupled( nSprings, 0 );
+        for ( int s = 0; s < nSprings; ++s )
+        {
+            int row = mSpringRows[ s ];
+            int column = mSpringColumns[ s ];
+            if ( column < 0 || column == row ||
+                 pairSprings.count( pairKey( row, column ) ) == 0 )
+                continue;
+
+            auto reverse = pairSprings.find( pairKey( column, row ) );
+            if ( reverse == pairSprings.end() )
+                continue;
+            int r = reverse->second;
+            if ( springs.springConst[ r ] != springs.springConst[ s ] ||
+                 springs.dampingCoeff[ r ] != springs.dampingCoeff[ s ] ||
+                 springs.restLength[ r ] != springs.restLength[ s ] )
+                continue;
+
+            isCoupled[ s ] = 1;
+            rowColumns[ row ].push_back( column );
+        }
+
+        // Compressed sparse rows, with the columns of each row sorted
+        mRowStart.assign( nNodes + 1, 0 );
+        mColumns.clear();
+        mDiagonals.resize( nNodes );
+        for ( int i = 0; i < nNodes; ++i )
+        {
+            std::vector<int>& columns = rowColumns[ i ];
+            columns.push_back( i );
+            std::sort( columns.begin(), columns.end() );
+            mRowStart[ i ] = mColumns.size();
+            for ( int column : columns )
+            {
+                if ( column == i )
+                    mDiagonals[ i ] = mColumns.size();
+                mColumns.push_back( column );
+            }
+        }
+        mRowStart[ nNodes ] = mColumns.size();
+        mBlocks.resize( mColumns.size() );
+
+        // Block of each coupled spring
+        mSpringBlocks.assign( nSprings, -1 );
+        for ( int s = 0; s < nSprings; ++s )
+        {
+            if ( !isCoupled[ s ] )
+                continue;
+            int row = mSpringRows[ s ];
+            auto begin = mColumns.begin() + mRowStart[ row ];
+            auto end = mColumns.begin() + mRowStart[ row + 1 ];
+            mSpringBlocks[ s ] = std::lower_bound( begin, end, mSpringColumns[ s ] ) -
+                                 mColumns.begin();
+        }
+
+        // Vectors of the system. The last changes of the velocities are lost
+        mIsFixed.resize( nNodes );
+        mVelocities.resize( nNodes );
+        mExternalForces.resize( nNodes );
+        mRhs.resize( nNodes );
+        mSolution.resize( nNodes );
+        mChanges.assign( nNodes, glm::vec3( 0.f ) );
+        mForces.assign( nNodes, glm::vec3( 0.f ) );
+        mPreconditioner.resize( nNodes );
+        mResidual.resize( nNodes );
+        mPreconditioned.resize( nNodes );
+        mDirection.resize( nNodes );
+        mProduct.resize( nNodes );
+    }
+
+    // Compute the blocks of the matrix and the right hand side.
+    // A spring of rest length L between bodies at a distance l along u gives
+    // a stiffness block k ( u u^T + ( 1 - L / l ) ( I - u u^T ) ) and a damping
+    // block c u u^T. The transverse term is dropped when the spring is
+    // compressed, so the blocks stay positive semi-definite
+    void ImplicitSpringSolver::assemble( const BodyForceRegistry::SpringBucket& springs,
+                                         const RigidBodyStore& store, float deltaTime )
+    {
+        float h = deltaTime;
+        int nNodes = mNodes.size();
+
+        // Mass of each body, and the forces and velocities at the start. Sleeping
+        // bodies and bodies with infinite mass keep their velocity
+        for ( int i = 0; i < nNodes; ++i )
+        {
+            int body = mNodes[ i ];
+            float invMass = store.getInvMass( body );
+            mIsFixed[ i ] = !store.isAwake( body ) || invMass <= 0.f;
+            mVelocities[ i ] = store.getVelocity( body );
+            mExternalForces[ i ] = store.getForce( body );
+
+            for ( int b = mRowStart[ i ]; b < mRowStart[ i + 1 ]; ++b )
+                mBlocks[ b ] = glm::mat3( 0.f );
+
+            if ( mIsFixed[ i ] )
+            {
+                mBlocks[ mDiagonals[ i ] ] = glm::mat3( 1.f );
+                mRhs[ i ] = mVelocities[ i ];
+            }
+            else
+            {
+                float mass = 1.f / invMass;
+                mBlocks[ mDiagonals[ i ] ] = glm::mat3( mass );
+                mRhs[ i ] = mass * mVelocities[ i ] + h * mExternalForces[ i ];
+            }
+        }
+
+        int nSprings = springs.bodies.size();
+        for ( int s = 0; s < nSprings; ++s )
+        {
+            int row = mSpringRows[ s ];
+            if ( mIsFixed[ row ] )
+                continue;
+
+            int other = springs.otherBodies[ s ];
+            glm::vec3 separation = store.getPosition( mNodes[ row ] ) - store.getPosition( other );
+            float distance = glm::length( separation );
+            if ( distance < 1e-6f )
+                continue;
+            glm::vec3 u = separation / distance;
+
+            float k = springs.springConst[ s ];
+            float c = springs.dampingCoeff[ s ];
+            float restLength = springs.restLength[ s ];
+            glm::vec3 velocity = mVelocities[ row ];
+            glm::vec3 otherVelocity = store.getVelocity( other );
+
+            // Force at the start of the step, as in the explicit springs
+            float relativeSpeed = glm::dot( velocity - otherVelocity, u );
+            mRhs[ row ] += h * ( k * ( restLength - distance ) - c * relativeSpeed ) * u;
+
+            // Stiffness and damping blocks
+            glm::mat3 uu = glm::outerProduct( u, u );
+            float transverse = std::max( 0.f, 1.f - restLength / distance );
+            glm::mat3 stiffness = k * ( uu + transverse * ( glm::mat3( 1.f ) - uu ) );
+            glm::mat3 damping = c * uu;
+            glm::mat3 block = h * damping + h * h * stiffness;
+
+            mBlocks[ mDiagonals[ row ] ] += block;
+            mRhs[ row ] += h * ( damping * velocity );
+
+            // Couple the other body if it moves with the system
+            int column = mSpringColumns[ s ];
+            if ( mSpringBlocks[ s ] >= 0 && !mIsFixed[ column ] )
+            {
+                mBlocks[ mSpringBlocks[ s ] ] -= block;
+                mRhs[ row ] -= h * ( damping * otherVelocity );
+            }
+        }
+
+        for ( int i = 0; i < nNodes; ++i )
+            mPreconditioner[ i ] = glm::inverse( mBlocks[ mDiagonals[ i ] ] );
+    }
+
+    // Solve the system with preconditioned conjugate gradients, starting from
+    // the current solution. It stops when the residual is below the tolerance,
+    // relative to the right hand side
+    int ImplicitSpringSolver::solveConjugateGradient( int maxIterations, float tolerance )
+    {
+        int nNodes = mNodes.size();
+
+        multiply( mSolution, mProduct );
+        for ( int i = 0; i < nNodes; ++i )
+        {
+            mResidual[ i ] = mRhs[ i ] - mProduct[ i ];
+            mPreconditioned[ i ] = mPreconditioner[ i ] * mResidual[ i ];
+            mDirection[ i ] = mPreconditioned[ i ];
+        }
+
+        float threshold = tolerance * tolerance * dot( mRhs, mRhs );
+        float rz = dot( mResidual, mPreconditioned );
+
+        int iteration = 0;
+        for ( ; iteration < maxIterations; ++iteration )
+        {
+            if ( dot( mResidual, mResidual ) <= threshold )
+                break;
+
+            multiply( mDirection, mProduct );
+            float pAp = dot( mDirection, mProduct );
+            if ( pAp <= 0.f )
+                break;
+            float alpha = rz / pAp;
+
+            for ( int i = 0; i < nNodes; ++i )
+            {
+                mSolution[ i ] += alpha * mDirection[ i ];
+                mResidual[ i ] -= alpha * mProduct[ i ];
+                mPreconditioned[ i ] = mPreconditioner[ i ] * mResidual[ i ];
+            }
+
+            float rzNew = dot( mResidual, mPreconditioned );
+            float beta = rzNew / rz;
+            rz = rzNew;
+            for ( int i = 0; i < nNodes; ++i )
+                mDirection[ i ] = mPreconditioned[ i ] + beta * mDirection[ i ];
+        }
+
+        return iteration;
+    }
+
+    // Product of the matrix with a vector
+    void ImplicitSpringSolver::multiply( const std::vector<glm::vec3>& x,
+                                         std::vector<glm::vec3>& y ) const
+    {
+        int nNodes = mNodes.size();
+        for ( int i = 0; i < nNodes; ++i )
+        {
+            glm::vec3 sum( 0.f );
+            for ( int b = mRowStart[ i ]; b < mRowStart[ i + 1 ]; ++b )
+                sum += mBlocks[ b ] * x[ mColumns[ b ] ];
+            y[ i ] = sum;
+        }
+    }
+}
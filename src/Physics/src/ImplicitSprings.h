@@ -0,0 +1,110 @@
+#ifndef IMPLICIT_SPRINGS_H
+#define IMPLICIT_SPRINGS_H
+
+#include "GLBase.h"
+#include "PhysicsBody.h"
+#include "ForceRegistry.h"
+#include "RigidBodyStore.h"
+
+using namespace GLBase;
+
+namespace Physics
+{
+    /*
+       Solver for the springs of a force registry with backward Euler.
+       Stiff springs integrated explicitly need very short steps to be
+       stable. Here the velocities of the bodies pulled by the springs at the
+       end of the step are found with the forces evaluated at that time,
+       linearized around the start of the step:
+           ( M - h dF/dv - h^2 dF/dx ) v' = M v + h F - h dF/dv v
+       The matrix has one 3x3 block for each body and one for each pair of
+       bodies joined by springs in both directions, stored in compressed
+       sparse rows. The structure is built again only when springs are added
+       or removed, and the values in each step. The springs that only pull one
+       of their bodies, and the ones to sleeping bodies or bodies with infinite
+       mass, are coupled explicitly to the velocity of the other body, so the
+       matrix is symmetric and positive definite. It is solved with conjugate
+       gradients, with the inverses of the diagonal blocks as preconditioner,
+       starting from the velocities of the previous step plus their last
+       change.
+       The velocities found are given to the integrator as the forces that
+       change them, so the springs work with the rest of the forces and with
+       all the integrators.
+    */
+    class ImplicitSpringSolver
+    {
+        public:
+            // Constructor
+            ImplicitSpringSolver();
+
+            // Find the velocities of the bodies pulled by the springs of the
+            // registry after a step of the given duration, and the forces of
+            // the springs that give them. The state of the bodies is read from
+            // the pool, and the forces already added to them are part of the
+            // step. Returns the number of iterations
+            int solve( const BodyForceRegistry& registry, const RigidBodyStore& store,
+                       float deltaTime, int maxIterations, float tolerance );
+
+            // Add the forces of the springs found by the last solve to the pool
+            void applyForces( RigidBodyStore& store );
+
+        private:
+            // Version of the springs of the registry used to build the
+            // structure, or -1 if it has not been built
+            int mSpringVersion;
+
+            // Identifiers in the pool of the bodies pulled by the springs, with
+            // one row of blocks each. Fixed bodies keep their velocity
+            std::vector<int> mNodes;
+            std::vector<char> mIsFixed;
+
+            // Blocks of the matrix in compressed sparse rows: first block of
+            // each row, column of each block, and position of the diagonal one
+            std::vector<int> mRowStart;
+            std::vector<int> mColumns;
+            std::vector<int> mDiagonals;
+            std::vector<glm::mat3> mBlocks;
+
+            // Row of each spring, node of its other body or -1, and block that
+            // couples them or -1 if they are coupled explicitly
+            std::vector<int> mSpringRows;
+            std::vector<int> mSpringColumns;
+            std::vector<int> mSpringBlocks;
+
+            // Velocities at the start of the step, forces added before the
+            // springs, right hand side and solution of the system
+            std::vector<glm::vec3> mVelocities;
+            std::vector<glm::vec3> mExternalForces;
+            std::vector<glm::vec3> mRhs;
+            std::vector<glm::vec3> mSolution;
+
+            // Change of the velocities in the last step, used to start the
+            // next one, and forces of the springs found
+            std::vector<glm::vec3> mChanges;
+            std::vector<glm::vec3> mForces;
+
+            // Inverses of the diagonal blocks, and auxiliary vectors of the
+            // conjugate gradient
+            std::vector<glm::mat3> mPreconditioner;
+            std::vector<glm::vec3> mResidual;
+            std::vector<glm::vec3> mPreconditioned;
+            std::vector<glm::vec3> mDirection;
+            std::vector<glm::vec3> mProduct;
+
+            // Build the nodes and the structure of the matrix from the springs
+            void buildStructure( const BodyForceRegistry::SpringBucket& springs );
+
+            // Compute the blocks of the matrix and the right hand side
+            void assemble( const BodyForceRegistry::SpringBucket& springs,
+                           const RigidBodyStore& store, float deltaTime );
+
+            // Solve the system with preconditioned conjugate gradients, and
+            // return the number of iterations
+            int solveConjugateGradient( int maxIterations, float tolerance );
+
+            // Product of the matrix with a vector
+            void multiply( const std::vector<glm::vec3>& x, std::vector<glm::vec3>& y ) const;
+    };
+}
+
+#endif
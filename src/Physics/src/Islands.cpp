@@ -0,0 +1,234 @@
+#include <limits>
+
+#include "Islands.h"
+#include "utils.h"
+
+using namespace GLBase;
+
+namespace Physics
+{
+    //--------------------------------------------------------------------------
+    // IslandManager class
+
+    // Constructor
+    IslandManager::IslandManager()
+    {
+    }
+
+    // Build the islands from the bodies and the manifolds with points
+    void IslandManager::build( const std::vector<RigidBody*>& bodies,
+                               const std::vector<ContactManifold*>& manifolds )
+    {
+        // The solver indices are used as the indices of the bodies in the
+        // union-find forest until the islands are built
+        int nBodies = bodies.size();
+        mParents.resize( nBodies + 1 );
+        for ( int i = 1; i <= nBodies; ++i )
+        {
+            mParents[ i ] = i;
+            bodies[ i - 1 ]->mSolverIndex = i;
+        }
+
+        // Only the bodies that can be moved by the contacts are in the islands.
+        // The rest have a solver index of zero, or infinite mass
+        auto isDynamic = [&]( int index )
+        {
+            return index > 0 && bodies[ index - 1 ]->getInvMass() > 0.f;
+        };
+
+        // Join the bodies in contact
+        for ( auto manifold : manifolds )
+        {
+            int indexA = manifold->bodyA->mSolverIndex;
+            int indexB = manifold->bodyB->mSolverIndex;
+            if ( isDynamic( indexA ) && isDynamic( indexB ) )
+                unite( indexA, indexB );
+        }
+
+        // Create the islands in the order of their first body, and count
+        // their bodies and manifolds
+        mIslandIds.assign( nBodies + 1, -1 );
+        mIslands.clear();
+        for ( int i = 1; i <= nBodies; ++i )
+        {
+            if ( !isDynamic( i ) )
+                continue;
+
+            int root = findRoot( i );
+            if ( mIslandIds[ root ] < 0 )
+            {
+                mIslandIds[ root ] = mIslands.size();
+                mIslands.push_back( { 0, 0, 0, 0, false } );
+            }
+
+            Island& island = mIslands[ mIslandIds[ root ] ];
+            island.nBodies++;
+            if ( bodies[ i - 1 ]->isAwake() )
+                island.isAwake = true;
+        }
+
+        // A manifold belongs to the island of its dynamic bodies. The islands
+        // in contact with a moving body of infinite mass are awake too
+        for ( auto manifold : manifolds )
+        {
+            int index = manifold->bodyA->mSolverIndex;
+            int other = manifold->bodyB->mSolverIndex;
+            if ( !isDynamic( index ) )
+                std::swap( index, other );
+            if ( !isDynamic( index ) )
+                continue;
+
+            Island& island = mIslands[ mIslandIds[ findRoot( index ) ] ];
+            island.nManifolds++;
+            if ( other > 0 && !isDynamic( other ) &&
+                 bodies[ other - 1 ]->getVelocity() != glm::vec3( 0.f ) )
+                island.isAwake = true;
+        }
+
+        // Place the islands one after another, and use the counters as the
+        // positions where the next element of each island is written
+        int firstBody = 0;
+        int firstManifold = 0;
+        for ( auto& island : mIslands )
+        {
+            island.firstBody = firstBody;
+            island.firstManifold = firstManifold;
+            firstBody += island.nBodies;
+            firstManifold += island.nManifolds;
+            island.nBodies = 0;
+            island.nManifolds = 0;
+        }
+
+        mBodies.resize( firstBody );
+        mManifolds.resize( firstManifold );
+        mKinematicBodies.clear();
+
+        for ( int i = 1; i <= nBodies; ++i )
+        {
+            if ( !isDynamic( i ) )
+            {
+                mKinematicBodies.push_back( bodies[ i - 1 ] );
+                continue;
+            }
+            Island& island = mIslands[ mIslandIds[ findRoot( i ) ] ];
+            mBodies[ island.firstBody + island.nBodies++ ] = bodies[ i - 1 ];
+        }
+
+        for ( auto manifold : manifolds )
+        {
+            int index = manifold->bodyA->mSolverIndex;
+            if ( !isDynamic( index ) )
+                index = manifold->bodyB->mSolverIndex;
+            if ( !isDynamic( index ) )
+                continue;
+            Island& island = mIslands[ mIslandIds[ findRoot( index ) ] ];
+            mManifolds[ island.firstManifold + island.nManifolds++ ] = manifold;
+        }
+
+        // Set the solver indices: the position of the body in its island plus
+        // one for the dynamic bodies, and minus the position in the list plus
+        // one for the ones with infinite mass
+        for ( auto& island : mIslands )
+        {
+            for ( int i = 0; i < island.nBodies; ++i )
+                mBodies[ island.firstBody + i ]->mSolverIndex = i + 1;
+        }
+        for ( int i = 0; i < (int)mKinematicBodies.size(); ++i )
+            mKinematicBodies[ i ]->mSolverIndex = -( i + 1 );
+    }
+
+    // Getters
+    const std::vector<Island>& IslandManager::getIslands() const
+    {
+        return mIslands;
+    }
+
+    const std::vector<RigidBody*>& IslandManager::getBodies() const
+    {
+        return mBodies;
+    }
+
+    const std::vector<ContactManifold*>& IslandManager::getManifolds() const
+    {
+        return mManifolds;
+    }
+
+    const std::vector<RigidBody*>& IslandManager::getKinematicBodies() const
+    {
+        return mKinematicBodies;
+    }
+
+    // Wake up all the bodies of the awake islands
+    void IslandManager::wakeUpIslands()
+    {
+        for ( auto& island : mIslands )
+        {
+            if ( !island.isAwake )
+                continue;
+
+            for ( int i = 0; i < island.nBodies; ++i )
+            {
+                RigidBody* body = mBodies[ island.firstBody + i ];
+                if ( !body->isAwake() )
+                    body->setAwake( true );
+            }
+        }
+    }
+
+    // Update the time at rest of the bodies of the awake islands, and put to
+    // sleep the islands that have been at rest long enough
+    void IslandManager::updateSleep( const SleepSettings& settings, float deltaTime )
+    {
+        if ( !settings.enabled )
+            return;
+
+        for ( auto& island : mIslands )
+        {
+            if ( !island.isAwake )
+                continue;
+
+            // The island can sleep when the body that has been moving most
+            // recently has been at rest long enough
+            float minSleepTime = std::numeric_limits<float>::max();
+            for ( int i = 0; i < island.nBodies; ++i )
+            {
+                RigidBody* body = mBodies[ island.firstBody + i ];
+                float sleepTime = body->updateSleepTime( deltaTime,
+                                                         settings.velocityThreshold );
+                minSleepTime = std::min( minSleepTime, sleepTime );
+            }
+
+            if ( minSleepTime < settings.timeToSleep )
+                continue;
+
+            for ( int i = 0; i < island.nBodies; ++i )
+                mBodies[ island.firstBody + i ]->setAwake( false );
+            island.isAwake = false;
+        }
+    }
+
+    // Root of the tree of a body, halving the path to it
+    int IslandManager::findRoot( int index )
+    {
+        while ( mParents[ index ] != index )
+        {
+            mParents[ index ] = mParents[ mParents[ index ] ];
+            index = mParents[ index ];
+        }
+        return index;
+    }
+
+    // Join the trees of two bodies. The root with the lowest index is kept,
+    // so the result does not depend on the order of the contacts
+    void IslandManager::unite( int indexA, int indexB )
+    {
+        int rootA = findRoot( indexA );
+        int rootB = findRoot( indexB );
+        if ( rootA == rootB )
+            return;
+        if ( rootA < rootB )
+            mParents[ rootB ] = rootA;
+        else
+            mParents[ rootA ] = rootB;
+    }
+}
@@ -0,0 +1,92 @@
+#ifndef ISLANDS_H
+#define ISLANDS_H
+
+#include "GLBase.h"
+#include "PhysicsBody.h"
+#include "ContactManifold.h"
+
+using namespace GLBase;
+
+namespace Physics
+{
+    // Parameters used to put bodies to sleep
+    struct SleepSettings
+    {
+        bool enabled = true;
+        // Speed below which a body is considered to be at rest
+        float velocityThreshold = 0.05f;
+        // Time that all the bodies of an island must be at rest before the
+        // island is put to sleep
+        float timeToSleep = 0.5f;
+    };
+
+    // Group of bodies connected by contacts. The bodies and manifolds of each
+    // island are contiguous in the arrays of the IslandManager
+    struct Island
+    {
+        int firstBody;
+        int nBodies;
+        int firstManifold;
+        int nManifolds;
+        // True if any of the bodies is awake, or the island is in contact with
+        // a moving body of infinite mass
+        bool isAwake;
+    };
+
+    // Split the bodies of a world into islands, the connected components of
+    // the graph whose nodes are the dynamic bodies and whose edges are their
+    // contacts. Bodies that do not move (static ones, or with infinite mass)
+    // do not connect islands, so a floor does not join everything on it.
+    // The components are found with union-find, and the islands are sorted by
+    // the lowest index of their bodies, keeping the order of the bodies and
+    // manifolds inside them, so the result only depends on the input order.
+    class IslandManager
+    {
+        public:
+            // Constructor
+            IslandManager();
+
+            // Build the islands from the bodies and the manifolds with points.
+            // The solver index of each body is set to its position in its
+            // island plus one, or to a negative value for the bodies with
+            // infinite mass, which are in no island
+            void build( const std::vector<RigidBody*>& bodies,
+                        const std::vector<ContactManifold*>& manifolds );
+
+            // Getters
+            const std::vector<Island>& getIslands() const;
+            const std::vector<RigidBody*>& getBodies() const;
+            const std::vector<ContactManifold*>& getManifolds() const;
+            // Rigid bodies with infinite mass, which are in no island
+            const std::vector<RigidBody*>& getKinematicBodies() const;
+
+            // Wake up all the bodies of the awake islands: the ones with an
+            // awake body, or in contact with a moving body of infinite mass
+            void wakeUpIslands();
+
+            // Update the time at rest of the bodies of the awake islands, and
+            // put to sleep the islands that have been at rest long enough
+            void updateSleep( const SleepSettings& settings, float deltaTime );
+
+        private:
+            // Parent of each body in the union-find forest, indexed by the
+            // solver index of the body. The first element is not used
+            std::vector<int> mParents;
+            // Island of each root, or -1
+            std::vector<int> mIslandIds;
+
+            std::vector<Island> mIslands;
+            // Bodies and manifolds, grouped by island
+            std::vector<RigidBody*> mBodies;
+            std::vector<ContactManifold*> mManifolds;
+            std::vector<RigidBody*> mKinematicBodies;
+
+            // Root of the tree of a body, halving the path to it
+            int findRoot( int index );
+
+            // Join the trees of two bodies
+            void unite( int indexA, int indexB );
+    };
+}
+
+#endif
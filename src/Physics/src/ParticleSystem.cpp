@@ -44,8 +44,9 @@ namespace Physics
         // Store the pointer also in the list of elementary objects in the scene
         elemObjs.push_back( mParticleSystemGL );
 
-        // Compute the model matrix of the geometry object
-        computeModelMatrix();
+        // Set the model matrix of the geometry object
+        mTransformDirty = true;
+        updateTransform();
     }
 
     // Set gravity of particles
@@ -143,8 +144,8 @@ namespace Physics
         mPosition += mVelocity * deltaTime;
 
         // Update the model matrix 
-        // computeModelMatrix( mPosition, mRotationMatrix, mScale );
-        computeModelMatrix();
+        mTransformDirty = true;
+        updateTransform();
 
         // // Move the collider
         // mCollider->moveCollider( mModelMatrix );
@@ -6,19 +6,45 @@ using namespace GLBase;
 
 namespace Physics
 {
+    // Quaternion of a rotation given by an angle in degrees and an axis
+    static glm::quat angleAxisDegrees( float angle, const glm::vec3& axis )
+    {
+        if ( angle == 0.f )
+            return glm::quat( 1.f, 0.f, 0.f, 0.f );
+        return glm::angleAxis( glm::radians( angle ), glm::normalize( axis ) );
+    }
+
+    // Model matrix of a transform. The columns of the rotation are scaled
+    // directly, instead of multiplying by translation and scale matrices
+    static glm::mat4 composeModelMatrix( const glm::vec3& position,
+                                         const glm::mat3& rotation,
+                                         const glm::vec3& scale )
+    {
+        glm::mat4 modelMatrix;
+        modelMatrix[0] = glm::vec4( rotation[0] * scale.x, 0.f );
+        modelMatrix[1] = glm::vec4( rotation[1] * scale.y, 0.f );
+        modelMatrix[2] = glm::vec4( rotation[2] * scale.z, 0.f );
+        modelMatrix[3] = glm::vec4( position, 1.f );
+        return modelMatrix;
+    }
+
     //--------------------------------------------------------------------------
     // CollisionBody class
 
     // Constructor
     CollisionBody::CollisionBody( glm::vec3 position, glm::vec3 scale,
                                   float rotationAngle, glm::vec3 rotationAxis ) :
-        mPosition { position }, mScale { scale }
+        mCollider { nullptr }, mSolverIndex { 0 }, mPosition { position }, mScale { scale },
+        mOrientation { angleAxisDegrees( rotationAngle, rotationAxis ) },
+        mRotationMatrix { glm::mat4_cast( mOrientation ) }, mTransformDirty { true },
+        mGeometryObject { nullptr }, mMaterial { nullptr },
+        mFriction { 0.5f }, mRestitution { 0.f },
+        mCollisionCategory { 1u }, mCollisionMask { 0xffffffffu }
     {
-        // Compute the rotation matrix from the angle and axis given
-        mRotationMatrix = glm::mat4( 1.f );
-        if (rotationAngle != 0.)
-            mRotationMatrix = glm::rotate( mRotationMatrix, glm::radians(rotationAngle), 
-                                           glm::normalize(rotationAxis) );
+        mModelMatrix = composeModelMatrix( mPosition, glm::mat3( mRotationMatrix ), mScale );
+
+        // There is no previous step yet
+        storePreviousTransform();
     }
 
     // Destructor
@@ -38,8 +64,9 @@ namespace Physics
         // Store the pointer also in the list of elementary objects in the scene
         elemObjs.push_back( objectPtr );
 
-        // Compute the model matrix of the geometry object
-        computeModelMatrix();
+        // Set the model matrix of the geometry object
+        mTransformDirty = true;
+        updateTransform();
     }
 
     // Add a geometrical object that will not be drawn
@@ -48,8 +75,9 @@ namespace Physics
         // Store the pointer to the geometry as a member object
         mGeometryObject = objectPtr;
 
-        // Compute the model matrix of the geometry object
-        computeModelMatrix();
+        // Set the model matrix of the geometry object
+        mTransformDirty = true;
+        updateTransform();
     }
 
     // Add collider
@@ -63,7 +91,8 @@ namespace Physics
         mCollider = collider;
 
         // Pass the transformation matrix to the collider
-        mCollider->moveCollider( mModelMatrix );
+        mTransformDirty = true;
+        updateTransform();
 
         //
         //
@@ -80,34 +109,40 @@ namespace Physics
     void CollisionBody::setPosition( glm::vec3 position )
     {
         mPosition = position;
-
-        // Update the model matrix of the geometry object
-        // mModelMatrix = computeModelMatrix( mPosition, mRotationMatrix, mScale );
-        computeModelMatrix();
+        // The body jumps to the new position, without interpolation
+        mPreviousPosition = position;
+        mTransformDirty = true;
     }
 
     // Set Scale
     void CollisionBody::setScale( glm::vec3 scale )
     {
         mScale = scale;
-
-        // Update the model matrix 
-        // mModelMatrix = computeModelMatrix( mPosition, mRotationMatrix, mScale );
-        computeModelMatrix();
+        mTransformDirty = true;
     }
 
     // Set rotation
     void CollisionBody::setRotation( float angle, glm::vec3 axis )
     {
-        // Compute the rotation matrix from the angle and axis given
-        mRotationMatrix = glm::mat4( 1.f );
-        if (angle != 0.)
-            mRotationMatrix = glm::rotate( mRotationMatrix, glm::radians(angle), 
-                                           glm::normalize(axis) );
+        setOrientation( angleAxisDegrees( angle, axis ) );
+    }
 
-        // Update the model matrix 
-        // mModelMatrix = computeModelMatrix( mPosition, mRotationMatrix, mScale );
-        computeModelMatrix();
+    void CollisionBody::setOrientation( const glm::quat& orientation )
+    {
+        mOrientation = glm::normalize( orientation );
+        // The body jumps to the new orientation, without interpolation
+        mPreviousOrientation = mOrientation;
+        mTransformDirty = true;
+    }
+
+    // Set the properties of the surface used in the contacts
+    void CollisionBody::setFriction( float friction )
+    {
+        mFriction = friction;
+    }
+    void CollisionBody::setRestitution( float restitution )
+    {
+        mRestitution = restitution;
     }
 
     // Getters
@@ -115,21 +150,108 @@ namespace Physics
     {
         return mPosition;
     }
+    const glm::quat& CollisionBody::getOrientation() const
+    {
+        return mOrientation;
+    }
+    const glm::mat4& CollisionBody::getRotationMatrix() const
+    {
+        return mRotationMatrix;
+    }
+    float CollisionBody::getFriction() const
+    {
+        return mFriction;
+    }
+    float CollisionBody::getRestitution() const
+    {
+        return mRestitution;
+    }
+
+    // Check if the body can move
+    bool CollisionBody::isAwake() const
+    {
+        return false;
+    }
+
+    // Check if the body has dynamics
+    bool CollisionBody::isDynamic() const
+    {
+        return false;
+    }
+
+    // Collision filtering
+    void CollisionBody::setCollisionFilter( uint32_t category, uint32_t mask )
+    {
+        mCollisionCategory = category;
+        mCollisionMask = mask;
+    }
+
+    uint32_t CollisionBody::getCollisionCategory() const
+    {
+        return mCollisionCategory;
+    }
+
+    uint32_t CollisionBody::getCollisionMask() const
+    {
+        return mCollisionMask;
+    }
+
+    // Check if the filters of two bodies let them collide
+    bool CollisionBody::canCollide( const CollisionBody* other ) const
+    {
+        return ( mCollisionCategory & other->mCollisionMask ) != 0 &&
+               ( other->mCollisionCategory & mCollisionMask ) != 0;
+    }
+
+    // If the transform changed, rebuild the model matrices, which the
+    // geometry object shares with the body, and move the collider
+    void CollisionBody::updateTransform()
+    {
+        if ( rebuildTransform() && mCollider != nullptr )
+            mCollider->moveCollider( mModelMatrix );
+    }
+
+    // Rebuild the model matrices without moving the collider
+    bool CollisionBody::rebuildTransform()
+    {
+        if ( !mTransformDirty )
+            return false;
+
+        mRotationMatrix = glm::mat4_cast( mOrientation );
+        mModelMatrix = composeModelMatrix( mPosition, glm::mat3( mRotationMatrix ), mScale );
+
+        if ( mGeometryObject != nullptr )
+            mGeometryObject->setModelMatrix( mModelMatrix );
+
+        mTransformDirty = false;
+        return true;
+    }
+
+    bool CollisionBody::isTransformDirty() const
+    {
+        return mTransformDirty;
+    }
+
+    // Keep the current transform as the one of the previous step
+    void CollisionBody::storePreviousTransform()
+    {
+        mPreviousPosition = mPosition;
+        mPreviousOrientation = mOrientation;
+    }
 
-    // Method to compute a model matrix 
-    // glm::mat4 CollisionBody::computeModelMatrix( const glm::vec3& translation, 
-    //                                              const glm::mat4 rotationMatrix, 
-    //                                              const glm::vec3& scale )
-    void CollisionBody::computeModelMatrix()
+    // Set the model matrix of the geometry object between the previous and the
+    // current transforms. The orientations are interpolated with slerp
+    void CollisionBody::interpolateTransform( float alpha )
     {
-        mModelMatrix = glm::mat4( 1.f );
-        mModelMatrix = glm::translate(mModelMatrix, mPosition);
-        mModelMatrix = mModelMatrix * mRotationMatrix;
-        mModelMatrix = glm::scale(mModelMatrix, mScale);
-        // // return modelMatrix;
+        if ( mGeometryObject == nullptr )
+            return;
 
-        // Compute the model matrix for the geometry object
-        mGeometryObject->setModelMatrix( mPosition, mRotationMatrix, mScale );
+        glm::vec3 position = glm::mix( mPreviousPosition, mPosition, alpha );
+        glm::mat3 rotation( mRotationMatrix );
+        if ( mPreviousOrientation != mOrientation )
+            rotation = glm::mat3_cast( glm::slerp( mPreviousOrientation, mOrientation, alpha ) );
+
+        mGeometryObject->setModelMatrix( composeModelMatrix( position, rotation, mScale ) );
     }
 
     // Draw
@@ -152,31 +274,81 @@ namespace Physics
                           float rotationAngle, glm::vec3 rotationAxis,
                           float mass, glm::vec3 velocity ) :
         CollisionBody( position, scale, rotationAngle, rotationAxis ),      // Initialize the base class explicitly
-        mMassInver { 1.f / mass },
-        mVelocity { velocity }, 
         // mAcceleration { glm::vec3( 0.f, 0.f, 0.f ) },
-        mDamping { 0.995f },
-        mForceAccum { glm::vec3( 0.f, 0.f, 0.f ) }
+        mStore { new RigidBodyStore() },
+        mOwnsStore { true },
+        mSleepTime { 0.f },
+        mContinuousCollision { false }
         // mTorqueAccum { glm::vec3( 0.f, 0.f, 0.f ) },
         // //
         // mAngularVelocity { glm::vec3( 0.f, 0.f, 0.f ) },
         // mForce { glm::vec3( 0.f, 0.f, 0.f ) }, 
         // mTorque { glm::vec3( 0.f, 0.f, 0.f ) }
     {
+        // The body starts in a pool of its own, with the default damping
+        mStoreId = mStore->add( position, velocity, 1.f / mass, 0.995f );
         setMass( mass );
 
     }
 
+    // Destructor
+    RigidBody::~RigidBody()
+    {
+        if ( mOwnsStore )
+            delete mStore;
+    }
+
+    // Move the dynamic state of the body to the given pool
+    void RigidBody::moveToStore( RigidBodyStore* store )
+    {
+        int id = store->add( mStore->getPosition( mStoreId ), mStore->getVelocity( mStoreId ),
+                             mStore->getInvMass( mStoreId ), mStore->getDamping( mStoreId ) );
+        store->addForce( id, mStore->getForce( mStoreId ) );
+        store->setAwake( id, mStore->isAwake( mStoreId ) );
+
+        if ( mOwnsStore )
+            delete mStore;
+        mStore = store;
+        mStoreId = id;
+        mOwnsStore = false;
+    }
+
+    // Pool with the dynamic state, and identifier of the body in it
+    RigidBodyStore* RigidBody::getStore() const
+    {
+        return mStore;
+    }
+
+    int RigidBody::getStoreId() const
+    {
+        return mStoreId;
+    }
+
+    // Set position
+    void RigidBody::setPosition( glm::vec3 position )
+    {
+        mStore->setPosition( mStoreId, position );
+        CollisionBody::setPosition( position );
+    }
+
+    // Position in the pool
+    glm::vec3 RigidBody::getPosition()
+    {
+        return mStore->getPosition( mStoreId );
+    }
+
     // Set velocity and acceleration
     void RigidBody::setVelocity( glm::vec3 velocity )
     {
-        mVelocity = velocity;
+        mStore->setVelocity( mStoreId, velocity );
+        if ( !isAwake() )
+            setAwake( true );
     }
 
     // Set velocity damping
     void RigidBody::setDamping( float damping )
     {
-        mDamping = damping;
+        mStore->setDamping( mStoreId, damping );
     }
 
     // Set mass 
@@ -185,17 +357,17 @@ namespace Physics
         if ( mass < 0.f )
         {
             mMass = -1.f;
-            mMassInver = 0.f;
+            mStore->setInvMass( mStoreId, 0.f );
         }
         else
         {
             mMass = mass;
-            mMassInver = 1.f / mass;
+            mStore->setInvMass( mStoreId, 1.f / mass );
         }
     }
     void RigidBody::setInvMass( float invMass )
     {
-        mMassInver = invMass;
+        mStore->setInvMass( mStoreId, invMass );
         if ( invMass == 0.f )
             mMass = -1.f;
         else
@@ -207,51 +379,115 @@ namespace Physics
     {
         return mMass;
     }
+    float RigidBody::getInvMass() const
+    {
+        return mStore->getInvMass( mStoreId );
+    }
     glm::vec3 RigidBody::getVelocity()
     {
-        return mVelocity;
+        return mStore->getVelocity( mStoreId );
+    }
+
+    glm::vec3 RigidBody::getForce() const
+    {
+        return mStore->getForce( mStoreId );
     }
 
     // Check if it has infinite mass
     bool RigidBody::hasInfiniteMass()
     {
-        return mMassInver < 0.f;
+        return getInvMass() < 0.f;
     }
 
     // Add a force
     void RigidBody::addForce( const glm::vec3& force )
     {
-        mForceAccum += force;
+        mStore->addForce( mStoreId, force );
+        if ( !isAwake() )
+            setAwake( true );
+    }
+
+    // Sleeping state
+    bool RigidBody::isAwake() const
+    {
+        return mStore->isAwake( mStoreId );
+    }
+
+    // Rigid bodies have dynamics
+    bool RigidBody::isDynamic() const
+    {
+        return true;
+    }
+
+    void RigidBody::setAwake( bool awake )
+    {
+        mStore->setAwake( mStoreId, awake );
+        mSleepTime = 0.f;
+
+        // A sleeping body does not move
+        if ( !awake )
+        {
+            mStore->setVelocity( mStoreId, glm::vec3( 0.f, 0.f, 0.f ) );
+            clearAccumulators();
+        }
+    }
+
+    // Update the time that the body has been at rest, and return it
+    float RigidBody::updateSleepTime( float deltaTime, float velocityThreshold )
+    {
+        glm::vec3 velocity = getVelocity();
+        if ( glm::dot( velocity, velocity ) > velocityThreshold * velocityThreshold )
+            mSleepTime = 0.f;
+        else
+            mSleepTime += deltaTime;
+        return mSleepTime;
     }
 
     // Set the accumulators to zero
     void RigidBody::clearAccumulators()
     {
-        mForceAccum = glm::vec3( 0.f, 0.f, 0.f );
+        mStore->clearForce( mStoreId );
         // mTorqueAccum = glm::vec3( 0.f, 0.f, 0.f );
     }
 
-    // Integrate forward in time by the given duration
-    void RigidBody::integrate( float deltaTime )
+    // Copy the position integrated in the pool to the transform. The model
+    // matrix and the collider are updated later
+    void RigidBody::syncPosition()
     {
-        // Compute acceleration from the force
-        glm::vec3 resultingAcc = mForceAccum * mMassInver;
-        // Update linear velocity
-        mVelocity += resultingAcc * deltaTime;
-        // Drag on the velocity, so it does not increase due to numerical errors
-        mVelocity *= powf( mDamping, deltaTime );
+        mPosition = mStore->getPosition( mStoreId );
+        mTransformDirty = true;
+    }
 
-        // Update the position
-        mPosition += mVelocity * deltaTime;
+    // Move the body by the given displacement. The collider is moved by
+    // updateTransform
+    void RigidBody::translate( const glm::vec3& displacement )
+    {
+        mPosition += displacement;
+        mStore->setPosition( mStoreId, mPosition );
+        mTransformDirty = true;
+    }
 
-        // Update the model matrix 
-        // computeModelMatrix( mPosition, mRotationMatrix, mScale );
-        computeModelMatrix();
+    // Move the position in the pool after an integration, with the velocity
+    // that takes the body there
+    void RigidBody::correctPosition( const glm::vec3& correction, float deltaTime )
+    {
+        mStore->correctPosition( mStoreId, correction, deltaTime );
+    }
 
-        // Move the collider
-        mCollider->moveCollider( mModelMatrix );
+    // Continuous collision detection
+    void RigidBody::setContinuousCollision( bool enabled )
+    {
+        mContinuousCollision = enabled;
+    }
+
+    bool RigidBody::getContinuousCollision() const
+    {
+        return mContinuousCollision;
+    }
 
-        // Reset the net force and torque on the object
-        clearAccumulators();
+    // Displacement in the last integration
+    glm::vec3 RigidBody::getDisplacement() const
+    {
+        return mStore->getDisplacement( mStoreId );
     }
 }
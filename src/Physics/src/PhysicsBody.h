@@ -4,9 +4,12 @@
 // #include "Physics.h"
 
 // #include "ForceGenerator.h"
+#include <glm/gtc/quaternion.hpp>
+
 #include "GLBase.h"
 #include "GLGeometry.h"
 #include "Colliders.h"
+#include "RigidBodyStore.h"
 
 using namespace GLGeometry;
 using namespace GLBase;
@@ -16,33 +19,33 @@ namespace Physics
     // Constants
     const float RAD_TO_DEG = 180.f / M_PI;
 
-    // Struct that describes the collision points between two objects A and B
-    struct CollisionPoints
-    {
-        glm::vec3 A;       // Furthest point of A into B
-        glm::vec3 B;       // Furthest point of B into A
-        glm::vec3 Normal;  // B – A normalized
-        float Depth;       // Length of B – A
-        bool HasCollision;
-    };
-
-    // Class for objects with collisions
+    // Class for objects with collisions.
+    // The transform is given by the position, the orientation as a quaternion
+    // and the scale. Changing any of them only marks the transform as dirty,
+    // and the model matrices and the collider are updated later by
+    // updateTransform, once for all the changes. The worlds do it for all the
+    // bodies at once in each step
     class CollisionBody
     {
         public:
             // Collider
             Collider* mCollider;
 
-            // Model matrix 
+            // Model matrix, rebuilt by updateTransform
             glm::mat4 mModelMatrix;
 
+            // Index of the body in its island, used by the collision solver.
+            // Zero for static bodies, and negative for rigid bodies with
+            // infinite mass
+            int mSolverIndex;
+
             // Constructor
             // CollisionBody( glm::vec3 position, glm::vec3 scale );
             CollisionBody( glm::vec3 position, glm::vec3 scale,
                            float rotationAngle, glm::vec3 rotationAxis );
 
             // Destructor
-            ~CollisionBody();
+            virtual ~CollisionBody();
 
             // Add geometrical object, and copy it to the list of elementary objects of
             // the GLSandbox class
@@ -55,36 +58,104 @@ namespace Physics
             // Add material
             void addMaterial( Material* material );
             // Set position
-            void setPosition( glm::vec3 position );
+            virtual void setPosition( glm::vec3 position );
             // Set Scale
             void setScale( glm::vec3 scale );
-            // Set rotation
+            // Set rotation, from an angle in degrees and an axis, or from a
+            // quaternion
             void setRotation( float angle, glm::vec3 axis );
+            void setOrientation( const glm::quat& orientation );
+            // Set the properties of the surface used in the contacts
+            void setFriction( float friction );
+            void setRestitution( float restitution );
 
             // Getters
             glm::vec3 getPosition();
-
-            // Method to compute a model matrix 
-            void computeModelMatrix();
+            const glm::quat& getOrientation() const;
+            // Rotation matrix, rebuilt with the model matrix
+            const glm::mat4& getRotationMatrix() const;
+            float getFriction() const;
+            float getRestitution() const;
+
+            // Check if the body can move. Bodies without dynamics never do
+            virtual bool isAwake() const;
+
+            // Check if the body has dynamics. Pairs of bodies without them are
+            // never checked for collisions
+            virtual bool isDynamic() const;
+
+            // Collision filtering. The body belongs to the categories set in
+            // the bits of the category, and collides with the ones set in the
+            // mask. By default it belongs to the first category and collides
+            // with all of them
+            void setCollisionFilter( uint32_t category, uint32_t mask );
+            uint32_t getCollisionCategory() const;
+            uint32_t getCollisionMask() const;
+
+            // Check if the filters of two bodies let them collide, which
+            // happens if the category of each one is in the mask of the other
+            bool canCollide( const CollisionBody* other ) const;
+
+            // If the transform changed, rebuild the model matrices of the body
+            // and of its geometry, and move the collider
+            void updateTransform();
+            bool isTransformDirty() const;
+
+            // Same as updateTransform, without moving the collider, so that
+            // the worlds can move the colliders of many bodies in a batch.
+            // Return if the transform changed
+            bool rebuildTransform();
+
+            // Keep the current position and rotation as the ones of the
+            // previous step, before the body is moved
+            void storePreviousTransform();
+
+            // Set the model matrix used to draw the body between the previous
+            // and the current transforms, with alpha from 0 to 1. The model
+            // matrix used by the physics is not changed
+            void interpolateTransform( float alpha );
 
             // Draw
             void draw();
 
         protected:
-            // Position, scale and Rotation
+            // Position, scale and orientation
             glm::vec3 mPosition;
             glm::vec3 mScale;
+            glm::quat mOrientation;
+
+            // Rotation matrix of the orientation
             glm::mat4 mRotationMatrix;
 
+            // If the transform changed since the model matrix was built
+            bool mTransformDirty;
+
+            // Position and orientation at the start of the last step, used to
+            // draw the body between steps
+            glm::vec3 mPreviousPosition;
+            glm::quat mPreviousOrientation;
+
             // Geometrical object
             GLElemObject* mGeometryObject;
 
             // Material
             Material* mMaterial;
+
+            // Friction coefficient, and coefficient of restitution of the
+            // contacts
+            float mFriction;
+            float mRestitution;
+
+            // Bits of the categories of the body, and of the ones it collides with
+            uint32_t mCollisionCategory;
+            uint32_t mCollisionMask;
     };
 
 
-    // Class for objects with both collisions and dynamics
+    // Class for objects with both collisions and dynamics.
+    // The dynamic state of the body is kept in a RigidBodyStore, and the body
+    // is a handle to it. A new body has a pool of its own, and its state is
+    // moved to the pool of the world when it is added to one
     class RigidBody : public CollisionBody
     {
         public:
@@ -93,6 +164,25 @@ namespace Physics
                        float rotationAngle, glm::vec3 rotationAxis,
                        float mass, glm::vec3 velocity = {0.f, 0.f, 0.f} );
 
+            // Destructor
+            ~RigidBody();
+
+            // Move the dynamic state of the body to the given pool
+            void moveToStore( RigidBodyStore* store );
+
+            // Pool with the dynamic state, and identifier of the body in it
+            RigidBodyStore* getStore() const;
+            int getStoreId() const;
+
+            // Set position
+            void setPosition( glm::vec3 position ) override;
+
+            // Position in the pool, which is the one where the forces are
+            // evaluated during the integration. It hides the one of the base
+            // class, which gives the position of the transform: both are the
+            // same out of the integration
+            glm::vec3 getPosition();
+
             // Set velocity and acceleration
             void setVelocity( glm::vec3 velocity );
 
@@ -105,31 +195,68 @@ namespace Physics
 
             // Getters
             float getMass();
+            float getInvMass() const;
             glm::vec3 getVelocity();
+            // Force accumulated in the pool
+            glm::vec3 getForce() const;
 
             // Check if it has infinite mass
             bool hasInfiniteMass();
 
+            // Sleeping bodies are not moved until something wakes them up:
+            // a contact with an awake body, a force or a new velocity
+            bool isAwake() const override;
+            void setAwake( bool awake );
+
+            // Rigid bodies have dynamics
+            bool isDynamic() const override;
+
+            // Update the time that the body has been at rest, moving slower
+            // than the given speed, and return it
+            float updateSleepTime( float deltaTime, float velocityThreshold );
+
             // Add a force
             void addForce( const glm::vec3& force );
 
-            // Integrate forward in time by the given duration
-            void integrate( float deltaTime );
+            // Copy the position integrated in the pool to the transform
+            void syncPosition();
+
+            // Move the body by the given displacement
+            void translate( const glm::vec3& displacement );
+
+            // Move the position in the pool after an integration of the given
+            // duration, changing the velocity to match. The transform is
+            // updated later by syncPosition
+            void correctPosition( const glm::vec3& correction, float deltaTime );
+
+            // Continuous collision detection. When enabled, a body that moves
+            // fast compared to its size is stopped at its first contact along
+            // the motion of each step, so it does not go through thin objects
+            void setContinuousCollision( bool enabled );
+            bool getContinuousCollision() const;
+
+            // Displacement in the last integration
+            glm::vec3 getDisplacement() const;
 
         protected:
-            // Variables for dynamics
+            // Variables for dynamics. The velocity, the inverse of the mass,
+            // the damping applied to linear motion and the accumulator for
+            // forces are in the pool
             float mMass;
-            float mMassInver;
-            glm::vec3 mVelocity;
             // glm::vec3 mAcceleration;
+            // glm::vec3 mTorqueAccum;
 
-            // Damping applied to linear motion, to ensure objects are not accelerated
-            // due to numerical inaccuracies
-            float mDamping;
+            // Pool with the dynamic state, identifier of the body in it, and
+            // if the pool belongs to the body
+            RigidBodyStore* mStore;
+            int mStoreId;
+            bool mOwnsStore;
 
-            // Accumulator for forces
-            glm::vec3 mForceAccum;
-            // glm::vec3 mTorqueAccum;
+            // Time at rest. The sleeping state is in the pool
+            float mSleepTime;
+
+            // Continuous collision detection
+            bool mContinuousCollision;
 
             // Set the accumulators to zero
             void clearAccumulators();
@@ -1,3 +1,5 @@
+#include <chrono>
+
 #include "PhysicsWorld.h"
 
 using namespace GLGeometry;
@@ -5,56 +7,102 @@ using namespace GLBase;
 
 namespace Physics
 {
-    //--------------------------------------------------------------------------
-    // BodyForceRegistry class
+    // Number of bodies integrated by a thread at a time. A multiple of 8, so
+    // the SIMD loops of the pool of rigid bodies cover whole chunks
+    const int INTEGRATION_CHUNK_SIZE = 64;
+    // Half size of the first box searched for the nearest bodies to a point.
+    // It is doubled until enough bodies are found
+    const float NEAREST_INITIAL_RADIUS = 1.f;
+    // Initial size of the buffer of the bodies checked for collisions with a
+    // cloth. It is doubled while the query fills it
+    const int CLOTH_BODIES_INITIAL_SIZE = 64;
 
-    // Register a pair body-force
-    void BodyForceRegistry::addBodyForce( RigidBody* body, ForceGenerator* force )
+    // Time since the given instant, in milliseconds
+    static float elapsedMilliseconds( std::chrono::steady_clock::time_point start )
     {
-        mRegistrations.push_back( BodyForceRegistration( body, force ) );
+        std::chrono::duration<float, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        return elapsed.count();
     }
 
-    // Remove a pair body-force
-    // If the pair is not registrated, this will not do anything
-    void BodyForceRegistry::removeBodyForce( RigidBody* body, ForceGenerator* force )
+    // Distance from a point to the AABB of a collider, or zero if it is inside
+    static float distanceToAABB( const glm::vec3& point, const Collider* collider )
     {
-        // Look for the registration
-        for ( Registry::iterator regIter = mRegistrations.begin(); 
-              regIter != mRegistrations.end(); ++regIter )
-        {
-            if ( regIter->forceGenerator == force && regIter->rigidBody == body )
+        const AABB& aabb = collider->getAABB();
+        glm::vec3 outside = glm::max( glm::max( aabb.cornersWorld[0] - point,
+                                                point - aabb.cornersWorld[1] ),
+                                      glm::vec3( 0.f ) );
+        return glm::length( outside );
+    }
+
+    // Check if a box rotated by the given matrix overlaps the AABB of a
+    // collider, with the separating axis test. The axes are the ones of both
+    // boxes and their cross products. From "Real-Time Collision Detection" by
+    // Christer Ericson
+    static bool checkOverlapBox( const glm::vec3& center, const glm::vec3& halfExtents,
+                                 const glm::mat3& rotation, const Collider* collider )
+    {
+        const AABB& aabb = collider->getAABB();
+        glm::vec3 aabbHalf = 0.5f * ( aabb.cornersWorld[1] - aabb.cornersWorld[0] );
+        glm::vec3 t = center - 0.5f * ( aabb.cornersWorld[0] + aabb.cornersWorld[1] );
+
+        // Components of the axes of the box along the world axes. The epsilon
+        // avoids false separations along the cross products of parallel axes
+        float r[3][3];
+        float absR[3][3];
+        for ( int i = 0; i < 3; ++i )
+            for ( int j = 0; j < 3; ++j )
             {
-                mRegistrations.erase( regIter );
-                return;
+                r[ i ][ j ] = rotation[ j ][ i ];
+                absR[ i ][ j ] = std::abs( r[ i ][ j ] ) + 1e-6f;
             }
+
+        // World axes
+        for ( int i = 0; i < 3; ++i )
+        {
+            float rb = halfExtents[0] * absR[ i ][0] + halfExtents[1] * absR[ i ][1] +
+                       halfExtents[2] * absR[ i ][2];
+            if ( std::abs( t[ i ] ) > aabbHalf[ i ] + rb )
+                return false;
         }
-    }
 
-    // Clear all the registrations
-    void BodyForceRegistry::clear()
-    {
-        mRegistrations.clear();
-    }
+        // Axes of the box
+        for ( int j = 0; j < 3; ++j )
+        {
+            float ra = aabbHalf[0] * absR[0][ j ] + aabbHalf[1] * absR[1][ j ] +
+                       aabbHalf[2] * absR[2][ j ];
+            float distance = t[0] * r[0][ j ] + t[1] * r[1][ j ] + t[2] * r[2][ j ];
+            if ( std::abs( distance ) > ra + halfExtents[ j ] )
+                return false;
+        }
 
-    // Call the force generators to update the forces on the particles
-    void BodyForceRegistry::applyForces( float deltaTime )
-    {
-        for ( Registry::iterator regIter = mRegistrations.begin(); 
-              regIter != mRegistrations.end(); ++regIter )
+        // Cross products of a world axis and an axis of the box
+        for ( int i = 0; i < 3; ++i )
         {
-            regIter->forceGenerator->updateForce( regIter->rigidBody, deltaTime );
+            int i1 = ( i + 1 ) % 3;
+            int i2 = ( i + 2 ) % 3;
+            for ( int j = 0; j < 3; ++j )
+            {
+                int j1 = ( j + 1 ) % 3;
+                int j2 = ( j + 2 ) % 3;
+                float ra = aabbHalf[ i1 ] * absR[ i2 ][ j ] + aabbHalf[ i2 ] * absR[ i1 ][ j ];
+                float rb = halfExtents[ j1 ] * absR[ i ][ j2 ] + halfExtents[ j2 ] * absR[ i ][ j1 ];
+                if ( std::abs( t[ i2 ] * r[ i1 ][ j ] - t[ i1 ] * r[ i2 ][ j ] ) > ra + rb )
+                    return false;
+            }
         }
-    }
 
+        return true;
+    }
 
     //--------------------------------------------------------------------------
     // CollisionWorld class
 
     // Constructor
-    CollisionWorld::CollisionWorld() : 
-        mCounter { 0 }
+    CollisionWorld::CollisionWorld( BroadphaseType broadphaseType ) : 
+        mTerrain { nullptr },
+        mBroadphase { nullptr }
     {
-
+        setBroadphase( broadphaseType );
     }
 
     // Destructor
@@ -62,18 +110,309 @@ namespace Physics
     {
         for ( auto body : mCollisionBodies )
             delete body;
+
+        delete mBroadphase;
     }
 
     // Add a CollisionBody
     void CollisionWorld::addCollisionBody( CollisionBody* collisionBody )
     {
         mCollisionBodies.push_back( collisionBody );
+
+        // Add it to the broad phase
+        addToBroadphase( collisionBody, true );
     }
 
     // Add a terrain
     void CollisionWorld::addTerrain( Terrain* terrain )
     {
         mTerrain = terrain;
+
+        // The terrain collides as a static body
+        if ( terrain->getCollisionBody() != nullptr )
+            addToBroadphase( terrain->getCollisionBody(), true );
+    }
+
+    // Select the type of broad phase used for the collision detection
+    void CollisionWorld::setBroadphase( BroadphaseType type )
+    {
+        delete mBroadphase;
+
+        switch ( type )
+        {
+            case BroadphaseType::SweepAndPrune:
+                mBroadphase = new SweepAndPrune( mAABBStore );
+                break;
+            case BroadphaseType::AABBTree:
+                mBroadphase = new BVHBroadphase( mAABBStore );
+                break;
+            case BroadphaseType::SpatialHash:
+                mBroadphase = new SpatialHashGrid( mAABBStore );
+                break;
+        }
+        mBroadphase->setPairFilter( mPairFilter );
+
+        // Add the bodies already in the world. Only the rigid bodies are dynamic
+        for ( auto body : mCollisionBodies )
+            mBroadphase->addBody( body, dynamic_cast<RigidBody*>( body ) == nullptr );
+        for ( auto body : mCollisionBodiesNotDrawn )
+            mBroadphase->addBody( body, dynamic_cast<RigidBody*>( body ) == nullptr );
+        if ( mTerrain != nullptr && mTerrain->getCollisionBody() != nullptr )
+            mBroadphase->addBody( mTerrain->getCollisionBody(), true );
+    }
+
+    // Set the callback used to filter the pairs of the broad phase
+    void CollisionWorld::setPairFilter( const PairFilter& filter )
+    {
+        mPairFilter = filter;
+        mBroadphase->setPairFilter( filter );
+    }
+
+    // Pairs found and rejected by the broad phase in the last step
+    const BroadphaseStats& CollisionWorld::getBroadphaseStats() const
+    {
+        return mBroadphase->getStats();
+    }
+
+    // Store the AABB of a body in the pool, and add it to the broad phase
+    void CollisionWorld::addToBroadphase( CollisionBody* body, bool isStatic )
+    {
+        // Bodies without a collider can not collide
+        if ( body->mCollider == nullptr )
+            return;
+
+        body->mCollider->attachAABBStore( &mAABBStore );
+        mBroadphase->addBody( body, isStatic );
+    }
+
+    // Find the closest body hit by a ray. The broad phase gives the bodies
+    // whose AABBs are hit, roughly from the nearest to the farthest, and each
+    // hit found shortens the ray so the bodies behind it are skipped
+    RaycastHit CollisionWorld::raycast( const glm::vec3& origin, const glm::vec3& direction,
+                                        float maxDistance ) const
+    {
+        // State of the ray. The callback only captures a reference to it, so
+        // it fits in the std::function without allocating
+        struct
+        {
+            glm::vec3 origin;
+            glm::vec3 direction;
+            RaycastHit hit;
+        } ray;
+        ray.origin = origin;
+        ray.hit.body = nullptr;
+        ray.hit.point = glm::vec3( 0.f );
+        ray.hit.normal = glm::vec3( 0.f );
+        ray.hit.distance = maxDistance;
+
+        float length = glm::length( direction );
+        if ( length == 0.f || !( maxDistance >= 0.f ) )
+            return ray.hit;
+        ray.direction = direction / length;
+
+        mBroadphase->raycast( origin, ray.direction, maxDistance, [&ray]( CollisionBody* body )
+        {
+            float distance;
+            glm::vec3 normal;
+            if ( body->mCollider->raycast( ray.origin, ray.direction, ray.hit.distance,
+                                           distance, normal ) &&
+                 ( ray.hit.body == nullptr || distance < ray.hit.distance ) )
+            {
+                ray.hit.body = body;
+                ray.hit.normal = normal;
+                ray.hit.distance = distance;
+            }
+            return ray.hit.distance;
+        } );
+
+        if ( ray.hit.body != nullptr )
+            ray.hit.point = origin + ray.hit.distance * ray.direction;
+        return ray.hit;
+    }
+
+    // Find the closest body hit by each ray of an array
+    void CollisionWorld::raycastBatch( const glm::vec3* origins, const glm::vec3* directions,
+                                       const float* maxDistances, int count,
+                                       RaycastHit* hits ) const
+    {
+        for ( int i = 0; i < count; ++i )
+            hits[ i ] = raycast( origins[ i ], directions[ i ], maxDistances[ i ] );
+    }
+
+    // Find the bodies whose AABBs overlap a sphere
+    int CollisionWorld::overlapSphere( const glm::vec3& center, float radius,
+                                       CollisionBody** bodies, int maxBodies ) const
+    {
+        auto test = [&]( const CollisionBody* body )
+        {
+            return distanceToAABB( center, body->mCollider ) <= radius;
+        };
+        return overlapQuery( center - glm::vec3( radius ), center + glm::vec3( radius ), test,
+                             bodies, maxBodies );
+    }
+
+    // Find the bodies whose AABBs overlap an AABB. The broad phase already
+    // gives them
+    int CollisionWorld::overlapAABB( const glm::vec3& min, const glm::vec3& max,
+                                     CollisionBody** bodies, int maxBodies ) const
+    {
+        auto test = []( const CollisionBody* body )
+        {
+            return true;
+        };
+        return overlapQuery( min, max, test, bodies, maxBodies );
+    }
+
+    // Find the bodies whose AABBs overlap a rotated box. The broad phase is
+    // queried with the AABB of the box
+    int CollisionWorld::overlapBox( const glm::vec3& center, const glm::vec3& halfExtents,
+                                    const glm::mat3& rotation, CollisionBody** bodies,
+                                    int maxBodies ) const
+    {
+        glm::vec3 extent( 0.f );
+        for ( int j = 0; j < 3; ++j )
+            extent += halfExtents[ j ] * glm::abs( rotation[ j ] );
+
+        auto test = [&]( const CollisionBody* body )
+        {
+            return checkOverlapBox( center, halfExtents, rotation, body->mCollider );
+        };
+        return overlapQuery( center - extent, center + extent, test, bodies, maxBodies );
+    }
+
+    // Same for arrays of shapes
+    void CollisionWorld::overlapSphereBatch( const glm::vec3* centers, const float* radii,
+                                             int count, CollisionBody** bodies, int maxBodies,
+                                             int* counts ) const
+    {
+        for ( int i = 0; i < count; ++i )
+            counts[ i ] = overlapSphere( centers[ i ], radii[ i ], bodies + i * maxBodies,
+                                         maxBodies );
+    }
+
+    void CollisionWorld::overlapAABBBatch( const glm::vec3* mins, const glm::vec3* maxs,
+                                           int count, CollisionBody** bodies, int maxBodies,
+                                           int* counts ) const
+    {
+        for ( int i = 0; i < count; ++i )
+            counts[ i ] = overlapAABB( mins[ i ], maxs[ i ], bodies + i * maxBodies, maxBodies );
+    }
+
+    void CollisionWorld::overlapBoxBatch( const glm::vec3* centers, const glm::vec3* halfExtents,
+                                          const glm::mat3* rotations, int count,
+                                          CollisionBody** bodies, int maxBodies,
+                                          int* counts ) const
+    {
+        for ( int i = 0; i < count; ++i )
+            counts[ i ] = overlapBox( centers[ i ], halfExtents[ i ], rotations[ i ],
+                                      bodies + i * maxBodies, maxBodies );
+    }
+
+    // Find the k bodies closest to a point. The broad phase is queried with
+    // boxes of growing size around the point. Once k bodies are found inside
+    // the sphere that fits in the box, no other body can be closer
+    int CollisionWorld::findNearest( const glm::vec3& point, int k, CollisionBody** bodies,
+                                     float* distances ) const
+    {
+        if ( k <= 0 )
+            return 0;
+
+        // Auxiliary array, one per thread so that the queries do not allocate
+        thread_local std::vector<CollisionBody*> candidates;
+
+        // Keep the k closest candidates up to a distance, sorted by distance
+        auto selectNearest = [&]( float maxDistance )
+        {
+            int nBodies = 0;
+            for ( auto body : candidates )
+            {
+                float distance = distanceToAABB( point, body->mCollider );
+                if ( distance > maxDistance ||
+                     ( nBodies == k && distance >= distances[ k - 1 ] ) )
+                    continue;
+
+                int i = std::min( nBodies, k - 1 );
+                for ( ; i > 0 && distances[ i - 1 ] > distance; --i )
+                {
+                    bodies[ i ] = bodies[ i - 1 ];
+                    distances[ i ] = distances[ i - 1 ];
+                }
+                bodies[ i ] = body;
+                distances[ i ] = distance;
+                nBodies = std::min( nBodies + 1, k );
+            }
+            return nBodies;
+        };
+
+        glm::vec3 boundsMin, boundsMax;
+        bool hasBounds = false;
+        float radius = NEAREST_INITIAL_RADIUS;
+        while ( true )
+        {
+            candidates.clear();
+            mBroadphase->queryAABB( point - glm::vec3( radius ), point + glm::vec3( radius ),
+                                    candidates );
+
+            // Only the bodies inside the sphere that fits in the box are
+            // certain to be closer than the ones not found
+            int nBodies = selectNearest( radius );
+            if ( nBodies == k )
+                return nBodies;
+
+            // If the box covers all the bodies of the world, take all of them
+            if ( !hasBounds )
+            {
+                mAABBStore.getBounds( boundsMin, boundsMax );
+                hasBounds = true;
+            }
+            if ( glm::all( glm::lessThanEqual( point - glm::vec3( radius ), boundsMin ) ) &&
+                 glm::all( glm::greaterThanEqual( point + glm::vec3( radius ), boundsMax ) ) )
+                return selectNearest( std::numeric_limits<float>::infinity() );
+
+            radius *= 2.f;
+        }
+    }
+
+    // Same for an array of points
+    void CollisionWorld::findNearestBatch( const glm::vec3* points, int count, int k,
+                                           CollisionBody** bodies, float* distances,
+                                           int* counts ) const
+    {
+        for ( int i = 0; i < count; ++i )
+            counts[ i ] = findNearest( points[ i ], k, bodies + i * k, distances + i * k );
+    }
+
+    // Find the bodies whose AABBs overlap a box with the broad phase, and keep
+    // the ones that pass the test
+    template <typename T>
+    int CollisionWorld::overlapQuery( const glm::vec3& min, const glm::vec3& max, const T& test,
+                                      CollisionBody** bodies, int maxBodies ) const
+    {
+        // Auxiliary array, one per thread so that the queries do not allocate
+        thread_local std::vector<CollisionBody*> candidates;
+        candidates.clear();
+        mBroadphase->queryAABB( min, max, candidates );
+
+        int nBodies = 0;
+        for ( auto body : candidates )
+        {
+            if ( nBodies == maxBodies )
+                break;
+            if ( test( body ) )
+                bodies[ nBodies++ ] = body;
+        }
+        return nBodies;
+    }
+
+    // Rebuild the transforms of the bodies moved since the last update
+    void CollisionWorld::updateTransforms()
+    {
+        for ( auto body : mCollisionBodies )
+            body->updateTransform();
+        for ( auto body : mCollisionBodiesNotDrawn )
+            body->updateTransform();
+        if ( mTerrain != nullptr && mTerrain->getCollisionBody() != nullptr )
+            mTerrain->getCollisionBody()->updateTransform();
     }
 
     // Draw the objects in the current frame, to the G-buffer
@@ -98,7 +437,16 @@ namespace Physics
     // DynamicsWorld class
 
     // Constructor
-    DynamicsWorld::DynamicsWorld()
+    DynamicsWorld::DynamicsWorld( BroadphaseType broadphaseType ) :
+        CollisionWorld( broadphaseType ),
+        mBodyForceRegistry { mBodyStore },
+        mConstraintSolver { nullptr },
+        mAccumulator { 0.f },
+        mInterpolationFactor { 1.f },
+        mRecorder { nullptr },
+        mStepCount { 0 },
+        mThreadPool { new ThreadPool( 1 ) },
+        mCollisionSolvers( 1 )
     {
 
     }
@@ -113,38 +461,50 @@ namespace Physics
 
         // Delete the terrain
         delete mTerrain;
+
+        delete mThreadPool;
     }
 
     // Add a RigidBody
     void DynamicsWorld::addRigidBody( RigidBody* rigidBody )
     {
+        // Its dynamic state goes to the pool, at the same position as the
+        // body in the vector of rigid bodies
         mRigidBodies.push_back( rigidBody );
+        rigidBody->moveToStore( &mBodyStore );
 
         // Add it also to the list of collision bodies, to check for collisions and
         // draw
         mCollisionBodies.push_back( rigidBody );
+
+        // Add it to the broad phase
+        addToBroadphase( rigidBody, false );
     }
 
     // Add a RigidBody that is not drawn
     void DynamicsWorld::addRigidBodyNotDrawn( RigidBody* rigidBody )
     {
         mRigidBodies.push_back( rigidBody );
+        rigidBody->moveToStore( &mBodyStore );
 
         // Add it also to the list of collision bodies, to check for collisions and
         // draw
         mCollisionBodiesNotDrawn.push_back( rigidBody );
+
+        // Add it to the broad phase
+        addToBroadphase( rigidBody, false );
     }
 
     // Register a pair body-force
-    void DynamicsWorld::addBodyForce( RigidBody* body, ForceGenerator* force )
+    ForceHandle DynamicsWorld::addBodyForce( RigidBody* body, ForceGenerator* force )
     {
-        mBodyForceRegistry.addBodyForce( body, force );
+        return mBodyForceRegistry.addBodyForce( body, force );
     }
 
     // Remove a pair body-force
-    void DynamicsWorld::removeBodyForce( RigidBody* body, ForceGenerator* force )
+    void DynamicsWorld::removeBodyForce( ForceHandle handle )
     {
-        mBodyForceRegistry.removeBodyForce( body, force );
+        mBodyForceRegistry.removeBodyForce( handle );
     }
 
     // Add a ParticleSystem
@@ -154,11 +514,67 @@ namespace Physics
         mCollisionBodies.push_back( particleSystem );
     }
 
-    // Update the objects in the current frame
+    // Add a Cloth
+    void DynamicsWorld::addCloth( Cloth* cloth )
+    {
+        mCloths.push_back( cloth );
+        mCollisionBodies.push_back( cloth );
+    }
+
+    // Update the objects in the current frame. With a fixed time step, the
+    // time of the frame is added to an accumulator, and as many steps as fit
+    // in it are simulated. The bodies are then drawn between their last two
+    // steps, at the fraction of a step left in the accumulator
     void DynamicsWorld::step( float deltaTime )
     {
         assert( deltaTime > 0.f );
 
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        mStepStats = StepStats();
+        mContactEvents.clear();
+
+        if ( !mTimestepSettings.fixed )
+        {
+            simulate( deltaTime );
+            mInterpolationFactor = 1.f;
+            mStepStats.totalTime = elapsedMilliseconds( start );
+            return;
+        }
+
+        float fixedDeltaTime = 1.f / mTimestepSettings.rate;
+        mAccumulator += deltaTime;
+        int nSteps = 0;
+        while ( mAccumulator >= fixedDeltaTime && nSteps < mTimestepSettings.maxSubsteps )
+        {
+            simulate( fixedDeltaTime );
+            mAccumulator -= fixedDeltaTime;
+            nSteps++;
+        }
+
+        // If the steps can not keep up with the frames, drop the time left
+        // instead of simulating more steps in the next frames, which would only
+        // make them slower
+        if ( mAccumulator >= fixedDeltaTime )
+            mAccumulator = std::fmod( mAccumulator, fixedDeltaTime );
+
+        // Draw the bodies between their last two steps
+        mInterpolationFactor = mAccumulator / fixedDeltaTime;
+        int nChunks = ( mRigidBodies.size() + INTEGRATION_CHUNK_SIZE - 1 ) /
+                      INTEGRATION_CHUNK_SIZE;
+        mThreadPool->parallelFor( nChunks, [&]( int chunk, int )
+        {
+            int end = std::min( (int)mRigidBodies.size(),
+                                ( chunk + 1 ) * INTEGRATION_CHUNK_SIZE );
+            for ( int i = chunk * INTEGRATION_CHUNK_SIZE; i < end; ++i )
+                mRigidBodies[ i ]->interpolateTransform( mInterpolationFactor );
+        } );
+
+        mStepStats.totalTime = elapsedMilliseconds( start );
+    }
+
+    // Simulate a step of the given duration
+    void DynamicsWorld::simulate( float deltaTime )
+    {
         /*
            The steps of the simulation are:
             - Apply forces
@@ -167,54 +583,451 @@ namespace Physics
             - Solve constraints
         */
 
-        // Update the movement after a certain amount of frames
-        // if ( mCounter++ == 10 )
-        if ( mCounter++ == 0 )
+        // Apply forces on the objects, and move them. Their colliders are
+        // moved with the rest of the bodies changed since the last step
+        integrateBodies( deltaTime );
+        mStepStats.steps++;
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        updateTransforms();
+
+        // Broad phase: update the structure with the new positions of the
+        // bodies, and get the pairs whose AABBs overlap. The AABBs of the
+        // fast bodies cover their whole motion, and these bodies are then
+        // stopped at their first contact
+        sweepFastBodies();
+        mBroadphase->update();
+        mBroadphase->findPairs( mBodyPairs );
+        clampFastBodies();
+
+        // Narrow phase: check for collisions between the finer colliders
+        // of each pair, and update their contact manifolds. GJK starts
+        // from the simplex of the previous step
+        mStepCount++;
+        mManifolds.clear();
+        for ( auto& pair : mBodyPairs )
         {
-            mCounter = 0;
+            ContactManifold* manifold = mContactCache.findOrCreate( pair.bodyA,
+                                                                    pair.bodyB );
+            manifold->lastStep = mStepCount;
+
+            // The contacts between bodies that have not moved are kept
+            if ( pair.bodyA->isAwake() || pair.bodyB->isAwake() )
+                manifold->update();
+            if ( manifold->nPoints > 0 )
+                mManifolds.push_back( manifold );
+        }
 
-            // Apply forces on the objects
-            mBodyForceRegistry.applyForces( deltaTime );
+        // Write the contacts that began, persisted and ended, and remove the
+        // manifolds of the pairs that no longer overlap. The terrain is one
+        // more static body, so its contacts are found here too
+        mContactCache.collectEvents( mStepCount, mContactEvents );
+        mContactCache.removeStale( mStepCount );
 
-            // Move the dynamic objects
-            for ( auto body : mRigidBodies )
-                body->integrate( deltaTime );
-
-            // Check for collisions between pairs of objects
-            // for ( auto bodyA : mCollisionBodies )
-            // {
-            //     for ( auto bodyB : mCollisionBodies )
-            //     {
-            //         // If they are the same, break the loop
-            //         if ( bodyA == bodyB )
-            //             break;
-            //         // If they are not the same, check for collisions between their
-            //         // AABB
-            //         // if ( bodyA->mCollider->checkCollisionAABB( bodyB->mCollider ) )
-            //         if ( bodyA->mCollider->findCollision( bodyB->mCollider ) )
-            //         {
-            //             LOG_INFO("Collision between");
-            //
-            //             // Check for collision between their finer colliders
-            //         }
-            //
-            //     }
-            // }
-            //
-            //
-
-            // Check also for collisions with the terrain
-
-
-            // Solve constraints
-            //
-            //
+        // Split the bodies into islands, and wake up the ones touched by
+        // an awake body
+        mIslandManager.build( mRigidBodies, mManifolds );
+        mIslandManager.wakeUpIslands();
+
+        mStepStats.collisionTime += elapsedMilliseconds( start );
+        start = std::chrono::steady_clock::now();
+
+        // Solve the contacts of the awake islands, changing the velocities
+        // and removing the penetration. The large islands are solved one
+        // after another, each of them using all the threads, and then the
+        // small ones in parallel
+        const std::vector<Island>& islands = mIslandManager.getIslands();
+        mLargeIslands.clear();
+        mSmallIslands.clear();
+        for ( int i = 0; i < (int)islands.size(); ++i )
+        {
+            if ( !islands[ i ].isAwake )
+                continue;
+            if ( islands[ i ].nManifolds >= getSolverSettings().coloringThreshold )
+                mLargeIslands.push_back( i );
+            else
+                mSmallIslands.push_back( i );
+        }
+
+        for ( auto island : mLargeIslands )
+            mCollisionSolvers[0].solveIsland( mIslandManager, islands[ island ], deltaTime,
+                                              mThreadPool );
+
+        mThreadPool->parallelFor( mSmallIslands.size(), [&]( int index, int thread )
+        {
+            mCollisionSolvers[ thread ].solveIsland( mIslandManager,
+                                                     islands[ mSmallIslands[ index ] ],
+                                                     deltaTime );
+        } );
+
+        // Put to sleep the islands that have been at rest for a while
+        mIslandManager.updateSleep( mSleepSettings, deltaTime );
+
+        // Move the colliders of the bodies pushed out of the penetration
+        updateTransforms();
+
+        mStepStats.solverTime += elapsedMilliseconds( start );
+        start = std::chrono::steady_clock::now();
+
+        // Simulate the cloths, colliding with the bodies in their final
+        // positions
+        for ( auto cloth : mCloths )
+        {
+            glm::vec3 min, max;
+            cloth->getBounds( deltaTime, min, max );
+            if ( mClothBodies.empty() )
+                mClothBodies.resize( CLOTH_BODIES_INITIAL_SIZE );
+            int nBodies = overlapAABB( min, max, mClothBodies.data(), mClothBodies.size() );
+            while ( nBodies == (int)mClothBodies.size() )
+            {
+                mClothBodies.resize( 2 * mClothBodies.size() );
+                nBodies = overlapAABB( min, max, mClothBodies.data(), mClothBodies.size() );
+            }
+            cloth->simulate( deltaTime, mClothBodies.data(), nBodies, mThreadPool );
         }
 
+        mStepStats.clothTime += elapsedMilliseconds( start );
+
         // Update the particle systems
         for ( auto particleSystem : mParticleSystems )
             particleSystem -> integrate( deltaTime );
 
+        // Record the states of the bodies at the end of the step
+        if ( mRecorder != nullptr )
+            mRecorder->record( mRigidBodies, deltaTime );
+    }
+
+    // Settings of the fixed time step
+    void DynamicsWorld::setTimestepSettings( const TimestepSettings& settings )
+    {
+        mTimestepSettings = settings;
+        mAccumulator = 0.f;
+    }
+
+    const TimestepSettings& DynamicsWorld::getTimestepSettings() const
+    {
+        return mTimestepSettings;
+    }
+
+    // Fraction of a step between the last two steps at which the bodies are drawn
+    float DynamicsWorld::getInterpolationFactor() const
+    {
+        return mInterpolationFactor;
+    }
+
+    // Apply the forces and move the bodies, in sub-steps. The forces are
+    // evaluated once for each stage of the integrator, with the bodies at the
+    // state given by the previous stage. Each stage moves the bodies in chunks
+    // handed out to the threads, in one pass over the pool. After the last
+    // stage, the position constraints are projected. At the end, the
+    // positions of the awake bodies are copied to their transforms, and the
+    // previous ones are kept to draw the bodies between steps. The sleeping
+    // ones are at rest
+    void DynamicsWorld::integrateBodies( float deltaTime )
+    {
+        IntegratorType type = mIntegratorSettings.type;
+        bool implicitSprings = mIntegratorSettings.implicitSprings;
+        int nSubsteps = std::max( mIntegratorSettings.substeps, 1 );
+        int nStages = RigidBodyStore::getNumStages( type );
+        float substepTime = deltaTime / nSubsteps;
+
+        int nBodies = mRigidBodies.size();
+        int nChunks = ( nBodies + INTEGRATION_CHUNK_SIZE - 1 ) / INTEGRATION_CHUNK_SIZE;
+
+        std::chrono::steady_clock::time_point start;
+        mBodyStore.beginStep( type, substepTime );
+        for ( int substep = 0; substep < nSubsteps; ++substep )
+        {
+            for ( int stage = 0; stage < nStages; ++stage )
+            {
+                // The forces added before the step are kept in the pool, and
+                // the ones of the registry are added to them. The implicit
+                // springs are solved once per sub-step, with the rest of the
+                // forces at its start, and their forces are kept for all its
+                // stages
+                start = std::chrono::steady_clock::now();
+                if ( substep > 0 || stage > 0 )
+                    mBodyStore.resetForces( 0, nBodies );
+                mBodyForceRegistry.applyForces( substepTime, !implicitSprings );
+                if ( implicitSprings )
+                {
+                    if ( stage == 0 )
+                        mStepStats.springIterations += mSpringSolver.solve(
+                            mBodyForceRegistry, mBodyStore, substepTime,
+                            mIntegratorSettings.springIterations,
+                            mIntegratorSettings.springTolerance );
+                    mSpringSolver.applyForces( mBodyStore );
+                }
+                mStepStats.forceEvaluations++;
+                mStepStats.forcesComputed += mBodyForceRegistry.size();
+                mStepStats.forceTime += elapsedMilliseconds( start );
+
+                start = std::chrono::steady_clock::now();
+                mThreadPool->parallelFor( nChunks, [&]( int chunk, int )
+                {
+                    int begin = chunk * INTEGRATION_CHUNK_SIZE;
+                    int end = std::min( nBodies, begin + INTEGRATION_CHUNK_SIZE );
+                    mBodyStore.integrate( type, stage, substepTime, begin, end );
+                } );
+                mStepStats.integrationTime += elapsedMilliseconds( start );
+            }
+
+            // Move the bodies joined by constraints to satisfy them
+            if ( mConstraintSolver != nullptr )
+            {
+                start = std::chrono::steady_clock::now();
+                mConstraintSolver->solve( substepTime, mThreadPool );
+                mStepStats.constraintTime += elapsedMilliseconds( start );
+            }
+            mStepStats.substeps++;
+        }
+
+        start = std::chrono::steady_clock::now();
+        mThreadPool->parallelFor( nChunks, [&]( int chunk, int )
+        {
+            int begin = chunk * INTEGRATION_CHUNK_SIZE;
+            int end = std::min( nBodies, begin + INTEGRATION_CHUNK_SIZE );
+            for ( int i = begin; i < end; ++i )
+            {
+                mRigidBodies[ i ]->storePreviousTransform();
+                if ( mRigidBodies[ i ]->isAwake() )
+                    mRigidBodies[ i ]->syncPosition();
+            }
+        } );
+        mStepStats.integrationTime += elapsedMilliseconds( start );
+    }
+
+    // Rebuild the transforms of the bodies moved since the last update. The
+    // rigid bodies are done in chunks handed out to the threads, and then the
+    // rest of the bodies
+    void DynamicsWorld::updateTransforms()
+    {
+        int nBodies = mRigidBodies.size();
+        int nChunks = ( nBodies + INTEGRATION_CHUNK_SIZE - 1 ) / INTEGRATION_CHUNK_SIZE;
+        mThreadPool->parallelFor( nChunks, [&]( int chunk, int )
+        {
+            int begin = chunk * INTEGRATION_CHUNK_SIZE;
+            int end = std::min( nBodies, begin + INTEGRATION_CHUNK_SIZE );
+
+            // Rebuild the matrices, and gather the colliders that moved
+            Collider* colliders[ INTEGRATION_CHUNK_SIZE ];
+            const glm::mat4* modelMatrices[ INTEGRATION_CHUNK_SIZE ];
+            int count = 0;
+            for ( int i = begin; i < end; ++i )
+            {
+                RigidBody* body = mRigidBodies[ i ];
+                if ( body->rebuildTransform() && body->mCollider != nullptr )
+                {
+                    colliders[ count ] = body->mCollider;
+                    modelMatrices[ count ] = &body->mModelMatrix;
+                    ++count;
+                }
+            }
+
+            // Move their AABBs and shapes in a batch
+            Collider::moveColliders( colliders, modelMatrices, count );
+        } );
+
+        CollisionWorld::updateTransforms();
+    }
+
+    // Settings of the integration of the bodies
+    void DynamicsWorld::setIntegratorSettings( const IntegratorSettings& settings )
+    {
+        mIntegratorSettings = settings;
+    }
+
+    const IntegratorSettings& DynamicsWorld::getIntegratorSettings() const
+    {
+        return mIntegratorSettings;
+    }
+
+    // Number of force evaluations and time spent in the last frame
+    const StepStats& DynamicsWorld::getStepStats() const
+    {
+        return mStepStats;
+    }
+
+    // Rigid bodies of the world
+    const std::vector<RigidBody*>& DynamicsWorld::getRigidBodies() const
+    {
+        return mRigidBodies;
+    }
+
+    // Recorder of the states of the bodies after each step
+    void DynamicsWorld::setRecorder( TrajectoryRecorder* recorder )
+    {
+        mRecorder = recorder;
+    }
+
+    // Solver of the position constraints
+    void DynamicsWorld::setConstraintSolver( XPBDSolver* solver )
+    {
+        mConstraintSolver = solver;
+    }
+
+    // Contacts that began, persisted and ended in the last frame
+    const ContactEvents& DynamicsWorld::getContactEvents() const
+    {
+        return mContactEvents;
+    }
+
+    // Settings of the collision solver
+    void DynamicsWorld::setSolverSettings( const SolverSettings& settings )
+    {
+        for ( auto& solver : mCollisionSolvers )
+            solver.setSettings( settings );
+    }
+
+    const SolverSettings& DynamicsWorld::getSolverSettings() const
+    {
+        return mCollisionSolvers[0].getSettings();
+    }
+
+    // Settings used to put the bodies to sleep
+    void DynamicsWorld::setSleepSettings( const SleepSettings& settings )
+    {
+        mSleepSettings = settings;
+
+        // Without sleeping, all the bodies must be awake
+        if ( !settings.enabled )
+        {
+            for ( auto body : mRigidBodies )
+                body->setAwake( true );
+        }
+    }
+
+    const SleepSettings& DynamicsWorld::getSleepSettings() const
+    {
+        return mSleepSettings;
+    }
+
+    // Settings of the continuous collision detection
+    void DynamicsWorld::setCCDSettings( const CCDSettings& settings )
+    {
+        mCCDSettings = settings;
+    }
+
+    const CCDSettings& DynamicsWorld::getCCDSettings() const
+    {
+        return mCCDSettings;
+    }
+
+    // Find the bodies with continuous collision detection that move fast, and
+    // enlarge their AABBs in the pool to cover their motion
+    void DynamicsWorld::sweepFastBodies()
+    {
+        mFastBodies.clear();
+        if ( !mCCDSettings.enabled )
+            return;
+
+        for ( auto body : mRigidBodies )
+        {
+            if ( !body->getContinuousCollision() || !body->isAwake() ||
+                 body->mCollider == nullptr )
+                continue;
+
+            // Only the bodies that move a large part of their size can go
+            // through other objects
+            const AABB& aabb = body->mCollider->getAABB();
+            glm::vec3 size = aabb.cornersWorld[1] - aabb.cornersWorld[0];
+            float minSize = std::min( size.x, std::min( size.y, size.z ) );
+            const glm::vec3& displacement = body->getDisplacement();
+            float threshold = mCCDSettings.motionThreshold * minSize;
+            if ( glm::dot( displacement, displacement ) <= threshold * threshold )
+                continue;
+
+            // The AABB at the start of the step is the current one moved back
+            mAABBStore.set( body->mCollider->getAABBId(),
+                            glm::min( aabb.cornersWorld[0], aabb.cornersWorld[0] - displacement ),
+                            glm::max( aabb.cornersWorld[1], aabb.cornersWorld[1] - displacement ) );
+            mFastBodies.push_back( body );
+        }
+    }
+
+    // Move the fast bodies back to their first contact in the pairs found by
+    // the broad phase, and restore their AABBs
+    void DynamicsWorld::clampFastBodies()
+    {
+        if ( mFastBodies.empty() )
+            return;
+
+        mFastBodyIds.clear();
+        for ( int i = 0; i < (int)mFastBodies.size(); ++i )
+            mFastBodyIds[ mFastBodies[ i ] ] = i;
+        mTimesOfImpact.assign( mFastBodies.size(), 1.f );
+
+        // Displacement of a body in this step. Only the rigid bodies move
+        auto getDisplacement = []( CollisionBody* body )
+        {
+            RigidBody* rigidBody = dynamic_cast<RigidBody*>( body );
+            if ( rigidBody == nullptr || !rigidBody->isAwake() )
+                return glm::vec3( 0.f );
+            return rigidBody->getDisplacement();
+        };
+
+        // The time of impact of a pair is found with the motion of A relative
+        // to B, and is the earliest one for the fast bodies of the pair. The
+        // terrain does not move, and has a test of its own as it is not convex
+        for ( auto& pair : mBodyPairs )
+        {
+            auto idA = mFastBodyIds.find( pair.bodyA );
+            auto idB = mFastBodyIds.find( pair.bodyB );
+            if ( idA == mFastBodyIds.end() && idB == mFastBodyIds.end() )
+                continue;
+
+            glm::vec3 displacement = getDisplacement( pair.bodyA ) -
+                                     getDisplacement( pair.bodyB );
+            auto terrainA = dynamic_cast<const HeightfieldCollider*>( pair.bodyA->mCollider );
+            auto terrainB = dynamic_cast<const HeightfieldCollider*>( pair.bodyB->mCollider );
+            if ( terrainA != nullptr && terrainB != nullptr )
+                continue;
+
+            float time;
+            if ( terrainB != nullptr )
+                time = findTimeOfImpact( pair.bodyA->mCollider, terrainB, displacement,
+                                         mCCDSettings.depth );
+            else if ( terrainA != nullptr )
+                time = findTimeOfImpact( pair.bodyB->mCollider, terrainA, -displacement,
+                                         mCCDSettings.depth );
+            else
+                time = findTimeOfImpact( pair.bodyA->mCollider, pair.bodyB->mCollider,
+                                         displacement, mCCDSettings.depth,
+                                         mCCDSettings.maxIterations );
+
+            if ( idA != mFastBodyIds.end() )
+                mTimesOfImpact[ idA->second ] = std::min( mTimesOfImpact[ idA->second ], time );
+            if ( idB != mFastBodyIds.end() )
+                mTimesOfImpact[ idB->second ] = std::min( mTimesOfImpact[ idB->second ], time );
+        }
+
+        // Move the bodies back to the time of impact. The rest of their motion
+        // in this step is lost, and the contact is solved as any other one.
+        // Moving the collider also restores its AABB in the pool
+        for ( int i = 0; i < (int)mFastBodies.size(); ++i )
+        {
+            RigidBody* body = mFastBodies[ i ];
+            body->translate( ( mTimesOfImpact[ i ] - 1.f ) * body->getDisplacement() );
+            body->updateTransform();
+        }
+    }
+
+    // Number of threads used to integrate the bodies and solve the islands
+    void DynamicsWorld::setNumThreads( int nThreads )
+    {
+        nThreads = std::max( nThreads, 1 );
+
+        delete mThreadPool;
+        mThreadPool = new ThreadPool( nThreads );
+
+        SolverSettings settings = getSolverSettings();
+        mCollisionSolvers.resize( nThreads );
+        setSolverSettings( settings );
+    }
+
+    int DynamicsWorld::getNumThreads() const
+    {
+        return mThreadPool->getNumThreads();
     }
 
     // // Draw the objects in the current frame, to the G-buffer
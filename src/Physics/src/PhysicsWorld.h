@@ -4,56 +4,95 @@
 #include "Physics.h"
 #include "PhysicsBody.h"
 #include "ForceGenerator.h"
+#include "ForceRegistry.h"
 #include "Terrain.h"
+#include "Broadphase.h"
+#include "ContactManifold.h"
+#include "CollisionSolver.h"
+#include "Islands.h"
+#include "ThreadPool.h"
+#include "ContinuousCollision.h"
+#include "Trajectory.h"
+#include "ImplicitSprings.h"
+#include "XPBD.h"
+#include "Cloth.h"
 
 using namespace GLGeometry;
 using namespace GLBase;
 
 namespace Physics
 {
-    // Registry for the forces that apply to each body in the world
-    class BodyForceRegistry
+    // Parameters of the time step of a DynamicsWorld
+    struct TimestepSettings
     {
-        protected:
-            // One force and the particle it is applied to
-            struct BodyForceRegistration
-            {
-                RigidBody* rigidBody;
-                ForceGenerator* forceGenerator;
-                BodyForceRegistration( RigidBody* body, ForceGenerator* force )
-                {
-                    rigidBody = body;
-                    forceGenerator = force;
-                }
-            };
-
-            // List of all registrations
-            // I think this works the same for a vector or a linked list
-            // typedef std::vector<BodyForceRegistration> Registry;
-            typedef std::list<BodyForceRegistration> Registry;
-            Registry mRegistrations;
-
-        public:
-            // Register a pair body-force
-            void addBodyForce( RigidBody* body, ForceGenerator* force );
+        // If true, the world is simulated in steps of fixed duration, no
+        // matter the duration of the frames. Otherwise each frame is a step
+        bool fixed = false;
+        // Number of steps per second
+        float rate = 60.f;
+        // Maximum number of steps in a frame. The time beyond them is dropped,
+        // so a slow frame does not make the next ones slower
+        int maxSubsteps = 5;
+    };
 
-            // Remove a pair body-force
-            // If the pair is not registrated, this will not do anything
-            void removeBodyForce( RigidBody* body, ForceGenerator* force );
+    // Integration of the motion of the bodies of a DynamicsWorld
+    struct IntegratorSettings
+    {
+        IntegratorType type = IntegratorType::SemiImplicitEuler;
+        // Number of sub-steps in each step. The forces are evaluated and the
+        // bodies moved in each sub-step, while the collisions are detected
+        // and solved once per step, so stiff forces can be stable without
+        // making the whole step shorter
+        int substeps = 1;
+        // If true, the springs of the force registry are integrated with
+        // backward Euler, solving a linear system for the velocities of the
+        // bodies they pull, so stiff spring networks are stable with long
+        // steps. The system is solved with conjugate gradients, up to the
+        // given iterations or relative residual
+        bool implicitSprings = false;
+        int springIterations = 50;
+        float springTolerance = 1e-4f;
+    };
 
-            // Clear all the registrations
-            void clear();
+    // Cost of the last call to DynamicsWorld::step
+    struct StepStats
+    {
+        // Steps simulated, and sub-steps of the integration in them
+        int steps = 0;
+        int substeps = 0;
+        // Evaluations of the forces, and forces of the registry computed in
+        // them
+        int forceEvaluations = 0;
+        int forcesComputed = 0;
+        // Iterations of the conjugate gradients of the implicit springs
+        int springIterations = 0;
+        // Time spent in each part of the steps, in milliseconds
+        float forceTime = 0.f;
+        float integrationTime = 0.f;
+        float constraintTime = 0.f;
+        float clothTime = 0.f;
+        float collisionTime = 0.f;
+        float solverTime = 0.f;
+        float totalTime = 0.f;
+    };
 
-            // Call the force generators to update the forces on the particles
-            void applyForces( float deltaTime );
+    // Closest hit of a ray cast against the bodies of a world. The body is
+    // nullptr if the ray does not hit any
+    struct RaycastHit
+    {
+        CollisionBody* body;
+        glm::vec3 point;
+        glm::vec3 normal;
+        float distance;
     };
 
     // The following class manages objects with collisions (CollisionBody)
     class CollisionWorld
     {
         public:
-            // Constructor
-            CollisionWorld();
+            // Constructor, with the type of broad phase used for the collision
+            // detection
+            CollisionWorld( BroadphaseType broadphaseType = BroadphaseType::SweepAndPrune );
 
             // Destructor
             ~CollisionWorld();
@@ -64,6 +103,72 @@ namespace Physics
             // Add a terrain
             void addTerrain( Terrain* terrain );
 
+            // Select the type of broad phase used for the collision detection.
+            // The bodies already in the world are moved to the new one
+            void setBroadphase( BroadphaseType type );
+
+            // Set a callback that decides if a pair of bodies found by the
+            // broad phase is checked for collisions. It is called only for the
+            // pairs whose categories and masks match, and can be empty
+            void setPairFilter( const PairFilter& filter );
+
+            // Pairs found by the broad phase in the last step, and the ones
+            // rejected by the filters before the narrow phase
+            const BroadphaseStats& getBroadphaseStats() const;
+
+            // Find the closest body hit by a ray before maxDistance. The direction
+            // does not need to be normalized, and the distance is measured in
+            // units of length. This only reads the world, so it can be called
+            // from several threads at once while no step is running
+            RaycastHit raycast( const glm::vec3& origin, const glm::vec3& direction,
+                                float maxDistance ) const;
+
+            // Same for arrays of rays, writing the closest hit of each of them
+            void raycastBatch( const glm::vec3* origins, const glm::vec3* directions,
+                               const float* maxDistances, int count,
+                               RaycastHit* hits ) const;
+
+            // Find the bodies whose AABBs overlap a sphere, an AABB or a box
+            // rotated by the given matrix, and write up to maxBodies of them to
+            // the buffer. Returns the number of bodies written. Like the ray
+            // casts, these can be called from several threads at once while no
+            // step is running, and they do not allocate memory
+            int overlapSphere( const glm::vec3& center, float radius,
+                               CollisionBody** bodies, int maxBodies ) const;
+            int overlapAABB( const glm::vec3& min, const glm::vec3& max,
+                             CollisionBody** bodies, int maxBodies ) const;
+            int overlapBox( const glm::vec3& center, const glm::vec3& halfExtents,
+                            const glm::mat3& rotation, CollisionBody** bodies,
+                            int maxBodies ) const;
+
+            // Same for arrays of shapes. The bodies of query i are written from
+            // bodies[ i * maxBodies ], and their number to counts[ i ]
+            void overlapSphereBatch( const glm::vec3* centers, const float* radii, int count,
+                                     CollisionBody** bodies, int maxBodies, int* counts ) const;
+            void overlapAABBBatch( const glm::vec3* mins, const glm::vec3* maxs, int count,
+                                   CollisionBody** bodies, int maxBodies, int* counts ) const;
+            void overlapBoxBatch( const glm::vec3* centers, const glm::vec3* halfExtents,
+                                  const glm::mat3* rotations, int count,
+                                  CollisionBody** bodies, int maxBodies, int* counts ) const;
+
+            // Find the k bodies closest to a point, measuring the distance to
+            // their AABBs, and write them with their distances from the closest
+            // to the farthest. Returns the number of bodies written, which is
+            // less than k only if the world has fewer bodies
+            int findNearest( const glm::vec3& point, int k, CollisionBody** bodies,
+                             float* distances ) const;
+
+            // Same for an array of points. The bodies of point i are written
+            // from bodies[ i * k ], and their number to counts[ i ]
+            void findNearestBatch( const glm::vec3* points, int count, int k,
+                                   CollisionBody** bodies, float* distances,
+                                   int* counts ) const;
+
+            // Rebuild the model matrices and move the colliders of the bodies
+            // whose transform changed since the last update. The dynamics
+            // worlds do it in each step
+            virtual void updateTransforms();
+
             // Draw the objects in the current frame, to the G-buffer
             // void draw( Shader& defaultShader );
             void draw();
@@ -80,16 +185,34 @@ namespace Physics
             // Terrain
             Terrain* mTerrain;
 
-            // Used to slow down simulations
-            int mCounter;
+            // World space AABBs of the colliders of the bodies
+            AABBStore mAABBStore;
+
+            // Broad phase of the collision detection, and callback used to
+            // filter its pairs
+            Broadphase* mBroadphase;
+            PairFilter mPairFilter;
+            // Pairs of bodies found by the broad phase in the current step
+            std::vector<BodyPair> mBodyPairs;
+
+            // Store the AABB of a body in the pool, and add it to the broad phase
+            void addToBroadphase( CollisionBody* body, bool isStatic );
+
+            // Find the bodies whose AABBs overlap a box with the broad phase,
+            // keep the ones that pass the given test, and write up to maxBodies
+            // of them to the buffer
+            template <typename T>
+            int overlapQuery( const glm::vec3& min, const glm::vec3& max, const T& test,
+                              CollisionBody** bodies, int maxBodies ) const;
     };
 
     // The following class manages objects with collisions and dynamics (RigidBody)
     class DynamicsWorld : public CollisionWorld
     {
         public:
-            // Constructor
-            DynamicsWorld();
+            // Constructor, with the type of broad phase used for the collision
+            // detection
+            DynamicsWorld( BroadphaseType broadphaseType = BroadphaseType::SweepAndPrune );
 
             // Destructor
             ~DynamicsWorld();
@@ -100,29 +223,160 @@ namespace Physics
             // Add a RigidBody that is not drawn
             void addRigidBodyNotDrawn( RigidBody* rigidBody );
 
-            // Register a pair body-force
-            void addBodyForce( RigidBody* body, ForceGenerator* force );
+            // Register a pair body-force, and return the handle to remove it.
+            // The bodies must be added to the world first, or -1 is returned
+            ForceHandle addBodyForce( RigidBody* body, ForceGenerator* force );
 
             // Remove a pair body-force
-            void removeBodyForce( RigidBody* body, ForceGenerator* force );
+            void removeBodyForce( ForceHandle handle );
 
             // Add a ParticleSystem
             void addParticleSystem( ParticleSystem* particleSystem );
 
+            // Add a Cloth
+            void addCloth( Cloth* cloth );
+
             // Update the objects in the current frame
             void step( float deltaTime );
 
+            // Settings of the time step
+            void setTimestepSettings( const TimestepSettings& settings );
+            const TimestepSettings& getTimestepSettings() const;
+
+            // With a fixed time step, fraction of a step after the last one at
+            // which the bodies are drawn in the current frame. They are drawn
+            // between their previous and current transforms
+            float getInterpolationFactor() const;
+
+            // Settings of the integration of the bodies
+            void setIntegratorSettings( const IntegratorSettings& settings );
+            const IntegratorSettings& getIntegratorSettings() const;
+
+            // Number of force evaluations and time spent in the last frame
+            const StepStats& getStepStats() const;
+
+            // Rigid bodies of the world, in the order in which they were added
+            const std::vector<RigidBody*>& getRigidBodies() const;
+
+            // Write the states of the rigid bodies to a recorder after each
+            // step. Set it to nullptr to stop recording. The world does not
+            // own the recorder
+            void setRecorder( TrajectoryRecorder* recorder );
+
+            // Project the constraints of an XPBD solver after each sub-step of
+            // the integration. Set it to nullptr to remove them. The world
+            // does not own the solver
+            void setConstraintSolver( XPBDSolver* solver );
+
+            // Contacts that began, persisted and ended in the last frame. With
+            // a fixed time step, the events of all the steps of the frame are
+            // written one after another
+            const ContactEvents& getContactEvents() const;
+
+            // Rebuild the transforms of the bodies moved since the last update
+            void updateTransforms() override;
+
+            // Settings of the collision solver
+            void setSolverSettings( const SolverSettings& settings );
+            const SolverSettings& getSolverSettings() const;
+
+            // Settings used to put the bodies to sleep
+            void setSleepSettings( const SleepSettings& settings );
+            const SleepSettings& getSleepSettings() const;
+
+            // Settings of the continuous collision detection
+            void setCCDSettings( const CCDSettings& settings );
+            const CCDSettings& getCCDSettings() const;
+
+            // Number of threads used to integrate the bodies and solve the
+            // islands. The results do not depend on it
+            void setNumThreads( int nThreads );
+            int getNumThreads() const;
+
             // // Draw the objects in the current frame, to the G-buffer
             // void draw( Shader& defaultShader );
 
         private:
             // Vector of pointers to RigidBody objects
             std::vector<RigidBody*> mRigidBodies;
+
+            // Pool with the dynamic state of the rigid bodies, and the
+            // settings of their integration
+            RigidBodyStore mBodyStore;
+            IntegratorSettings mIntegratorSettings;
+
             // Vector of pointers to ParticleSystem objects
             std::vector<ParticleSystem*> mParticleSystems;
 
-            // Registry of the forces applied to each body
+            // Vector of pointers to Cloth objects, and buffer of the bodies
+            // that can collide with one of them
+            std::vector<Cloth*> mCloths;
+            std::vector<CollisionBody*> mClothBodies;
+
+            // Registry of the forces applied to each body, and solver of its
+            // springs when they are integrated implicitly
             BodyForceRegistry mBodyForceRegistry;
+            ImplicitSpringSolver mSpringSolver;
+
+            // Solver of the position constraints, or nullptr
+            XPBDSolver* mConstraintSolver;
+
+            // Fixed time step: time of the frames not simulated yet, and
+            // fraction of a step it represents
+            TimestepSettings mTimestepSettings;
+            float mAccumulator;
+            float mInterpolationFactor;
+
+            // Cost of the last frame
+            StepStats mStepStats;
+
+            // Recorder of the states of the bodies, or nullptr
+            TrajectoryRecorder* mRecorder;
+
+            // Contact manifolds of the pairs found by the broad phase, kept
+            // between steps
+            ContactCache mContactCache;
+            // Manifolds with contact points in the current step
+            std::vector<ContactManifold*> mManifolds;
+            // Contacts that began, persisted and ended in the current frame
+            ContactEvents mContactEvents;
+            // Number of steps done, used to remove the pairs that no longer
+            // overlap
+            int mStepCount;
+
+            // Islands of bodies in contact
+            IslandManager mIslandManager;
+            SleepSettings mSleepSettings;
+            // Awake islands, split into the ones solved using all the threads,
+            // and the ones solved by a single thread
+            std::vector<int> mLargeIslands;
+            std::vector<int> mSmallIslands;
+
+            // Threads, and one solver for the contacts for each of them
+            ThreadPool* mThreadPool;
+            std::vector<CollisionSolver> mCollisionSolvers;
+
+            // Continuous collision detection: bodies whose motion is swept in
+            // this step, their time of impact, and their position in the list
+            CCDSettings mCCDSettings;
+            std::vector<RigidBody*> mFastBodies;
+            std::vector<float> mTimesOfImpact;
+            std::unordered_map<const CollisionBody*, int> mFastBodyIds;
+
+            // Simulate a step of the given duration
+            void simulate( float deltaTime );
+
+            // Apply the forces and move the bodies, in the sub-steps of a step
+            // of the given duration
+            void integrateBodies( float deltaTime );
+
+            // Find the bodies with continuous collision detection that move
+            // fast, and enlarge their AABBs in the pool to cover their motion
+            void sweepFastBodies();
+
+            // Move the fast bodies back to their first contact in the pairs
+            // found by the broad phase, and restore their AABBs
+            void clampFastBodies();
     };
 }
 
@@ -1,4 +1,7 @@
+#include <limits>
+
 #include "Colliders.h"
+#include "GJK.h"
 
 using namespace GLBase;
 using namespace GLGeometry;
@@ -12,19 +15,16 @@ namespace Physics
     PlaneCollider::PlaneCollider()
     {
         // Compute the AABB in model space
-        mAABB.cornersModel.push_back( glm::vec3( -0.5f, 0.f, -0.5f ) );
-        mAABB.cornersModel.push_back( glm::vec3(  0.5f, 0.f,  0.5f ) );
+        mAABB.cornersModel[0] = glm::vec3( -0.5f, -0.5f, 0.f );
+        mAABB.cornersModel[1] = glm::vec3(  0.5f,  0.5f, 0.f );
 
-        // Compute the vertices of the AABB in model space
-        computeVerticesAABB();
+        // Compute the center and half extents of the AABB in model space
+        computeCenterExtentsAABB();
     }
 
-    // Update the collider and AABB after a transformation
-    void PlaneCollider::moveCollider( const glm::mat4& modelMatrix )
+    // Update the collider after a transformation
+    void PlaneCollider::moveShape( const glm::mat4& modelMatrix )
     {
-        // Update the AABB
-        computeAABBTransformed( mAABB.verticesModel, modelMatrix, mAABB.cornersWorld );
-
         // Move the center
         mCenter = glm::vec3( modelMatrix[3][0],
                              modelMatrix[3][1],
@@ -34,41 +34,101 @@ namespace Physics
         mNormal = glm::vec3( glm::normalize( modelMatrix * glm::vec4( 0.f, 0.f, 1.f, 0.f ) ) );
 
         // Compute the two tangent vectors
-        mTangent.push_back( glm::normalize( glm::vec3( modelMatrix * glm::vec4( 1.f, 0.f, 0.f, 0.f ) ) ) );
-        mTangent.push_back( glm::normalize( glm::vec3( modelMatrix * glm::vec4( 0.f, 1.f, 0.f, 0.f ) ) ) );
+        mTangent[0] = glm::normalize( glm::vec3( modelMatrix * glm::vec4( 1.f, 0.f, 0.f, 0.f ) ) );
+        mTangent[1] = glm::normalize( glm::vec3( modelMatrix * glm::vec4( 0.f, 1.f, 0.f, 0.f ) ) );
 
-        // Compute the dimensions
+        // Compute the dimensions, from the length of the transformed tangents
         for ( int j = 0; j < 2; ++j )
-        {
-            mDimensions.push_back( 0.f );
-            for ( int i = 0; i < 3; ++i )
-                mDimensions[ j ] += modelMatrix[i][j] * modelMatrix[i][j];
-            mDimensions[ j ] = 0.5f * std::sqrt( mDimensions[ j ] );
-        }
+            mDimensions[ j ] = 0.5f * glm::length( glm::vec3( modelMatrix[ j ] ) );
     }
 
     // Methods for finding collisions
-    bool PlaneCollider::findCollision( const Collider* other ) const
+    CollisionPoints PlaneCollider::findCollision( const Collider* other, Simplex& simplex ) const
     {
-        return other->findCollision( this );
+        return swapPoints( other->findCollision( this, simplex ) );
     }
 
-    bool PlaneCollider::findCollision( const SphereCollider* other ) const
+    CollisionPoints PlaneCollider::findCollision( const SphereCollider* other, Simplex& simplex ) const
     {
         // This collision is implemented in the class SphereCollider
-        return other->findCollision( this );
+        return swapPoints( other->findCollision( this, simplex ) );
     }
 
-    bool PlaneCollider::findCollision( const PlaneCollider* other ) const
+    CollisionPoints PlaneCollider::findCollision( const PlaneCollider* other, Simplex& simplex ) const
     {
         // No collision between planes
-        // return {};
-        return false;
+        CollisionPoints points;
+        points.HasCollision = false;
+        return points;
     }
 
-    bool PlaneCollider::findCollision( const ConvexCollider* other ) const
+    CollisionPoints PlaneCollider::findCollision( const ConvexCollider* other, Simplex& simplex ) const
     {
         // This collision is implemented in the class ConvexCollider
-        return other->findCollision( this );
+        return swapPoints( other->findCollision( this, simplex ) );
+    }
+
+    CollisionPoints PlaneCollider::findCollision( const HeightfieldCollider* other, Simplex& simplex ) const
+    {
+        // No collision between planes and terrains
+        CollisionPoints points;
+        points.HasCollision = false;
+        return points;
+    }
+
+    // Method to find the furthest point in a given direction, which is one of
+    // the corners of the plane
+    glm::vec3 PlaneCollider::findFurthestPoint( const glm::vec3& direction ) const
+    {
+        glm::vec3 point = mCenter;
+        for ( int i = 0; i < 2; ++i )
+        {
+            if ( glm::dot( direction, mTangent[ i ] ) >= 0.f )
+                point += mDimensions[ i ] * mTangent[ i ];
+            else
+                point -= mDimensions[ i ] * mTangent[ i ];
+        }
+        return point;
+    }
+
+    // Cast a ray against the plane, and check that the hit point is inside
+    // its rectangle
+    bool PlaneCollider::raycast( const glm::vec3& origin, const glm::vec3& direction,
+                                 float maxDistance, float& distance, glm::vec3& normal ) const
+    {
+        // The ray is parallel to the plane
+        float speed = glm::dot( direction, mNormal );
+        if ( std::abs( speed ) < 1e-8f )
+            return false;
+
+        distance = glm::dot( mCenter - origin, mNormal ) / speed;
+        if ( distance < 0.f || distance > maxDistance )
+            return false;
+
+        glm::vec3 offset = origin + distance * direction - mCenter;
+        for ( int i = 0; i < 2; ++i )
+            if ( std::abs( glm::dot( offset, mTangent[ i ] ) ) > mDimensions[ i ] )
+                return false;
+
+        normal = speed < 0.f ? mNormal : -mNormal;
+        return true;
+    }
+
+    // Depth of points over the rectangle of the plane, which is minus their
+    // distance to it, with the normal of the face on their side
+    void PlaneCollider::getPenetrations( const glm::vec3* positions, int count,
+                                         float* depths, glm::vec3* normals ) const
+    {
+        for ( int k = 0; k < count; ++k )
+        {
+            glm::vec3 offset = positions[ k ] - mCenter;
+            float distance = glm::dot( offset, mNormal );
+            normals[ k ] = distance < 0.f ? -mNormal : mNormal;
+            depths[ k ] = -std::abs( distance );
+
+            for ( int i = 0; i < 2; ++i )
+                if ( std::abs( glm::dot( offset, mTangent[ i ] ) ) > mDimensions[ i ] )
+                    depths[ k ] = -std::numeric_limits<float>::max();
+        }
     }
 }
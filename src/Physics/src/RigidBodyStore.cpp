@@ -0,0 +1,539 @@
+#include <algorithm>
+#include <cmath>
+
+#if defined( __AVX2__ ) || defined( __SSE2__ )
+#include <immintrin.h>
+#endif
+
+#include "RigidBodyStore.h"
+#include "utils.h"
+
+using namespace GLBase;
+
+namespace Physics
+{
+    //--------------------------------------------------------------------------
+    // RigidBodyStore class
+
+    // Constructor
+    RigidBodyStore::RigidBodyStore()
+    {
+    }
+
+    // Add the state of a body, and return its identifier.
+    // It starts awake and without forces
+    int RigidBodyStore::add( const glm::vec3& position, const glm::vec3& velocity,
+                             float invMass, float damping )
+    {
+        int id = mPositionX.size();
+        mPositionX.push_back( position.x );
+        mPositionY.push_back( position.y );
+        mPositionZ.push_back( position.z );
+        mVelocityX.push_back( velocity.x );
+        mVelocityY.push_back( velocity.y );
+        mVelocityZ.push_back( velocity.z );
+        mForceX.push_back( 0.f );
+        mForceY.push_back( 0.f );
+        mForceZ.push_back( 0.f );
+        mDisplacementX.push_back( 0.f );
+        mDisplacementY.push_back( 0.f );
+        mDisplacementZ.push_back( 0.f );
+        mInvMass.push_back( invMass );
+        mAwake.push_back( 1 );
+        mDampingIds.push_back( findDamping( damping ) );
+        return id;
+    }
+
+    // Setters
+    void RigidBodyStore::setPosition( int id, const glm::vec3& position )
+    {
+        mPositionX[ id ] = position.x;
+        mPositionY[ id ] = position.y;
+        mPositionZ[ id ] = position.z;
+    }
+
+    void RigidBodyStore::setVelocity( int id, const glm::vec3& velocity )
+    {
+        mVelocityX[ id ] = velocity.x;
+        mVelocityY[ id ] = velocity.y;
+        mVelocityZ[ id ] = velocity.z;
+    }
+
+    void RigidBodyStore::setInvMass( int id, float invMass )
+    {
+        mInvMass[ id ] = invMass;
+    }
+
+    void RigidBodyStore::setDamping( int id, float damping )
+    {
+        mDampingIds[ id ] = findDamping( damping );
+    }
+
+    void RigidBodyStore::setAwake( int id, bool awake )
+    {
+        mAwake[ id ] = awake ? 1 : 0;
+    }
+
+    // Getters
+    glm::vec3 RigidBodyStore::getPosition( int id ) const
+    {
+        return glm::vec3( mPositionX[ id ], mPositionY[ id ], mPositionZ[ id ] );
+    }
+
+    glm::vec3 RigidBodyStore::getVelocity( int id ) const
+    {
+        return glm::vec3( mVelocityX[ id ], mVelocityY[ id ], mVelocityZ[ id ] );
+    }
+
+    glm::vec3 RigidBodyStore::getForce( int id ) const
+    {
+        return glm::vec3( mForceX[ id ], mForceY[ id ], mForceZ[ id ] );
+    }
+
+    glm::vec3 RigidBodyStore::getDisplacement( int id ) const
+    {
+        return glm::vec3( mDisplacementX[ id ], mDisplacementY[ id ], mDisplacementZ[ id ] );
+    }
+
+    float RigidBodyStore::getInvMass( int id ) const
+    {
+        return mInvMass[ id ];
+    }
+
+    float RigidBodyStore::getDamping( int id ) const
+    {
+        return mDampingValues[ mDampingIds[ id ] ];
+    }
+
+    bool RigidBodyStore::isAwake( int id ) const
+    {
+        return mAwake[ id ] != 0;
+    }
+
+    int RigidBodyStore::size() const
+    {
+        return mPositionX.size();
+    }
+
+    // Arrays of the state
+    const float* RigidBodyStore::getPositionArray( int axis ) const
+    {
+        switch ( axis )
+        {
+            case 0:
+                return mPositionX.data();
+            case 1:
+                return mPositionY.data();
+            default:
+                return mPositionZ.data();
+        }
+    }
+
+    const float* RigidBodyStore::getVelocityArray( int axis ) const
+    {
+        switch ( axis )
+        {
+            case 0:
+                return mVelocityX.data();
+            case 1:
+                return mVelocityY.data();
+            default:
+                return mVelocityZ.data();
+        }
+    }
+
+    float* RigidBodyStore::getForceArray( int axis )
+    {
+        switch ( axis )
+        {
+            case 0:
+                return mForceX.data();
+            case 1:
+                return mForceY.data();
+            default:
+                return mForceZ.data();
+        }
+    }
+
+    const float* RigidBodyStore::getInvMassArray() const
+    {
+        return mInvMass.data();
+    }
+
+    const int* RigidBodyStore::getAwakeArray() const
+    {
+        return mAwake.data();
+    }
+
+    // Add a force
+    void RigidBodyStore::addForce( int id, const glm::vec3& force )
+    {
+        mForceX[ id ] += force.x;
+        mForceY[ id ] += force.y;
+        mForceZ[ id ] += force.z;
+    }
+
+    // Set the force to zero
+    void RigidBodyStore::clearForce( int id )
+    {
+        mForceX[ id ] = 0.f;
+        mForceY[ id ] = 0.f;
+        mForceZ[ id ] = 0.f;
+    }
+
+    // Move a body after its integration, with the velocity that takes it there
+    void RigidBodyStore::correctPosition( int id, const glm::vec3& correction,
+                                          float deltaTime )
+    {
+        glm::vec3 velocityChange = correction / deltaTime;
+        mPositionX[ id ] += correction.x;
+        mPositionY[ id ] += correction.y;
+        mPositionZ[ id ] += correction.z;
+        mVelocityX[ id ] += velocityChange.x;
+        mVelocityY[ id ] += velocityChange.y;
+        mVelocityZ[ id ] += velocityChange.z;
+        mDisplacementX[ id ] += correction.x;
+        mDisplacementY[ id ] += correction.y;
+        mDisplacementZ[ id ] += correction.z;
+    }
+
+    // Prepare a step of the given duration
+    void RigidBodyStore::beginStep( IntegratorType type, float deltaTime )
+    {
+        mDampingFactors.resize( mDampingValues.size() );
+        for ( int i = 0; i < (int)mDampingValues.size(); ++i )
+            mDampingFactors[ i ] = powf( mDampingValues[ i ], deltaTime );
+
+        std::fill( mDisplacementX.begin(), mDisplacementX.end(), 0.f );
+        std::fill( mDisplacementY.begin(), mDisplacementY.end(), 0.f );
+        std::fill( mDisplacementZ.begin(), mDisplacementZ.end(), 0.f );
+
+        mExternalForces.x = mForceX;
+        mExternalForces.y = mForceY;
+        mExternalForces.z = mForceZ;
+
+        // Semi-implicit Euler keeps nothing between stages
+        if ( type == IntegratorType::SemiImplicitEuler )
+            return;
+
+        int nBodies = size();
+        mIntegrated.resize( nBodies );
+        mStartPositions.resize( nBodies );
+        mStartVelocities.resize( nBodies );
+        mAccelerations.resize( nBodies );
+        mVelocitySums.resize( nBodies );
+    }
+
+    // Set the forces to the ones added before the step
+    void RigidBodyStore::resetForces( int begin, int end )
+    {
+        std::copy( mExternalForces.x.begin() + begin, mExternalForces.x.begin() + end,
+                   mForceX.begin() + begin );
+        std::copy( mExternalForces.y.begin() + begin, mExternalForces.y.begin() + end,
+                   mForceY.begin() + begin );
+        std::copy( mExternalForces.z.begin() + begin, mExternalForces.z.begin() + end,
+                   mForceZ.begin() + begin );
+    }
+
+    // Number of stages of an integrator
+    int RigidBodyStore::getNumStages( IntegratorType type )
+    {
+        switch ( type )
+        {
+            case IntegratorType::VelocityVerlet: return 2;
+            case IntegratorType::RK4:            return 4;
+            default:                             return 1;
+        }
+    }
+
+    // Do a stage of an integrator
+    void RigidBodyStore::integrate( IntegratorType type, int stage, float deltaTime,
+                                    int begin, int end )
+    {
+        switch ( type )
+        {
+            case IntegratorType::VelocityVerlet:
+                integrateVerlet( stage, deltaTime, begin, end );
+                break;
+            case IntegratorType::RK4:
+                integrateRK4( stage, deltaTime, begin, end );
+                break;
+            default:
+                integrateEuler( deltaTime, begin, end );
+                break;
+        }
+    }
+
+    // Semi-implicit Euler for the bodies with identifiers in [ begin, end ). It
+    // is done for 8 (AVX2) or 4 (SSE2) bodies at a time, with the same
+    // operations as the scalar version, so both give the same results. The
+    // lanes of the sleeping bodies keep their velocity and are not moved, and
+    // the groups where all the bodies sleep are skipped
+    void RigidBodyStore::integrateEuler( float deltaTime, int begin, int end )
+    {
+        int i = begin;
+
+#if defined( __AVX2__ )
+        const __m256 dt = _mm256_set1_ps( deltaTime );
+        const __m256 zero = _mm256_setzero_ps();
+
+        for ( ; i + 8 <= end; i += 8 )
+        {
+            float* force[3] = { &mForceX[ i ], &mForceY[ i ], &mForceZ[ i ] };
+            __m256 awake = _mm256_castsi256_ps( _mm256_cmpgt_epi32(
+                _mm256_loadu_si256( (const __m256i*)&mAwake[ i ] ), _mm256_setzero_si256() ) );
+            if ( _mm256_movemask_ps( awake ) == 0 )
+            {
+                for ( int axis = 0; axis < 3; ++axis )
+                    _mm256_storeu_ps( force[ axis ], zero );
+                continue;
+            }
+
+            __m256 invMass = _mm256_loadu_ps( &mInvMass[ i ] );
+            __m256 damping = _mm256_i32gather_ps( mDampingFactors.data(),
+                _mm256_loadu_si256( (const __m256i*)&mDampingIds[ i ] ), 4 );
+
+            // Same steps for each coordinate: velocity from the force, damping,
+            // and displacement
+            float* position[3] = { &mPositionX[ i ], &mPositionY[ i ], &mPositionZ[ i ] };
+            float* velocity[3] = { &mVelocityX[ i ], &mVelocityY[ i ], &mVelocityZ[ i ] };
+            float* displacement[3] = { &mDisplacementX[ i ], &mDisplacementY[ i ],
+                                       &mDisplacementZ[ i ] };
+            for ( int axis = 0; axis < 3; ++axis )
+            {
+                __m256 start = _mm256_loadu_ps( velocity[ axis ] );
+                __m256 acceleration = _mm256_mul_ps( _mm256_loadu_ps( force[ axis ] ), invMass );
+                __m256 v = _mm256_add_ps( start, _mm256_mul_ps( acceleration, dt ) );
+                v = _mm256_blendv_ps( start, _mm256_mul_ps( v, damping ), awake );
+                __m256 d = _mm256_and_ps( _mm256_mul_ps( v, dt ), awake );
+                _mm256_storeu_ps( velocity[ axis ], v );
+                _mm256_storeu_ps( displacement[ axis ],
+                                  _mm256_add_ps( _mm256_loadu_ps( displacement[ axis ] ), d ) );
+                _mm256_storeu_ps( position[ axis ],
+                                  _mm256_add_ps( _mm256_loadu_ps( position[ axis ] ), d ) );
+                _mm256_storeu_ps( force[ axis ], zero );
+            }
+        }
+#elif defined( __SSE2__ )
+        const __m128 dt = _mm_set1_ps( deltaTime );
+        const __m128 zero = _mm_setzero_ps();
+        const float* factors = mDampingFactors.data();
+
+        for ( ; i + 4 <= end; i += 4 )
+        {
+            float* force[3] = { &mForceX[ i ], &mForceY[ i ], &mForceZ[ i ] };
+            __m128 awake = _mm_castsi128_ps( _mm_cmpgt_epi32(
+                _mm_loadu_si128( (const __m128i*)&mAwake[ i ] ), _mm_setzero_si128() ) );
+            if ( _mm_movemask_ps( awake ) == 0 )
+            {
+                for ( int axis = 0; axis < 3; ++axis )
+                    _mm_storeu_ps( force[ axis ], zero );
+                continue;
+            }
+
+            __m128 invMass = _mm_loadu_ps( &mInvMass[ i ] );
+            __m128 damping = _mm_setr_ps( factors[ mDampingIds[ i ] ],
+                                          factors[ mDampingIds[ i + 1 ] ],
+                                          factors[ mDampingIds[ i + 2 ] ],
+                                          factors[ mDampingIds[ i + 3 ] ] );
+
+            // Same steps for each coordinate: velocity from the force, damping,
+            // and displacement
+            float* position[3] = { &mPositionX[ i ], &mPositionY[ i ], &mPositionZ[ i ] };
+            float* velocity[3] = { &mVelocityX[ i ], &mVelocityY[ i ], &mVelocityZ[ i ] };
+            float* displacement[3] = { &mDisplacementX[ i ], &mDisplacementY[ i ],
+                                       &mDisplacementZ[ i ] };
+            for ( int axis = 0; axis < 3; ++axis )
+            {
+                // SSE2 has no blend, so the lanes are selected with the mask
+                __m128 start = _mm_loadu_ps( velocity[ axis ] );
+                __m128 acceleration = _mm_mul_ps( _mm_loadu_ps( force[ axis ] ), invMass );
+                __m128 v = _mm_add_ps( start, _mm_mul_ps( acceleration, dt ) );
+                v = _mm_or_ps( _mm_and_ps( awake, _mm_mul_ps( v, damping ) ),
+                               _mm_andnot_ps( awake, start ) );
+                __m128 d = _mm_and_ps( _mm_mul_ps( v, dt ), awake );
+                _mm_storeu_ps( velocity[ axis ], v );
+                _mm_storeu_ps( displacement[ axis ],
+                               _mm_add_ps( _mm_loadu_ps( displacement[ axis ] ), d ) );
+                _mm_storeu_ps( position[ axis ], _mm_add_ps( _mm_loadu_ps( position[ axis ] ), d ) );
+                _mm_storeu_ps( force[ axis ], zero );
+            }
+        }
+#endif
+
+        // Remaining bodies, or all of them if SIMD is not available
+        integrateEulerScalar( deltaTime, i, end );
+    }
+
+    // Scalar version of integrateEuler
+    void RigidBodyStore::integrateEulerScalar( float deltaTime, int begin, int end )
+    {
+        for ( int i = begin; i < end; ++i )
+        {
+            if ( !mAwake[ i ] )
+            {
+                clearForce( i );
+                continue;
+            }
+
+            float damping = mDampingFactors[ mDampingIds[ i ] ];
+
+            // Compute acceleration from the force, and update the velocity
+            glm::vec3 velocity = getVelocity( i );
+            velocity += getForce( i ) * mInvMass[ i ] * deltaTime;
+            // Drag on the velocity, so it does not increase due to numerical errors
+            velocity *= damping;
+
+            // Update the position
+            glm::vec3 displacement = velocity * deltaTime;
+            setVelocity( i, velocity );
+            setPosition( i, getPosition( i ) + displacement );
+            mDisplacementX[ i ] += displacement.x;
+            mDisplacementY[ i ] += displacement.y;
+            mDisplacementZ[ i ] += displacement.z;
+
+            // Reset the net force
+            clearForce( i );
+        }
+    }
+
+    // Stages of velocity Verlet. The first one moves the bodies with the
+    // acceleration at the start of the step, and predicts their velocity at
+    // the end, used by the forces that depend on it. The second one updates
+    // the velocity with the mean of the accelerations at the start and at the
+    // end
+    void RigidBodyStore::integrateVerlet( int stage, float deltaTime, int begin, int end )
+    {
+        for ( int i = begin; i < end; ++i )
+        {
+            if ( stage == 0 )
+                mIntegrated[ i ] = mAwake[ i ];
+            if ( !mIntegrated[ i ] )
+            {
+                if ( stage == 1 )
+                    clearForce( i );
+                continue;
+            }
+
+            glm::vec3 velocity = getVelocity( i );
+            glm::vec3 acceleration = getForce( i ) * mInvMass[ i ];
+
+            if ( stage == 0 )
+            {
+                glm::vec3 displacement = ( velocity + 0.5f * acceleration * deltaTime ) *
+                                         deltaTime;
+                mStartVelocities.set( i, velocity );
+                mAccelerations.set( i, acceleration );
+                setPosition( i, getPosition( i ) + displacement );
+                setVelocity( i, velocity + acceleration * deltaTime );
+                mDisplacementX[ i ] += displacement.x;
+                mDisplacementY[ i ] += displacement.y;
+                mDisplacementZ[ i ] += displacement.z;
+            }
+            else
+            {
+                velocity = mStartVelocities.get( i ) +
+                           0.5f * ( mAccelerations.get( i ) + acceleration ) * deltaTime;
+                // Drag on the velocity, so it does not increase due to numerical errors
+                setVelocity( i, velocity * mDampingFactors[ mDampingIds[ i ] ] );
+                clearForce( i );
+            }
+        }
+    }
+
+    // Stages of Runge-Kutta 4. Each stage adds the derivatives of the state
+    // where the forces were evaluated, the velocity and the acceleration, to
+    // the weighted sums, and moves the bodies from the start of the step to the
+    // next state with them. The last one moves the bodies with the sums
+    void RigidBodyStore::integrateRK4( int stage, float deltaTime, int begin, int end )
+    {
+        // Weight of the derivatives of each stage, and fraction of the step
+        // where the next evaluation is
+        const float weights[4] = { 1.f, 2.f, 2.f, 1.f };
+        const float fractions[3] = { 0.5f, 0.5f, 1.f };
+
+        for ( int i = begin; i < end; ++i )
+        {
+            if ( stage == 0 )
+                mIntegrated[ i ] = mAwake[ i ];
+            if ( !mIntegrated[ i ] )
+            {
+                if ( stage == 3 )
+                    clearForce( i );
+                continue;
+            }
+
+            glm::vec3 velocity = getVelocity( i );
+            glm::vec3 acceleration = getForce( i ) * mInvMass[ i ];
+
+            if ( stage == 0 )
+            {
+                mStartPositions.set( i, getPosition( i ) );
+                mStartVelocities.set( i, velocity );
+                mVelocitySums.set( i, glm::vec3( 0.f ) );
+                mAccelerations.set( i, glm::vec3( 0.f ) );
+            }
+            glm::vec3 velocitySum = mVelocitySums.get( i ) + weights[ stage ] * velocity;
+            glm::vec3 accelerationSum = mAccelerations.get( i ) + weights[ stage ] * acceleration;
+            mVelocitySums.set( i, velocitySum );
+            mAccelerations.set( i, accelerationSum );
+
+            glm::vec3 startPosition = mStartPositions.get( i );
+            glm::vec3 startVelocity = mStartVelocities.get( i );
+            if ( stage < 3 )
+            {
+                float time = fractions[ stage ] * deltaTime;
+                setPosition( i, startPosition + velocity * time );
+                setVelocity( i, startVelocity + acceleration * time );
+            }
+            else
+            {
+                glm::vec3 displacement = velocitySum * ( deltaTime / 6.f );
+                velocity = startVelocity + accelerationSum * ( deltaTime / 6.f );
+                setPosition( i, startPosition + displacement );
+                // Drag on the velocity, so it does not increase due to numerical errors
+                setVelocity( i, velocity * mDampingFactors[ mDampingIds[ i ] ] );
+                mDisplacementX[ i ] += displacement.x;
+                mDisplacementY[ i ] += displacement.y;
+                mDisplacementZ[ i ] += displacement.z;
+                clearForce( i );
+            }
+        }
+    }
+
+    // Index of a damping value in the table. There are usually only a few
+    // distinct values, so they are searched linearly
+    int RigidBodyStore::findDamping( float damping )
+    {
+        for ( int i = 0; i < (int)mDampingValues.size(); ++i )
+        {
+            if ( mDampingValues[ i ] == damping )
+                return i;
+        }
+
+        mDampingValues.push_back( damping );
+        return mDampingValues.size() - 1;
+    }
+
+    //--------------------------------------------------------------------------
+    // Vec3Array struct
+
+    void RigidBodyStore::Vec3Array::resize( int size )
+    {
+        x.resize( size );
+        y.resize( size );
+        z.resize( size );
+    }
+
+    glm::vec3 RigidBodyStore::Vec3Array::get( int id ) const
+    {
+        return glm::vec3( x[ id ], y[ id ], z[ id ] );
+    }
+
+    void RigidBodyStore::Vec3Array::set( int id, const glm::vec3& value )
+    {
+        x[ id ] = value.x;
+        y[ id ] = value.y;
+        z[ id ] = value.z;
+    }
+}
@@ -0,0 +1,171 @@
+#ifndef RIGID_BODY_STORE_H
+#define RIGID_BODY_STORE_H
+
+#include "GLBase.h"
+
+using namespace GLBase;
+
+namespace Physics
+{
+    // Numerical integrators of the motion of the bodies, and the number of
+    // times each of them evaluates the forces in a step
+    //  - Semi-implicit Euler: one evaluation, first order
+    //  - Velocity Verlet: two evaluations, second order
+    //  - Runge-Kutta 4: four evaluations, fourth order
+    enum class IntegratorType
+    {
+        SemiImplicitEuler,
+        VelocityVerlet,
+        RK4
+    };
+
+    // Pool of the dynamic state of the rigid bodies, stored as a structure of
+    // arrays: position, velocity, accumulated force, inverse mass, damping and
+    // sleeping state.
+    // Each body gets an identifier, which is the position of its state in the
+    // arrays.
+    // The bodies are integrated in a single pass over the arrays, several at a
+    // time with SIMD instructions. The damping is given by the index of its
+    // value in a table of the distinct values used, so the damping factor of a
+    // step is computed once for each value and not for each body.
+    // The integrators that evaluate the forces several times in a step do it
+    // in stages: after each evaluation, a stage moves the bodies to the state
+    // where the forces are evaluated next, and the last one to the end of the
+    // step.
+    class RigidBodyStore
+    {
+        public:
+            // Constructor
+            RigidBodyStore();
+
+            // Add the state of a body, and return its identifier
+            int add( const glm::vec3& position, const glm::vec3& velocity,
+                     float invMass, float damping );
+
+            // Setters
+            void setPosition( int id, const glm::vec3& position );
+            void setVelocity( int id, const glm::vec3& velocity );
+            void setInvMass( int id, float invMass );
+            void setDamping( int id, float damping );
+            void setAwake( int id, bool awake );
+
+            // Getters
+            glm::vec3 getPosition( int id ) const;
+            glm::vec3 getVelocity( int id ) const;
+            glm::vec3 getForce( int id ) const;
+            glm::vec3 getDisplacement( int id ) const;
+            float getInvMass( int id ) const;
+            float getDamping( int id ) const;
+            bool isAwake( int id ) const;
+            int size() const;
+
+            // Arrays of a coordinate of the positions, velocities and forces,
+            // and of the inverse masses and sleeping states, to read and add
+            // the forces of many bodies in a single loop
+            const float* getPositionArray( int axis ) const;
+            const float* getVelocityArray( int axis ) const;
+            float* getForceArray( int axis );
+            const float* getInvMassArray() const;
+            const int* getAwakeArray() const;
+
+            // Add a force, and set the force to zero
+            void addForce( int id, const glm::vec3& force );
+            void clearForce( int id );
+
+            // Move a body after it was integrated for the given duration,
+            // changing its velocity and its displacement in the step as if it
+            // had moved there in the integration
+            void correctPosition( int id, const glm::vec3& correction, float deltaTime );
+
+            // Prepare a step of the given duration: compute the damping factor
+            // of each distinct damping value, keep the forces added before the
+            // step, which are the same in all its evaluations, and set the
+            // displacements to zero. It must be called before integrate. With
+            // sub-steps, it is called once for the whole step, with the
+            // duration of a sub-step
+            void beginStep( IntegratorType type, float deltaTime );
+
+            // Set the forces of the bodies with identifiers in [ begin, end ) to
+            // the ones added before the step, before the forces are evaluated
+            // again
+            void resetForces( int begin, int end );
+
+            // Number of stages of an integrator
+            static int getNumStages( IntegratorType type );
+
+            // Do a stage of an integrator for the bodies with identifiers in
+            // [ begin, end ), after the forces are evaluated. The last stage
+            // moves them forward in time by the given duration, and sets their
+            // forces to zero. The sleeping bodies are skipped, and only their
+            // forces are set to zero
+            void integrate( IntegratorType type, int stage, float deltaTime,
+                            int begin, int end );
+
+            // Semi-implicit Euler, with SIMD instructions
+            void integrateEuler( float deltaTime, int begin, int end );
+
+            // Scalar version of integrateEuler, used for the bodies left after
+            // the SIMD loop, and to compare with it
+            void integrateEulerScalar( float deltaTime, int begin, int end );
+
+            // Stages of velocity Verlet and Runge-Kutta 4
+            void integrateVerlet( int stage, float deltaTime, int begin, int end );
+            void integrateRK4( int stage, float deltaTime, int begin, int end );
+
+        private:
+            // Position, velocity, force and displacement in the last step
+            std::vector<float> mPositionX;
+            std::vector<float> mPositionY;
+            std::vector<float> mPositionZ;
+            std::vector<float> mVelocityX;
+            std::vector<float> mVelocityY;
+            std::vector<float> mVelocityZ;
+            std::vector<float> mForceX;
+            std::vector<float> mForceY;
+            std::vector<float> mForceZ;
+            std::vector<float> mDisplacementX;
+            std::vector<float> mDisplacementY;
+            std::vector<float> mDisplacementZ;
+            std::vector<float> mInvMass;
+
+            // 1 for the bodies that are awake, and 0 for the sleeping ones. They
+            // are 32-bit integers, so the SIMD loops load them as lane masks
+            std::vector<int> mAwake;
+            // Bodies integrated in the stages of the current sub-step: the ones
+            // awake at its first stage. A body woken up by a force between the
+            // stages waits for the next sub-step
+            std::vector<int> mIntegrated;
+
+            // Index of the damping value of each body, distinct damping values
+            // and their factors for the current step
+            std::vector<int> mDampingIds;
+            std::vector<float> mDampingValues;
+            std::vector<float> mDampingFactors;
+
+            // Array of vectors, used for the state kept between the stages
+            struct Vec3Array
+            {
+                std::vector<float> x;
+                std::vector<float> y;
+                std::vector<float> z;
+
+                void resize( int size );
+                glm::vec3 get( int id ) const;
+                void set( int id, const glm::vec3& value );
+            };
+
+            // Forces added before the step, and state at the start of the step
+            Vec3Array mExternalForces;
+            Vec3Array mStartPositions;
+            Vec3Array mStartVelocities;
+            // Accelerations of the first evaluation of velocity Verlet, or the
+            // weighted sums of the derivatives of the stages of Runge-Kutta 4
+            Vec3Array mAccelerations;
+            Vec3Array mVelocitySums;
+
+            // Index of a damping value in the table, added if it is new
+            int findDamping( float damping );
+    };
+}
+
+#endif
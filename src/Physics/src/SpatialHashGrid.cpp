@@ -0,0 +1,453 @@
+#include <algorithm>
+#include <limits>
+
+#include "Broadphase.h"
+#include "utils.h"
+
+using namespace GLBase;
+using namespace GLGeometry;
+
+namespace Physics
+{
+    // Distance, in cells, by which a body can start after the cell where it
+    // is reported in a ray cast, to absorb the rounding of the distances
+    const float RAY_CELL_TOLERANCE = 1e-4f;
+
+    //--------------------------------------------------------------------------
+    // SpatialHashGrid class
+
+    // Constructor
+    SpatialHashGrid::SpatialHashGrid( const AABBStore& aabbStore ) :
+        Broadphase( aabbStore ),
+        mCellSize { 1.f },
+        mGridMin { std::numeric_limits<float>::max() },
+        mGridMax { -std::numeric_limits<float>::max() }
+    {
+    }
+
+    // Add a body
+    void SpatialHashGrid::addBody( CollisionBody* body, bool isStatic )
+    {
+        // Bodies without a collider can not collide
+        if ( body->mCollider == nullptr )
+            return;
+
+        // Create the proxy of the body, at the position of its AABB in the pool
+        int proxy = body->mCollider->getAABBId();
+        if ( proxy >= (int)mProxies.size() )
+            mProxies.resize( proxy + 1, { nullptr, true } );
+        mProxies[ proxy ] = { body, isStatic };
+    }
+
+    // Build the grid and find the overlapping pairs.
+    // The arrays only grow when the number of bodies or cells grows, so this
+    // does not allocate memory in most steps
+    void SpatialHashGrid::update()
+    {
+        computeCellSize();
+
+        // Count the number of cells that each body is in, and keep apart the
+        // ones that are too large. The others give the bounds of the grid
+        mLargeProxies.clear();
+        mGridMin = glm::vec3( std::numeric_limits<float>::max() );
+        mGridMax = glm::vec3( -std::numeric_limits<float>::max() );
+        int nEntries = 0;
+        for ( int i = 0; i < (int)mProxies.size(); ++i )
+        {
+            if ( mProxies[ i ].body == nullptr )
+                continue;
+
+            glm::ivec3 cellMin, cellMax;
+            getCellRange( mAABBStore.getMin( i ), mAABBStore.getMax( i ), cellMin, cellMax );
+            int64_t nCells = (int64_t)( cellMax.x - cellMin.x + 1 ) *
+                             (int64_t)( cellMax.y - cellMin.y + 1 ) *
+                             (int64_t)( cellMax.z - cellMin.z + 1 );
+            if ( nCells > MAX_CELLS_PER_BODY )
+            {
+                mLargeProxies.push_back( i );
+                continue;
+            }
+            nEntries += nCells;
+            mGridMin = glm::min( mGridMin, mAABBStore.getMin( i ) );
+            mGridMax = glm::max( mGridMax, mAABBStore.getMax( i ) );
+        }
+
+        // Clear the hash table, with at least twice as many slots as entries
+        int tableSize = 16;
+        while ( tableSize < 2 * nEntries )
+            tableSize *= 2;
+        mCells.resize( tableSize );
+        for ( auto& cell : mCells )
+            cell.count = -1;
+
+        // Count the number of proxies in each cell
+        int nextLarge = 0;
+        for ( int i = 0; i < (int)mProxies.size(); ++i )
+        {
+            if ( mProxies[ i ].body == nullptr )
+                continue;
+            if ( nextLarge < (int)mLargeProxies.size() && mLargeProxies[ nextLarge ] == i )
+            {
+                ++nextLarge;
+                continue;
+            }
+
+            glm::ivec3 cellMin, cellMax;
+            getCellRange( mAABBStore.getMin( i ), mAABBStore.getMax( i ), cellMin, cellMax );
+            glm::ivec3 c;
+            for ( c.x = cellMin.x; c.x <= cellMax.x; ++c.x )
+                for ( c.y = cellMin.y; c.y <= cellMax.y; ++c.y )
+                    for ( c.z = cellMin.z; c.z <= cellMax.z; ++c.z )
+                    {
+                        Cell& cell = mCells[ findSlot( c ) ];
+                        if ( cell.count < 0 )
+                        {
+                            cell.coords = c;
+                            cell.count = 0;
+                        }
+                        cell.count++;
+                    }
+        }
+
+        // Compute where the proxies of each cell start
+        int offset = 0;
+        for ( auto& cell : mCells )
+        {
+            if ( cell.count <= 0 )
+                continue;
+            cell.start = offset;
+            offset += cell.count;
+            cell.count = 0;
+        }
+
+        // Store the proxies in their cells
+        mCellProxies.resize( nEntries );
+        nextLarge = 0;
+        for ( int i = 0; i < (int)mProxies.size(); ++i )
+        {
+            if ( mProxies[ i ].body == nullptr )
+                continue;
+            if ( nextLarge < (int)mLargeProxies.size() && mLargeProxies[ nextLarge ] == i )
+            {
+                ++nextLarge;
+                continue;
+            }
+
+            glm::ivec3 cellMin, cellMax;
+            getCellRange( mAABBStore.getMin( i ), mAABBStore.getMax( i ), cellMin, cellMax );
+            glm::ivec3 c;
+            for ( c.x = cellMin.x; c.x <= cellMax.x; ++c.x )
+                for ( c.y = cellMin.y; c.y <= cellMax.y; ++c.y )
+                    for ( c.z = cellMin.z; c.z <= cellMax.z; ++c.z )
+                    {
+                        Cell& cell = mCells[ findSlot( c ) ];
+                        mCellProxies[ cell.start + cell.count++ ] = i;
+                    }
+        }
+
+        // Find the pairs in each cell. Two bodies can share several cells, so
+        // each pair is only reported by the cell that contains the minimum
+        // corner of the intersection of their AABBs
+        mGridPairs.clear();
+        for ( auto& cell : mCells )
+        {
+            for ( int a = 0; a < cell.count; ++a )
+            {
+                int proxyA = mCellProxies[ cell.start + a ];
+                for ( int b = a + 1; b < cell.count; ++b )
+                {
+                    int proxyB = mCellProxies[ cell.start + b ];
+                    const Proxy& pA = mProxies[ proxyA ];
+                    const Proxy& pB = mProxies[ proxyB ];
+
+                    // Static bodies do not collide with each other
+                    if ( pA.isStatic && pB.isStatic )
+                        continue;
+                    if ( !mAABBStore.checkOverlap( proxyA, proxyB ) )
+                        continue;
+                    if ( getCellCoords( glm::max( mAABBStore.getMin( proxyA ),
+                                                  mAABBStore.getMin( proxyB ) ) ) != cell.coords )
+                        continue;
+
+                    mGridPairs.push_back( { proxyA, proxyB } );
+                }
+            }
+        }
+
+        // Check the large bodies against all the others, with the one against
+        // many test of the pool of AABBs
+        for ( int large : mLargeProxies )
+        {
+            const Proxy& pA = mProxies[ large ];
+            mOverlaps.clear();
+            mAABBStore.overlapOneVsMany( mAABBStore.getMin( large ), mAABBStore.getMax( large ),
+                                         0, mProxies.size(), mOverlaps );
+            for ( int other : mOverlaps )
+            {
+                const Proxy& pB = mProxies[ other ];
+                if ( other == large || pB.body == nullptr || ( pA.isStatic && pB.isStatic ) )
+                    continue;
+                // Pairs of large bodies are found from both of them
+                if ( other < large && std::binary_search( mLargeProxies.begin(),
+                                                          mLargeProxies.end(), other ) )
+                    continue;
+                mGridPairs.push_back( { large, other } );
+            }
+        }
+    }
+
+    // Write the pairs of bodies whose AABBs overlap
+    void SpatialHashGrid::findPairs( std::vector<BodyPair>& pairs )
+    {
+        pairs.clear();
+        mStats = BroadphaseStats();
+        for ( auto& pair : mGridPairs )
+            writePair( mProxies[ pair.first ].body, mProxies[ pair.second ].body, pairs );
+    }
+
+    // Write the bodies whose AABBs overlap the given box
+    void SpatialHashGrid::queryAABB( const glm::vec3& min, const glm::vec3& max,
+                                     std::vector<CollisionBody*>& bodies ) const
+    {
+        glm::ivec3 cellMin, cellMax;
+        getCellRange( min, max, cellMin, cellMax );
+        int64_t nCells = (int64_t)( cellMax.x - cellMin.x + 1 ) *
+                         (int64_t)( cellMax.y - cellMin.y + 1 ) *
+                         (int64_t)( cellMax.z - cellMin.z + 1 );
+
+        // For boxes larger than the table, check all the bodies in the pool
+        if ( nCells > (int64_t)mCells.size() )
+        {
+            // Auxiliary array, one per thread so that the queries do not allocate
+            thread_local std::vector<int> overlaps;
+            overlaps.clear();
+            mAABBStore.overlapOneVsMany( min, max, 0, mProxies.size(), overlaps );
+            for ( int proxy : overlaps )
+                if ( mProxies[ proxy ].body != nullptr )
+                    bodies.push_back( mProxies[ proxy ].body );
+            return;
+        }
+
+        // Check the bodies in the cells covered by the box. As with the pairs,
+        // each body is only reported from one of the cells
+        glm::ivec3 c;
+        for ( c.x = cellMin.x; c.x <= cellMax.x; ++c.x )
+            for ( c.y = cellMin.y; c.y <= cellMax.y; ++c.y )
+                for ( c.z = cellMin.z; c.z <= cellMax.z; ++c.z )
+                {
+                    const Cell& cell = mCells[ findSlot( c ) ];
+                    for ( int i = 0; i < cell.count; ++i )
+                    {
+                        int proxy = mCellProxies[ cell.start + i ];
+                        glm::vec3 proxyMin = mAABBStore.getMin( proxy );
+                        if ( checkOverlap( proxyMin, mAABBStore.getMax( proxy ), min, max ) &&
+                             getCellCoords( glm::max( proxyMin, min ) ) == c )
+                            bodies.push_back( mProxies[ proxy ].body );
+                    }
+                }
+
+        // Check the large bodies, which are not in the grid
+        for ( int large : mLargeProxies )
+            if ( checkOverlap( mAABBStore.getMin( large ), mAABBStore.getMax( large ), min, max ) )
+                bodies.push_back( mProxies[ large ].body );
+    }
+
+    // Call callback( body ) for the bodies whose AABBs are hit by a ray.
+    // The cells crossed by the ray are visited in order with a 3D DDA, and
+    // each body is reported from the cell where the ray enters its AABB, so
+    // the bodies are visited from the nearest to the farthest and the walk
+    // stops at the distance returned by the callback. The large bodies are
+    // checked one by one and merged with the others
+    void SpatialHashGrid::raycast( const glm::vec3& origin, const glm::vec3& direction,
+                                   float maxDistance,
+                                   const std::function<float( CollisionBody* )>& callback ) const
+    {
+        // Auxiliary arrays, one set per thread so that rays can be cast from
+        // several threads at once without allocating in each call
+        thread_local std::vector<int> hits;
+        thread_local std::vector<float> distances;
+        thread_local std::vector<std::pair<float, int>> largeHits;
+        thread_local std::vector<int> reported;
+        glm::vec3 invDirection = getInverseDirection( direction );
+        float tEnter, tExit;
+
+        // The grid is built in the first update
+        if ( mCells.empty() )
+        {
+            Broadphase::raycast( origin, direction, maxDistance, callback );
+            return;
+        }
+
+        // Part of the ray inside the grid, and the cells where it starts and ends
+        float tStart, tEnd;
+        bool crossesGrid = clipRay( mGridMin, mGridMax, origin, invDirection,
+                                                       maxDistance, tStart, tEnd );
+        glm::ivec3 cell, lastCell;
+        if ( crossesGrid )
+        {
+            cell = getCellCoords( origin + tStart * direction );
+            lastCell = getCellCoords( origin + tEnd * direction );
+
+            // For rays that cross more cells than the table has, check all the
+            // bodies in the pool
+            glm::ivec3 nSteps = glm::abs( lastCell - cell );
+            if ( (int64_t)nSteps.x + nSteps.y + nSteps.z + 1 > (int64_t)mCells.size() )
+            {
+                Broadphase::raycast( origin, direction, maxDistance, callback );
+                return;
+            }
+        }
+
+        // Distances to the large bodies, sorted
+        largeHits.clear();
+        for ( int large : mLargeProxies )
+            if ( clipRay( mAABBStore.getMin( large ), mAABBStore.getMax( large ), origin,
+                          invDirection, maxDistance, tEnter, tExit ) )
+                largeHits.push_back( { tEnter, large } );
+        std::sort( largeHits.begin(), largeHits.end() );
+        int nextLarge = 0;
+
+        if ( crossesGrid )
+        {
+            // Distance along the ray to the next boundary of a cell along each
+            // axis, and between boundaries
+            glm::ivec3 step;
+            glm::vec3 tNext, tDelta;
+            for ( int axis = 0; axis < 3; ++axis )
+            {
+                if ( direction[ axis ] > 0.f )
+                {
+                    step[ axis ] = 1;
+                    tNext[ axis ] = ( ( cell[ axis ] + 1 ) * mCellSize - origin[ axis ] ) *
+                                    invDirection[ axis ];
+                    tDelta[ axis ] = mCellSize * invDirection[ axis ];
+                }
+                else if ( direction[ axis ] < 0.f )
+                {
+                    step[ axis ] = -1;
+                    tNext[ axis ] = ( cell[ axis ] * mCellSize - origin[ axis ] ) *
+                                    invDirection[ axis ];
+                    tDelta[ axis ] = -mCellSize * invDirection[ axis ];
+                }
+                else
+                {
+                    step[ axis ] = 0;
+                    tNext[ axis ] = std::numeric_limits<float>::infinity();
+                    tDelta[ axis ] = 0.f;
+                }
+            }
+
+            reported.clear();
+            float tolerance = RAY_CELL_TOLERANCE * mCellSize;
+            while ( true )
+            {
+                float tCellExit = std::min( tNext.x, std::min( tNext.y, tNext.z ) );
+
+                // Bodies of the cell that the ray enters before leaving it
+                hits.clear();
+                distances.clear();
+                const Cell& current = mCells[ findSlot( cell ) ];
+                for ( int i = 0; i < current.count; ++i )
+                {
+                    int proxy = mCellProxies[ current.start + i ];
+                    if ( !clipRay( mAABBStore.getMin( proxy ), mAABBStore.getMax( proxy ), origin,
+                                   invDirection, maxDistance, tEnter, tExit ) ||
+                         tEnter > tCellExit + tolerance ||
+                         std::find( reported.begin(), reported.end(), proxy ) != reported.end() )
+                        continue;
+                    hits.push_back( proxy );
+                    distances.push_back( tEnter );
+                    reported.push_back( proxy );
+                }
+                for ( ; nextLarge < (int)largeHits.size(); ++nextLarge )
+                {
+                    if ( largeHits[ nextLarge ].first > tCellExit + tolerance )
+                        break;
+                    hits.push_back( largeHits[ nextLarge ].second );
+                    distances.push_back( largeHits[ nextLarge ].first );
+                }
+                visitRayHits( hits, distances, maxDistance, callback );
+
+                // Move to the next cell along the ray
+                if ( tCellExit >= std::min( tEnd, maxDistance ) )
+                    break;
+                int axis = tNext.x <= tNext.y ? ( tNext.x <= tNext.z ? 0 : 2 ) :
+                                                ( tNext.y <= tNext.z ? 1 : 2 );
+                cell[ axis ] += step[ axis ];
+                tNext[ axis ] += tDelta[ axis ];
+            }
+        }
+
+        // The large bodies after the grid
+        hits.clear();
+        distances.clear();
+        for ( ; nextLarge < (int)largeHits.size(); ++nextLarge )
+        {
+            hits.push_back( largeHits[ nextLarge ].second );
+            distances.push_back( largeHits[ nextLarge ].first );
+        }
+        visitRayHits( hits, distances, maxDistance, callback );
+    }
+
+    // Body of a proxy, or nullptr if the AABB is not in the broad phase
+    CollisionBody* SpatialHashGrid::getProxyBody( int proxy ) const
+    {
+        return proxy < (int)mProxies.size() ? mProxies[ proxy ].body : nullptr;
+    }
+
+    // Compute the size of the cells as the median size of the AABBs
+    void SpatialHashGrid::computeCellSize()
+    {
+        if ( mProxies.empty() )
+            return;
+
+        // Largest side of each AABB
+        mExtents.clear();
+        for ( int i = 0; i < (int)mProxies.size(); ++i )
+        {
+            if ( mProxies[ i ].body == nullptr )
+                continue;
+            glm::vec3 extent = mAABBStore.getMax( i ) - mAABBStore.getMin( i );
+            mExtents.push_back( std::max( extent.x, std::max( extent.y, extent.z ) ) );
+        }
+        if ( mExtents.empty() )
+            return;
+
+        // Find the median
+        auto median = mExtents.begin() + mExtents.size() / 2;
+        std::nth_element( mExtents.begin(), median, mExtents.end() );
+        if ( *median > 0.f )
+            mCellSize = *median;
+    }
+
+    // Range of cells covered by an AABB
+    void SpatialHashGrid::getCellRange( const glm::vec3& min, const glm::vec3& max,
+                                        glm::ivec3& cellMin, glm::ivec3& cellMax ) const
+    {
+        cellMin = getCellCoords( min );
+        cellMax = getCellCoords( max );
+    }
+
+    // Coordinates of the cell that contains a point
+    glm::ivec3 SpatialHashGrid::getCellCoords( const glm::vec3& point ) const
+    {
+        return glm::ivec3( glm::floor( point / mCellSize ) );
+    }
+
+    // Find the slot of a cell in the hash table
+    int SpatialHashGrid::findSlot( const glm::ivec3& coords ) const
+    {
+        // Hash of the coordinates, from large primes
+        uint32_t hash = ( (uint32_t)coords.x * 73856093u ) ^
+                        ( (uint32_t)coords.y * 19349663u ) ^
+                        ( (uint32_t)coords.z * 83492791u );
+        int mask = mCells.size() - 1;
+        int slot = hash & mask;
+
+        // Linear probing until the cell or an empty slot is found
+        while ( mCells[ slot ].count >= 0 && mCells[ slot ].coords != coords )
+            slot = ( slot + 1 ) & mask;
+
+        return slot;
+    }
+}
@@ -1,4 +1,5 @@
 #include "Colliders.h"
+#include "GJK.h"
 
 using namespace GLBase;
 using namespace GLGeometry;
@@ -13,22 +14,19 @@ namespace Physics
         mRadius { 1.f }
     {
         // Compute the AABB in model space
-        mAABB.cornersModel.push_back( glm::vec3( -0.5f, -0.5f, -0.5f ) );
-        mAABB.cornersModel.push_back( glm::vec3(  0.5f,  0.5f,  0.5f ) );
+        mAABB.cornersModel[0] = glm::vec3( -0.5f, -0.5f, -0.5f );
+        mAABB.cornersModel[1] = glm::vec3(  0.5f,  0.5f,  0.5f );
 
-        // Compute the vertices of the AABB in model space
-        computeVerticesAABB();
+        // Compute the center and half extents of the AABB in model space
+        computeCenterExtentsAABB();
 
         // Place the center at the position ( 0, 0, 0 )
         mCenter = glm::vec3( 0., 0., 0. );
     }
 
-    // Update the collider and AABB after a transformation
-    void SphereCollider::moveCollider( const glm::mat4& modelMatrix )
+    // Update the collider after a transformation
+    void SphereCollider::moveShape( const glm::mat4& modelMatrix )
     {
-        // Update the AABB
-        computeAABBTransformed( mAABB.verticesModel, modelMatrix, mAABB.cornersWorld );
-
         // Move the center
         mCenter = glm::vec3( modelMatrix[3][0],
                              modelMatrix[3][1],
@@ -42,13 +40,15 @@ namespace Physics
     }
 
     // Methods for finding collisions
-    bool SphereCollider::findCollision( const Collider* other ) const
+    CollisionPoints SphereCollider::findCollision( const Collider* other, Simplex& simplex ) const
     {
-        return other->findCollision( this );
+        return swapPoints( other->findCollision( this, simplex ) );
     }
 
-    bool SphereCollider::findCollision( const SphereCollider* other ) const
+    CollisionPoints SphereCollider::findCollision( const SphereCollider* other, Simplex& simplex ) const
     {
+        CollisionPoints points;
+        points.HasCollision = false;
 
         // Test collisions between AABBs first
         if ( checkCollisionAABB( other ) )
@@ -59,61 +59,107 @@ namespace Physics
 
             // Compute the distance squared between the centers of the spheres
             float distSq = 0.f;
-            glm::vec3 separation = mCenter - other->mCenter;
+            glm::vec3 separation = other->mCenter - mCenter;
             for ( int i = 0; i < 3; ++i )
                 distSq += separation[ i ] * separation[ i ];
 
             // Compare the two quantities
-            return distSq <= sumRadiusSq;
+            if ( distSq <= sumRadiusSq )
+            {
+                // The normal goes from the center of this sphere to the other.
+                // Concentric spheres are separated along the vertical axis
+                float dist = std::sqrt( distSq );
+                points.Normal = dist > 0.f ? separation / dist : glm::vec3( 0.f, 1.f, 0.f );
+                points.A = mCenter + mRadius * points.Normal;
+                points.B = other->mCenter - other->mRadius * points.Normal;
+                points.Depth = mRadius + other->mRadius - dist;
+                points.HasCollision = true;
+            }
         }
 
-        return false;
+        return points;
     }
 
-    bool SphereCollider::findCollision( const PlaneCollider* plane ) const
+    CollisionPoints SphereCollider::findCollision( const PlaneCollider* plane, Simplex& simplex ) const
     {
         // Test collision with the AABB
         if ( checkCollisionAABBPlane( plane ) )
         {
-            // Vector between centers
-            glm::vec3 vCenters = mCenter - plane->mCenter;
-            // Projection of the center of the sphere on the three axes of the plane
-            glm::vec3 projections;
-
-            // Project on the tangent directions
-            projections[ 0 ] = glm::dot( vCenters, plane->mTangent[ 0 ] );
-            projections[ 1 ] = glm::dot( vCenters, plane->mTangent[ 1 ] );
-
-            // Check if these projections fall inside the plane
-            if ( projections[ 0 ] + mRadius <= plane->mDimensions[ 0 ] &&
-                 projections[ 1 ] + mRadius <= plane->mDimensions[ 1 ] )
-            {
-
-                // Project the center on the normal
-                projections[ 2 ] = glm::dot( vCenters, plane->mNormal );
-
-                // Check if the sphere lies entirely on the plane
-                if ( projections[ 0 ] <= plane->mDimensions[ 0 ] &&
-                     projections[ 1 ] <= plane->mDimensions[ 1 ] &&
-                     std::fabs( projections[ 2 ] ) <= mRadius )
-                {
-                    return true;
-                }
-
-                // Otherwise, the computation is more complex, and this needs to be 
-                // implemented
-                //
-                //
-                //
-            }
+            // The core of the sphere is a point, so GJK finds the distance to
+            // the plane in a couple of iterations
+            return findCollisionGJK( this, plane, simplex );
         }
 
-        return false;
+        CollisionPoints points;
+        points.HasCollision = false;
+        return points;
     }
 
-    bool SphereCollider::findCollision( const ConvexCollider* other ) const
+    CollisionPoints SphereCollider::findCollision( const ConvexCollider* other, Simplex& simplex ) const
     {
         // Tbis is implemented in the class ConvexCollider
-        return other->findCollision( this );
+        return swapPoints( other->findCollision( this, simplex ) );
+    }
+
+    CollisionPoints SphereCollider::findCollision( const HeightfieldCollider* other, Simplex& simplex ) const
+    {
+        // This is implemented in the class HeightfieldCollider
+        return swapPoints( other->findCollision( this, simplex ) );
+    }
+
+    // Method to find the furthest point in a given direction
+    glm::vec3 SphereCollider::findFurthestPoint( const glm::vec3& direction ) const
+    {
+        return mCenter + mRadius * glm::normalize( direction );
+    }
+
+    // The core shape of the sphere is its center, and the margin its radius
+    float SphereCollider::getMargin() const
+    {
+        return mRadius;
+    }
+
+    // Cast a ray against the sphere, solving for the points of the ray at a
+    // distance of the radius from the center
+    bool SphereCollider::raycast( const glm::vec3& origin, const glm::vec3& direction,
+                                  float maxDistance, float& distance, glm::vec3& normal ) const
+    {
+        glm::vec3 offset = origin - mCenter;
+        float b = glm::dot( offset, direction );
+        float c = glm::dot( offset, offset ) - mRadius * mRadius;
+
+        // The origin is outside and the ray goes away from the sphere
+        if ( c > 0.f && b > 0.f )
+            return false;
+        float discriminant = b * b - c;
+        if ( discriminant < 0.f )
+            return false;
+
+        // A ray starting inside the sphere hits it at its origin, facing it
+        if ( c <= 0.f )
+        {
+            distance = 0.f;
+            normal = -direction;
+            return true;
+        }
+
+        distance = -b - std::sqrt( discriminant );
+        if ( distance > maxDistance )
+            return false;
+        normal = ( offset + distance * direction ) / mRadius;
+        return true;
+    }
+
+    // Depth of points inside the sphere, along the direction from its center
+    void SphereCollider::getPenetrations( const glm::vec3* positions, int count,
+                                          float* depths, glm::vec3* normals ) const
+    {
+        for ( int k = 0; k < count; ++k )
+        {
+            glm::vec3 offset = positions[ k ] - mCenter;
+            float distance = glm::length( offset );
+            normals[ k ] = distance > 1e-6f ? offset / distance : glm::vec3( 0.f, 1.f, 0.f );
+            depths[ k ] = mRadius - distance;
+        }
     }
 }
@@ -0,0 +1,382 @@
+#include <algorithm>
+#include <functional>
+#include <limits>
+
+#include "Broadphase.h"
+#include "utils.h"
+
+using namespace GLBase;
+using namespace GLGeometry;
+
+namespace Physics
+{
+    // Bodies larger than this times the median size of the AABBs are kept
+    // apart in the ray casts, so they do not widen the range of endpoints
+    // searched for the others
+    const float LARGE_PROXY_FACTOR = 8.f;
+
+    //--------------------------------------------------------------------------
+    // SweepAndPrune class
+
+    // Constructor
+    SweepAndPrune::SweepAndPrune( const AABBStore& aabbStore ) :
+        Broadphase( aabbStore ),
+        mNeedsRebuild { false },
+        mMaxExtents { 0.f, 0.f, 0.f },
+        mBoundsMin { std::numeric_limits<float>::max() },
+        mBoundsMax { -std::numeric_limits<float>::max() }
+    {
+    }
+
+    // Add a body
+    void SweepAndPrune::addBody( CollisionBody* body, bool isStatic )
+    {
+        // Bodies without a collider can not collide
+        if ( body->mCollider == nullptr )
+            return;
+
+        // Create the proxy of the body, at the position of its AABB in the pool
+        int proxy = body->mCollider->getAABBId();
+        if ( proxy >= (int)mProxies.size() )
+            mProxies.resize( proxy + 1, nullptr );
+        mProxies[ proxy ] = body;
+
+        // Add the endpoints at the end of the arrays. They are sorted, and the
+        // pairs of the new body found, in the next update
+        for ( int axis = 0; axis < 3; ++axis )
+        {
+            mEndpoints[ axis ].push_back( { 0.f, proxy, true } );
+            mEndpoints[ axis ].push_back( { 0.f, proxy, false } );
+        }
+        mNeedsRebuild = true;
+    }
+
+    // Update the endpoints and the list of overlapping pairs
+    void SweepAndPrune::update()
+    {
+        // Update the values of the endpoints from the pool of AABBs. This does
+        // not change their order
+        for ( int axis = 0; axis < 3; ++axis )
+        {
+            const float* mins = mAABBStore.getMinArray( axis );
+            const float* maxs = mAABBStore.getMaxArray( axis );
+            for ( auto& endpoint : mEndpoints[ axis ] )
+                endpoint.value = endpoint.isMin ? mins[ endpoint.proxy ] : maxs[ endpoint.proxy ];
+        }
+
+        // After adding bodies the arrays are far from sorted, so sort them
+        // from scratch and find all the pairs again
+        if ( mNeedsRebuild )
+        {
+            rebuild();
+            mNeedsRebuild = false;
+        }
+        else
+        {
+            // Sort the endpoints again. The overlapping pairs are updated when
+            // two endpoints are swapped, so all the values need to be updated
+            // before this
+            for ( int axis = 0; axis < 3; ++axis )
+                sortAxis( axis );
+        }
+
+        computeExtents();
+    }
+
+    // Write the pairs of bodies whose AABBs overlap
+    void SweepAndPrune::findPairs( std::vector<BodyPair>& pairs )
+    {
+        pairs.clear();
+        mStats = BroadphaseStats();
+        for ( auto& pair : mPairs )
+            writePair( mProxies[ pair.first ], mProxies[ pair.second ], pairs );
+    }
+
+    // Write the bodies whose AABBs overlap the given box.
+    // The box is checked against the whole pool at once
+    void SweepAndPrune::queryAABB( const glm::vec3& min, const glm::vec3& max,
+                                   std::vector<CollisionBody*>& bodies ) const
+    {
+        // Auxiliary array, one per thread so that the queries do not allocate
+        thread_local std::vector<int> overlaps;
+        overlaps.clear();
+        mAABBStore.overlapOneVsMany( min, max, 0, mProxies.size(), overlaps );
+        for ( int proxy : overlaps )
+            if ( mProxies[ proxy ] != nullptr )
+                bodies.push_back( mProxies[ proxy ] );
+    }
+
+    // Call callback( body ) for the bodies whose AABBs are hit by a ray.
+    // Every body hit by the ray overlaps it along each axis, so the endpoints
+    // to check are the ones in the range of the ray along an axis, extended
+    // by the largest size of the bodies. They are found with binary searches
+    // along the axis where there are fewest of them, and walked in the
+    // direction of the ray: the ray can not enter a body before it reaches
+    // its first endpoint, so the hits found are reported in order as the
+    // walk passes their distance, and the walk stops at the distance
+    // returned by the callback
+    void SweepAndPrune::raycast( const glm::vec3& origin, const glm::vec3& direction,
+                                 float maxDistance,
+                                 const std::function<float( CollisionBody* )>& callback ) const
+    {
+        // The endpoints of new bodies are not sorted until the next update
+        if ( mNeedsRebuild )
+        {
+            Broadphase::raycast( origin, direction, maxDistance, callback );
+            return;
+        }
+
+        // Bodies hit and not reported yet, in a heap with the nearest first.
+        // One per thread so that rays can be cast from several threads at
+        // once without allocating in each call
+        thread_local std::vector<std::pair<float, int>> pending;
+        pending.clear();
+        auto nearestFirst = std::greater<std::pair<float, int>>();
+        auto reportUpTo = [&]( float distance )
+        {
+            while ( !pending.empty() && pending.front().first <= distance )
+            {
+                std::pop_heap( pending.begin(), pending.end(), nearestFirst );
+                std::pair<float, int> hit = pending.back();
+                pending.pop_back();
+                if ( hit.first > maxDistance )
+                {
+                    pending.clear();
+                    return;
+                }
+                maxDistance = std::min( maxDistance, callback( mProxies[ hit.second ] ) );
+            }
+        };
+        auto addHit = [&]( int proxy, float distance )
+        {
+            pending.push_back( { distance, proxy } );
+            std::push_heap( pending.begin(), pending.end(), nearestFirst );
+        };
+
+        glm::vec3 invDirection = getInverseDirection( direction );
+        float tEnter, tExit;
+
+        // The large bodies are checked one by one
+        for ( int large : mLargeProxies )
+            if ( clipRay( mAABBStore.getMin( large ), mAABBStore.getMax( large ), origin,
+                          invDirection, maxDistance, tEnter, tExit ) )
+                addHit( large, tEnter );
+
+        // Part of the ray inside the box of the other bodies
+        float tStart, tEnd;
+        if ( clipRay( mBoundsMin, mBoundsMax, origin, invDirection, maxDistance, tStart, tEnd ) )
+        {
+            // Range of endpoints to check along each axis, keeping the smallest
+            int bestAxis = 0;
+            int bestBegin = 0;
+            int bestEnd = std::numeric_limits<int>::max();
+            float bestLow = 0.f;
+            float bestHigh = 0.f;
+            for ( int axis = 0; axis < 3; ++axis )
+            {
+                float a = origin[ axis ] + tStart * direction[ axis ];
+                float b = origin[ axis ] + tEnd * direction[ axis ];
+                float low = std::min( a, b );
+                float high = std::max( a, b );
+
+                // With the ray going down the axis, the bodies are walked by
+                // their maximum, so the range is extended upwards
+                bool forward = invDirection[ axis ] > 0.f;
+                float first = forward ? low - mMaxExtents[ axis ] : low;
+                float last = forward ? high : high + mMaxExtents[ axis ];
+
+                const std::vector<Endpoint>& endpoints = mEndpoints[ axis ];
+                int begin = std::lower_bound( endpoints.begin(), endpoints.end(), first,
+                                              []( const Endpoint& endpoint, float value )
+                                              {
+                                                  return endpoint.value < value;
+                                              } ) - endpoints.begin();
+                int end = std::upper_bound( endpoints.begin(), endpoints.end(), last,
+                                            []( float value, const Endpoint& endpoint )
+                                            {
+                                                return value < endpoint.value;
+                                            } ) - endpoints.begin();
+                if ( end - begin < bestEnd - bestBegin )
+                {
+                    bestAxis = axis;
+                    bestBegin = begin;
+                    bestEnd = end;
+                    bestLow = low;
+                    bestHigh = high;
+                }
+            }
+
+            // Box of the part of the ray inside the bounds, to discard most
+            // bodies along the other axes before the slab test
+            glm::vec3 segmentMin = glm::min( origin + tStart * direction, origin + tEnd * direction );
+            glm::vec3 segmentMax = glm::max( origin + tStart * direction, origin + tEnd * direction );
+            int axisB = ( bestAxis + 1 ) % 3;
+            int axisC = ( bestAxis + 2 ) % 3;
+            const float* minsB = mAABBStore.getMinArray( axisB );
+            const float* maxsB = mAABBStore.getMaxArray( axisB );
+            const float* minsC = mAABBStore.getMinArray( axisC );
+            const float* maxsC = mAABBStore.getMaxArray( axisC );
+
+            // Walk the endpoints that start the bodies in the direction of the
+            // ray, skipping the bodies that end before the range
+            bool forward = invDirection[ bestAxis ] > 0.f;
+            const std::vector<Endpoint>& endpoints = mEndpoints[ bestAxis ];
+            const float* mins = mAABBStore.getMinArray( bestAxis );
+            const float* maxs = mAABBStore.getMaxArray( bestAxis );
+            int count = bestEnd - bestBegin;
+            for ( int k = 0; k < count; ++k )
+            {
+                const Endpoint& endpoint = endpoints[ forward ? bestBegin + k : bestEnd - 1 - k ];
+                if ( endpoint.isMin != forward )
+                    continue;
+
+                // Report the hits nearer than the endpoint
+                float reach = ( endpoint.value - origin[ bestAxis ] ) * invDirection[ bestAxis ];
+                reportUpTo( reach );
+                if ( reach > maxDistance )
+                    break;
+
+                int proxy = endpoint.proxy;
+                if ( ( forward ? maxs[ proxy ] < bestLow : mins[ proxy ] > bestHigh ) ||
+                     minsB[ proxy ] > segmentMax[ axisB ] || maxsB[ proxy ] < segmentMin[ axisB ] ||
+                     minsC[ proxy ] > segmentMax[ axisC ] || maxsC[ proxy ] < segmentMin[ axisC ] ||
+                     std::binary_search( mLargeProxies.begin(), mLargeProxies.end(), proxy ) )
+                    continue;
+                if ( clipRay( mAABBStore.getMin( proxy ), mAABBStore.getMax( proxy ), origin,
+                              invDirection, maxDistance, tEnter, tExit ) )
+                    addHit( proxy, tEnter );
+            }
+        }
+
+        reportUpTo( std::numeric_limits<float>::infinity() );
+    }
+
+    // Body of a proxy, or nullptr if the AABB is not in the broad phase
+    CollisionBody* SweepAndPrune::getProxyBody( int proxy ) const
+    {
+        return proxy < (int)mProxies.size() ? mProxies[ proxy ] : nullptr;
+    }
+
+    // Sort all the endpoints, and find the overlapping pairs with a sweep
+    // along the first axis
+    void SweepAndPrune::rebuild()
+    {
+        for ( int axis = 0; axis < 3; ++axis )
+            std::sort( mEndpoints[ axis ].begin(), mEndpoints[ axis ].end(), isBefore );
+
+        mPairs.clear();
+        mPairIndices.clear();
+
+        // Proxies whose interval along the axis contains the current endpoint,
+        // and the position of each of them in the list
+        std::vector<int> active;
+        std::vector<int> activeIndex( mProxies.size(), -1 );
+        for ( auto& endpoint : mEndpoints[ 0 ] )
+        {
+            if ( endpoint.isMin )
+            {
+                for ( int other : active )
+                    if ( mAABBStore.checkOverlap( endpoint.proxy, other ) )
+                        addPair( endpoint.proxy, other );
+                activeIndex[ endpoint.proxy ] = active.size();
+                active.push_back( endpoint.proxy );
+            }
+            else
+            {
+                int index = activeIndex[ endpoint.proxy ];
+                active[ index ] = active.back();
+                activeIndex[ active[ index ] ] = index;
+                active.pop_back();
+            }
+        }
+    }
+
+    // Find the proxies much larger than the median, which are checked one by
+    // one in the ray casts, and the largest size and the bounds of the others
+    void SweepAndPrune::computeExtents()
+    {
+        mLargeProxies.clear();
+        for ( int axis = 0; axis < 3; ++axis )
+            mMaxExtents[ axis ] = 0.f;
+        mBoundsMin = glm::vec3( std::numeric_limits<float>::max() );
+        mBoundsMax = glm::vec3( -std::numeric_limits<float>::max() );
+
+        // Largest side of each AABB, and their median
+        mExtents.clear();
+        for ( int i = 0; i < (int)mProxies.size(); ++i )
+        {
+            if ( mProxies[ i ] == nullptr )
+                continue;
+            glm::vec3 extent = mAABBStore.getMax( i ) - mAABBStore.getMin( i );
+            mExtents.push_back( std::max( extent.x, std::max( extent.y, extent.z ) ) );
+        }
+        if ( mExtents.empty() )
+            return;
+        auto median = mExtents.begin() + mExtents.size() / 2;
+        std::nth_element( mExtents.begin(), median, mExtents.end() );
+        float threshold = *median > 0.f ? LARGE_PROXY_FACTOR * *median :
+                                          std::numeric_limits<float>::infinity();
+
+        for ( int i = 0; i < (int)mProxies.size(); ++i )
+        {
+            if ( mProxies[ i ] == nullptr )
+                continue;
+            glm::vec3 min = mAABBStore.getMin( i );
+            glm::vec3 max = mAABBStore.getMax( i );
+            glm::vec3 extent = max - min;
+            if ( std::max( extent.x, std::max( extent.y, extent.z ) ) > threshold )
+            {
+                mLargeProxies.push_back( i );
+                continue;
+            }
+            for ( int axis = 0; axis < 3; ++axis )
+                mMaxExtents[ axis ] = std::max( mMaxExtents[ axis ], extent[ axis ] );
+            mBoundsMin = glm::min( mBoundsMin, min );
+            mBoundsMax = glm::max( mBoundsMax, max );
+        }
+    }
+
+    // Sort the endpoints along an axis, updating the overlapping pairs
+    void SweepAndPrune::sortAxis( int axis )
+    {
+        std::vector<Endpoint>& endpoints = mEndpoints[ axis ];
+
+        // Insertion sort, which is close to linear for almost sorted arrays
+        for ( int i = 1; i < (int)endpoints.size(); ++i )
+        {
+            Endpoint current = endpoints[ i ];
+            int j = i - 1;
+            while ( j >= 0 && isBefore( current, endpoints[ j ] ) )
+            {
+                const Endpoint& other = endpoints[ j ];
+
+                // A minimum moving before a maximum means that the two bodies
+                // start overlapping along this axis. They will be a pair only if
+                // they also overlap along the other axes
+                if ( current.isMin && !other.isMin )
+                {
+                    if ( mAABBStore.checkOverlap( current.proxy, other.proxy ) )
+                        addPair( current.proxy, other.proxy );
+                }
+                // A maximum moving before a minimum means that the two bodies
+                // stop overlapping
+                else if ( !current.isMin && other.isMin )
+                {
+                    removePair( current.proxy, other.proxy );
+                }
+
+                endpoints[ j + 1 ] = endpoints[ j ];
+                --j;
+            }
+            endpoints[ j + 1 ] = current;
+        }
+    }
+
+    // Check if an endpoint goes before another one in the sorted arrays.
+    // For equal values the minimum goes first, so that touching AABBs are
+    // considered to overlap
+    bool SweepAndPrune::isBefore( const Endpoint& a, const Endpoint& b )
+    {
+        return a.value < b.value || ( a.value == b.value && a.isMin && !b.isMin );
+    }
+}
@@ -10,17 +10,25 @@ namespace Physics
     // Constructor
     Terrain::Terrain( std::vector<GLElemObject*>* elementaryObjects ) :
         // mElementaryObjects { elementaryObjects },
+        mDataHeight { nullptr },
+        mDataNormal { nullptr },
         mTessellationShader( Shader( std::string(BASE_DIR_SHADERS) + "/GLGeometry/tessellationGPassVertex.glsl",
                                      std::string(BASE_DIR_SHADERS) + "/GLGeometry/tessellationGPassFragment.glsl",
                                      "",
                                      std::string(BASE_DIR_SHADERS) + "/GLGeometry/tessellationGPassTessCtrl.glsl",
-                                     std::string(BASE_DIR_SHADERS) + "/GLGeometry/tessellationGPassTessEval.glsl" ) )
+                                     std::string(BASE_DIR_SHADERS) + "/GLGeometry/tessellationGPassTessEval.glsl" ) ),
+        mCollisionBody { nullptr },
+        mCollider { nullptr },
+        mCollisionGeometry { nullptr }
     {
     }
 
     // Destructor
     Terrain::~Terrain()
     {
+        delete mCollisionBody;
+        delete mCollider;
+        delete mCollisionGeometry;
         if ( mDataHeight )
             delete mDataHeight;
         if ( mDataNormal )
@@ -85,6 +93,9 @@ namespace Physics
         // Add a model matrix to the GLTerrainPatch
         mTerrainPatch->setModelMatrix( { 0., yShift, 0. }, 0., {0., 0., 1.}, { hScale, vScale, hScale } );
 
+        // Create the body for the collisions
+        createCollisionBody( width, height, hScale, vScale, yShift );
+
         // // Add this to the list of elementary objects
         // // This is needed for it to be considered when computing the shadow maps
         // mElementaryObjects->push_back( mTerrainPatch );
@@ -143,6 +154,9 @@ namespace Physics
             mTessellationShader.use();
             mTessellationShader.setInt("heightMap", 0);
             mTessellationShader.setInt("normalMap", 1);
+
+            // Create the body for the collisions
+            createCollisionBody( width, height, hScale, vScale, yShift );
         }
         else
         {
@@ -205,6 +219,9 @@ namespace Physics
         // Add a model matrix to the GLTerrainPatch
         mTerrainPatch->setModelMatrix( { 0., yShift, 0. }, 0., {0., 0., 1.}, { hScale, vScale, hScale } );
 
+        // Create the body for the collisions
+        createCollisionBody( width, height, hScale, vScale, yShift );
+
         // // Add this to the list of elementary objects
         // // This is needed for it to be considered when computing the shadow maps
         // mElementaryObjects->push_back( mTerrainPatch );
@@ -217,6 +234,17 @@ namespace Physics
         mMaterial = material;
     }
 
+    // Body and collider used for the collisions with the terrain
+    CollisionBody* Terrain::getCollisionBody()
+    {
+        return mCollisionBody;
+    }
+
+    const HeightfieldCollider* Terrain::getCollider() const
+    {
+        return mCollider;
+    }
+
     // Get the tessellation shader
     Shader& Terrain::getTessellationShader()
     {
@@ -250,22 +278,13 @@ namespace Physics
         // https://stackoverflow.com/questions/49640250/calculate-normals-from-heightmap
         glm::vec3 normal = { 0.f, 1.f, 0.f };
 
-        // Set the corners and edges to have vertical normal
-        for ( int i = 0; i < width; ++i )
+        // Start with vertical normals everywhere, which are kept near the
+        // edges. The collider of the terrain reads all of them
+        for ( int i = 0; i < width * height; ++i )
         {
             for ( int k = 0; k < 3; ++k )
-            {
                 mDataNormal[ i*4 + k ] = normal[k];
-                mDataNormal[ ((height-1)*width + i)*4 + k ] = normal[k];
-            }
-        }
-        for ( int j = 0; j < height; ++j )
-        {
-            for ( int k = 0; k < 3; ++k )
-            {
-                mDataNormal[ (j*width)*4 + k ] = normal[k];
-                mDataNormal[ (j*width + height-1)*4 + k ] = normal[k];
-            }
+            mDataNormal[ i*4 + 3 ] = 0.f;
         }
 
         // Rest of the grid
@@ -311,4 +330,22 @@ namespace Physics
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_FLOAT, mDataNormal);
         glGenerateMipmap(GL_TEXTURE_2D);
     }
+
+    // Create the body for the collisions, with the same transformation as the
+    // terrain patch. The collider reads the height and normal data directly
+    void Terrain::createCollisionBody( int width, int height, float hScale,
+                                       float vScale, float yShift )
+    {
+        delete mCollisionBody;
+        delete mCollider;
+        delete mCollisionGeometry;
+
+        mCollisionBody = new CollisionBody( { 0.f, yShift, 0.f }, { hScale, vScale, hScale },
+                                            0.f, { 0.f, 0.f, 1.f } );
+        mCollisionGeometry = new GLObjectPlaceholder();
+        mCollisionBody->addGeometryNotDrawn( mCollisionGeometry );
+
+        mCollider = new HeightfieldCollider( mDataHeight, mDataNormal, width, height );
+        mCollisionBody->addCollider( mCollider );
+    }
 }
@@ -38,6 +38,12 @@ namespace Physics
             // Draw the terrain
             void draw();
 
+            // Body used for the collisions with the terrain, with a collider
+            // that reads the height and normal data of the last patch added
+            // from height data. This is nullptr if there is no such patch
+            CollisionBody* getCollisionBody();
+            const HeightfieldCollider* getCollider() const;
+
         private:
             // // List of elementary objects in the corresponding sandbox
             // std::vector<GLElemObject*>* mElementaryObjects;
@@ -58,9 +64,19 @@ namespace Physics
             // Shader for tessellation
             Shader mTessellationShader;
 
+            // Body, collider and placeholder geometry for the collisions
+            CollisionBody* mCollisionBody;
+            HeightfieldCollider* mCollider;
+            GLObjectPlaceholder* mCollisionGeometry;
+
             // Compute the normal map given an array of data for the height map
             void computeNormalmapData( float* data, int width, int height,
                                        float hScale, float vScale );
+
+            // Create the body for the collisions, with the same transformation
+            // as the terrain patch
+            void createCollisionBody( int width, int height, float hScale,
+                                      float vScale, float yShift );
     };
 }
 
@@ -0,0 +1,112 @@
+#include "ThreadPool.h"
+#include "utils.h"
+
+using namespace GLBase;
+
+namespace Physics
+{
+    //--------------------------------------------------------------------------
+    // ThreadPool class
+
+    // Constructor
+    ThreadPool::ThreadPool( int nThreads ) :
+        mTask { nullptr },
+        mCount { 0 },
+        mNextIndex { 0 },
+        mBusyWorkers { 0 },
+        mGeneration { 0 },
+        mStop { false }
+    {
+        for ( int i = 1; i < nThreads; ++i )
+            mWorkers.emplace_back( &ThreadPool::workerLoop, this, i );
+    }
+
+    // Destructor
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock( mMutex );
+            mStop = true;
+        }
+        mWorkAvailable.notify_all();
+
+        for ( auto& worker : mWorkers )
+            worker.join();
+    }
+
+    // Getters
+    int ThreadPool::getNumThreads() const
+    {
+        return mWorkers.size() + 1;
+    }
+
+    // Call task( index, thread ) for each index in [ 0, count ), and wait until
+    // all of them are done
+    void ThreadPool::parallelFor( int count, const std::function<void( int, int )>& task )
+    {
+        if ( count <= 0 )
+            return;
+
+        // Without workers, or with a single iteration, there is no need to
+        // wake anybody up
+        if ( mWorkers.empty() || count == 1 )
+        {
+            for ( int i = 0; i < count; ++i )
+                task( i, 0 );
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock( mMutex );
+            mTask = &task;
+            mCount = count;
+            mNextIndex = 0;
+            mBusyWorkers = mWorkers.size();
+            mGeneration++;
+        }
+        mWorkAvailable.notify_all();
+
+        // The calling thread works too
+        runTasks( 0 );
+
+        std::unique_lock<std::mutex> lock( mMutex );
+        mWorkDone.wait( lock, [this]() { return mBusyWorkers == 0; } );
+        mTask = nullptr;
+    }
+
+    // Main function of the workers
+    void ThreadPool::workerLoop( int thread )
+    {
+        int generation = 0;
+        while ( true )
+        {
+            {
+                std::unique_lock<std::mutex> lock( mMutex );
+                mWorkAvailable.wait( lock, [&]() { return mStop || mGeneration != generation; } );
+                if ( mStop )
+                    return;
+                generation = mGeneration;
+            }
+
+            runTasks( thread );
+
+            {
+                std::lock_guard<std::mutex> lock( mMutex );
+                mBusyWorkers--;
+            }
+            mWorkDone.notify_one();
+        }
+    }
+
+    // Run iterations of the current loop until there are none left
+    void ThreadPool::runTasks( int thread )
+    {
+        while ( true )
+        {
+            int index = mNextIndex.fetch_add( 1 );
+            if ( index >= mCount )
+                return;
+            ( *mTask )( index, thread );
+        }
+    }
+}
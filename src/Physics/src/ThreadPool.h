@@ -0,0 +1,67 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+#include "GLBase.h"
+
+using namespace GLBase;
+
+namespace Physics
+{
+    // Fixed set of worker threads that run the iterations of a loop in
+    // parallel. The thread that calls parallelFor works too, so a pool with
+    // one thread runs everything in the calling thread.
+    // The iterations are handed out one at a time, so which thread runs each
+    // of them changes from one call to the next. Tasks that must give the
+    // same result regardless of the number of threads can use the thread
+    // index to select scratch memory, but not to decide what to compute.
+    class ThreadPool
+    {
+        public:
+            // Constructor, with the total number of threads, counting the one
+            // that calls parallelFor
+            ThreadPool( int nThreads );
+
+            // Destructor
+            ~ThreadPool();
+
+            // Getters
+            int getNumThreads() const;
+
+            // Call task( index, thread ) for each index in [ 0, count ), and
+            // wait until all of them are done. The thread index is in
+            // [ 0, getNumThreads() )
+            void parallelFor( int count, const std::function<void( int, int )>& task );
+
+        private:
+            std::vector<std::thread> mWorkers;
+
+            // Loop being run, and the next index to hand out
+            const std::function<void( int, int )>* mTask;
+            int mCount;
+            std::atomic<int> mNextIndex;
+
+            // Number of workers still running the current loop
+            int mBusyWorkers;
+            // Incremented for each loop, so the workers know there is new work
+            int mGeneration;
+            bool mStop;
+
+            std::mutex mMutex;
+            std::condition_variable mWorkAvailable;
+            std::condition_variable mWorkDone;
+
+            // Main function of the workers
+            void workerLoop( int thread );
+
+            // Run iterations of the current loop until there are none left
+            void runTasks( int thread );
+    };
+}
+
+#endif
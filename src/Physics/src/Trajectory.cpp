@@ -0,0 +1,643 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Trajectory.h"
+#include "utils.h"
+
+using namespace GLBase;
+
+namespace Physics
+{
+    // Identifiers of the parts of a trajectory file
+    const char TRAJECTORY_MAGIC[8] = { 'P', 'H', 'Y', 'S', 'T', 'R', 'A', 'J' };
+    const uint32_t TRAJECTORY_VERSION = 1;
+    const uint32_t TRAJECTORY_CHUNK_MAGIC = 0x4b4e4843;  // "CHNK"
+    const uint32_t TRAJECTORY_INDEX_MAGIC = 0x58444e49;  // "INDX"
+
+    // Number of values of the state of a body: position, orientation and
+    // velocity
+    const int STATE_VALUES = 10;
+
+    // Append raw bytes to a buffer, and read them back from memory that may
+    // not be aligned
+    static void appendBytes( std::vector<uint8_t>& data, const void* bytes, size_t size )
+    {
+        const uint8_t* begin = static_cast<const uint8_t*>( bytes );
+        data.insert( data.end(), begin, begin + size );
+    }
+
+    template <typename T>
+    static T readValue( const uint8_t*& data )
+    {
+        T value;
+        std::memcpy( &value, data, sizeof( T ) );
+        data += sizeof( T );
+        return value;
+    }
+
+    // Variable length integers, with seven bits in each byte and the highest
+    // bit set in all the bytes but the last one. The signed differences are
+    // mapped first to unsigned integers, with the small magnitudes first
+    static void appendVarint( std::vector<uint8_t>& data, uint32_t value )
+    {
+        while ( value >= 0x80 )
+        {
+            data.push_back( (uint8_t)( value | 0x80 ) );
+            value >>= 7;
+        }
+        data.push_back( (uint8_t)value );
+    }
+
+    // Read a variable length integer that ends before end. Returns false if it
+    // does not, or if it has more bytes than a 32-bit integer needs
+    static bool readVarint( const uint8_t*& data, const uint8_t* end, uint32_t& value )
+    {
+        value = 0;
+        for ( int shift = 0; shift < 32; shift += 7 )
+        {
+            if ( data >= end )
+                return false;
+            uint8_t byte = *data++;
+            value |= (uint32_t)( byte & 0x7f ) << shift;
+            if ( ( byte & 0x80 ) == 0 )
+                return true;
+        }
+        return false;
+    }
+
+    static uint32_t zigzagEncode( int32_t value )
+    {
+        return ( (uint32_t)value << 1 ) ^ (uint32_t)( value >> 31 );
+    }
+
+    static int32_t zigzagDecode( uint32_t value )
+    {
+        return (int32_t)( value >> 1 ) ^ -(int32_t)( value & 1 );
+    }
+
+    // Quantize a value with the given precision
+    static int32_t quantize( float value, float precision )
+    {
+        double q = std::round( (double)value / precision );
+        q = std::clamp( q, (double)std::numeric_limits<int32_t>::min(),
+                        (double)std::numeric_limits<int32_t>::max() );
+        return (int32_t)q;
+    }
+
+    // Values of the state of a body, in the order in which they are stored
+    static void getStateValues( const BodyState& state, float values[ STATE_VALUES ] )
+    {
+        for ( int i = 0; i < 3; ++i )
+        {
+            values[ i ] = state.position[ i ];
+            values[ 7 + i ] = state.velocity[ i ];
+        }
+        values[3] = state.orientation.x;
+        values[4] = state.orientation.y;
+        values[5] = state.orientation.z;
+        values[6] = state.orientation.w;
+    }
+
+    static void setStateValues( const float values[ STATE_VALUES ], BodyState& state )
+    {
+        for ( int i = 0; i < 3; ++i )
+        {
+            state.position[ i ] = values[ i ];
+            state.velocity[ i ] = values[ 7 + i ];
+        }
+        state.orientation = glm::quat( values[6], values[3], values[4], values[5] );
+    }
+
+    // Precision of each value of the state
+    static void getPrecisions( float positionPrecision, float orientationPrecision,
+                               float velocityPrecision, float precisions[ STATE_VALUES ] )
+    {
+        for ( int i = 0; i < 3; ++i )
+        {
+            precisions[ i ] = positionPrecision;
+            precisions[ 7 + i ] = velocityPrecision;
+        }
+        for ( int i = 3; i < 7; ++i )
+            precisions[ i ] = orientationPrecision;
+    }
+
+    //--------------------------------------------------------------------------
+    // TrajectoryRecorder class
+
+    // Constructor
+    TrajectoryRecorder::TrajectoryRecorder() :
+        mFile { nullptr },
+        mNumSteps { 0 },
+        mTime { 0.f },
+        mChunkFirstStep { 0 }
+    {
+    }
+
+    // Destructor
+    TrajectoryRecorder::~TrajectoryRecorder()
+    {
+        close();
+    }
+
+    // Create a file and write its header
+    bool TrajectoryRecorder::open( const std::string& path, const TrajectorySettings& settings )
+    {
+        close();
+
+        // The quantized values are divided by the precisions, which must be
+        // positive. The negated test also rejects NaN
+        if ( settings.compressed && !( settings.positionPrecision > 0.f &&
+                                       settings.orientationPrecision > 0.f &&
+                                       settings.velocityPrecision > 0.f ) )
+        {
+            LOG_ERROR( "The precisions of the trajectory must be positive" );
+            return false;
+        }
+
+        mFile = std::fopen( path.c_str(), "wb" );
+        if ( mFile == nullptr )
+        {
+            LOG_ERROR( "Failed to create the trajectory file " << path );
+            return false;
+        }
+
+        mSettings = settings;
+        mSettings.stepsPerChunk = std::max( mSettings.stepsPerChunk, 1 );
+        mNumSteps = 0;
+        mTime = 0.f;
+        mChunkFirstStep = 0;
+        mStepOffsets.clear();
+        mChunkData.clear();
+        mPreviousValues.clear();
+        mIndex.clear();
+
+        TrajectoryFileHeader header;
+        std::memcpy( header.magic, TRAJECTORY_MAGIC, sizeof( header.magic ) );
+        header.version = TRAJECTORY_VERSION;
+        header.compressed = mSettings.compressed ? 1 : 0;
+        header.stepsPerChunk = mSettings.stepsPerChunk;
+        header.positionPrecision = mSettings.positionPrecision;
+        header.orientationPrecision = mSettings.orientationPrecision;
+        header.velocityPrecision = mSettings.velocityPrecision;
+        std::fwrite( &header, sizeof( header ), 1, mFile );
+
+        return true;
+    }
+
+    // Write the last chunk and the index, and close the file
+    void TrajectoryRecorder::close()
+    {
+        if ( mFile == nullptr )
+            return;
+
+        if ( !mStepOffsets.empty() )
+            writeChunk();
+
+        TrajectoryIndexFooter footer;
+        footer.indexOffset = std::ftell( mFile );
+        footer.nChunks = mIndex.size();
+        footer.magic = TRAJECTORY_INDEX_MAGIC;
+        std::fwrite( mIndex.data(), sizeof( TrajectoryIndexEntry ), mIndex.size(), mFile );
+        std::fwrite( &footer, sizeof( footer ), 1, mFile );
+
+        std::fclose( mFile );
+        mFile = nullptr;
+    }
+
+    // Add a step with the states of the bodies
+    void TrajectoryRecorder::record( const std::vector<RigidBody*>& bodies, float deltaTime )
+    {
+        if ( mFile == nullptr )
+            return;
+
+        mTime += deltaTime;
+
+        // Step header
+        mStepOffsets.push_back( mChunkData.size() );
+        uint32_t nBodies = bodies.size();
+        appendBytes( mChunkData, &mTime, sizeof( mTime ) );
+        appendBytes( mChunkData, &nBodies, sizeof( nBodies ) );
+
+        float precisions[ STATE_VALUES ];
+        getPrecisions( mSettings.positionPrecision, mSettings.orientationPrecision,
+                       mSettings.velocityPrecision, precisions );
+
+        // The bodies that were not in the previous step start from zero
+        if ( mSettings.compressed )
+            mPreviousValues.resize( nBodies * STATE_VALUES, 0 );
+
+        for ( uint32_t i = 0; i < nBodies; ++i )
+        {
+            BodyState state;
+            state.id = i;
+            state.position = bodies[ i ]->getPosition();
+            state.orientation = bodies[ i ]->getOrientation();
+            state.velocity = bodies[ i ]->getVelocity();
+
+            float values[ STATE_VALUES ];
+            getStateValues( state, values );
+
+            if ( !mSettings.compressed )
+            {
+                appendBytes( mChunkData, &state.id, sizeof( state.id ) );
+                appendBytes( mChunkData, values, sizeof( values ) );
+                continue;
+            }
+
+            // Differences with the quantized state of the previous step. They
+            // wrap around like the integers, so they can always be undone
+            appendVarint( mChunkData, state.id );
+            for ( int j = 0; j < STATE_VALUES; ++j )
+            {
+                int32_t& previous = mPreviousValues[ i * STATE_VALUES + j ];
+                int32_t current = quantize( values[ j ], precisions[ j ] );
+                appendVarint( mChunkData, zigzagEncode( (int32_t)( (uint32_t)current -
+                                                                   (uint32_t)previous ) ) );
+                previous = current;
+            }
+        }
+        mPreviousValues.resize( nBodies * STATE_VALUES );
+
+        mNumSteps++;
+        if ( (int)mStepOffsets.size() == mSettings.stepsPerChunk )
+            writeChunk();
+    }
+
+    // Getters
+    bool TrajectoryRecorder::isOpen() const
+    {
+        return mFile != nullptr;
+    }
+
+    int TrajectoryRecorder::getNumSteps() const
+    {
+        return mNumSteps;
+    }
+
+    // Write the chunk being filled to the file, and start a new one
+    void TrajectoryRecorder::writeChunk()
+    {
+        TrajectoryChunkHeader header;
+        header.magic = TRAJECTORY_CHUNK_MAGIC;
+        header.firstStep = mChunkFirstStep;
+        header.nSteps = mStepOffsets.size();
+        header.dataSize = mStepOffsets.size() * sizeof( uint32_t ) + mChunkData.size();
+
+        mIndex.push_back( { (uint64_t)std::ftell( mFile ), header.firstStep, header.nSteps } );
+
+        std::fwrite( &header, sizeof( header ), 1, mFile );
+        std::fwrite( mStepOffsets.data(), sizeof( uint32_t ), mStepOffsets.size(), mFile );
+        std::fwrite( mChunkData.data(), 1, mChunkData.size(), mFile );
+
+        // The first step of the next chunk is not relative to this one
+        mChunkFirstStep = mNumSteps;
+        mStepOffsets.clear();
+        mChunkData.clear();
+        mPreviousValues.clear();
+    }
+
+    //--------------------------------------------------------------------------
+    // TrajectoryReplayer class
+
+    // Constructor
+    TrajectoryReplayer::TrajectoryReplayer() :
+        mData { nullptr },
+        mSize { 0 },
+        mNumSteps { 0 },
+        mDecodedChunk { -1 },
+        mDecodedStep { -1 }
+    {
+    }
+
+    // Destructor
+    TrajectoryReplayer::~TrajectoryReplayer()
+    {
+        close();
+    }
+
+    // Map a file to memory and read its index
+    bool TrajectoryReplayer::open( const std::string& path )
+    {
+        close();
+
+        int fd = ::open( path.c_str(), O_RDONLY );
+        if ( fd < 0 )
+        {
+            LOG_ERROR( "Failed to open the trajectory file " << path );
+            return false;
+        }
+
+        struct stat fileStat;
+        if ( fstat( fd, &fileStat ) != 0 || fileStat.st_size < (off_t)sizeof( TrajectoryFileHeader ) )
+        {
+            LOG_ERROR( "Failed to read the trajectory file " << path );
+            ::close( fd );
+            return false;
+        }
+
+        // The mapping stays valid after closing the descriptor
+        void* data = mmap( nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+        ::close( fd );
+        if ( data == MAP_FAILED )
+        {
+            LOG_ERROR( "Failed to map the trajectory file " << path );
+            return false;
+        }
+        mData = static_cast<const uint8_t*>( data );
+        mSize = fileStat.st_size;
+
+        std::memcpy( &mHeader, mData, sizeof( mHeader ) );
+        if ( std::memcmp( mHeader.magic, TRAJECTORY_MAGIC, sizeof( mHeader.magic ) ) != 0 ||
+             mHeader.version != TRAJECTORY_VERSION || !readIndex() )
+        {
+            LOG_ERROR( "Invalid trajectory file " << path );
+            close();
+            return false;
+        }
+
+        return true;
+    }
+
+    // Unmap the file
+    void TrajectoryReplayer::close()
+    {
+        if ( mData != nullptr )
+            munmap( const_cast<uint8_t*>( mData ), mSize );
+
+        mData = nullptr;
+        mSize = 0;
+        mIndex.clear();
+        mNumSteps = 0;
+        mDecodedChunk = -1;
+        mDecodedStep = -1;
+    }
+
+    // Read the states of the bodies in a step
+    bool TrajectoryReplayer::readStep( int step, std::vector<BodyState>& states )
+    {
+        if ( step < 0 || step >= mNumSteps )
+            return false;
+
+        int chunk = findChunk( step );
+        const uint8_t* end;
+        const uint8_t* data = getStepData( chunk, step, end );
+        states.clear();
+
+        if ( !mHeader.compressed )
+        {
+            data += sizeof( float );
+            uint32_t nBodies = readValue<uint32_t>( data );
+            size_t stateSize = sizeof( uint32_t ) + STATE_VALUES * sizeof( float );
+            if ( nBodies > (size_t)( end - data ) / stateSize )
+            {
+                LOG_ERROR( "Invalid step " << step << " in the trajectory file" );
+                return false;
+            }
+            states.resize( nBodies );
+            for ( uint32_t i = 0; i < nBodies; ++i )
+            {
+                states[ i ].id = readValue<uint32_t>( data );
+                float values[ STATE_VALUES ];
+                std::memcpy( values, data, sizeof( values ) );
+                data += sizeof( values );
+                setStateValues( values, states[ i ] );
+            }
+            return true;
+        }
+
+        // Decode the steps of the chunk from the first one, or from the last
+        // one decoded if it is before this step
+        int firstStep = mIndex[ chunk ].firstStep;
+        if ( mDecodedChunk != chunk || mDecodedStep > step )
+        {
+            mDecodedIds.clear();
+            mDecodedValues.clear();
+            mDecodedChunk = chunk;
+            mDecodedStep = firstStep - 1;
+        }
+        for ( int s = mDecodedStep + 1; s <= step; ++s )
+        {
+            data = getStepData( chunk, s, end );
+            if ( !decodeStep( data, end ) )
+            {
+                LOG_ERROR( "Invalid step " << s << " in the trajectory file" );
+                mDecodedChunk = -1;
+                return false;
+            }
+        }
+        mDecodedStep = step;
+
+        float precisions[ STATE_VALUES ];
+        getPrecisions( mHeader.positionPrecision, mHeader.orientationPrecision,
+                       mHeader.velocityPrecision, precisions );
+
+        states.resize( mDecodedIds.size() );
+        for ( size_t i = 0; i < states.size(); ++i )
+        {
+            float values[ STATE_VALUES ];
+            for ( int j = 0; j < STATE_VALUES; ++j )
+                values[ j ] = mDecodedValues[ i * STATE_VALUES + j ] * precisions[ j ];
+            states[ i ].id = mDecodedIds[ i ];
+            setStateValues( values, states[ i ] );
+            states[ i ].orientation = glm::normalize( states[ i ].orientation );
+        }
+        return true;
+    }
+
+    // Move the bodies to their states in a step, and update their transforms
+    bool TrajectoryReplayer::applyStep( int step, const std::vector<RigidBody*>& bodies )
+    {
+        if ( !readStep( step, mStates ) )
+            return false;
+
+        for ( auto& state : mStates )
+        {
+            if ( state.id >= bodies.size() || bodies[ state.id ] == nullptr )
+                continue;
+
+            RigidBody* body = bodies[ state.id ];
+            body->setPosition( state.position );
+            body->setOrientation( state.orientation );
+            body->updateTransform();
+        }
+        return true;
+    }
+
+    // Getters
+    bool TrajectoryReplayer::isOpen() const
+    {
+        return mData != nullptr;
+    }
+
+    int TrajectoryReplayer::getNumSteps() const
+    {
+        return mNumSteps;
+    }
+
+    // Time of a step since the first one
+    float TrajectoryReplayer::getTime( int step ) const
+    {
+        if ( step < 0 || step >= mNumSteps )
+            return 0.f;
+
+        const uint8_t* end;
+        const uint8_t* data = getStepData( findChunk( step ), step, end );
+        return readValue<float>( data );
+    }
+
+    // Read the index at the end of the file. If there is none, or it does not
+    // match the size of the file or the chunks, walk the chunks from the
+    // start, stopping at the first one that is incomplete
+    bool TrajectoryReplayer::readIndex()
+    {
+        mIndex.clear();
+
+        if ( mSize >= sizeof( TrajectoryFileHeader ) + sizeof( TrajectoryIndexFooter ) )
+        {
+            TrajectoryIndexFooter footer;
+            std::memcpy( &footer, mData + mSize - sizeof( footer ), sizeof( footer ) );
+            uint64_t indexSize = mSize - sizeof( footer );
+            if ( footer.magic == TRAJECTORY_INDEX_MAGIC &&
+                 footer.indexOffset <= indexSize &&
+                 footer.nChunks * sizeof( TrajectoryIndexEntry ) == indexSize - footer.indexOffset )
+            {
+                mIndex.resize( footer.nChunks );
+                std::memcpy( mIndex.data(), mData + footer.indexOffset,
+                             footer.nChunks * sizeof( TrajectoryIndexEntry ) );
+                for ( auto& entry : mIndex )
+                {
+                    if ( !validateChunk( entry ) )
+                    {
+                        mIndex.clear();
+                        break;
+                    }
+                }
+            }
+        }
+
+        if ( mIndex.empty() )
+        {
+            uint64_t offset = sizeof( TrajectoryFileHeader );
+            while ( offset + sizeof( TrajectoryChunkHeader ) <= mSize )
+            {
+                TrajectoryChunkHeader header;
+                std::memcpy( &header, mData + offset, sizeof( header ) );
+                TrajectoryIndexEntry entry = { offset, header.firstStep, header.nSteps };
+                if ( !validateChunk( entry ) )
+                    break;
+
+                mIndex.push_back( entry );
+                offset += sizeof( header ) + header.dataSize;
+            }
+        }
+
+        // Check that the chunks are in order
+        mNumSteps = 0;
+        for ( auto& entry : mIndex )
+        {
+            if ( entry.firstStep != (uint32_t)mNumSteps ||
+                 entry.nSteps > (uint32_t)( std::numeric_limits<int>::max() - mNumSteps ) )
+                return false;
+            mNumSteps += entry.nSteps;
+        }
+        return true;
+    }
+
+    // Check a chunk of the index. The offsets of the steps must be in order,
+    // and each step must have room at least for its time and its number of
+    // bodies, so they can be read without checking again
+    bool TrajectoryReplayer::validateChunk( const TrajectoryIndexEntry& entry ) const
+    {
+        if ( entry.offset < sizeof( TrajectoryFileHeader ) || entry.offset > mSize ||
+             mSize - entry.offset < sizeof( TrajectoryChunkHeader ) )
+            return false;
+
+        TrajectoryChunkHeader header;
+        std::memcpy( &header, mData + entry.offset, sizeof( header ) );
+        if ( header.magic != TRAJECTORY_CHUNK_MAGIC || header.firstStep != entry.firstStep ||
+             header.nSteps != entry.nSteps ||
+             header.dataSize > mSize - entry.offset - sizeof( header ) ||
+             header.nSteps > header.dataSize / sizeof( uint32_t ) )
+            return false;
+
+        const uint8_t* offsets = mData + entry.offset + sizeof( header );
+        uint64_t stepsSize = header.dataSize - header.nSteps * sizeof( uint32_t );
+        const uint64_t minStepSize = sizeof( float ) + sizeof( uint32_t );
+        uint64_t previous = 0;
+        for ( uint32_t s = 0; s < header.nSteps; ++s )
+        {
+            uint64_t offset = readValue<uint32_t>( offsets );
+            if ( offset < previous || offset > stepsSize || stepsSize - offset < minStepSize )
+                return false;
+            previous = offset + minStepSize;
+        }
+        return true;
+    }
+
+    // Chunk of a step, by binary search on the first steps of the chunks
+    int TrajectoryReplayer::findChunk( int step ) const
+    {
+        auto next = std::upper_bound( mIndex.begin(), mIndex.end(), (uint32_t)step,
+                                      []( uint32_t s, const TrajectoryIndexEntry& entry )
+        {
+            return s < entry.firstStep;
+        } );
+        return ( next - mIndex.begin() ) - 1;
+    }
+
+    // Position of a step in the file, from the offsets of its chunk. Its data
+    // ends where the next step starts, or at the end of the chunk
+    const uint8_t* TrajectoryReplayer::getStepData( int chunk, int step,
+                                                    const uint8_t*& end ) const
+    {
+        const TrajectoryIndexEntry& entry = mIndex[ chunk ];
+        TrajectoryChunkHeader header;
+        std::memcpy( &header, mData + entry.offset, sizeof( header ) );
+
+        const uint8_t* offsets = mData + entry.offset + sizeof( TrajectoryChunkHeader );
+        const uint8_t* steps = offsets + entry.nSteps * sizeof( uint32_t );
+        uint32_t index = step - entry.firstStep;
+        const uint8_t* offset = offsets + index * sizeof( uint32_t );
+        const uint8_t* data = steps + readValue<uint32_t>( offset );
+        if ( index + 1 < entry.nSteps )
+            end = steps + readValue<uint32_t>( offset );
+        else
+            end = offsets + header.dataSize;
+        return data;
+    }
+
+    // Decode a compressed step. The bodies that were not in the previous step
+    // start from zero
+    bool TrajectoryReplayer::decodeStep( const uint8_t* data, const uint8_t* end )
+    {
+        data += sizeof( float );
+        uint32_t nBodies = readValue<uint32_t>( data );
+        // Each body takes at least one byte for each value and its identifier
+        if ( nBodies > (size_t)( end - data ) / ( STATE_VALUES + 1 ) )
+            return false;
+        mDecodedIds.resize( nBodies );
+        mDecodedValues.resize( nBodies * STATE_VALUES, 0 );
+
+        for ( uint32_t i = 0; i < nBodies; ++i )
+        {
+            if ( !readVarint( data, end, mDecodedIds[ i ] ) )
+                return false;
+            for ( int j = 0; j < STATE_VALUES; ++j )
+            {
+                uint32_t difference;
+                if ( !readVarint( data, end, difference ) )
+                    return false;
+                int32_t& value = mDecodedValues[ i * STATE_VALUES + j ];
+                value = (int32_t)( (uint32_t)value + (uint32_t)zigzagDecode( difference ) );
+            }
+        }
+        return true;
+    }
+}
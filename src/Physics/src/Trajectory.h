@@ -0,0 +1,220 @@
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include <cstdio>
+#include <string>
+
+#include <glm/gtc/quaternion.hpp>
+
+#include "GLBase.h"
+#include "PhysicsBody.h"
+
+using namespace GLBase;
+
+namespace Physics
+{
+    // State of a rigid body in a step of a trajectory. The identifier is the
+    // position of the body in the list of rigid bodies of the world
+    struct BodyState
+    {
+        uint32_t id;
+        glm::vec3 position;
+        glm::quat orientation;
+        glm::vec3 velocity;
+    };
+
+    // Parameters of the files written by a TrajectoryRecorder
+    struct TrajectorySettings
+    {
+        // Number of steps in each chunk of the file. The replayer decodes at
+        // most one chunk to seek any step
+        int stepsPerChunk = 64;
+        // If true, the states are quantized with the given precisions, and
+        // each step is stored as the difference with the previous one in its
+        // chunk, as variable length integers. Otherwise they are stored as
+        // floats
+        bool compressed = false;
+        float positionPrecision = 1e-4f;
+        float orientationPrecision = 1e-5f;
+        float velocityPrecision = 1e-3f;
+    };
+
+    /*
+       Layout of a trajectory file. All the values are little endian.
+        - File header
+        - Chunks, one after another. Each chunk has a header, the offsets of
+          its steps from the end of the offsets, and the steps. Each step has
+          its time, its number of bodies and their states
+        - Index, with the position and first step of each chunk, followed by
+          its footer
+       The chunks are appended as they are filled, and the index is written
+       when the recorder is closed. A file without an index, for example from
+       a program that crashed, can still be read by walking the chunks.
+       In compressed files the first step of each chunk is stored relative to
+       zero, so the chunks can be decoded independently.
+    */
+    struct TrajectoryFileHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t compressed;
+        uint32_t stepsPerChunk;
+        float positionPrecision;
+        float orientationPrecision;
+        float velocityPrecision;
+    };
+
+    struct TrajectoryChunkHeader
+    {
+        uint32_t magic;
+        uint32_t firstStep;
+        uint32_t nSteps;
+        // Size of the offsets and the steps, in bytes
+        uint32_t dataSize;
+    };
+
+    struct TrajectoryIndexEntry
+    {
+        uint64_t offset;
+        uint32_t firstStep;
+        uint32_t nSteps;
+    };
+
+    struct TrajectoryIndexFooter
+    {
+        uint64_t indexOffset;
+        uint32_t nChunks;
+        uint32_t magic;
+    };
+
+    // Writes the states of the rigid bodies of a DynamicsWorld in each step
+    // to a chunked, append-only binary file. The steps are kept in memory
+    // until their chunk is full, and then written at once
+    class TrajectoryRecorder
+    {
+        public:
+            // Constructor
+            TrajectoryRecorder();
+
+            // Destructor. The file is closed
+            ~TrajectoryRecorder();
+
+            // Create a file, replacing the one with the same name if any.
+            // Returns false if it can not be created
+            bool open( const std::string& path,
+                       const TrajectorySettings& settings = TrajectorySettings() );
+
+            // Write the last chunk and the index, and close the file
+            void close();
+
+            // Add a step with the states of the bodies, after the given time
+            // since the previous one, or since the recorder was opened
+            void record( const std::vector<RigidBody*>& bodies, float deltaTime );
+
+            // Getters
+            bool isOpen() const;
+            int getNumSteps() const;
+
+        private:
+            // File, and its settings
+            std::FILE* mFile;
+            TrajectorySettings mSettings;
+
+            // Steps recorded, and time since the recorder was opened
+            int mNumSteps;
+            float mTime;
+
+            // Chunk being filled: its first step, the offsets of its steps and
+            // their data
+            int mChunkFirstStep;
+            std::vector<uint32_t> mStepOffsets;
+            std::vector<uint8_t> mChunkData;
+
+            // Quantized states of the previous step of the chunk, used to
+            // compute the differences
+            std::vector<int32_t> mPreviousValues;
+
+            // Position and first step of each chunk written
+            std::vector<TrajectoryIndexEntry> mIndex;
+
+            // Write the chunk being filled to the file
+            void writeChunk();
+    };
+
+    // Reads the files written by a TrajectoryRecorder, and moves the bodies to
+    // the states of any step without simulating them.
+    // The file is mapped to memory, so seeking a step only decodes part of a
+    // chunk. Reading the steps in order decodes each of them once
+    class TrajectoryReplayer
+    {
+        public:
+            // Constructor
+            TrajectoryReplayer();
+
+            // Destructor. The file is closed
+            ~TrajectoryReplayer();
+
+            // Map a file to memory and read its index. Returns false if it can
+            // not be read
+            bool open( const std::string& path );
+
+            // Unmap the file
+            void close();
+
+            // Read the states of the bodies in a step. Returns false if the
+            // step is not in the file
+            bool readStep( int step, std::vector<BodyState>& states );
+
+            // Move the bodies to their states in a step, and update their
+            // transforms. The bodies are indexed by the identifiers of the
+            // states, and the ones missing from the list are skipped
+            bool applyStep( int step, const std::vector<RigidBody*>& bodies );
+
+            // Getters
+            bool isOpen() const;
+            int getNumSteps() const;
+            // Time of a step since the recording started
+            float getTime( int step ) const;
+
+        private:
+            // Mapped file, and its header
+            const uint8_t* mData;
+            size_t mSize;
+            TrajectoryFileHeader mHeader;
+
+            // Position and first step of each chunk
+            std::vector<TrajectoryIndexEntry> mIndex;
+            int mNumSteps;
+
+            // Chunk and step decoded last, and identifiers and quantized
+            // states of that step, so that the next step of the chunk can be
+            // decoded from them
+            int mDecodedChunk;
+            int mDecodedStep;
+            std::vector<uint32_t> mDecodedIds;
+            std::vector<int32_t> mDecodedValues;
+
+            // States read by applyStep
+            std::vector<BodyState> mStates;
+
+            // Read the index at the end of the file, or build it by walking
+            // the chunks if there is none or it is not valid
+            bool readIndex();
+
+            // Check that a chunk of the index is inside the file, matches its
+            // header, and that the offsets of its steps are inside the chunk
+            bool validateChunk( const TrajectoryIndexEntry& entry ) const;
+
+            // Chunk of a step
+            int findChunk( int step ) const;
+
+            // Position of a step in the file, and end of its data
+            const uint8_t* getStepData( int chunk, int step, const uint8_t*& end ) const;
+
+            // Decode a compressed step, adding its differences to the values
+            // of the previous one. Returns false if its data is not valid
+            bool decodeStep( const uint8_t* data, const uint8_t* end );
+    };
+}
+
+#endif
@@ -0,0 +1,374 @@
+#include <algorithm>
+#include <cmath>
+
+#include "XPBD.h"
+#include "utils.h"
+
+using namespace GLBase;
+
+namespace Physics
+{
+    // Change of the Lagrange multiplier of a constraint with the given value,
+    // sum of the inverse masses times the squared gradients, and compliance
+    // divided by the square of the time step
+    static float computeLambdaChange( float value, float weightedGradients, float alpha,
+                                      float lambda )
+    {
+        float denominator = weightedGradients + alpha;
+        if ( denominator < 1e-12f )
+            return 0.f;
+        return ( -value - alpha * lambda ) / denominator;
+    }
+
+    //--------------------------------------------------------------------------
+    // XPBDSolver::ConstraintGroup struct
+
+    // Add a constraint, with the first color not used by its nodes
+    void XPBDSolver::ConstraintGroup::add( const int* constraintNodes, float restValue,
+                                           float compliance )
+    {
+        coloring.add( constraintNodes, nBodies );
+        nodes.insert( nodes.end(), constraintNodes, constraintNodes + nBodies );
+        restValues.push_back( restValue );
+        compliances.push_back( compliance );
+        lambdas.push_back( 0.f );
+        isSorted = false;
+    }
+
+    // Sort the constraints by color
+    void XPBDSolver::ConstraintGroup::sort()
+    {
+        int nConstraints = size();
+        std::vector<int> positions;
+        coloring.sort( positions );
+
+        std::vector<int> sortedNodes( nodes.size() );
+        std::vector<float> sortedRestValues( nConstraints );
+        std::vector<float> sortedCompliances( nConstraints );
+        for ( int i = 0; i < nConstraints; ++i )
+        {
+            int position = positions[ i ];
+            std::copy( nodes.begin() + i * nBodies, nodes.begin() + ( i + 1 ) * nBodies,
+                       sortedNodes.begin() + position * nBodies );
+            sortedRestValues[ position ] = restValues[ i ];
+            sortedCompliances[ position ] = compliances[ i ];
+        }
+
+        std::swap( nodes, sortedNodes );
+        std::swap( restValues, sortedRestValues );
+        std::swap( compliances, sortedCompliances );
+        isSorted = true;
+    }
+
+    // Remove all the constraints
+    void XPBDSolver::ConstraintGroup::clear()
+    {
+        nodes.clear();
+        restValues.clear();
+        compliances.clear();
+        lambdas.clear();
+        coloring.clear();
+        isSorted = true;
+    }
+
+    int XPBDSolver::ConstraintGroup::size() const
+    {
+        return restValues.size();
+    }
+
+    //--------------------------------------------------------------------------
+    // XPBDSolver class
+
+    // Constructor
+    XPBDSolver::XPBDSolver()
+    {
+        mDistances.nBodies = 2;
+        mBendings.nBodies = 3;
+        mVolumes.nBodies = 4;
+        mDistances.project = &XPBDSolver::projectDistances;
+        mBendings.project = &XPBDSolver::projectBendings;
+        mVolumes.project = &XPBDSolver::projectVolumes;
+        mDistances.isSorted = true;
+        mBendings.isSorted = true;
+        mVolumes.isSorted = true;
+    }
+
+    // Settings
+    void XPBDSolver::setSettings( const XPBDSettings& settings )
+    {
+        mSettings = settings;
+    }
+
+    const XPBDSettings& XPBDSolver::getSettings() const
+    {
+        return mSettings;
+    }
+
+    // Add a constraint on the distance between two bodies
+    void XPBDSolver::addDistanceConstraint( RigidBody* bodyA, RigidBody* bodyB,
+                                            float compliance, float restLength )
+    {
+        if ( restLength < 0.f )
+            restLength = glm::length( bodyB->getPosition() - bodyA->getPosition() );
+
+        int nodes[2] = { findNode( bodyA ), findNode( bodyB ) };
+        mDistances.add( nodes, restLength, compliance );
+    }
+
+    // Add a bending constraint on three consecutive bodies of a chain. The
+    // rest value is the distance from the middle body to the center of the
+    // three
+    void XPBDSolver::addBendingConstraint( RigidBody* bodyA, RigidBody* bodyB,
+                                           RigidBody* bodyC, float compliance )
+    {
+        glm::vec3 center = ( bodyA->getPosition() + bodyB->getPosition() +
+                             bodyC->getPosition() ) / 3.f;
+        float restDistance = glm::length( bodyB->getPosition() - center );
+
+        int nodes[3] = { findNode( bodyA ), findNode( bodyB ), findNode( bodyC ) };
+        mBendings.add( nodes, restDistance, compliance );
+    }
+
+    // Add a constraint on the volume of a tetrahedron. The volume has a sign,
+    // so the tetrahedron can not be turned inside out
+    void XPBDSolver::addVolumeConstraint( RigidBody* bodyA, RigidBody* bodyB,
+                                          RigidBody* bodyC, RigidBody* bodyD,
+                                          float compliance )
+    {
+        glm::vec3 position = bodyA->getPosition();
+        float restVolume = glm::dot( glm::cross( bodyB->getPosition() - position,
+                                                 bodyC->getPosition() - position ),
+                                     bodyD->getPosition() - position ) / 6.f;
+
+        int nodes[4] = { findNode( bodyA ), findNode( bodyB ), findNode( bodyC ),
+                         findNode( bodyD ) };
+        mVolumes.add( nodes, restVolume, compliance );
+    }
+
+    // Remove all the constraints
+    void XPBDSolver::clear()
+    {
+        mBodies.clear();
+        mNodeIds.clear();
+        mDistances.clear();
+        mBendings.clear();
+        mVolumes.clear();
+    }
+
+    // Getters
+    int XPBDSolver::getNumConstraints() const
+    {
+        return mDistances.size() + mBendings.size() + mVolumes.size();
+    }
+
+    int XPBDSolver::getNumColors() const
+    {
+        int nColors = 0;
+        for ( const ConstraintGroup* group : { &mDistances, &mBendings, &mVolumes } )
+            nColors = std::max( nColors, group->coloring.getNumColors() );
+        return nColors;
+    }
+
+    // Node of a body, added if it is new
+    int XPBDSolver::findNode( RigidBody* body )
+    {
+        auto it = mNodeIds.find( body );
+        if ( it != mNodeIds.end() )
+            return it->second;
+
+        int node = mBodies.size();
+        mBodies.push_back( body );
+        mNodeIds[ body ] = node;
+        return node;
+    }
+
+    // Move the bodies to satisfy the constraints after an integration of the
+    // given duration. The positions of the bodies are copied to the nodes,
+    // the constraints projected the given number of iterations, and the
+    // corrections copied back to the bodies with the velocities that match
+    // them
+    void XPBDSolver::solve( float deltaTime, ThreadPool* threadPool )
+    {
+        if ( mBodies.empty() )
+            return;
+
+        // Wake up the sleeping bodies joined to an awake one
+        for ( ConstraintGroup* group : { &mDistances, &mBendings, &mVolumes } )
+        {
+            int nBodies = group->nBodies;
+            for ( int i = 0; i < group->size(); ++i )
+            {
+                const int* nodes = &group->nodes[ i * nBodies ];
+                bool isAwake = false;
+                for ( int k = 0; k < nBodies; ++k )
+                    isAwake = isAwake || mBodies[ nodes[ k ] ]->isAwake();
+                if ( !isAwake )
+                    continue;
+
+                for ( int k = 0; k < nBodies; ++k )
+                {
+                    if ( !mBodies[ nodes[ k ] ]->isAwake() )
+                        mBodies[ nodes[ k ] ]->setAwake( true );
+                }
+            }
+        }
+
+        // Copy the state of the bodies
+        int nNodes = mBodies.size();
+        mPositions.resize( nNodes );
+        mStartPositions.resize( nNodes );
+        mInvMasses.resize( nNodes );
+        for ( int i = 0; i < nNodes; ++i )
+        {
+            RigidBody* body = mBodies[ i ];
+            mPositions[ i ] = body->getPosition();
+            mStartPositions[ i ] = mPositions[ i ];
+            mInvMasses[ i ] = body->isAwake() ? std::max( body->getInvMass(), 0.f ) : 0.f;
+        }
+
+        // Sort the constraints added since the last step, and start the
+        // multipliers from zero
+        for ( ConstraintGroup* group : { &mDistances, &mBendings, &mVolumes } )
+        {
+            if ( !group->isSorted )
+                group->sort();
+            std::fill( group->lambdas.begin(), group->lambdas.end(), 0.f );
+        }
+
+        for ( int iteration = 0; iteration < mSettings.iterations; ++iteration )
+        {
+            projectGroup( mDistances, deltaTime, threadPool );
+            projectGroup( mBendings, deltaTime, threadPool );
+            projectGroup( mVolumes, deltaTime, threadPool );
+        }
+
+        // Move the bodies, and change their velocities by the same amount
+        for ( int i = 0; i < nNodes; ++i )
+        {
+            glm::vec3 correction = mPositions[ i ] - mStartPositions[ i ];
+            if ( mInvMasses[ i ] > 0.f && correction != glm::vec3( 0.f ) )
+                mBodies[ i ]->correctPosition( correction, deltaTime );
+        }
+    }
+
+    // Project the constraints of a group once, with its projection function.
+    // Each color is split in chunks projected in parallel, as they share no
+    // nodes
+    void XPBDSolver::projectGroup( ConstraintGroup& group, float deltaTime,
+                                   ThreadPool* threadPool )
+    {
+        if ( group.size() == 0 )
+            return;
+
+        auto projectChunk = [&]( int begin, int end )
+        {
+            ( this->*group.project )( begin, end, deltaTime );
+            return 0.f;
+        };
+        group.coloring.forEachChunk( threadPool, projectChunk );
+    }
+
+    // Distance constraints: C = | xA - xB | - L, with gradients along the
+    // direction between the bodies
+    void XPBDSolver::projectDistances( int begin, int end, float deltaTime )
+    {
+        float invDeltaTime2 = 1.f / ( deltaTime * deltaTime );
+        for ( int i = begin; i < end; ++i )
+        {
+            int nodeA = mDistances.nodes[ 2 * i ];
+            int nodeB = mDistances.nodes[ 2 * i + 1 ];
+            float invMassA = mInvMasses[ nodeA ];
+            float invMassB = mInvMasses[ nodeB ];
+
+            glm::vec3 difference = mPositions[ nodeA ] - mPositions[ nodeB ];
+            float distance = glm::length( difference );
+            if ( distance < 1e-6f )
+                continue;
+            glm::vec3 direction = difference / distance;
+
+            float alpha = mDistances.compliances[ i ] * invDeltaTime2;
+            float& lambda = mDistances.lambdas[ i ];
+            float lambdaChange = computeLambdaChange( distance - mDistances.restValues[ i ],
+                                                      invMassA + invMassB, alpha, lambda );
+            lambda += lambdaChange;
+
+            mPositions[ nodeA ] += invMassA * lambdaChange * direction;
+            mPositions[ nodeB ] -= invMassB * lambdaChange * direction;
+        }
+    }
+
+    // Bending constraints: C = | xB - c | - h, where c is the center of the
+    // three bodies. The gradient is 2/3 of the direction from the center for
+    // the middle body, and -1/3 of it for the others
+    void XPBDSolver::projectBendings( int begin, int end, float deltaTime )
+    {
+        float invDeltaTime2 = 1.f / ( deltaTime * deltaTime );
+        for ( int i = begin; i < end; ++i )
+        {
+            int nodeA = mBendings.nodes[ 3 * i ];
+            int nodeB = mBendings.nodes[ 3 * i + 1 ];
+            int nodeC = mBendings.nodes[ 3 * i + 2 ];
+            float invMassA = mInvMasses[ nodeA ];
+            float invMassB = mInvMasses[ nodeB ];
+            float invMassC = mInvMasses[ nodeC ];
+
+            glm::vec3 center = ( mPositions[ nodeA ] + mPositions[ nodeB ] +
+                                 mPositions[ nodeC ] ) / 3.f;
+            glm::vec3 difference = mPositions[ nodeB ] - center;
+            float distance = glm::length( difference );
+            if ( distance < 1e-6f )
+                continue;
+            glm::vec3 direction = difference / distance;
+
+            float weightedGradients = ( invMassA + 4.f * invMassB + invMassC ) / 9.f;
+            float alpha = mBendings.compliances[ i ] * invDeltaTime2;
+            float& lambda = mBendings.lambdas[ i ];
+            float lambdaChange = computeLambdaChange( distance - mBendings.restValues[ i ],
+                                                      weightedGradients, alpha, lambda );
+            lambda += lambdaChange;
+
+            glm::vec3 step = lambdaChange / 3.f * direction;
+            mPositions[ nodeA ] -= invMassA * step;
+            mPositions[ nodeB ] += 2.f * invMassB * step;
+            mPositions[ nodeC ] -= invMassC * step;
+        }
+    }
+
+    // Volume constraints: C = ( x1 - x0 ) x ( x2 - x0 ) . ( x3 - x0 ) / 6 - V.
+    // The gradient of each of the last three bodies is the cross product of
+    // the edges to the other two, over 6, and the one of the first body is
+    // minus their sum
+    void XPBDSolver::projectVolumes( int begin, int end, float deltaTime )
+    {
+        float invDeltaTime2 = 1.f / ( deltaTime * deltaTime );
+        for ( int i = begin; i < end; ++i )
+        {
+            const int* nodes = &mVolumes.nodes[ 4 * i ];
+            glm::vec3 edge1 = mPositions[ nodes[1] ] - mPositions[ nodes[0] ];
+            glm::vec3 edge2 = mPositions[ nodes[2] ] - mPositions[ nodes[0] ];
+            glm::vec3 edge3 = mPositions[ nodes[3] ] - mPositions[ nodes[0] ];
+
+            glm::vec3 gradients[4];
+            gradients[1] = glm::cross( edge2, edge3 ) / 6.f;
+            gradients[2] = glm::cross( edge3, edge1 ) / 6.f;
+            gradients[3] = glm::cross( edge1, edge2 ) / 6.f;
+            gradients[0] = -( gradients[1] + gradients[2] + gradients[3] );
+
+            float weightedGradients = 0.f;
+            for ( int k = 0; k < 4; ++k )
+                weightedGradients += mInvMasses[ nodes[ k ] ] *
+                                     glm::dot( gradients[ k ], gradients[ k ] );
+
+            float volume = glm::dot( edge1, gradients[1] );
+            float alpha = mVolumes.compliances[ i ] * invDeltaTime2;
+            float& lambda = mVolumes.lambdas[ i ];
+            float lambdaChange = computeLambdaChange( volume - mVolumes.restValues[ i ],
+                                                      weightedGradients, alpha, lambda );
+            lambda += lambdaChange;
+
+            for ( int k = 0; k < 4; ++k )
+                mPositions[ nodes[ k ] ] += mInvMasses[ nodes[ k ] ] * lambdaChange *
+                                            gradients[ k ];
+        }
+    }
+}
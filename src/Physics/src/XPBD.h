@@ -0,0 +1,152 @@
+#ifndef XPBD_H
+#define XPBD_H
+
+#include <unordered_map>
+
+#include "GLBase.h"
+#include "PhysicsBody.h"
+#include "GraphColoring.h"
+#include "ThreadPool.h"
+
+using namespace GLBase;
+
+namespace Physics
+{
+    // Parameters of the XPBD solver
+    struct XPBDSettings
+    {
+        // Iterations over all the constraints in each sub-step of the
+        // integration. With several sub-steps, one iteration is usually enough
+        int iterations = 4;
+    };
+
+    /*
+       Extended position based dynamics (XPBD) solver for constraints between
+       rigid bodies, used for ropes, chains and soft connections:
+        - Distance: the distance between two bodies is kept at a rest length
+        - Bending: the middle one of three bodies is kept at its rest distance
+          from the center of the three, which keeps a chain from folding
+        - Volume: the volume of the tetrahedron of four bodies is kept at its
+          rest value
+       After each sub-step of the integration, the bodies are moved to satisfy
+       the constraints, and their velocities are changed by the same amount
+       divided by the duration of the sub-step. The compliance of a
+       constraint is the inverse of its stiffness, in units of the constraint
+       per newton: meters per newton for distance and bending, and cubic
+       meters per newton for volume. Zero makes it rigid. As it is divided by
+       the square of the sub-step, the constraints are equally stiff with any
+       time step, and they are stable with any stiffness.
+       Each type of constraint is stored in flat arrays, sorted by color. The
+       color is given when the constraint is created, as the first one not
+       used by any of its bodies, so the constraints of a color share no body
+       and are projected in parallel without locks. Like in the collision
+       solver, the constraints that do not fit in the colors go to one more,
+       which is projected by a single thread, and the result is the same with
+       any number of threads.
+       The bodies with infinite mass and the sleeping ones do not move. A
+       sleeping body joined to an awake one is woken up.
+    */
+    class XPBDSolver
+    {
+        public:
+            // Constructor
+            XPBDSolver();
+
+            // Settings
+            void setSettings( const XPBDSettings& settings );
+            const XPBDSettings& getSettings() const;
+
+            // Add a constraint on the distance between two bodies. If the rest
+            // length is negative, it is their current distance
+            void addDistanceConstraint( RigidBody* bodyA, RigidBody* bodyB,
+                                        float compliance = 0.f, float restLength = -1.f );
+
+            // Add a bending constraint on three consecutive bodies of a chain,
+            // with bodyB in the middle. The rest shape is the current one
+            void addBendingConstraint( RigidBody* bodyA, RigidBody* bodyB, RigidBody* bodyC,
+                                       float compliance = 0.f );
+
+            // Add a constraint on the volume of the tetrahedron of four bodies.
+            // The rest volume is the current one
+            void addVolumeConstraint( RigidBody* bodyA, RigidBody* bodyB, RigidBody* bodyC,
+                                      RigidBody* bodyD, float compliance = 0.f );
+
+            // Remove all the constraints
+            void clear();
+
+            // Getters
+            int getNumConstraints() const;
+            // Largest number of colors of a type of constraint
+            int getNumColors() const;
+
+            // Move the bodies to satisfy the constraints after they were
+            // integrated for the given duration, and change their velocities
+            // to match. If there is a thread pool, each color is split among
+            // its threads
+            void solve( float deltaTime, ThreadPool* threadPool = nullptr );
+
+        private:
+            // Function that projects the constraints in [ begin, end ) of a
+            // group
+            typedef void ( XPBDSolver::*ProjectFunction )( int begin, int end, float deltaTime );
+
+            // Constraints of one type, each of them on the same number of
+            // bodies. The nodes of constraint i start at nodes[ i * nBodies ]
+            struct ConstraintGroup
+            {
+                int nBodies;
+                ProjectFunction project;
+                std::vector<int> nodes;
+                std::vector<float> restValues;
+                std::vector<float> compliances;
+                // Lagrange multipliers, set to zero in each sub-step
+                std::vector<float> lambdas;
+                // Colors of the constraints, and if they are sorted by color
+                GraphColoring coloring;
+                bool isSorted;
+
+                // Add a constraint, giving it the first color not used by its
+                // nodes
+                void add( const int* constraintNodes, float restValue, float compliance );
+
+                // Sort the constraints by color, keeping their order inside
+                // each color
+                void sort();
+
+                // Remove all the constraints
+                void clear();
+
+                int size() const;
+            };
+
+            XPBDSettings mSettings;
+
+            // Bodies joined by the constraints, and the node of each of them
+            std::vector<RigidBody*> mBodies;
+            std::unordered_map<RigidBody*, int> mNodeIds;
+
+            // Positions and inverse masses of the nodes in the current sub-step,
+            // and positions after the integration. The fixed nodes have no
+            // inverse mass
+            std::vector<glm::vec3> mPositions;
+            std::vector<glm::vec3> mStartPositions;
+            std::vector<float> mInvMasses;
+
+            ConstraintGroup mDistances;
+            ConstraintGroup mBendings;
+            ConstraintGroup mVolumes;
+
+            // Node of a body, added if it is new
+            int findNode( RigidBody* body );
+
+            // Project the constraints of a group once, one color at a time
+            void projectGroup( ConstraintGroup& group, float deltaTime, ThreadPool* threadPool );
+
+            // Project the constraints in [ begin, end ) of each group
+            void projectDistances( int begin, int end, float deltaTime );
+            void projectBendings( int begin, int end, float deltaTime );
+            void projectVolumes( int begin, int end, float deltaTime );
+    };
+}
+
+#endif